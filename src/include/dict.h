@@ -81,6 +81,24 @@ typedef struct attr_flags {
 	uint8_t			type_size;			//!< For TLV2 and root attributes.
 } fr_dict_attr_flags_t;
 
+/** Maximum length of a pre-built attribute header
+ *
+ * Vendor-Specific (2) + Vendor-Id (4) + vendor type (4) + vendor length (2).
+ */
+#define FR_DICT_HDR_MAX_LEN		12
+
+/** Pre-built wire format header for an attribute, built by fr_dict_freeze()
+ *
+ * Only RFC attributes, and VSAs which aren't nested in TLVs, get one.  The
+ * lengths are those of an attribute with no value, the encoder adds the
+ * length of the value to the octets at length_offset.
+ */
+typedef struct dict_attr_hdr {
+	uint8_t			len;				//!< Length of the header, 0 if there's no template.
+	uint8_t			length_offset[2];		//!< Offsets of the length octets, 0 if unused.
+	uint8_t			data[FR_DICT_HDR_MAX_LEN];	//!< The header.
+} fr_dict_attr_hdr_t;
+
 extern const FR_NAME_NUMBER dict_attr_types[];
 extern const size_t dict_attr_sizes[FR_TYPE_MAX + 1][2];
 extern fr_dict_t *fr_dict_internal;
@@ -96,6 +114,11 @@ struct dict_attr {
 	fr_dict_attr_t const	**children;			//!< Children of this attribute.
 	fr_dict_attr_t const	*next;				//!< Next child in bin.
 
+	fr_dict_attr_t const	**child_index;			//!< Children 0..255 by number, built by fr_dict_freeze().
+	struct dict_vendor_index *vendor_index;			//!< Vendors by PEN, built by fr_dict_freeze().
+
+	fr_dict_attr_hdr_t	hdr;				//!< Header template, built by fr_dict_freeze().
+
 	unsigned int		depth;				//!< Depth of nesting for this attribute.
 
 	fr_dict_attr_flags_t	flags;				//!< Flags.
@@ -183,6 +206,8 @@ int			fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out,
 
 int			fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename);
 
+int			fr_dict_freeze(fr_dict_t *dict);
+
 int			fr_dict_parse_str(fr_dict_t *dict, char *buf,
 					  fr_dict_attr_t const *parent, unsigned int vendor);
 
@@ -252,6 +277,9 @@ fr_dict_attr_t const	*fr_dict_attr_child_by_da(fr_dict_attr_t const *parent, fr_
 
 fr_dict_attr_t const	*fr_dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned int attr);
 
+fr_dict_attr_t const	*fr_dict_vendor_child_by_num(fr_dict_attr_t const *parent, unsigned int vendor,
+						     fr_dict_vendor_t const **dv);
+
 fr_dict_enum_t		*fr_dict_enum_by_value(fr_dict_t *dict, fr_dict_attr_t const *da,
 					       fr_value_box_t const *value);
 
@@ -78,14 +78,49 @@ USES_APPLE_DEPRECATED_API
 #  define fr_md5_copy(_out, _in)	memcpy(_out, _in, sizeof(*_out))
 #endif
 
+/*
+ *	Number of messages which fr_md5_multi() hashes in parallel.
+ *	This is the number of 32-bit lanes in the widest vector
+ *	registers we're compiled for.
+ */
+#if defined(__AVX512F__)
+#  define FR_MD5_MULTI_LANES	(16)
+#elif defined(__AVX2__)
+#  define FR_MD5_MULTI_LANES	(8)
+#else
+#  define FR_MD5_MULTI_LANES	(4)
+#endif
+
+/** MD5 states for a shared secret, computed once and reused for every packet
+ *
+ */
+typedef struct fr_md5_secret {
+	FR_MD5_CTX	prefix;			//!< MD5 state after hashing the secret.
+	FR_MD5_CTX	ipad;			//!< HMAC-MD5 state after hashing the inner key block.
+	FR_MD5_CTX	opad;			//!< HMAC-MD5 state after hashing the outer key block.
+} fr_md5_secret_t;
+
 /* hmac.c */
 void	fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
 		    uint8_t const *key, size_t key_len)
 	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
 
+void	fr_md5_secret_init(fr_md5_secret_t *state, uint8_t const *secret, size_t secret_len);
+
+void	fr_hmac_md5_secret(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t text_len,
+			   fr_md5_secret_t const *state)
+	CC_BOUNDED(__minbytes__, 1, MD5_DIGEST_LENGTH);
+
+void	fr_hmac_md5_secret_multi(uint8_t digest[][MD5_DIGEST_LENGTH],
+				 uint8_t const * const text[], size_t const text_len[],
+				 fr_md5_secret_t const * const state[], size_t num);
+
 /* md5.c */
 void	fr_md5_calc(uint8_t *out, uint8_t const *in, size_t inlen);
 
+void	fr_md5_multi(uint8_t out[][MD5_DIGEST_LENGTH], FR_MD5_CTX const * const ctx[],
+		     uint8_t const * const in[], size_t const inlen[], size_t num);
+
 #ifdef __cplusplus
 }
 #endif
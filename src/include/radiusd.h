@@ -119,6 +119,11 @@ typedef struct main_config {
 
 	bool		daemonize;			//!< Should the server daemonize on startup.
 	bool		spawn_workers;			//!< Should the server spawn threads.
+	uint32_t	num_networks;			//!< Number of network threads to start.
+	uint32_t	min_workers;			//!< The worker pool never shrinks below this.
+	uint32_t	max_workers;			//!< The worker pool never grows past this.
+	char const	*network_cpus;			//!< CPUs to pin the network threads to.
+	char const	*worker_cpus;			//!< CPUs to pin the worker threads to.
 	char const      *pid_file;			//!< Path to write out PID file.
 
 #ifdef WITH_PROXY
@@ -427,6 +432,8 @@ ssize_t		rad_filename_unescape(char *out, size_t outlen, char const *in, size_t
 void		talloc_const_free(void const *ptr);
 char		*rad_ajoin(TALLOC_CTX *ctx, char const **argv, int argc, char c);
 REQUEST		*request_alloc(TALLOC_CTX *ctx);
+REQUEST		*request_alloc_pooled(TALLOC_CTX *ctx, size_t pool_size);
+int		request_reset(REQUEST *request);
 REQUEST		*request_alloc_fake(REQUEST *oldreq);
 REQUEST		*request_alloc_coa(REQUEST *request);
 REQUEST		*request_alloc_proxy(REQUEST *request);
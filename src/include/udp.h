@@ -39,6 +39,26 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+#define UDP_MMSG_MAX		(64)
+
+/** One packet in a batch of packets read from, or written to, a UDP socket
+ *
+ *  For writes, the source address is the local address, and the
+ *  destination address is the address of the peer.
+ */
+typedef struct udp_mmsg_t {
+	uint8_t			*data;			//!< the packet data.
+	size_t			data_len;		//!< size of the buffer on input, size of the packet on output.
+							//!< For writes, the size of the packet.
+
+	fr_ipaddr_t		src_ipaddr;		//!< of the packet.
+	uint16_t		src_port;		//!< of the packet.
+	fr_ipaddr_t		dst_ipaddr;		//!< of the packet.
+	uint16_t		dst_port;		//!< of the packet.
+	int			if_index;		//!< of the interface that received (or will send) the packet.
+	struct timeval		when;			//!< the packet was received.
+} udp_mmsg_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t dst_port);
@@ -52,6 +72,10 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 struct timeval *when);
 
+int udp_recv_mmsg(int sockfd, udp_mmsg_t *msgs, int num);
+
+int udp_send_mmsg(int sockfd, udp_mmsg_t *msgs, int num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,10 +33,14 @@ extern "C" {
 
 #ifdef WITH_UDPFROMTO
 int udpfromto_init(int s);
+void udpfromto_cmsg(struct msghdr *msgh, struct sockaddr *to, socklen_t *to_len,
+		    int *if_index, struct timeval *when);
 int recvfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *from, socklen_t *fromlen,
 	       struct sockaddr *to, socklen_t *tolen,
 	       int *if_index, struct timeval *when);
+int udpfromto_cmsg_set(int fd, struct msghdr *msgh, void *cbuf,
+		       struct sockaddr *from, socklen_t from_len, int if_index);
 int sendfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *from, socklen_t fromlen,
 	       struct sockaddr *to, socklen_t tolen,
@@ -98,6 +98,9 @@ struct value_box {
 
 	bool				tainted;		//!< i.e. did it come from an untrusted source
 
+	bool				borrowed;		//!< datum.ptr points into a buffer owned by
+								//!< something else, and must not be freed.
+
 	fr_value_box_t			*next;			//!< Next in a series of value_box.
 };
 
@@ -267,6 +270,9 @@ int		fr_value_box_memdup_shallow(fr_value_box_t *dst, fr_dict_attr_t const *enum
 					    uint8_t *src, size_t len, bool tainted);
 int		fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
 						   uint8_t *src, bool tainted);
+int		fr_value_box_memdup_borrow(fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+					   uint8_t const *src, size_t len, bool tainted);
+int		fr_value_box_unborrow(TALLOC_CTX *ctx, fr_value_box_t *vb);
 
 /*
  *	Parsing
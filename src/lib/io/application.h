@@ -49,6 +49,39 @@ typedef void (*fr_app_process_set_t)(void const *instance, REQUEST *request);
  */
 typedef void (*fr_app_event_list_set_t)(void const *instance, fr_event_list_t *el);
 
+/** Create another instance of an I/O path, for use by a different network thread
+ *
+ *  Some transports (e.g. UDP with SO_REUSEPORT) can open multiple
+ *  sockets for the same address and port, and have the kernel
+ *  distribute packets across them.  Each socket is then serviced by a
+ *  different network thread.
+ *
+ *  The new instance MUST NOT share any mutable state (sockets,
+ *  tracking tables, timers, statistics) with the original instance,
+ *  as the two will be used by different threads.  The new instance
+ *  will be opened by the caller.
+ *
+ * @param[in] ctx	to allocate the new instance in.
+ * @param[out] out	where to write the new instance.
+ * @param[in] instance	the instance to copy.
+ * @return
+ *	- <0 on error
+ *	- 0 if the instance is not configured for sharding.  *out is NULL.
+ *	- 1 on success.
+ */
+typedef int (*fr_app_io_shard_t)(TALLOC_CTX *ctx, void **out, void const *instance);
+
+/** Print transport-specific statistics for an I/O path
+ *
+ *  Called from the network thread which owns the instance, so the
+ *  statistics can be read without locking.  Each shard prints its
+ *  own statistics.
+ *
+ * @param[in] instance	of the I/O path.
+ * @param[in] fp	where the statistics are printed.
+ */
+typedef void (*fr_app_io_debug_t)(void const *instance, FILE *fp);
+
 /** Describes a new application (protocol)
  *
  */
@@ -102,12 +135,19 @@ typedef struct fr_app_io_t {
 							//!< connection.
 	fr_io_get_fd_t			fd;		//!< Return the file descriptor from the instance.
 	fr_io_data_read_t		read;		//!< Read from a socket to a data buffer
+	fr_io_data_read_vector_t	read_vector;	//!< Read multiple packets from a datagram socket.
+							//!< May be NULL.
 	fr_io_data_write_t		write;		//!< Write from a data buffer to a socket
+	fr_io_data_write_vector_t	write_vector;	//!< Write multiple packets to a datagram socket.
+							//!< May be NULL, in which case write is used.
 	fr_io_decode_t			decode;		//!< Translate raw bytes into VALUE_PAIRs and metadata.
 	fr_io_encode_t			encode;		//!< Pack VALUE_PAIRs back into a byte array.
 	fr_io_signal_t			flush;		//!< Flush the data when the socket is ready for writing.
 	fr_io_signal_t			error;		//!< There was an error on the socket.
 	fr_io_signal_t			close;		//!< Close the transport.
 	fr_io_nak_t			nak;		//!< Function to send a NAK.
+	fr_app_io_shard_t		shard;		//!< Create an instance for another network thread.
+							//!< May be NULL.
+	fr_app_io_debug_t		debug;		//!< Print transport statistics.  May be NULL.
 } fr_app_io_t;
 #endif
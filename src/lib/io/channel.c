@@ -29,6 +29,12 @@ RCSID("$Id$")
 #include <freeradius-devel/fr_log.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /*
  *	Debugging, mainly for channel_test
  */
@@ -58,6 +64,17 @@ RCSID("$Id$")
  */
 #define ATOMIC_QUEUE_SIZE (1024)
 
+/*
+ *	How many messages the receiver pops from the queue at a time.
+ */
+#define CHANNEL_RECV_BATCH (16)
+
+/*
+ *	Number of buckets in the per-lane latency histograms.  There
+ *	are four buckets for each power of two.
+ */
+#define CHANNEL_LATENCY_BUCKETS (256)
+
 typedef enum fr_channel_signal_t {
 	FR_CHANNEL_SIGNAL_ERROR			= FR_CHANNEL_ERROR,
 	FR_CHANNEL_SIGNAL_DATA_TO_WORKER	= FR_CHANNEL_DATA_READY_WORKER,
@@ -75,10 +92,44 @@ typedef enum fr_channel_signal_t {
 
 typedef struct fr_channel_control_t {
 	fr_channel_signal_t	signal;		//!< the signal to send
-	uint64_t		ack;		//!< or the endpoint..
+	uint64_t		ack;		//!< the sender's ACK, see fr_channel_end_t, or the endpoint..
 	fr_channel_t		*ch;		//!< the channel
 } fr_channel_control_t;
 
+/** Messages taken from a queue, but not yet received
+ *
+ */
+typedef struct fr_channel_batch_t {
+	int			num;		//!< Number of messages in the batch.
+	int			next;		//!< Next message to return from the batch.
+	void			*msgs[CHANNEL_RECV_BATCH]; //!< The messages.
+} fr_channel_batch_t;
+
+/** One priority lane in the master -> worker direction
+ *
+ * Each lane has its own queue, so that a burst of low priority
+ * messages can't fill the queue used by high priority ones.  The
+ * master limits the number of messages in a lane to its credit.
+ */
+typedef struct fr_channel_lane_t {
+	fr_atomic_queue_t	*aq;		//!< The queue of messages for this lane.
+
+	uint32_t		credit;		//!< Maximum number of messages in the queue.
+	uint32_t		weight;		//!< How many messages the worker takes from this
+						//!< lane, before looking at the next one.
+
+	uint64_t		num_sent;	//!< Messages sent by the master.
+	uint64_t		num_refused;	//!< Messages refused because the lane had no credit.
+
+	atomic_uint_least64_t	num_received;	//!< Messages received by the worker.
+
+	fr_channel_batch_t	recv;		//!< Messages taken from the queue by the worker.
+
+	atomic_uint_least64_t	latency[CHANNEL_LATENCY_BUCKETS]; //!< How long messages waited
+						//!< before the worker received them.  Written
+						//!< by the worker, and read by the master.
+} fr_channel_lane_t;
+
 /** One end of a channel
  *
  * Consists of a kqueue descriptor, and an atomic queue.
@@ -101,8 +152,14 @@ typedef struct fr_channel_end_t {
 	size_t			num_kevents;	//!< Number of times we've looked at kevents.
 
 	uint64_t		sequence;	//!< Sequence number for this channel.
-	uint64_t		ack;		//!< Sequence number of the other end.
-	uint64_t		their_view_of_my_sequence;	//!< Should be clear.
+	uint64_t		ack;		//!< Number of messages received from the other end.
+						//!< Each end numbers its messages 1..N, so when this
+						//!< is the same as the other end's sequence number,
+						//!< we've seen everything it sent.  Requests can be
+						//!< received out of order (see fr_channel_lane_t),
+						//!< so this is a count, and not the sequence number
+						//!< of the last message received.
+	uint64_t		their_view_of_my_sequence;	//!< The other end's "ack".
 
 	uint64_t		sequence_at_last_signal;	//!< When we last signaled.
 
@@ -115,6 +172,13 @@ typedef struct fr_channel_end_t {
 	fr_time_t		last_sent_signal; //!< The last time when we signaled the other end.
 
 	fr_atomic_queue_t	*aq;		//!< The queue of messages - visible only to this channel.
+						//!< Only used for replies, requests go into the lanes.
+
+	fr_channel_batch_t	recv;		//!< Messages taken from the other end's queue,
+						//!< but not yet received.
+
+	unsigned int		lane;		//!< The lane the worker is receiving from.
+	uint32_t		quantum;	//!< Messages left to receive from that lane.
 } fr_channel_end_t;
 
 /** A full channel, which consists of two ends
@@ -129,6 +193,8 @@ typedef struct fr_channel_t {
 	bool			active;		//!< Whether the channel is active.
 
 	fr_channel_end_t	end[2];		//!< Two ends of the channel.
+
+	fr_channel_lane_t	lane[FR_CHANNEL_NUM_LANES]; //!< Priority lanes for requests.
 } fr_channel_t;
 
 
@@ -143,6 +209,7 @@ typedef struct fr_channel_t {
  */
 fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_control_t *worker)
 {
+	unsigned int i, j;
 	fr_time_t when;
 	fr_channel_t *ch;
 
@@ -153,11 +220,24 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_contro
 		return NULL;
 	}
 
-	ch->end[TO_WORKER].aq = fr_atomic_queue_create(ch, ATOMIC_QUEUE_SIZE);
-	if (!ch->end[TO_WORKER].aq) {
-		talloc_free(ch);
-		goto nomem;
+	/*
+	 *	Every lane has a full size queue, but less important
+	 *	lanes get less credit, and are drained less often.
+	 */
+	for (i = 0; i < FR_CHANNEL_NUM_LANES; i++) {
+		ch->lane[i].aq = fr_atomic_queue_create(ch, ATOMIC_QUEUE_SIZE);
+		if (!ch->lane[i].aq) {
+			talloc_free(ch);
+			goto nomem;
+		}
+
+		ch->lane[i].credit = ATOMIC_QUEUE_SIZE >> i;
+		ch->lane[i].weight = 1 << (FR_CHANNEL_NUM_LANES - 1 - i);
+		atomic_init(&ch->lane[i].num_received, 0);
+		for (j = 0; j < CHANNEL_LATENCY_BUCKETS; j++) atomic_init(&ch->lane[i].latency[j], 0);
 	}
+	ch->end[FROM_WORKER].lane = 0;
+	ch->end[FROM_WORKER].quantum = ch->lane[0].weight;
 
 	ch->end[FROM_WORKER].aq = fr_atomic_queue_create(ch, ATOMIC_QUEUE_SIZE);
 	if (!ch->end[FROM_WORKER].aq) {
@@ -171,6 +251,12 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_contro
 	/*
 	 *	Create the ring buffer for the master to send
 	 *	control-plane messages to the worker, and vice-versa.
+	 *
+	 *	Both are allocated on the NUMA node of the thread
+	 *	creating the channel, which is usually the master.
+	 *	They carry only a few small messages per batch of
+	 *	packets, so it's not worth placing them on the node
+	 *	of the thread which reads them.
 	 */
 	ch->end[TO_WORKER].rb = fr_ring_buffer_create(ch, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
 	if (!ch->end[TO_WORKER].rb) {
@@ -263,10 +349,24 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_
 	uint64_t sequence;
 	fr_time_t when, message_interval;
 	fr_channel_end_t *master;
+	fr_channel_lane_t *lane;
 
 	master = &(ch->end[TO_WORKER]);
 	when = cd->m.when;
 
+	lane = &ch->lane[(cd->priority < FR_CHANNEL_NUM_LANES) ? cd->priority : FR_CHANNEL_NUM_LANES - 1];
+
+	/*
+	 *	The lane is full of messages which the worker hasn't
+	 *	seen yet.  The caller should try another channel.
+	 */
+	if ((lane->num_sent - atomic_load_explicit(&lane->num_received, memory_order_relaxed)) >= lane->credit) {
+		fr_strerror_printf("No credit left in channel lane %d", (int) (lane - ch->lane));
+		lane->num_refused++;
+		*p_reply = fr_channel_recv_reply(ch);
+		return -1;
+	}
+
 	sequence = master->sequence + 1;
 	cd->live.sequence = sequence;
 	cd->live.ack = master->ack;
@@ -275,13 +375,21 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_
 	 *	Push the message onto the queue for the other end.  If
 	 *	the push fails, the caller should try another queue.
 	 */
-	if (!fr_atomic_queue_push(master->aq, cd)) {
+	if (!fr_atomic_queue_push(lane->aq, cd)) {
 		fr_strerror_printf("Failed pushing to atomic queue");
+		lane->num_refused++;
 		*p_reply = fr_channel_recv_reply(ch);
 		return -1;
 	}
 
+	lane->num_sent++;
 	master->sequence = sequence;
+
+	/*
+	 *	Messages which the network held on to while the
+	 *	workers were busy can be older than the channel.
+	 */
+	if (when < master->last_write) when = master->last_write;
 	message_interval = when - master->last_write;
 
 	if (!master->message_interval) {
@@ -332,6 +440,102 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_
 	return fr_channel_data_ready(ch, when, master, FR_CHANNEL_SIGNAL_DATA_TO_WORKER);
 }
 
+/** Get the next message from the other end's queue
+ *
+ *  Messages are popped from the atomic queue in batches, and then
+ *  returned one at a time.
+ *
+ * @param[in] batch	which holds the messages.
+ * @param[in] aq	the queue to pop messages from.
+ * @return
+ *	- NULL on no data to receive.
+ *	- the next message.
+ */
+static inline fr_channel_data_t *fr_channel_recv_next(fr_channel_batch_t *batch, fr_atomic_queue_t *aq)
+{
+	if (batch->next == batch->num) {
+		batch->next = 0;
+		batch->num = fr_atomic_queue_pop_n(aq, batch->msgs, CHANNEL_RECV_BATCH);
+		if (!batch->num) return NULL;
+	}
+
+	return batch->msgs[batch->next++];
+}
+
+/** Get the histogram bucket for a latency
+ *
+ *  Latencies below 4ns have their own buckets.  After that, there
+ *  are four buckets for each power of two, which gives percentiles
+ *  to within 25%.
+ */
+static inline int fr_channel_latency_bucket(fr_time_t latency)
+{
+	int msb = 0;
+	fr_time_t tmp = latency;
+
+	if (latency < 4) return latency;
+
+	while (tmp >>= 1) msb++;
+
+	return ((msb - 1) * 4) + ((latency >> (msb - 2)) & 0x03);
+}
+
+/** Get the next request from the lanes, in weighted order
+ *
+ *  Each lane gets "weight" messages before we move to the next one.
+ *  Empty lanes give up their turn.
+ *
+ * @param[in] ch	the channel.
+ * @param[in] worker	the worker end of the channel.
+ * @return
+ *	- NULL if all of the lanes are empty.
+ *	- the next message.
+ */
+static fr_channel_data_t *fr_channel_recv_lane(fr_channel_t *ch, fr_channel_end_t *worker)
+{
+	int i, bucket;
+	fr_time_t now;
+	fr_channel_lane_t *lane;
+	fr_channel_data_t *cd;
+
+	/*
+	 *	Look at the current lane, and then at all of the
+	 *	lanes in turn, ending up back at the current one.
+	 */
+	for (i = 0; i <= FR_CHANNEL_NUM_LANES; i++) {
+		lane = &ch->lane[worker->lane];
+
+		if (worker->quantum > 0) {
+			cd = fr_channel_recv_next(&lane->recv, lane->aq);
+			if (cd) {
+				worker->quantum--;
+
+				/*
+				 *	We're the only writer, so we
+				 *	don't need atomic increments.
+				 *	But the master reads these, so
+				 *	the stores have to be atomic.
+				 */
+				atomic_store_explicit(&lane->num_received,
+						      atomic_load_explicit(&lane->num_received, memory_order_relaxed) + 1,
+						      memory_order_relaxed);
+
+				now = fr_time();
+				bucket = fr_channel_latency_bucket((now > cd->m.when) ? (now - cd->m.when) : 0);
+				atomic_store_explicit(&lane->latency[bucket],
+						      atomic_load_explicit(&lane->latency[bucket], memory_order_relaxed) + 1,
+						      memory_order_relaxed);
+				return cd;
+			}
+		}
+
+		worker->lane = (worker->lane + 1) % FR_CHANNEL_NUM_LANES;
+		worker->quantum = ch->lane[worker->lane].weight;
+	}
+
+	return NULL;
+}
+
 /** Receive a reply message from the channel
  *
  * @param[in] ch	the channel to read data from.
@@ -351,7 +555,8 @@ fr_channel_data_t *fr_channel_recv_reply(fr_channel_t *ch)
 	/*
 	 *	It's OK for the queue to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return NULL;
+	cd = fr_channel_recv_next(&master->recv, aq);
+	if (!cd) return NULL;
 
 	/*
 	 *	We want an exponential moving average for round trip
@@ -381,8 +586,13 @@ fr_channel_data_t *fr_channel_recv_reply(fr_channel_t *ch)
 	rad_assert(cd->live.sequence > master->ack);
 	rad_assert(cd->live.sequence <= master->sequence); /* must have fewer replies than requests */
 
+	/*
+	 *	Replies use one queue, so they arrive in order, and
+	 *	the count is also the sequence number of this reply.
+	 */
 	master->num_outstanding--;
-	master->ack = cd->live.sequence;
+	master->ack++;
+	rad_assert(master->ack == cd->live.sequence);
 	master->their_view_of_my_sequence = cd->live.ack;
 
 	rad_assert(master->last_read_other <= cd->m.when);
@@ -403,25 +613,30 @@ fr_channel_data_t *fr_channel_recv_request(fr_channel_t *ch)
 {
 	fr_channel_data_t *cd;
 	fr_channel_end_t *worker;
-	fr_atomic_queue_t *aq;
 
-	aq = ch->end[TO_WORKER].aq;
 	worker = &(ch->end[FROM_WORKER]);
 
 	/*
-	 *	It's OK for the queue to be empty.
+	 *	It's OK for the queues to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return NULL;
+	cd = fr_channel_recv_lane(ch, worker);
+	if (!cd) return NULL;
 
-	rad_assert(cd->live.sequence > worker->ack);
-	rad_assert(cd->live.sequence >= worker->sequence); /* must have more requests than replies */
+	/*
+	 *	Messages in different lanes are received out of
+	 *	order.  The master numbers its requests 1..N, so we
+	 *	ACK the number of requests we have received.  When
+	 *	that's the same as the master's sequence number, we've
+	 *	seen everything it sent.
+	 */
+	rad_assert(cd->live.sequence > 0);
+	rad_assert(worker->ack >= worker->sequence); /* must have more requests than replies */
 
 	worker->num_outstanding++;
-	worker->ack = cd->live.sequence;
-	worker->their_view_of_my_sequence = cd->live.ack;
+	worker->ack++;
+	if (cd->live.ack > worker->their_view_of_my_sequence) worker->their_view_of_my_sequence = cd->live.ack;
 
-	rad_assert(worker->last_read_other <= cd->m.when);
-	worker->last_read_other = cd->m.when;
+	if (cd->m.when > worker->last_read_other) worker->last_read_other = cd->m.when;
 
 	return cd;
 }
@@ -627,9 +842,9 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	}
 
 	/*
-	 *	Compare their ACK to the last sequence we
-	 *	sent.  If it's different, we signal the worker
-	 *	to wake up.
+	 *	Compare their ACK (the number of requests they've
+	 *	received) to the last sequence we sent.  If it's
+	 *	different, we signal the worker to wake up.
 	 */
 	master = &ch->end[TO_WORKER];
 #if ENABLE_SKIPS
@@ -817,8 +1032,96 @@ int fr_channel_signal_open(fr_channel_t *ch)
 	return fr_control_message_send(ch->end[TO_WORKER].control, ch->end[TO_WORKER].rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Take a copy of a lane's latency histogram
+ *
+ *  The worker keeps adding to the histogram while we read it, so
+ *  the copy may be missing the most recent messages.  But each
+ *  bucket is read whole.
+ *
+ * @param[in] lane	to copy the histogram from.
+ * @param[out] latency	where the copy is written.
+ * @return the number of messages in the copy.
+ */
+static uint64_t fr_channel_lane_snapshot(fr_channel_lane_t *lane, uint64_t *latency)
+{
+	int i;
+	uint64_t total = 0;
+
+	for (i = 0; i < CHANNEL_LATENCY_BUCKETS; i++) {
+		latency[i] = atomic_load_explicit(&lane->latency[i], memory_order_relaxed);
+		total += latency[i];
+	}
+
+	return total;
+}
+
+/** Get the number of messages in a channel lane's latency histogram
+ *
+ *  This is the number of requests the worker has received from the
+ *  lane.
+ *
+ * @param[in] ch		The channel.
+ * @param[in] lane		The lane to look at.
+ * @return
+ *	- 0 if there were no messages, or the lane doesn't exist.
+ *	- the number of messages.
+ */
+uint64_t fr_channel_lane_latency_count(fr_channel_t *ch, unsigned int lane)
+{
+	uint64_t latency[CHANNEL_LATENCY_BUCKETS];
+
+	if (lane >= FR_CHANNEL_NUM_LANES) return 0;
+
+	return fr_channel_lane_snapshot(&ch->lane[lane], latency);
+}
+
+/** Get a latency percentile for a channel lane
+ *
+ *  The latency is the time from when the request was received
+ *  (or sent to the channel), until the worker received it from the
+ *  channel.  This function can be called from either end of the
+ *  channel.
+ *
+ * @param[in] ch		The channel.
+ * @param[in] lane		The lane to look at.
+ * @param[in] percentile	to return, e.g. 50, 90, or 99.
+ * @return
+ *	- 0 if there were no messages, or the lane doesn't exist.
+ *	- the latency which "percentile" percent of messages didn't exceed.
+ */
+fr_time_t fr_channel_lane_latency(fr_channel_t *ch, unsigned int lane, unsigned int percentile)
+{
+	int i, msb;
+	uint64_t total, wanted, count;
+	uint64_t latency[CHANNEL_LATENCY_BUCKETS];
+
+	if ((lane >= FR_CHANNEL_NUM_LANES) || (percentile > 100)) return 0;
+
+	total = fr_channel_lane_snapshot(&ch->lane[lane], latency);
+	if (!total) return 0;
+
+	wanted = ((total * percentile) + 99) / 100;
+	if (!wanted) wanted = 1;
+
+	count = 0;
+	for (i = 0; i < CHANNEL_LATENCY_BUCKETS; i++) {
+		count += latency[i];
+		if (count >= wanted) break;
+	}
+
+	/*
+	 *	Return the top of the bucket.
+	 */
+	if (i < 4) return i;
+
+	msb = (i / 4) + 1;
+	return ((((fr_time_t) (4 + (i & 0x03))) << (msb - 2)) + (((fr_time_t) 1) << (msb - 2)) - 1);
+}
+
 void fr_channel_debug(fr_channel_t *ch, FILE *fp)
 {
+	unsigned int i;
+
 	fprintf(fp, "to worker\n");
 	fprintf(fp, "\tnum_signals sent = %zu\n", ch->end[TO_WORKER].num_signals);
 	fprintf(fp, "\tnum_signals re-sent = %zu\n", ch->end[TO_WORKER].num_resignals);
@@ -831,4 +1134,16 @@ void fr_channel_debug(fr_channel_t *ch, FILE *fp)
 	fprintf(fp, "\tnum_kevents checked = %zu\n", ch->end[FROM_WORKER].num_kevents);
 	fprintf(fp, "\tsequence = %"PRIu64"\n", ch->end[FROM_WORKER].sequence);
 	fprintf(fp, "\tack = %"PRIu64"\n", ch->end[FROM_WORKER].ack);
+
+	for (i = 0; i < FR_CHANNEL_NUM_LANES; i++) {
+		fprintf(fp, "lane %u\n", i);
+		fprintf(fp, "\tcredit = %u, weight = %u\n", ch->lane[i].credit, ch->lane[i].weight);
+		fprintf(fp, "\tnum_sent = %"PRIu64"\n", ch->lane[i].num_sent);
+		fprintf(fp, "\tnum_refused = %"PRIu64"\n", ch->lane[i].num_refused);
+		fprintf(fp, "\tnum_received = %"PRIu64"\n",
+			(uint64_t) atomic_load_explicit(&ch->lane[i].num_received, memory_order_relaxed));
+		fprintf(fp, "\tlatency p50 = %"PRIu64" ns, p90 = %"PRIu64" ns, p99 = %"PRIu64" ns\n",
+			fr_channel_lane_latency(ch, i, 50), fr_channel_lane_latency(ch, i, 90),
+			fr_channel_lane_latency(ch, i, 99));
+	}
 }
@@ -51,6 +51,19 @@ typedef struct fr_channel_t fr_channel_t;
  */
 typedef struct fr_listen fr_listen_t;
 
+/*
+ *	The reply is a NAK, and doesn't reflect the cost of
+ *	processing the request.
+ */
+#define FR_CHANNEL_CODE_NONE	(UINT32_MAX)
+
+/*
+ *	Number of priority lanes in the network -> worker direction.
+ *	Messages are put into the lane given by their priority, and
+ *	the lowest priority lane takes everything else.
+ */
+#define FR_CHANNEL_NUM_LANES	(4)
+
 typedef enum fr_channel_event_t {
 	FR_CHANNEL_ERROR = 0,
 	FR_CHANNEL_DATA_READY_WORKER,
@@ -78,7 +91,9 @@ typedef struct fr_channel_data_t {
 		 */
 		struct {
 			uint64_t		sequence;	//!< sequence number
-			uint64_t		ack;		//!< ACK of the sequence number from the other end
+			uint64_t		ack;		//!< Number of messages the sender has received from
+								//!< the other end.  Requests can be received out of
+								//!< order, so this is a count, and not a sequence number.
 		} live;
 
 		/*
@@ -105,7 +120,11 @@ typedef struct fr_channel_data_t {
 	        } reply;
 	};
 
-	uint32_t	priority;				//!< Priority of this packet.
+	uint32_t	priority;				//!< Priority of this packet, which also
+								//!< selects the channel lane.
+
+	uint32_t	code;					//!< Class of the request, for cost prediction.
+								//!< Set by the network side, and copied to the reply.
 
 	void		*packet_ctx;				//!< Packet specific context for holding client
 								//!< information, and other proto_* specific information
@@ -140,6 +159,9 @@ void fr_channel_master_ctx_add(fr_channel_t *ch, void *ctx) CC_HINT(nonnull);
 void *fr_channel_master_ctx_get(fr_channel_t *ch) CC_HINT(nonnull);
 
 
+uint64_t fr_channel_lane_latency_count(fr_channel_t *ch, unsigned int lane) CC_HINT(nonnull);
+fr_time_t fr_channel_lane_latency(fr_channel_t *ch, unsigned int lane, unsigned int percentile) CC_HINT(nonnull);
+
 void fr_channel_debug(fr_channel_t *ch, FILE *fp);
 
 #ifdef __cplusplus
@@ -29,10 +29,26 @@ RCSID("$Id$")
 #include <freeradius-devel/fr_log.h>
 
 #include <string.h>
+#include <unistd.h>
 #include <sys/event.h>
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_STDATOMIC_H
+#include <stdatomic.h>
+#else
+#include <freeradius-devel/stdatomic.h>
+#endif
+
 #define FR_CONTROL_MAX_TYPES	(32)
 
+/*
+ *	How many messages we pop from the atomic queue at a time.
+ */
+#define FR_CONTROL_BATCH	(16)
+
 /*
  *	Debugging, mainly for channel_test
  */
@@ -79,10 +95,26 @@ struct fr_control_t {
 
 	uintptr_t		ident;			//!< our ident for kqueue.
 
+	int			fd;			//!< eventfd used for wakeups, or -1 for EVFILT_USER.
+	bool			coalesce;		//!< only signal the receiver once per service.
+	atomic_bool		pending;		//!< the receiver has been signalled, and
+							//!< hasn't yet serviced the queue.
+
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
 
 
+/** Close the eventfd, if we have one.
+ *
+ */
+static int _control_free(fr_control_t *c)
+{
+	if (c->fd >= 0) close(c->fd);
+	c->fd = -1;
+
+	return 0;
+}
+
 /** Create a control-plane signaling path.
  *
  * @param[in] ctx the talloc context
@@ -107,6 +139,9 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, int kq, fr_atomic_queue_t *aq,
 	c->kq = kq;
 	c->aq = aq;
 	c->ident = ident;
+	c->fd = -1;
+	atomic_init(&c->pending, false);
+	talloc_set_destructor(c, _control_free);
 
 	/*
 	 *	Tell the KQ to listen on our events.
@@ -131,6 +166,56 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, int kq, fr_atomic_queue_t *aq,
 }
 
 
+/** Switch the control plane to coalesced wakeups
+ *
+ *  Once this is called, the sender signals the receiver only when
+ *  the receiver has serviced everything it was previously told
+ *  about.  While the receiver is awake and hasn't yet called
+ *  fr_control_service(), further messages are pushed to the queue
+ *  without making a system call.  The receiver MUST therefore use
+ *  fr_control_service(), and not fr_control_message_pop().
+ *
+ *  Where the platform supports it, the signal is also moved from
+ *  EVFILT_USER to an eventfd.  The caller should then insert the
+ *  returned descriptor into its event list, read it when it becomes
+ *  readable, and service the control plane.
+ *
+ *  This function is called ONLY from the receiving thread, before
+ *  any messages are sent.
+ *
+ * @param[in] c the control structure
+ * @return
+ *	- <0 no descriptor is available, and EVFILT_USER is still used.
+ *	- >=0 the descriptor to watch for reads.
+ */
+int fr_control_wakeup_fd(fr_control_t *c)
+{
+	(void) talloc_get_type_abort(c, fr_control_t);
+
+	c->coalesce = true;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	if (c->fd < 0) c->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
+	return c->fd;
+}
+
+/** Clear a wakeup signal sent to an eventfd
+ *
+ *  This function is called ONLY from the receiving thread.
+ *
+ * @param[in] c the control structure
+ */
+void fr_control_wakeup_clear(fr_control_t *c)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	eventfd_t value;
+
+	if (c->fd >= 0) (void) eventfd_read(c->fd, &value);
+#endif
+}
+
 /** Clean up messages in a control-plane buffer
  *
  *  Find the oldest messages which are marked FR_CONTROL_MESSAGE_DONE,
@@ -196,7 +281,6 @@ void fr_control_free(fr_control_t *c)
 
 	EV_SET(&kev, c->ident, EVFILT_USER, EV_DELETE, NOTE_FFNOP, 0, NULL);
 	if (kevent(c->kq, &kev, 1, NULL, 0, NULL) < 0) {
-		talloc_free(c);
 		fr_strerror_printf("Failed opening KQ for control socket: %s", fr_syserror(errno));
 	}
 
@@ -293,6 +377,60 @@ int fr_control_message_push(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
 	return 0;
 }
 
+/** Wake up the receiver of a control plane
+ *
+ *  If wakeups are coalesced, and the receiver has already been
+ *  signalled but hasn't yet serviced the queue, this function does
+ *  nothing.  Otherwise, the receiver is signalled via the eventfd,
+ *  or via EVFILT_USER.  If that fails, the receiver is no longer
+ *  marked as signalled, so that the next sender tries again.
+ *
+ *  This function may be called from any thread.
+ *
+ * @param[in] c the control structure
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_control_signal(fr_control_t *c)
+{
+	int rcode;
+	struct kevent kev;
+
+	if (c->coalesce && atomic_exchange(&c->pending, true)) return 0;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	if (c->fd >= 0) {
+		if (eventfd_write(c->fd, 1) == 0) return 0;
+
+		/*
+		 *	The counter can only overflow if the receiver
+		 *	has gone away.  In which case there's no point
+		 *	in complaining.
+		 */
+		if (errno == EAGAIN) return 0;
+
+		fr_strerror_printf("Failed writing to eventfd: %s", fr_syserror(errno));
+		goto fail;
+	}
+#endif
+
+	EV_SET(&kev, c->ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
+	rcode = kevent(c->kq, &kev, 1, NULL, 0, NULL);
+	if (rcode >= 0) return rcode;
+
+	fr_strerror_printf("Failed updating KQ: %s", fr_syserror(errno));
+
+fail:
+	/*
+	 *	The receiver wasn't woken up, and won't clear the
+	 *	flag.  If we left it set, every later signal would
+	 *	be skipped.
+	 */
+	if (c->coalesce) atomic_store(&c->pending, false);
+	return -1;
+}
+
 /** Send a control-plane message
  *
  *  This function is called ONLY from the originating thread.
@@ -308,21 +446,13 @@ int fr_control_message_push(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
  */
 int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id, void *data, size_t data_size)
 {
-	int rcode;
-	struct kevent kev;
-
 	(void) talloc_get_type_abort(c, fr_control_t);
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) {
 		return -1;
 	}
 
-	EV_SET(&kev, c->ident, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
-	rcode = kevent(c->kq, &kev, 1, NULL, 0, NULL);
-	if (rcode >= 0) return rcode;
-
-	fr_strerror_printf("Failed updating KQ: %s", fr_syserror(errno));
-	return rcode;
+	return fr_control_signal(c);
 }
 
 
@@ -433,19 +563,56 @@ int fr_control_callback_delete(fr_control_t *c, uint32_t id)
 	return 0;
 }
 
+/** Service all of the control messages in the queue
+ *
+ *  Messages are popped from the atomic queue in batches, and the
+ *  callbacks are run in order.
+ *
+ *  The "pending" flag is cleared before the queue is drained, so
+ *  that any message pushed after we stop looking will cause a new
+ *  signal.
+ *
+ * @param[in] c the control structure
+ * @param[in] data a buffer where each message is copied before the callback is run
+ * @param[in] data_size size of the buffer
+ * @param[in] now the current time
+ */
 void fr_control_service(fr_control_t *c, void *data, size_t data_size, fr_time_t now)
 {
-	uint32_t id = 0;
+	int i, num;
+	uint32_t id;
 	size_t message_size;
+	fr_control_message_t *m[FR_CONTROL_BATCH];
 
-	while (true) {
-		message_size = fr_control_message_pop(c->aq, &id, data, data_size);
-		if (!message_size) return;
+	if (c->coalesce) atomic_store(&c->pending, false);
 
-		if (id >= FR_CONTROL_MAX_TYPES) continue;
+	while ((num = fr_atomic_queue_pop_n(c->aq, (void **) m, FR_CONTROL_BATCH)) > 0) {
+		for (i = 0; i < num; i++) {
+			rad_assert(m[i]->status == FR_CONTROL_MESSAGE_USED);
 
-		if (!c->type[id].callback) continue;
+			/*
+			 *	Copy the data out, and release the
+			 *	message BEFORE running the callback.
+			 *	The callback may free the ring buffer
+			 *	which holds the message.
+			 */
+			id = m[i]->id;
+			message_size = m[i]->data_size;
+			if (message_size > data_size) {
+				m[i]->status = FR_CONTROL_MESSAGE_DONE;
+				continue;
+			}
+
+			memcpy(data, ((uint8_t *) m[i]) + sizeof(*m[i]), message_size);
+			m[i]->status = FR_CONTROL_MESSAGE_DONE;
+
+			if (id >= FR_CONTROL_MAX_TYPES) continue;
+
+			if (!c->type[id].callback) continue;
+
+			c->type[id].callback(c->type[id].ctx, data, message_size, now);
+		}
 
-		c->type[id].callback(c->type[id].ctx, data, message_size, now);
+		if (num < FR_CONTROL_BATCH) return;
 	}
 }
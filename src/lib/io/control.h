@@ -56,10 +56,16 @@ typedef	void (*fr_control_callback_t)(void *ctx, void const *data, size_t data_s
 #define FR_CONTROL_ID_CHANNEL (1)
 #define FR_CONTROL_ID_SOCKET  (2)
 #define FR_CONTROL_ID_WORKER  (3)
+#define FR_CONTROL_ID_STATS   (4)
+#define FR_CONTROL_ID_WORKER_REMOVE (5)
 
 fr_control_t *fr_control_create(TALLOC_CTX *ctx, int kq, fr_atomic_queue_t *aq, uintptr_t ident) CC_HINT(nonnull(3));
 void fr_control_free(fr_control_t *c) CC_HINT(nonnull);
 
+int fr_control_wakeup_fd(fr_control_t *c) CC_HINT(nonnull);
+void fr_control_wakeup_clear(fr_control_t *c) CC_HINT(nonnull);
+int fr_control_signal(fr_control_t *c) CC_HINT(nonnull);
+
 int fr_control_gc(fr_control_t *c, fr_ring_buffer_t *rb) CC_HINT(nonnull);
 
 int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id, void *data, size_t data_size) CC_HINT(nonnull);
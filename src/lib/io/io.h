@@ -185,6 +185,40 @@ typedef size_t (*fr_io_nak_t)(void const *instance, uint8_t *const packet, size_
  */
 typedef ssize_t (*fr_io_data_read_t)(void const *instance, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len);
 
+/** One packet in a vectored read or write.
+ *
+ */
+typedef struct fr_io_vector_t {
+	void			*packet_ctx;		//!< request specific data.
+	fr_time_t		*recv_time;		//!< when the packet was received
+	fr_time_t		request_time;		//!< when the original request was received (writes only)
+	uint8_t			*buffer;		//!< where the raw packet is read to (or written from)
+	size_t			buffer_len;		//!< room in the buffer on input, length of the packet on output.
+							//!< For writes, the length of the packet.
+} fr_io_vector_t;
+
+/** Read multiple packets from a datagram socket.
+ *
+ *  This function is an optimization of fr_io_data_read_t for
+ *  datagram sockets.  The caller passes an array of vectors, each
+ *  of which points to a separate buffer.  The function reads as many
+ *  packets as are available, up to num.
+ *
+ *  Packets which are read, but are then discarded (e.g. bad
+ *  signature, duplicate, unknown client), MUST still be counted in
+ *  the return value, with buffer_len set to zero.  The caller will
+ *  skip them.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in,out] vector	array of buffers to read packets into
+ * @param[in] num		number of entries in the vector
+ * @return
+ *	- <0 on error
+ *	- 0 for "no packets available"
+ *	- >0 number of entries in the vector which were used.
+ */
+typedef int (*fr_io_data_read_vector_t)(void const *instance, fr_io_vector_t *vector, int num);
+
 /** Write a socket.
  *
  *  If the socket is a datagram socket, then the function can read or
@@ -222,6 +256,26 @@ typedef ssize_t (*fr_io_data_read_t)(void const *instance, void **packet_ctx, fr
 typedef ssize_t (*fr_io_data_write_t)(void const *instance, void *packet_ctx, fr_time_t request_time,
 				      uint8_t *buffer, size_t buffer_len);
 
+/** Write multiple packets to a datagram socket.
+ *
+ *  This function is an optimization of fr_io_data_write_t for
+ *  datagram sockets.  The network thread collects all of the replies
+ *  for a socket which are ready in one pass of the event loop, and
+ *  writes them with one call.
+ *
+ *  Each entry in the vector has the same meaning as the parameters to
+ *  fr_io_data_write_t.  The function MUST either write all of the
+ *  packets, or return an error.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in] vector		array of packets to write
+ * @param[in] num		number of entries in the vector
+ * @return
+ *	- <0 on error
+ *	- >=0 number of packets written.
+ */
+typedef int (*fr_io_data_write_vector_t)(void const *instance, fr_io_vector_t *vector, int num);
+
 /**  Handle a close or error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
@@ -18,6 +18,37 @@
 #include <freeradius-devel/io/io.h>
 #include <freeradius-devel/io/application.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+/*
+ *	Number of priority levels used for admission control.  Lower
+ *	numbers are more important.
+ */
+#define FR_LISTEN_NUM_PRIORITIES	(4)
+
+/** Admission control for a listener
+ *
+ *  The policy is set when the listener is created, and doesn't
+ *  change after that.  The counters are updated by the workers.
+ *  A listener which opens more than one socket shares one set of
+ *  counters between them.
+ */
+typedef struct fr_listen_admit_t {
+	void const		*owner;		//!< the socket which reports the counters, or NULL for all
+	fr_time_t		max_delay;	//!< NAK messages which would wait longer than this
+	uint32_t		max_backlog;	//!< NAK messages when this many are queued, 0 for no limit
+	uint8_t			priority[256];	//!< priority of each packet code, < FR_LISTEN_NUM_PRIORITIES
+
+	atomic_int		backlog;	//!< messages queued in the workers
+	atomic_uint_least64_t	num_shed_delay;	//!< NAKed because the projected delay was too long
+	atomic_uint_least64_t	num_shed_backlog; //!< NAKed because the backlog was full
+	atomic_uint_least64_t	num_timeouts;	//!< NAKed after waiting in the queue for max_delay
+} fr_listen_admit_t;
+
 
 /** Describes a path data takes to/from the wire to/from VALUE_PAIRs
  *
@@ -34,6 +65,10 @@ struct fr_listen {
 
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+	uint32_t		max_batch;		//!< maximum number of packets to read per wakeup
+	bool			zero_copy;		//!< decoders may point VALUE_PAIRs at the message data
+
+	fr_listen_admit_t	*admit;			//!< admission control, or NULL for the defaults
 };
 
 /**
@@ -50,8 +85,14 @@ struct fr_async_t {
 	fr_channel_t		*channel;
 
 	uint32_t		priority;
+	uint32_t		code;		//!< class of the request, copied to the reply.
+	fr_message_ref_t	*message;	//!< holds the message data while it's being decoded,
+						//!< if the listener allows zero-copy decoding.
 	void			*packet_ctx;
 	fr_listen_t const	*listen;	//!< How we received this request,
 						//!< and how we'll send the reply.
+
+	struct fr_worker_steal_slot_t *stolen_from;	//!< The worker we took this request from, if any.
+							//!< That worker sends the reply.
 };
 #endif
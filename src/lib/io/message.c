@@ -300,6 +300,71 @@ fr_message_t *fr_message_localize(TALLOC_CTX *ctx, fr_message_t *m, size_t messa
 }
 
 
+/**
+ *  A talloc handle for the data of a message.
+ */
+struct fr_message_ref_t {
+	fr_message_t		*m;		//!< the message, or NULL if it's been detached
+};
+
+static int _message_ref_free(fr_message_ref_t *ref)
+{
+	if (ref->m) (void) fr_message_done(ref->m);
+
+	return 0;
+}
+
+/** Hold a message until nothing refers to its data
+ *
+ *  Instead of copying data out of the message, the recipient can
+ *  point at it, and add a talloc reference to the handle.  The
+ *  message is marked done when the handle is freed, which is when
+ *  its parent and all of the references to it have gone.
+ *
+ *  This lets a decoder avoid copying large values, at the cost of
+ *  the originator not being able to clean up the message until the
+ *  recipient is done with all of them.
+ *
+ * @param[in] ctx the talloc context for the handle
+ * @param[in] m the message to hold
+ * @return
+ *	- NULL on error
+ *	- the handle
+ */
+fr_message_ref_t *fr_message_ref_alloc(TALLOC_CTX *ctx, fr_message_t *m)
+{
+	fr_message_ref_t *ref;
+
+	if ((m->status != FR_MESSAGE_USED) && (m->status != FR_MESSAGE_LOCALIZED)) {
+		fr_strerror_printf("Cannot hold message unless it is in use");
+		return NULL;
+	}
+
+	ref = talloc_zero(ctx, fr_message_ref_t);
+	if (!ref) {
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	ref->m = m;
+	talloc_set_destructor(ref, _message_ref_free);
+
+	return ref;
+}
+
+/** Stop a handle from marking its message as done
+ *
+ *  For when the recipient has to finish with the message itself,
+ *  and nothing else refers to its data.
+ *
+ * @param[in] ref the handle
+ */
+void fr_message_ref_detach(fr_message_ref_t *ref)
+{
+	ref->m = NULL;
+}
+
+
 /** Clean up messages in a message ring.
  *
  *  Find the oldest messages which are marked FR_MESSAGE_DONE,
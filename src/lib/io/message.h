@@ -51,6 +51,11 @@ typedef struct fr_message_t {
 	size_t			rb_size;	//!< cache-aligned size in the ring buffer
 } fr_message_t;
 
+/**
+ *  A handle which holds a message until nothing refers to its data.
+ */
+typedef struct fr_message_ref_t fr_message_ref_t;
+
 fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_t message_size, size_t ring_buffer_size) CC_HINT(nonnull);
 
 fr_message_t *fr_message_reserve(fr_message_set_t *ms, size_t reserve_size) CC_HINT(nonnull);
@@ -62,6 +67,9 @@ int fr_message_done(fr_message_t *m) CC_HINT(nonnull);
 
 fr_message_t *fr_message_localize(TALLOC_CTX *ctx, fr_message_t *m, size_t message_size) CC_HINT(nonnull);
 
+fr_message_ref_t *fr_message_ref_alloc(TALLOC_CTX *ctx, fr_message_t *m) CC_HINT(nonnull(2));
+void fr_message_ref_detach(fr_message_ref_t *ref) CC_HINT(nonnull);
+
 int fr_message_set_messages_used(fr_message_set_t *ms) CC_HINT(nonnull);
 void fr_message_set_gc(fr_message_set_t *ms) CC_HINT(nonnull);
 
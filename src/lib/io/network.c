@@ -45,6 +45,21 @@ RCSID("$Id$")
 #define PTHREAD_MUTEX_UNLOCK
 #endif
 
+#define MAX_BATCH (64)
+
+/*
+ *	Extra CPU time we charge workers on a different NUMA node, so
+ *	that we prefer workers on our own node until they're busier
+ *	than the remote ones by this much.
+ */
+#define REMOTE_COST (NANOSEC / 10)
+
+/*
+ *	How long we wait before trying again to resume a socket which
+ *	we couldn't put back into the event loop.
+ */
+#define RESUME_RETRY_USEC (100000)
+
 typedef struct fr_network_worker_t {
 	int			heap_id;		//!< workers are in a heap
 	fr_time_t		cpu_time;		//!< how much CPU time this worker has spent
@@ -52,15 +67,80 @@ typedef struct fr_network_worker_t {
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
+	bool			remote;			//!< worker is on a different NUMA node
+	bool			closing;		//!< we've asked the worker to close the channel
+
+	fr_dlist_t		entry;			//!< in the list of all workers
 } fr_network_worker_t;
 
+/**
+ *  A message set which a worker handed to us when its channel closed.
+ *
+ *  The replies we haven't written yet live in it, so we free it once
+ *  we're done with them.
+ */
+typedef struct fr_network_orphan_t {
+	fr_message_set_t	*ms;			//!< the worker's reply message set
+	fr_dlist_t		entry;			//!< in the list of orphaned message sets
+} fr_network_orphan_t;
+
+/**
+ *  A request to add a worker, sent over the control plane.
+ */
+typedef struct fr_network_worker_add_t {
+	fr_worker_t		*worker;		//!< the worker to add
+	bool			remote;			//!< worker is on a different NUMA node
+} fr_network_worker_add_t;
+
+/*
+ *	Requests are classified by the first octet of the packet.  For
+ *	RADIUS (and most other protocols), that is the packet code.
+ */
+#define MAX_CODE (256)
+
+/**
+ *  The measured cost of processing one class of request.
+ */
+typedef struct fr_network_cost_t {
+	fr_time_t		predicted;		//!< EWMA of the processing time
+	fr_time_t		error;			//!< EWMA of the absolute prediction error
+	uint64_t		count;			//!< number of replies used for the prediction
+} fr_network_cost_t;
+
 typedef struct fr_network_socket_t {
 	fr_listen_t const	*listen;		//!< I/O ctx and functions.
 
 	fr_message_set_t	*ms;			//!< message buffers for this socket.
 	fr_channel_data_t	*cd;			//!< cached in case of allocation & read error
+
+	uint64_t		num_reads;		//!< number of reads which returned packets
+	uint64_t		num_packets;		//!< number of packets read
+
+	fr_dlist_t		entry;			//!< in the list of sockets with pending replies
+	int			num_pending;		//!< number of replies waiting to be written
+	fr_channel_data_t	*pending[MAX_BATCH];	//!< replies waiting to be written
+
+	uint64_t		num_writes;		//!< number of vectored writes
+	uint64_t		num_written;		//!< number of replies written via vectored writes
+
+	bool			paused;			//!< we've stopped reading from the socket
+	fr_dlist_t		paused_entry;		//!< in the list of paused sockets
+	fr_dlist_t		backlog;		//!< packets read, but which no worker would take
+	uint64_t		num_pauses;		//!< number of times we stopped reading
+	uint64_t		num_resumes;		//!< number of times we started reading again
+
+	fr_network_cost_t	cost[MAX_CODE];		//!< per packet code processing cost
 } fr_network_socket_t;
 
+/**
+ *  A request for cost statistics, sent over the control plane.
+ */
+typedef struct fr_network_stats_t {
+	fr_network_stats_callback_t	callback;	//!< called for each class of request
+	void				*ctx;		//!< context for the callback
+	FILE				*fp;		//!< where fr_network_debug() output goes, or NULL
+} fr_network_stats_t;
+
 
 struct fr_network_t {
 	int			kq;			//!< our KQ
@@ -72,6 +152,7 @@ struct fr_network_t {
 	uintptr_t		aq_ident;		//!< identifier for control-plane events
 
 	fr_control_t		*control;		//!< the control plane
+	int			control_fd;		//!< eventfd for control-plane events, or -1
 
 	fr_ring_buffer_t	*rb;			//!< ring buffer for my control-plane messages
 
@@ -80,26 +161,40 @@ struct fr_network_t {
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
 	fr_heap_t		*workers;		//!< workers, ordered by total CPU time spent
 	fr_heap_t		*closing;		//!< workers which are being closed
+	fr_dlist_t		worker_list;		//!< all workers, so that we can find one to remove
+	fr_dlist_t		orphans;		//!< message sets from workers which have closed
 
 	uint64_t		num_requests;		//!< number of requests we sent
 	uint64_t		num_replies;		//!< number of replies we received
 
 	rbtree_t		*sockets;		//!< list of sockets we're managing
 
+	fr_dlist_t		pending;		//!< sockets with replies waiting to be written
+	fr_dlist_t		paused;			//!< sockets we've stopped reading from
+	fr_event_timer_t	*resume_ev;		//!< retries resuming paused sockets
+
 #ifdef HAVE_PTHREAD_H
 	pthread_mutex_t		mutex;			//!< for sending us control messages
 #endif
 };
 
 static void fr_network_post_event(fr_event_list_t *el, struct timeval *now, void *uctx);
+static void fr_network_read(fr_event_list_t *el, int sockfd, int flags, void *ctx);
+static void fr_network_write(fr_event_list_t *el, int sockfd, int flags, void *ctx);
+static void fr_network_error(fr_event_list_t *el, int sockfd, int flags, void *ctx);
+static void fr_network_socket_resume(fr_network_t *nr);
 
 static int worker_cmp(void const *one, void const *two)
 {
 	fr_network_worker_t const *a = one;
 	fr_network_worker_t const *b = two;
+	fr_time_t a_cost, b_cost;
 
-	if (a->cpu_time < b->cpu_time) return -1;
-	if (a->cpu_time > b->cpu_time) return +1;
+	a_cost = a->cpu_time + (a->remote ? REMOTE_COST : 0);
+	b_cost = b->cpu_time + (b->remote ? REMOTE_COST : 0);
+
+	if (a_cost < b_cost) return -1;
+	if (a_cost > b_cost) return +1;
 
 	return 0;
 }
@@ -134,6 +229,35 @@ static int socket_cmp(void const *one, void const *two)
 #define IALPHA (8)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
+/** Update the predicted cost of a class of request
+ *
+ *  We track the error of the prediction along with the prediction,
+ *  so that the accuracy of the load balancing can be checked.
+ *
+ * @param[in] cost	the cost to update.
+ * @param[in] processing_time	the measured cost of one request.
+ */
+static void fr_network_cost_update(fr_network_cost_t *cost, fr_time_t processing_time)
+{
+	fr_time_t error;
+
+	if (!cost->count) {
+		cost->predicted = processing_time;
+		cost->count++;
+		return;
+	}
+
+	if (processing_time > cost->predicted) {
+		error = processing_time - cost->predicted;
+	} else {
+		error = cost->predicted - processing_time;
+	}
+
+	cost->error = RTT(cost->error, error);
+	cost->predicted = RTT(cost->predicted, processing_time);
+	cost->count++;
+}
+
 /** Drain the input channel
  *
  * @param[in] nr the network
@@ -143,6 +267,7 @@ static int socket_cmp(void const *one, void const *two)
 static void fr_network_drain_input(fr_network_t *nr, fr_channel_t *ch, fr_channel_data_t *cd)
 {
 	fr_network_worker_t *w;
+	fr_network_socket_t *s = NULL;
 
 	if (!cd) {
 		cd = fr_channel_recv_reply(ch);
@@ -168,10 +293,74 @@ static void fr_network_drain_input(fr_network_t *nr, fr_channel_t *ch, fr_channe
 			w->predicted = RTT(w->predicted, cd->reply.processing_time);
 		}
 
+		/*
+		 *	Update stats for this class of request.
+		 *	Replies usually come in bursts for the same
+		 *	socket, so cache the lookup.
+		 */
+		if (cd->code != FR_CHANNEL_CODE_NONE) {
+			if (!s || (s->listen != cd->listen)) {
+				fr_network_socket_t my_socket;
+
+				my_socket.listen = cd->listen;
+				s = rbtree_finddata(nr->sockets, &my_socket);
+			}
+
+			if (s) fr_network_cost_update(&s->cost[cd->code % MAX_CODE], cd->reply.processing_time);
+		}
+
 		(void) fr_heap_insert(nr->replies, cd);
 	} while ((cd = fr_channel_recv_reply(ch)) != NULL);
 }
 
+/** Take ownership of a message set from a worker which has closed its channel
+ *
+ * @param[in] nr the network
+ * @param[in] ms the message set, which is not parented by any talloc context.
+ */
+static void fr_network_orphan_add(fr_network_t *nr, fr_message_set_t *ms)
+{
+	fr_network_orphan_t *o;
+
+	if (!ms) return;
+
+	fr_message_set_gc(ms);
+	if (fr_message_set_messages_used(ms) == 0) {
+		talloc_free(ms);
+		return;
+	}
+
+	o = talloc_zero(nr, fr_network_orphan_t);
+	if (!o) _exit(1);
+
+	o->ms = talloc_steal(o, ms);
+	fr_dlist_insert_tail(&nr->orphans, &o->entry);
+}
+
+/** Free orphaned message sets once all of their replies have been written
+ *
+ * @param[in] nr the network
+ */
+static void fr_network_orphan_gc(fr_network_t *nr)
+{
+	fr_dlist_t *entry, *next;
+
+	for (entry = FR_DLIST_FIRST(nr->orphans);
+	     entry != NULL;
+	     entry = next) {
+		fr_network_orphan_t *o;
+
+		next = FR_DLIST_NEXT(nr->orphans, entry);
+		o = fr_ptr_to_type(fr_network_orphan_t, entry, entry);
+
+		fr_message_set_gc(o->ms);
+		if (fr_message_set_messages_used(o->ms) > 0) continue;
+
+		fr_dlist_remove(&o->entry);
+		talloc_free(o);
+	}
+}
+
 /** Handle a network control message callback for a channel
  *
  * @param[in] ctx the network
@@ -183,6 +372,7 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 {
 	fr_channel_event_t ce;
 	fr_channel_t *ch;
+	fr_network_worker_t *w;
 	fr_network_t *nr = ctx;
 
 	ce = fr_channel_service_message(now, &ch, data, data_size);
@@ -197,12 +387,19 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 
 	case FR_CHANNEL_NOOP:
 		fr_log(nr->log, L_DBG, "aq noop");
+
+		/*
+		 *	The worker has emptied its channel, so
+		 *	there's room for more requests.
+		 */
+		fr_network_socket_resume(nr);
 		break;
 
 	case FR_CHANNEL_DATA_READY_NETWORK:
 		rad_assert(ch != NULL);
 		fr_log(nr->log, L_DBG, "aq data ready");
 		fr_network_drain_input(nr, ch, NULL);
+		fr_network_socket_resume(nr);
 		break;
 
 	case FR_CHANNEL_DATA_READY_WORKER:
@@ -216,8 +413,37 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 		break;
 
 	case FR_CHANNEL_CLOSE:
+		rad_assert(ch != NULL);
 		fr_log(nr->log, L_DBG, "aq channel close");
-		///
+
+		/*
+		 *	The worker has finished with the channel.
+		 *	Pick up any replies it sent before closing.
+		 */
+		fr_network_drain_input(nr, ch, NULL);
+
+		/*
+		 *	The worker either acknowledged our close, or
+		 *	closed the channel itself because it's
+		 *	exiting.  In the second case, it's still in
+		 *	the list of workers we send requests to.
+		 */
+		w = fr_channel_master_ctx_get(ch);
+		if (w->closing) {
+			(void) fr_heap_extract(nr->closing, w);
+		} else {
+			fr_dlist_remove(&w->entry);
+			(void) fr_heap_extract(nr->workers, w);
+		}
+
+		/*
+		 *	The replies live in the worker's message set,
+		 *	which the worker has handed to us.  Keep it
+		 *	until we've written them.  We can free the
+		 *	channel now.
+		 */
+		fr_network_orphan_add(nr, fr_channel_worker_ctx_get(ch));
+		talloc_free(w);
 		break;
 	}
 }
@@ -225,12 +451,15 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 /** Send a message on the "best" channel.
  *
  * @param nr the network
+ * @param s the socket the message was read from
  * @param cd the message we've received
  */
-static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
+static int fr_network_send_request(fr_network_t *nr, fr_network_socket_t *s, fr_channel_data_t *cd)
 {
 	fr_network_worker_t *worker;
 	fr_channel_data_t *reply;
+	fr_network_cost_t *cost;
+	fr_time_t predicted;
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
@@ -245,6 +474,15 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 
 	(void) talloc_get_type_abort(worker, fr_network_worker_t);
 
+	/*
+	 *	Different kinds of requests cost very different
+	 *	amounts to process.  Use the cost of this class of
+	 *	request if we know it, and otherwise the average cost
+	 *	of requests sent to this worker.
+	 */
+	cost = &s->cost[cd->code % MAX_CODE];
+	predicted = cost->count ? cost->predicted : worker->predicted;
+
 	/*
 	 *	Send the message to the channel.  If we fail, recurse.
 	 *	That's easier than manually tracking the channel we
@@ -262,7 +500,7 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 		int rcode;
 
 		fr_log(nr->log, L_DBG, "recursing in send_request");
-		rcode = fr_network_send_request(nr, cd);
+		rcode = fr_network_send_request(nr, s, cd);
 
 		/*
 		 *	Mark this channel as still busy, for some
@@ -270,7 +508,7 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 		 *	don't immediately pop it off the heap and try
 		 *	to send it another request.
 		 */
-		worker->cpu_time = cd->m.when + worker->predicted;
+		worker->cpu_time = cd->m.when + predicted;
 		(void) fr_heap_insert(nr->workers, worker);
 
 		return rcode;
@@ -282,7 +520,8 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 	 *	updated with a more accurate number when we receive a
 	 *	reply from this channel.
 	 */
-	worker->cpu_time += worker->predicted;
+	worker->cpu_time += predicted;
+	nr->num_requests++;
 
 	/*
 	 *	Insert the worker back into the heap of workers.
@@ -299,6 +538,342 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 }
 
 
+/** Stop reading from a socket
+ *
+ *  The kernel socket buffer holds new packets until we start reading
+ *  again.  Sockets which can be written to keep their write
+ *  callback, so that pending replies still get flushed.
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the network socket
+ */
+static void fr_network_socket_pause(fr_network_t *nr, fr_network_socket_t *s)
+{
+	int fd, rcode;
+
+	if (s->paused) return;
+
+	fd = s->listen->app_io->fd(s->listen->app_io_instance);
+
+	if (s->listen->app_io->write) {
+		rcode = fr_event_fd_insert(nr->el, fd, NULL, fr_network_write,
+					   s->listen->app_io->error ? fr_network_error : NULL, s);
+	} else {
+		rcode = fr_event_fd_delete(nr->el, fd);
+	}
+
+	/*
+	 *	Even if we can't stop the reads, we still hold the
+	 *	packets, and send them when the workers have room.
+	 */
+	if (rcode < 0) fr_log(nr->log, L_ERR, "Failed pausing socket %d: %s", fd, fr_strerror());
+
+	s->paused = true;
+	s->num_pauses++;
+	fr_dlist_insert_tail(&nr->paused, &s->paused_entry);
+
+	fr_log(nr->log, L_DBG, "paused socket %d, the workers are busy", fd);
+}
+
+/** Send a message from a socket, or hold it until the workers have room
+ *
+ *  If no worker will take the message, we stop reading from the
+ *  socket.  Messages which have already been read are kept in order,
+ *  and sent before reading resumes.
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the network socket
+ * @param[in] cd	the message we've received
+ */
+static void fr_network_send_or_hold(fr_network_t *nr, fr_network_socket_t *s, fr_channel_data_t *cd)
+{
+	if (!s->paused && fr_network_send_request(nr, s, cd)) return;
+
+	fr_dlist_insert_tail(&s->backlog, &cd->request.list);
+	fr_network_socket_pause(nr, s);
+}
+
+static void fr_network_resume_timer(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
+
+	fr_network_socket_resume(nr);
+}
+
+/** Try resuming the paused sockets again later
+ *
+ *  Nothing else may wake us up, so if a socket can't be put back
+ *  into the event loop, a timer tries again.
+ *
+ * @param[in] nr	the network
+ */
+static void fr_network_resume_retry(fr_network_t *nr)
+{
+	struct timeval now, when, delay;
+
+	if (nr->resume_ev) return;
+
+	gettimeofday(&now, NULL);
+	delay.tv_sec = 0;
+	delay.tv_usec = RESUME_RETRY_USEC;
+	fr_timeval_add(&when, &now, &delay);
+
+	if (fr_event_timer_insert(nr->el, fr_network_resume_timer, nr, &when, &nr->resume_ev) < 0) {
+		fr_log(nr->log, L_ERR, "Failed inserting resume timer: %s", fr_strerror());
+	}
+}
+
+/** Start reading from paused sockets again
+ *
+ *  Each socket first sends the packets it was holding.  If the
+ *  workers still won't take them, it stays paused.  If it can't be
+ *  put back into the event loop, it stays paused, and we try again
+ *  later.
+ *
+ * @param[in] nr	the network
+ */
+static void fr_network_socket_resume(fr_network_t *nr)
+{
+	int			fd;
+	fr_dlist_t		*entry, *next;
+	fr_network_socket_t	*s;
+	fr_channel_data_t	*cd;
+
+	for (entry = FR_DLIST_FIRST(nr->paused);
+	     entry != NULL;
+	     entry = next) {
+		next = FR_DLIST_NEXT(nr->paused, entry);
+		s = fr_ptr_to_type(fr_network_socket_t, paused_entry, entry);
+
+		while ((entry = FR_DLIST_FIRST(s->backlog)) != NULL) {
+			cd = fr_ptr_to_type(fr_channel_data_t, request.list, entry);
+			fr_dlist_remove(&cd->request.list);
+
+			if (!fr_network_send_request(nr, s, cd)) {
+				fr_dlist_insert_head(&s->backlog, &cd->request.list);
+
+				/*
+				 *	No worker has room, so there's
+				 *	no point in trying the other
+				 *	sockets.
+				 */
+				return;
+			}
+		}
+
+		fd = s->listen->app_io->fd(s->listen->app_io_instance);
+		if (fr_event_fd_insert(nr->el, fd,
+				       fr_network_read,
+				       s->listen->app_io->write ? fr_network_write : NULL,
+				       s->listen->app_io->error ? fr_network_error : NULL,
+				       s) < 0) {
+			fr_log(nr->log, L_ERR, "Failed resuming socket %d: %s", fd, fr_strerror());
+			fr_network_resume_retry(nr);
+			continue;
+		}
+
+		s->paused = false;
+		s->num_resumes++;
+		fr_dlist_remove(&s->paused_entry);
+
+		fr_log(nr->log, L_DBG, "resumed socket %d", fd);
+	}
+}
+
+/** NAK a packet which we can't send to a worker
+ *
+ *  The NAK is written to the transport, just as if a worker had
+ *  NAK'd the packet.  That lets the transport clean up any state it
+ *  has for the packet, e.g. tracking table entries.
+ *
+ * @param[in] s			the network socket
+ * @param[in] packet_ctx	from the transport read
+ * @param[in] request_time	when the packet was received
+ * @param[in] packet		the packet to NAK
+ * @param[in] packet_len	length of the packet
+ */
+static void fr_network_nak(fr_network_socket_t *s, void *packet_ctx, fr_time_t request_time,
+			   uint8_t *packet, size_t packet_len)
+{
+	size_t			size = 0;
+	uint8_t			reply[256];
+	fr_listen_t const	*listen = s->listen;
+
+	if (listen->app_io->nak) {
+		size = listen->app_io->nak(listen->app_io_instance, packet, packet_len, reply, sizeof(reply));
+	}
+
+	if (listen->app_io->write) {
+		(void) listen->app_io->write(listen->app_io_instance, packet_ctx, request_time, reply, size);
+	}
+}
+
+/** Read a batch of packets from a datagram socket.
+ *
+ *  The packets are read into one contiguous reservation in the
+ *  message set, one default_message_size slot per packet.  The
+ *  packets are then compacted in place, and split into individual
+ *  messages via fr_message_alloc_reserve().
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the network socket
+ * @param[in] sockfd	the socket which is ready to read.
+ */
+static void fr_network_read_vector(fr_network_t *nr, fr_network_socket_t *s, int sockfd)
+{
+	int			i, num, num_read;
+	size_t			size, total;
+	uint8_t			*p;
+	fr_channel_data_t	*cd, *next;
+	fr_io_vector_t		vector[MAX_BATCH];
+
+	size = s->listen->default_message_size;
+
+	num = s->listen->max_batch;
+	if (num > MAX_BATCH) num = MAX_BATCH;
+
+	/*
+	 *	Don't reserve more than half of the ring buffer.
+	 */
+	if ((size_t) num > (s->listen->num_messages / 2)) num = s->listen->num_messages / 2;
+
+	if (!s->cd) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, size * num);
+		if (!cd) {
+			fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", size * num);
+			talloc_free(s);
+			return;
+		}
+	} else {
+		cd = s->cd;
+	}
+
+	rad_assert(cd->m.data != NULL);
+	rad_assert(cd->m.rb_size >= size * num);
+
+	for (i = 0; i < num; i++) {
+		vector[i].packet_ctx = NULL;
+		vector[i].recv_time = NULL;
+		vector[i].buffer = cd->m.data + (i * size);
+		vector[i].buffer_len = size;
+	}
+
+	num_read = s->listen->app_io->read_vector(s->listen->app_io_instance, vector, num);
+	if (num_read == 0) {
+		fr_log(nr->log, L_DBG_ERR, "got no data from transport read");
+		s->cd = cd;
+		return;
+	}
+
+	if (num_read < 0) {
+		fr_log(nr->log, L_DBG_ERR, "error from transport read on socket %d", sockfd);
+		talloc_free(s);
+		return;
+	}
+
+	s->num_reads++;
+	s->num_packets += num_read;
+
+	/*
+	 *	Compact the packets so that they are contiguous in
+	 *	the reservation.  Packet "i" is always at or before
+	 *	slot "i", so we never overwrite a packet which hasn't
+	 *	been moved yet.
+	 */
+	p = cd->m.data;
+	total = 0;
+	for (i = 0; i < num_read; i++) {
+		if (!vector[i].buffer_len) continue;
+
+		if (p != vector[i].buffer) memmove(p, vector[i].buffer, vector[i].buffer_len);
+		vector[i].buffer = p;
+
+		p += vector[i].buffer_len;
+		total += vector[i].buffer_len;
+	}
+
+	/*
+	 *	All of the packets were discarded by the transport.
+	 *	Keep the reservation for the next read.
+	 */
+	if (!total) {
+		s->cd = cd;
+		return;
+	}
+	s->cd = NULL;
+
+	fr_log(nr->log, L_DBG, "got %d packets, total size %zd", num_read, total);
+
+	for (i = 0; i < num_read; i++) {
+		if (!vector[i].buffer_len) continue;
+
+		/*
+		 *	The packets are contiguous, so this packet is
+		 *	at the start of the message.  The message may
+		 *	have been moved to a new ring buffer by
+		 *	fr_message_alloc_reserve(), so we don't use
+		 *	vector[i].buffer.
+		 */
+		rad_assert(cd->m.data_size == 0);
+
+		/*
+		 *	Initialize the rest of the fields of the channel data.
+		 */
+		if (vector[i].recv_time) {
+			cd->m.when = *vector[i].recv_time;
+		} else {
+			cd->m.when = fr_time_cached();
+		}
+		cd->code = cd->m.data[0];
+		cd->priority = s->listen->admit ? s->listen->admit->priority[cd->code] : 0;
+		cd->listen = s->listen;
+		cd->packet_ctx = vector[i].packet_ctx;
+		cd->request.recv_time = vector[i].recv_time;
+
+		total -= vector[i].buffer_len;
+
+		/*
+		 *	Split the remaining packets into a new
+		 *	message, or allocate the last one.
+		 */
+		if (total > 0) {
+			next = (fr_channel_data_t *) fr_message_alloc_reserve(s->ms, &cd->m, vector[i].buffer_len, total);
+		} else {
+			next = NULL;
+			(void) fr_message_alloc(s->ms, &cd->m, vector[i].buffer_len);
+		}
+
+		fr_network_send_or_hold(nr, s, cd);
+
+		if (!total) break;
+
+		/*
+		 *	We can't allocate messages for the rest of
+		 *	the packets.  NAK them, so that the transport
+		 *	can clean up after them.
+		 */
+		if (!next) {
+			fr_log(nr->log, L_ERR, "Failed allocating message for batched packets: %s", fr_strerror());
+
+			for (i++; i < num_read; i++) {
+				if (!vector[i].buffer_len) continue;
+
+				fr_network_nak(s, vector[i].packet_ctx,
+					       vector[i].recv_time ? *vector[i].recv_time : 0,
+					       vector[i].buffer, vector[i].buffer_len);
+			}
+			break;
+		}
+
+		/*
+		 *	The new message holds the rest of the packets,
+		 *	but none of them have been allocated yet.
+		 */
+		cd = next;
+		cd->m.data_size = 0;
+	}
+}
+
 /** Read a packet from the network.
  *
  * @param[in] el	the event list.
@@ -318,6 +893,11 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 
 	fr_log(nr->log, L_DBG, "network read");
 
+	if (s->listen->app_io->read_vector && (s->listen->max_batch > 1)) {
+		fr_network_read_vector(nr, s, sockfd);
+		return;
+	}
+
 	if (!s->cd) {
 		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
 		if (!cd) {
@@ -371,6 +951,9 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	}
 	s->cd = NULL;
 
+	s->num_reads++;
+	s->num_packets++;
+
 	fr_log(nr->log, L_DBG, "got packet size %zd", data_size);
 
 	/*
@@ -379,18 +962,16 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	if (recv_time) {
 		cd->m.when = *recv_time;
 	} else {
-		cd->m.when = fr_time();
+		cd->m.when = fr_time_cached();
 	}
-	cd->priority = 0;
+	cd->code = cd->m.data[0];
+	cd->priority = s->listen->admit ? s->listen->admit->priority[cd->code] : 0;
 	cd->listen = s->listen;
 	cd->request.recv_time = recv_time;
 
 	(void) fr_message_alloc(s->ms, &cd->m, data_size);
 
-	if (!fr_network_send_request(nr, cd)) {
-		fr_log(nr->log, L_ERR, "Failed sending packet to worker");
-		fr_message_done(&cd->m);
-	}
+	fr_network_send_or_hold(nr, s, cd);
 }
 
 
@@ -428,10 +1009,32 @@ static void fr_network_error(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 
 static int _network_socket_free(fr_network_socket_t *s)
 {
+	int i;
 	fr_network_t *nr = talloc_parent(s);
+	fr_dlist_t *entry;
+	fr_channel_data_t *cd;
 
 	fr_event_fd_delete(nr->el, s->listen->app_io->fd(s->listen->app_io_instance));
 
+	/*
+	 *	Throw away any packets which no worker would take.
+	 */
+	while ((entry = FR_DLIST_FIRST(s->backlog)) != NULL) {
+		cd = fr_ptr_to_type(fr_channel_data_t, request.list, entry);
+		fr_dlist_remove(&cd->request.list);
+		fr_message_done(&cd->m);
+	}
+	fr_dlist_remove(&s->paused_entry);
+
+	/*
+	 *	Throw away any replies which haven't been written.
+	 */
+	for (i = 0; i < s->num_pending; i++) {
+		fr_message_done(&s->pending[i]->m);
+	}
+	s->num_pending = 0;
+	fr_dlist_remove(&s->entry);
+
 	rbtree_deletebydata(nr->sockets, s);
 
 	if (s->listen->app_io->close) {
@@ -456,19 +1059,35 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 	fr_network_t		*nr = ctx;
 	fr_network_socket_t	*s;
 	fr_app_io_t const	*app_io;
+	fr_listen_t const	*listen;
 
-	rad_assert(data_size == sizeof(*s));
+	rad_assert(data_size == sizeof(listen));
 
-	if (data_size != sizeof(*s)) return;
+	if (data_size != sizeof(listen)) return;
 
-	s = talloc(nr, fr_network_socket_t);
+	memcpy(&listen, data, sizeof(listen));
+
+	s = talloc_zero(nr, fr_network_socket_t);
 	rad_assert(s != NULL);
-	memcpy(s, data, sizeof(*s));
+
+	s->listen = listen;
+	FR_DLIST_INIT(s->entry);
+	FR_DLIST_INIT(s->paused_entry);
+	FR_DLIST_INIT(s->backlog);
 
 	talloc_set_destructor(s, _network_socket_free);
 
 	/*
 	 *	Allocate the ring buffer for messages and packets.
+	 *
+	 *	It's allocated by this thread, and so ends up on our
+	 *	NUMA node, not on the worker's.  Packets from one
+	 *	socket go to many workers, so there is no single node
+	 *	to put it on.  Each packet is written once by us, and
+	 *	read once by a worker.  Putting the buffer on a
+	 *	worker's node would only make the writes remote
+	 *	instead of the reads.  Since we prefer workers on our
+	 *	own node, most reads are local anyway.
 	 */
 	s->ms = fr_message_set_create(s, s->listen->num_messages,
 				      sizeof(fr_channel_data_t),
@@ -514,22 +1133,118 @@ static void fr_network_worker_callback(void *ctx, void const *data, size_t data_
 	fr_network_t *nr = ctx;
 	fr_worker_t *worker;
 	fr_network_worker_t *w;
+	fr_network_worker_add_t add;
 
-	rad_assert(data_size == sizeof(worker));
+	rad_assert(data_size == sizeof(add));
 
-	memcpy(&worker, data, data_size);
+	memcpy(&add, data, data_size);
+	worker = add.worker;
 	(void) talloc_get_type_abort(worker, fr_worker_t);
 
 	w = talloc_zero(nr, fr_network_worker_t);
 	if (!w) _exit(1);
 
 	w->worker = worker;
+	w->remote = add.remote;
 	w->channel = fr_worker_channel_create(worker, w, nr->control);
 	if (!w->channel) _exit(1);
 
 	fr_channel_master_ctx_add(w->channel, w);
 
+	fr_dlist_insert_tail(&nr->worker_list, &w->entry);
 	(void) fr_heap_insert(nr->workers, w);
+
+	fr_network_socket_resume(nr);
+}
+
+/** Handle a network control message callback for removing a worker
+ *
+ *  No more requests are sent to the worker, and the channel is
+ *  closed.  The worker finishes the requests it already has, and
+ *  then acknowledges the close.
+ *
+ * @param[in] ctx the network
+ * @param[in] data the message
+ * @param[in] data_size size of the data
+ * @param[in] now the current time
+ */
+static void fr_network_worker_remove_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
+{
+	fr_network_t *nr = ctx;
+	fr_worker_t *worker;
+	fr_network_worker_t *w = NULL;
+	fr_dlist_t *entry;
+
+	rad_assert(data_size == sizeof(worker));
+
+	memcpy(&worker, data, data_size);
+
+	for (entry = FR_DLIST_FIRST(nr->worker_list);
+	     entry != NULL;
+	     entry = FR_DLIST_NEXT(nr->worker_list, entry)) {
+		w = fr_ptr_to_type(fr_network_worker_t, entry, entry);
+		if (w->worker == worker) break;
+		w = NULL;
+	}
+
+	if (!w) {
+		fr_log(nr->log, L_DBG_ERR, "asked to remove unknown worker %p", worker);
+		return;
+	}
+
+	fr_dlist_remove(&w->entry);
+	(void) fr_heap_extract(nr->workers, w);
+
+	fr_channel_signal_worker_close(w->channel);
+	w->closing = true;
+	(void) fr_heap_insert(nr->closing, w);
+}
+
+
+static int socket_stats(void *ctx, void *data)
+{
+	int			i;
+	fr_network_stats_t	*stats = ctx;
+	fr_network_socket_t	*s = data;
+
+	for (i = 0; i < MAX_CODE; i++) {
+		if (!s->cost[i].count) continue;
+
+		stats->callback(stats->ctx, s->listen, i,
+				s->cost[i].predicted, s->cost[i].error, s->cost[i].count);
+	}
+
+	return 0;
+}
+
+/** Handle a control-plane request for cost statistics
+ *
+ * @param[in] ctx the network
+ * @param[in] data the message
+ * @param[in] data_size size of the data
+ * @param[in] now the current time
+ */
+static void fr_network_stats_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
+{
+	fr_network_t		*nr = ctx;
+	fr_network_stats_t	stats;
+
+	rad_assert(data_size == sizeof(stats));
+
+	memcpy(&stats, data, data_size);
+
+	if (stats.fp) {
+		fr_network_debug(nr, stats.fp);
+		fflush(stats.fp);
+		return;
+	}
+
+	(void) rbtree_walk(nr->sockets, RBTREE_IN_ORDER, socket_stats, &stats);
+
+	/*
+	 *	Tell the caller we're done.
+	 */
+	stats.callback(stats.ctx, NULL, 0, 0, 0, 0);
 }
 
 
@@ -545,7 +1260,7 @@ static void fr_network_evfilt_user(UNUSED int kq, UNUSED struct kevent const *ke
 	fr_network_t *nr = talloc_get_type_abort(ctx, fr_network_t);
 	uint8_t data[256];
 
-	now = fr_time();
+	now = fr_time_cached();
 
 	/*
 	 *	Service all available control-plane events
@@ -554,6 +1269,23 @@ static void fr_network_evfilt_user(UNUSED int kq, UNUSED struct kevent const *ke
 }
 
 
+/** Service a control-plane eventfd.
+ *
+ * @param[in] el the event list
+ * @param[in] fd the eventfd
+ * @param[in] flags from the event
+ * @param[in] ctx the fr_network_t
+ */
+static void fr_network_control_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *ctx)
+{
+	fr_network_t *nr = talloc_get_type_abort(ctx, fr_network_t);
+
+	fr_control_wakeup_clear(nr->control);
+
+	fr_network_evfilt_user(nr->kq, NULL, nr);
+}
+
+
 /** Create a network
  *
  * @param[in] ctx the talloc ctx
@@ -575,6 +1307,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 
 	nr->el = el;
 	nr->log = logger;
+	nr->control_fd = -1;
 
 	nr->kq = fr_event_list_kq(nr->el);
 	rad_assert(nr->kq >= 0);
@@ -606,6 +1339,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 	if (!nr->rb) {
 		fr_strerror_printf("Failed creating ring buffer: %s", fr_strerror());
 	fail2:
+		if (nr->control_fd >= 0) (void) fr_event_fd_delete(nr->el, nr->control_fd);
 		fr_control_free(nr->control);
 		goto fail;
 	}
@@ -625,6 +1359,27 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 		goto fail2;
 	}
 
+	if (fr_control_callback_add(nr->control, FR_CONTROL_ID_WORKER_REMOVE, nr, fr_network_worker_remove_callback) < 0) {
+		fr_strerror_printf("Failed adding worker removal callback: %s", fr_strerror());
+		goto fail2;
+	}
+
+	if (fr_control_callback_add(nr->control, FR_CONTROL_ID_STATS, nr, fr_network_stats_callback) < 0) {
+		fr_strerror_printf("Failed adding stats callback: %s", fr_strerror());
+		goto fail2;
+	}
+
+	/*
+	 *	Workers signal us once per wakeup, instead of once per
+	 *	reply.  And on Linux, via an eventfd.
+	 */
+	nr->control_fd = fr_control_wakeup_fd(nr->control);
+	if ((nr->control_fd >= 0) &&
+	    (fr_event_fd_insert(nr->el, nr->control_fd, fr_network_control_read, NULL, NULL, nr) < 0)) {
+		fr_strerror_printf("Failed adding control eventfd: %s", fr_strerror());
+		goto fail2;
+	}
+
 	/*
 	 *	Create the various heaps.
 	 */
@@ -634,6 +1389,11 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 		goto fail2;
 	}
 
+	FR_DLIST_INIT(nr->pending);
+	FR_DLIST_INIT(nr->paused);
+	FR_DLIST_INIT(nr->worker_list);
+	FR_DLIST_INIT(nr->orphans);
+
 	nr->replies = fr_heap_create(reply_cmp, offsetof(fr_channel_data_t, channel.heap_id));
 	if (!nr->replies) {
 		fr_strerror_printf("Failed creating heap for replies: %s", fr_strerror());
@@ -683,16 +1443,26 @@ int fr_network_destroy(fr_network_t *nr)
 {
 	fr_network_worker_t *worker;
 	fr_channel_data_t *cd;
+	uint8_t data[256];
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 	rad_assert(nr->closing);
 
+	/*
+	 *	Workers which have exited have closed their channels,
+	 *	but we may not have seen the messages yet.  Service
+	 *	them now, so that we don't signal workers which have
+	 *	gone away.
+	 */
+	fr_control_service(nr->control, data, sizeof(data), fr_time());
+
 	/*
 	 *	Pop all of the workers, and signal them that we're
 	 *	closing/
 	 */
 	while ((worker = fr_heap_pop(nr->workers)) != NULL) {
 		fr_channel_signal_worker_close(worker->channel);
+		worker->closing = true;
 		(void) fr_heap_insert(nr->closing, worker);
 	}
 
@@ -711,14 +1481,81 @@ int fr_network_destroy(fr_network_t *nr)
 		fr_message_done(&cd->m);
 	}
 
+	if (nr->resume_ev) (void) fr_event_timer_delete(nr->el, &nr->resume_ev);
 	(void) fr_event_post_delete(nr->el, fr_network_post_event, nr);
+	if (nr->control_fd >= 0) (void) fr_event_fd_delete(nr->el, nr->control_fd);
 
 	talloc_free(nr);
 
 	return 0;
 }
 
+/** Write all of the pending replies for a socket
+ *
+ * @param[in] nr	the network
+ * @param[in] s		the socket
+ * @return
+ *	- <0 on error.  The socket has been closed.
+ *	- 0 on success
+ */
+static int fr_network_write_vector(fr_network_t *nr, fr_network_socket_t *s)
+{
+	int			i, num, rcode;
+	fr_listen_t const	*listen = s->listen;
+	fr_io_vector_t		vector[MAX_BATCH];
+
+	num = s->num_pending;
+	if (!num) return 0;
+
+	for (i = 0; i < num; i++) {
+		fr_channel_data_t *cd = s->pending[i];
+
+		vector[i].packet_ctx = cd->packet_ctx;
+		vector[i].recv_time = NULL;
+		vector[i].request_time = cd->reply.request_time;
+		vector[i].buffer = cd->m.data;
+		vector[i].buffer_len = cd->m.data_size;
+	}
+
+	/*
+	 *	The write function is responsible for ensuring
+	 *	that NAKs are not written to the network.
+	 */
+	rcode = listen->app_io->write_vector(listen->app_io_instance, vector, num);
+
+	for (i = 0; i < num; i++) {
+		fr_message_done(&s->pending[i]->m);
+	}
+	s->num_pending = 0;
+	fr_dlist_remove(&s->entry);
+
+	if (rcode < 0) {
+		/*
+		 *	Tell the socket that there was an error.
+		 *
+		 *	Don't call close, as that will be done
+		 *	in the destructor.
+		 */
+		if (listen->app_io->error) listen->app_io->error(listen->app_io_instance);
+
+		talloc_free(s);
+		return -1;
+	}
+
+	s->num_writes++;
+	s->num_written += num;
+
+	fr_log(nr->log, L_DBG, "Sending %d replies to socket %d",
+	       num, listen->app_io->fd(listen->app_io_instance));
+
+	return 0;
+}
+
 /** Handle replies after all FD and timer events have been serviced
+ *
+ *  Replies for sockets which support vectored writes are collected
+ *  per socket, and written together once all of the replies have been
+ *  processed.
  *
  * @param el	the event loop
  * @param now	the current time (mostly)
@@ -727,6 +1564,8 @@ int fr_network_destroy(fr_network_t *nr)
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_dlist_t *entry;
+	fr_network_socket_t my_socket, *s = NULL;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
@@ -735,6 +1574,33 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 
 		listen = cd->listen;
 
+		if (listen->app_io->write_vector) {
+			/*
+			 *	Replies for the same socket tend to
+			 *	come in bunches.
+			 */
+			if (!s || (s->listen != listen)) {
+				my_socket.listen = listen;
+				s = rbtree_finddata(nr->sockets, &my_socket);
+			}
+
+			/*
+			 *	The socket has been closed.
+			 */
+			if (!s) {
+				fr_message_done(&cd->m);
+				continue;
+			}
+
+			if (!s->num_pending) fr_dlist_insert_tail(&nr->pending, &s->entry);
+
+			s->pending[s->num_pending++] = cd;
+			if (s->num_pending < MAX_BATCH) continue;
+
+			if (fr_network_write_vector(nr, s) < 0) s = NULL;
+			continue;
+		}
+
 		/*
 		 *	The write function is responsible for ensuring
 		 *	that NAKs are not written to the network.
@@ -742,7 +1608,7 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 		rcode = listen->app_io->write(listen->app_io_instance, cd->packet_ctx,
 					      cd->reply.request_time, cd->m.data, cd->m.data_size);
 		if (rcode < 0) {
-			fr_network_socket_t my_socket, *s;
+			fr_network_socket_t *bad;
 
 			/*
 			 *	Tell the socket that there was an error.
@@ -752,9 +1618,14 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 			 */
 			if (listen->app_io->error) listen->app_io->error(listen->app_io_instance);
 
+			fr_message_done(&cd->m);
+
 			my_socket.listen = listen;
-			s = rbtree_finddata(nr->sockets, &my_socket);
-			if (s) talloc_free(s);
+			bad = rbtree_finddata(nr->sockets, &my_socket);
+			if (bad) {
+				if (bad == s) s = NULL;
+				talloc_free(bad);
+			}
 			continue;
 		}
 
@@ -766,6 +1637,17 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 		       cd->listen->app_io->fd(cd->listen->app_io_instance));
 		fr_message_done(&cd->m);
 	}
+
+	/*
+	 *	Flush the replies for all of the sockets.
+	 */
+	while ((entry = FR_DLIST_FIRST(nr->pending)) != NULL) {
+		s = fr_ptr_to_type(fr_network_socket_t, entry, entry);
+
+		(void) fr_network_write_vector(nr, s);
+	}
+
+	if (FR_DLIST_FIRST(nr->orphans)) fr_network_orphan_gc(nr);
 }
 
 
@@ -791,13 +1673,17 @@ void fr_network(fr_network_t *nr)
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		num_events = fr_event_corral(nr->el, wait_for_event);
+		fr_time_sync();
 		fr_log(nr->log, L_DBG, "Got num_events %d", num_events);
 		if (num_events < 0) break;
 
 		/*
-		 *	Service outstanding events.
+		 *	Service outstanding events.  If we have replies
+		 *	to write, service the event list even when there
+		 *	are no events, as the post-event callback is
+		 *	what writes them.
 		 */
-		if (num_events > 0) {
+		if ((num_events > 0) || !wait_for_event) {
 			fr_log(nr->log, L_DBG, "servicing events");
 			fr_event_service(nr->el);
 		}
@@ -823,33 +1709,210 @@ void fr_network_exit(fr_network_t *nr)
 int fr_network_socket_add(fr_network_t *nr, fr_listen_t const *listen)
 {
 	int rcode;
-	fr_network_socket_t m;
-
-	memset(&m, 0, sizeof(m));
-	m.listen = listen;
 
 	PTHREAD_MUTEX_LOCK(&nr->mutex);
-	rcode = fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_SOCKET, &m, sizeof(m));
+	rcode = fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_SOCKET, &listen, sizeof(listen));
 	PTHREAD_MUTEX_UNLOCK(&nr->mutex);
 
 	return rcode;
 }
 
 /** Add a worker to a network
+ *
+ *  Remote workers are used only when the local ones are
+ *  significantly busier.
  *
  * @param nr the network
  * @param worker the worker
+ * @param remote whether the worker runs on a different NUMA node to the network
  */
-int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker)
+int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker, bool remote)
 {
 	int rcode;
+	fr_network_worker_add_t add;
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 	(void) talloc_get_type_abort(worker, fr_worker_t);
 
+	add.worker = worker;
+	add.remote = remote;
+
 	PTHREAD_MUTEX_LOCK(&nr->mutex);
-	rcode = fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_WORKER, &worker, sizeof(worker));
+	rcode = fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_WORKER, &add, sizeof(add));
 	PTHREAD_MUTEX_UNLOCK(&nr->mutex);
 
 	return rcode;
 }
+
+/** Remove a worker from a network
+ *
+ *  The network stops sending requests to the worker, and closes the
+ *  channel once the worker has finished with the requests it has.
+ *
+ * @param nr the network
+ * @param worker the worker
+ */
+int fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker)
+{
+	int rcode;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+	(void) talloc_get_type_abort(worker, fr_worker_t);
+
+	PTHREAD_MUTEX_LOCK(&nr->mutex);
+	rcode = fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_WORKER_REMOVE, &worker, sizeof(worker));
+	PTHREAD_MUTEX_UNLOCK(&nr->mutex);
+
+	return rcode;
+}
+
+/** Ask a network for the predicted cost of each class of request
+ *
+ *  The callback is run in the network thread, once for each
+ *  (listener, packet code) which has received replies.  It is then
+ *  called one last time with listen == NULL, to signal that there are
+ *  no more statistics.
+ *
+ * @param nr the network
+ * @param callback to call with the statistics
+ * @param ctx for the callback
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_network_stats_request(fr_network_t *nr, fr_network_stats_callback_t callback, void *ctx)
+{
+	int rcode;
+	fr_network_stats_t stats;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	stats.callback = callback;
+	stats.ctx = ctx;
+	stats.fp = NULL;
+
+	PTHREAD_MUTEX_LOCK(&nr->mutex);
+	rcode = fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_STATS, &stats, sizeof(stats));
+	PTHREAD_MUTEX_UNLOCK(&nr->mutex);
+
+	return rcode;
+}
+
+/** Ask a network to write its debug information
+ *
+ *  The network reads its counters in its own thread, and writes them
+ *  to fp via fr_network_debug().  The caller must not close fp until
+ *  the network has serviced the request.
+ *
+ * @param nr the network
+ * @param fp where the debug output is written
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_network_debug_request(fr_network_t *nr, FILE *fp)
+{
+	int rcode;
+	fr_network_stats_t stats;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	stats.callback = NULL;
+	stats.ctx = NULL;
+	stats.fp = fp;
+
+	PTHREAD_MUTEX_LOCK(&nr->mutex);
+	rcode = fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_STATS, &stats, sizeof(stats));
+	PTHREAD_MUTEX_UNLOCK(&nr->mutex);
+
+	return rcode;
+}
+
+static int socket_debug(void *ctx, void *data)
+{
+	int			i;
+	FILE			*fp = ctx;
+	fr_network_socket_t	*s = data;
+
+	fprintf(fp, "\tsocket %d\n", s->listen->app_io->fd(s->listen->app_io_instance));
+	fprintf(fp, "\t\tnum_reads = %" PRIu64 "\n", s->num_reads);
+	fprintf(fp, "\t\tnum_packets = %" PRIu64 "\n", s->num_packets);
+	if (s->num_reads) {
+		fprintf(fp, "\t\taverage batch size = %.2f\n", ((double) s->num_packets) / s->num_reads);
+	}
+
+	fprintf(fp, "\t\tnum_writes = %" PRIu64 "\n", s->num_writes);
+	fprintf(fp, "\t\tnum_written = %" PRIu64 "\n", s->num_written);
+	if (s->num_writes) {
+		fprintf(fp, "\t\taverage write batch size = %.2f\n", ((double) s->num_written) / s->num_writes);
+	}
+
+	fprintf(fp, "\t\tpaused = %s\n", s->paused ? "yes" : "no");
+	fprintf(fp, "\t\tnum_pauses = %" PRIu64 "\n", s->num_pauses);
+	fprintf(fp, "\t\tnum_resumes = %" PRIu64 "\n", s->num_resumes);
+
+	if (s->listen->admit && (!s->listen->admit->owner || (s->listen->admit->owner == s->listen))) {
+		fr_listen_admit_t *admit = s->listen->admit;
+
+		fprintf(fp, "\t\tbacklog = %d\n", atomic_load_explicit(&admit->backlog, memory_order_relaxed));
+		fprintf(fp, "\t\tnum_shed_delay = %" PRIu64 "\n",
+			(uint64_t) atomic_load_explicit(&admit->num_shed_delay, memory_order_relaxed));
+		fprintf(fp, "\t\tnum_shed_backlog = %" PRIu64 "\n",
+			(uint64_t) atomic_load_explicit(&admit->num_shed_backlog, memory_order_relaxed));
+		fprintf(fp, "\t\tnum_timeouts = %" PRIu64 "\n",
+			(uint64_t) atomic_load_explicit(&admit->num_timeouts, memory_order_relaxed));
+	}
+
+	for (i = 0; i < MAX_CODE; i++) {
+		if (!s->cost[i].count) continue;
+
+		fprintf(fp, "\t\tcode %d: count = %" PRIu64 ", predicted = %" PRIu64 ", error = %" PRIu64 "\n",
+			i, s->cost[i].count, s->cost[i].predicted, s->cost[i].error);
+	}
+
+	/*
+	 *	We own the socket, so the transport's statistics
+	 *	can be read without locking.
+	 */
+	if (s->listen->app_io->debug) s->listen->app_io->debug(s->listen->app_io_instance, fp);
+
+	return 0;
+}
+
+/** Print debug information about the network structure
+ *
+ * @param[in] nr the network
+ * @param[in] fp the file where the debug output is printed.
+ */
+void fr_network_debug(fr_network_t *nr, FILE *fp)
+{
+	unsigned int		i;
+	fr_dlist_t		*entry;
+	fr_network_worker_t	*w;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+	fprintf(fp, "\tkq = %d\n", nr->kq);
+	fprintf(fp, "\tnum_requests = %" PRIu64 "\n", nr->num_requests);
+	fprintf(fp, "\tnum_replies = %" PRIu64 "\n", nr->num_replies);
+	fprintf(fp, "\tnum_sockets = %u\n", rbtree_num_elements(nr->sockets));
+
+	(void) rbtree_walk(nr->sockets, RBTREE_IN_ORDER, socket_debug, fp);
+
+	/*
+	 *	How long requests wait in each lane of the channels
+	 *	before the workers see them.
+	 */
+	for (entry = FR_DLIST_FIRST(nr->worker_list);
+	     entry != NULL;
+	     entry = FR_DLIST_NEXT(nr->worker_list, entry)) {
+		w = fr_ptr_to_type(fr_network_worker_t, entry, entry);
+
+		fprintf(fp, "\tworker %p\n", w->worker);
+		for (i = 0; i < FR_CHANNEL_NUM_LANES; i++) {
+			fprintf(fp, "\t\tlane %u latency p50 = %" PRIu64 " ns, p90 = %" PRIu64 " ns, p99 = %" PRIu64 " ns\n",
+				i, fr_channel_lane_latency(w->channel, i, 50), fr_channel_lane_latency(w->channel, i, 90),
+				fr_channel_lane_latency(w->channel, i, 99));
+		}
+	}
+}
@@ -33,13 +33,31 @@ extern "C" {
 
 typedef struct fr_network_t fr_network_t;
 
+/** Receive the predicted cost of one class of request
+ *
+ * @param[in] ctx	as passed to fr_network_stats_request().
+ * @param[in] listen	the listener, or NULL when there are no more statistics.
+ * @param[in] code	the packet code.
+ * @param[in] predicted	the predicted processing time.
+ * @param[in] error	the average absolute error of the prediction.
+ * @param[in] count	the number of replies the prediction is based on.
+ */
+typedef void (*fr_network_stats_callback_t)(void *ctx, fr_listen_t const *listen, uint32_t code,
+					    fr_time_t predicted, fr_time_t error, uint64_t count);
+
 fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t const *logger) CC_HINT(nonnull(2,3));
 void fr_network_exit(fr_network_t *nr) CC_HINT(nonnull);
 int fr_network_destroy(fr_network_t *nr) CC_HINT(nonnull);
 void fr_network(fr_network_t *nr) CC_HINT(nonnull);
 
 int fr_network_socket_add(fr_network_t *nr, fr_listen_t const *io) CC_HINT(nonnull);
-int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
+int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker, bool remote) CC_HINT(nonnull);
+int fr_network_worker_remove(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
+
+int fr_network_stats_request(fr_network_t *nr, fr_network_stats_callback_t callback, void *ctx) CC_HINT(nonnull(1,2));
+int fr_network_debug_request(fr_network_t *nr, FILE *fp) CC_HINT(nonnull);
+
+void fr_network_debug(fr_network_t *nr, FILE *fp) CC_HINT(nonnull);
 
 #ifdef __cplusplus
 }
@@ -29,8 +29,22 @@ RCSID("$Id$")
 #include <freeradius-devel/rad_assert.h>
 #include <string.h>
 
+#ifdef HAVE_MEMFD_CREATE
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
 /*
  *	Ring buffers are allocated in a block.
+ *
+ *	Where possible, the block is mapped twice, back to back.  Data
+ *	which runs off of the end of the first mapping then continues
+ *	in the second one, which is the start of the buffer.  So every
+ *	reservation is contiguous, and we never have to wrap.
+ *
+ *	For mapped buffers, data_start and data_end are free-running
+ *	counters, and the buffer offset is the counter modulo the
+ *	size.  write_offset is always the same as data_end.
  */
 struct fr_ring_buffer_t {
 	uint8_t		*buffer;	//!< actual start of the ring buffer
@@ -43,8 +57,67 @@ struct fr_ring_buffer_t {
 	size_t		reserved;	//!< amount of reserved data at write_offset
 
 	bool		closed;		//!< whether allocations are closed
+	bool		mapped;		//!< whether the buffer is mapped twice
 };
 
+#define RB_MAPPED_OFFSET(_rb, _x) ((_x) & ((_rb)->size - 1))
+
+#ifdef HAVE_MEMFD_CREATE
+static int _ring_buffer_unmap(fr_ring_buffer_t *rb)
+{
+	(void) munmap(rb->buffer, rb->size * 2);
+	return 0;
+}
+
+/** Map the same memory twice, back to back
+ *
+ * @param[in] rb	the ring buffer.
+ * @param[in] size	of the buffer, which must be a multiple of the page size.
+ * @return
+ *	- <0 on error, in which case the caller should use normal memory.
+ *	- 0 on success.
+ */
+static int fr_ring_buffer_map(fr_ring_buffer_t *rb, size_t size)
+{
+	int	fd;
+	uint8_t	*base;
+
+	fd = memfd_create("fr_ring_buffer", MFD_CLOEXEC);
+	if (fd < 0) return -1;
+
+	if (ftruncate(fd, size) < 0) {
+	error:
+		close(fd);
+		return -1;
+	}
+
+	/*
+	 *	Reserve enough address space for both copies, and then
+	 *	map the memory into each half.
+	 */
+	base = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) goto error;
+
+	if ((mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+	    (mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+		(void) munmap(base, size * 2);
+		goto error;
+	}
+
+	/*
+	 *	The mappings keep the memory alive.
+	 */
+	close(fd);
+
+	rb->buffer = base;
+	rb->size = size;
+	rb->mapped = true;
+	talloc_set_destructor(rb, _ring_buffer_unmap);
+
+	return 0;
+}
+#endif
+
 /** Create a ring buffer.
  *
  *  The size provided will be rounded up to the next highest power of
@@ -79,6 +152,14 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 	for (pow = 0x00000001;
 	     pow < size;
 	     pow <<= 1);
+
+#ifdef HAVE_MEMFD_CREATE
+	/*
+	 *	Buffers of at least a page can be mapped twice.
+	 */
+	if ((pow >= (size_t) sysconf(_SC_PAGESIZE)) && (fr_ring_buffer_map(rb, pow) == 0)) return rb;
+#endif
+
 	size = pow;
 	size--;
 
@@ -116,6 +197,19 @@ uint8_t *fr_ring_buffer_reserve(fr_ring_buffer_t *rb, size_t size)
 		return NULL;
 	}
 
+	/*
+	 *	The data always fits if there's enough free space.
+	 */
+	if (rb->mapped) {
+		if (((rb->data_end - rb->data_start) + size) <= rb->size) {
+			rb->reserved = size;
+			return rb->buffer + RB_MAPPED_OFFSET(rb, rb->data_end);
+		}
+
+		fr_strerror_printf("No memory available in ring buffer");
+		return NULL;
+	}
+
 	/*
 	 *	We're writing to the start of the buffer, and there is
 	 *	already data in it.  See if the data fits.
@@ -205,6 +299,18 @@ uint8_t *fr_ring_buffer_alloc(fr_ring_buffer_t *rb, size_t size)
 		rb->reserved = 0;
 	}
 
+	if (rb->mapped) {
+		if (((rb->data_end - rb->data_start) + size) <= rb->size) {
+			p = rb->buffer + RB_MAPPED_OFFSET(rb, rb->data_end);
+			rb->data_end += size;
+			rb->write_offset = rb->data_end;
+			return p;
+		}
+
+		fr_strerror_printf("No memory available in ring buffer");
+		return NULL;
+	}
+
 	/*
 	 *	We're writing to the start of the buffer, and there is
 	 *	already data in it.  See if the data fits.
@@ -339,7 +445,8 @@ uint8_t *fr_ring_buffer_reserve_split(fr_ring_buffer_t *dst, size_t reserve_size
 	/*
 	 *	Copy the data from the old buffer to the new one.
 	 */
-	memcpy(p, src->buffer + src->write_offset, move_size);
+	memcpy(p, src->buffer + (src->mapped ? RB_MAPPED_OFFSET(src, src->write_offset) : src->write_offset),
+	       move_size);
 
 	/*
 	 *	We now have no data reserved here.  All bets are
@@ -378,6 +485,20 @@ int fr_ring_buffer_free(fr_ring_buffer_t *rb, size_t size_to_free)
 	 */
 	if (!size_to_free) return 0;
 
+	if (rb->mapped) {
+		block_size = rb->data_end - rb->data_start;
+
+		if (size_to_free > block_size) {
+			fr_strerror_printf("Cannot free more memory than exists.");
+			return -1;
+		}
+
+		if (size_to_free == block_size) goto empty_buffer;
+
+		rb->data_start += size_to_free;
+		return 0;
+	}
+
 	/*
 	 *	Freeing data from the middle of the buffer.
 	 *
@@ -506,6 +627,8 @@ size_t fr_ring_buffer_used(fr_ring_buffer_t *rb)
 
 	(void) talloc_get_type_abort(rb, fr_ring_buffer_t);
 
+	if (rb->mapped) return rb->data_end - rb->data_start;
+
 	if (rb->write_offset < rb->data_start) {
 		size = rb->write_offset;
 	} else {
@@ -531,6 +654,12 @@ int fr_ring_buffer_start(fr_ring_buffer_t *rb, uint8_t **p_start, size_t *p_size
 {
 	(void) talloc_get_type_abort(rb, fr_ring_buffer_t);
 
+	if (rb->mapped) {
+		*p_start = rb->buffer + RB_MAPPED_OFFSET(rb, rb->data_start);
+		*p_size = rb->data_end - rb->data_start;
+		return 0;
+	}
+
 	*p_start = rb->buffer + rb->data_start;
 
 	if (rb->write_offset < rb->data_start) {
@@ -550,6 +679,6 @@ int fr_ring_buffer_start(fr_ring_buffer_t *rb, uint8_t **p_start, size_t *p_size
  */
 void fr_ring_buffer_debug(fr_ring_buffer_t *rb, FILE *fp)
 {
-	fprintf(fp, "Buffer %p, write_offset %zd, data_start %zd, data_end %zd\n",
-		rb->buffer, rb->write_offset, rb->data_start, rb->data_end);
+	fprintf(fp, "Buffer %p%s, write_offset %zd, data_start %zd, data_end %zd\n",
+		rb->buffer, rb->mapped ? " (mapped)" : "", rb->write_offset, rb->data_start, rb->data_end);
 }
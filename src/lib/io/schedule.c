@@ -33,6 +33,20 @@ RCSID("$Id$")
 #include <pthread.h>
 #endif
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -61,6 +75,29 @@ RCSID("$Id$")
 
 #define SEM_WAIT_INTR(_x) do {if (sem_wait(_x) == 0) break;} while (errno == EINTR)
 
+/*
+ *	How often the monitor thread checks the load on the workers.
+ */
+#define FR_SCHEDULE_TICK	(NANOSEC / 10)
+
+/*
+ *	Add a worker when the workers are busier than this (percent),
+ *	or when there are more queued messages than workers.
+ */
+#define FR_SCHEDULE_BUSY	(80)
+
+/*
+ *	Retire a worker when the remaining ones would be less busy
+ *	than this (percent), and have been for FR_SCHEDULE_COOLDOWN.
+ */
+#define FR_SCHEDULE_IDLE	(50)
+#define FR_SCHEDULE_COOLDOWN	((fr_time_t) NANOSEC * 10)
+
+/*
+ *	Highest CPU number we allow in a CPU list.
+ */
+#define FR_SCHEDULE_MAX_CPU	(1024)
+
 /**
  *  Track the child thread status.
  */
@@ -79,6 +116,7 @@ typedef struct fr_schedule_worker_t {
 	pthread_t	pthread_id;		//!< the thread of this worker
 
 	int		id;			//!< a unique ID
+	int		numa_node;		//!< NUMA node it's pinned to, or -1
 	int		uses;			//!< how many network threads are using it
 	fr_time_t	cpu_time;		//!< how much CPU time this worker has used
 
@@ -88,6 +126,9 @@ typedef struct fr_schedule_worker_t {
 
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_worker_t	*worker;		//!< the worker data structure
+
+	fr_time_t	running;		//!< CPU time used, as of the last check
+	fr_time_t	retiring;		//!< when we started retiring it, or 0
 } fr_schedule_worker_t;
 
 /**
@@ -97,6 +138,7 @@ typedef struct fr_schedule_network_t {
 	pthread_t	pthread_id;		//!< the thread of this network
 
 	int		id;			//!< a unique ID
+	int		numa_node;		//!< NUMA node it's pinned to, or -1
 	fr_schedule_t	*sc;			//!< the scheduler we are running under
 
 	fr_schedule_child_status_t status;	//!< status of the worker
@@ -108,16 +150,18 @@ typedef struct fr_schedule_network_t {
  *  The scheduler
  */
 struct fr_schedule_t {
-	bool		running;		//!< is the scheduler running?
+	atomic_bool	running;		//!< is the scheduler running?  Read by the monitor thread.
 
 	fr_event_list_t	*el;			//!< event list for single-threaded mode.
 
 	fr_log_t	*log;			//!< log destination
 
 	int		max_networks;		//!< number of network threads
+	int		min_workers;		//!< min number of worker threads
 	int		max_workers;		//!< max number of worker threads
 
 	int		num_workers;		//!< number of worker threads
+	atomic_int	load_workers;		//!< num_workers, for other threads to read
 	int		num_workers_exited;	//!< number of exited workers
 
 #ifdef HAVE_PTHREAD_H
@@ -129,15 +173,130 @@ struct fr_schedule_t {
 
 	uint32_t	worker_flags;		//!< for debugging the worker
 
+	int		*network_cpu;		//!< CPUs to pin network threads to
+	int		num_network_cpus;	//!< number of entries in network_cpu
+	int		*worker_cpu;		//!< CPUs to pin worker threads to
+	int		num_worker_cpus;	//!< number of entries in worker_cpu
+
 	fr_dlist_t	workers;		//!< list of workers
+	fr_worker_steal_t *steal;		//!< so workers can share work
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
 
-	fr_schedule_network_t *sn;		//!< pointer to the (one) network thread
+	int		num_networks;		//!< number of running network threads
+	int		next_network;		//!< the next network to add a socket to
+	fr_schedule_network_t *sn;		//!< array of network threads
+
+#ifdef HAVE_PTHREAD_H
+	pthread_t	monitor_id;		//!< thread which grows and shrinks the worker pool
+	bool		monitor_running;	//!< whether we need to join the monitor thread
+#endif
+	fr_time_t	checked;		//!< when the monitor last checked the workers
+	fr_time_t	quiet_since;		//!< when the workers became idle enough to shrink the pool
 };
 
 
+/** Parse a list of CPUs
+ *
+ * @param[in] ctx	to allocate the list in.
+ * @param[out] out	the CPU numbers.
+ * @param[in] str	of the form "0-3,8,10-11".
+ * @return
+ *	- <0 on error
+ *	- the number of CPUs in the list.
+ */
+static int fr_schedule_cpus_parse(TALLOC_CTX *ctx, int **out, char const *str)
+{
+	int		num = 0;
+	int		*cpus = NULL;
+	char const	*p = str;
+	char		*end;
+	unsigned long	first, last, i;
+
+	while (*p) {
+		while (isspace((int) *p)) p++;
+
+		first = strtoul(p, &end, 10);
+		if (end == p) goto error;
+		p = end;
+
+		last = first;
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &end, 10);
+			if ((end == p) || (last < first)) goto error;
+			p = end;
+		}
+
+		if (last >= FR_SCHEDULE_MAX_CPU) goto error;
+
+		cpus = talloc_realloc(ctx, cpus, int, num + (last - first) + 1);
+		if (!cpus) {
+			fr_strerror_printf("Failed allocating memory");
+			return -1;
+		}
+
+		for (i = first; i <= last; i++) cpus[num++] = i;
+
+		while (isspace((int) *p)) p++;
+		if (*p == ',') {
+			p++;
+			continue;
+		}
+		if (*p) goto error;
+	}
+
+	if (!num) goto error;
+
+	*out = cpus;
+	return num;
+
+error:
+	fr_strerror_printf("Invalid CPU list '%s'", str);
+	talloc_free(cpus);
+	return -1;
+}
+
+/** Pin the calling thread to a CPU
+ *
+ *  This is done before the thread allocates anything, so that (with
+ *  the usual first-touch policy) its event list, message sets and
+ *  ring buffers are allocated on its own NUMA node.
+ *
+ * @param[in] cpu	to pin the thread to.
+ * @return
+ *	- <0 on error
+ *	- the NUMA node of the CPU, or 0 if it's unknown.
+ */
+static int fr_schedule_pin(int cpu)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+	int		rcode;
+	cpu_set_t	set;
+#ifdef SYS_getcpu
+	unsigned int	my_cpu, node;
+#endif
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	rcode = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rcode != 0) {
+		fr_strerror_printf("Failed pinning thread to CPU %d: %s", cpu, fr_syserror(rcode));
+		return -1;
+	}
+
+#ifdef SYS_getcpu
+	if (syscall(SYS_getcpu, &my_cpu, &node, NULL) == 0) return node;
+#endif
+	return 0;
+#else
+	fr_strerror_printf("Pinning threads to CPUs is not supported on this system");
+	return -1;
+#endif
+}
+
 /** Initialize and run the worker thread.
  *
  * @param[in] arg the fr_schedule_worker_t
@@ -145,6 +304,7 @@ struct fr_schedule_t {
  */
 static void *fr_schedule_worker_thread(void *arg)
 {
+	int i;
 	fr_schedule_worker_t *sw = arg;
 	fr_schedule_t *sc = sw->sc;
 	fr_schedule_child_status_t status = FR_CHILD_FAIL;
@@ -153,6 +313,14 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	fr_log(sc->log, L_INFO, "Worker %d starting\n", sw->id);
 
+	if (sc->worker_cpu) {
+		sw->numa_node = fr_schedule_pin(sc->worker_cpu[sw->id % sc->num_worker_cpus]);
+		if (sw->numa_node < 0) {
+			fr_log(sc->log, L_ERR, "Worker %d - %s", sw->id, fr_strerror());
+			goto fail;
+		}
+	}
+
 	el = fr_event_list_alloc(sw, NULL, NULL);
 	if (!el) {
 		fr_log(sc->log, L_ERR, "Worker %d - Failed creating event list: %s",
@@ -166,6 +334,11 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	if (sc->steal && (fr_worker_steal_join(sw->worker, sc->steal, sw->id) < 0)) {
+		fr_log(sc->log, L_ERR, "Worker %d - Failed joining steal group: %s", sw->id, fr_strerror());
+		goto fail;
+	}
+
 	snprintf(buffer, sizeof(buffer), "thread %d - ", sw->id);
 	fr_worker_name(sw->worker, buffer);
 
@@ -180,7 +353,18 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	sw->status = FR_CHILD_RUNNING;
 
-	(void) fr_network_worker_add(sc->sn->rc, sw->worker);
+	/*
+	 *	Every network thread can send packets to every
+	 *	worker, but prefers ones on its own NUMA node.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		bool remote;
+
+		remote = (sw->numa_node >= 0) && (sc->sn[i].numa_node >= 0) &&
+			 (sw->numa_node != sc->sn[i].numa_node);
+
+		(void) fr_network_worker_add(sc->sn[i].rc, sw->worker, remote);
+	}
 
 	fr_log(sc->log, L_INFO, "Spawned async worker %d", sw->id);
 
@@ -230,7 +414,7 @@ fail:
  */
 static void *fr_schedule_network_thread(void *arg)
 {
-	TALLOC_CTX			*ctx;
+	TALLOC_CTX			*ctx = NULL;
 	fr_schedule_network_t		*sn = arg;
 	fr_schedule_t			*sc = sn->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
@@ -238,6 +422,14 @@ static void *fr_schedule_network_thread(void *arg)
 
 	fr_log(sc->log, L_INFO, "Network %d starting\n", sn->id);
 
+	if (sc->network_cpu) {
+		sn->numa_node = fr_schedule_pin(sc->network_cpu[sn->id % sc->num_network_cpus]);
+		if (sn->numa_node < 0) {
+			fr_log(sc->log, L_ERR, "Network %d - %s", sn->id, fr_strerror());
+			goto fail;
+		}
+	}
+
 	ctx = talloc_init("network %d", sn->id);
 	if (!ctx) {
 		fr_log(sc->log, L_ERR, "Network %d - Failed allocating memory", sn->id);
@@ -264,7 +456,7 @@ static void *fr_schedule_network_thread(void *arg)
 	 */
 	sem_post(&sc->semaphore);
 
-	fr_log(sc->log, L_INFO, "Spawned asycn network 0");
+	fr_log(sc->log, L_INFO, "Spawned async network %d", sn->id);
 
 	/*
 	 *	Do all of the work.
@@ -286,7 +478,7 @@ fail:
 
 	sn->status = status;
 
-	fr_log(sc->log, L_INFO, "Network exiting");
+	fr_log(sc->log, L_INFO, "Network %d exiting", sn->id);
 
 	/*
 	 *	Tell the scheduler we're done.
@@ -297,13 +489,288 @@ fail:
 }
 
 
+#ifdef HAVE_PTHREAD_H
+/** Start a worker thread.
+ *
+ *  The worker posts to the scheduler semaphore once it has either
+ *  started, or failed to start.  The caller must wait for that.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] id for the worker, unique among the running workers
+ * @return
+ *	- NULL on error
+ *	- fr_schedule_worker_t on success
+ */
+static fr_schedule_worker_t *fr_schedule_worker_spawn(fr_schedule_t *sc, int id)
+{
+	int rcode;
+	pthread_attr_t attr;
+	fr_schedule_worker_t *sw;
+
+	/*
+	 *	Create a worker "glue" structure
+	 */
+	sw = talloc_zero(NULL, fr_schedule_worker_t);
+	if (!sw) {
+		fr_log(sc->log, L_ERR, "Worker %d - Failed allocating memory", id);
+		return NULL;
+	}
+
+	sw->id = id;
+	sw->numa_node = -1;
+	sw->sc = sc;
+	sw->status = FR_CHILD_INITIALIZING;
+	fr_dlist_insert_head(&sc->workers, &sw->entry);
+
+	(void) pthread_attr_init(&attr);
+	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	rcode = pthread_create(&sw->pthread_id, &attr, fr_schedule_worker_thread, sw);
+	(void) pthread_attr_destroy(&attr);
+	if (rcode != 0) {
+		fr_log(sc->log, L_ERR, "Failed creating worker %d: %s\n", id, fr_syserror(rcode));
+		fr_dlist_remove(&sw->entry);
+		talloc_free(sw);
+		return NULL;
+	}
+
+	sc->num_workers++;
+
+	return sw;
+}
+
+/** Find the lowest worker ID which isn't in use
+ *
+ *  IDs index the steal group, so they must be less than max_workers.
+ *
+ * @param[in] sc the scheduler
+ * @return
+ *	- <0 if all IDs are in use
+ *	- the ID
+ */
+static int fr_schedule_worker_id(fr_schedule_t *sc)
+{
+	int id;
+	fr_dlist_t *entry;
+
+	for (id = 0; id < sc->max_workers; id++) {
+		for (entry = FR_DLIST_FIRST(sc->workers);
+		     entry != NULL;
+		     entry = FR_DLIST_NEXT(sc->workers, entry)) {
+			fr_schedule_worker_t *sw;
+
+			sw = fr_ptr_to_type(fr_schedule_worker_t, entry, entry);
+			if (sw->id == id) break;
+		}
+
+		if (!entry) return id;
+	}
+
+	return -1;
+}
+
+/** Add one worker to the pool, and wait for it to start.
+ *
+ * @param[in] sc the scheduler
+ */
+static void fr_schedule_worker_grow(fr_schedule_t *sc)
+{
+	int id;
+	fr_schedule_worker_t *sw;
+
+	id = fr_schedule_worker_id(sc);
+	if (id < 0) return;
+
+	sw = fr_schedule_worker_spawn(sc, id);
+	if (!sw) return;
+
+	SEM_WAIT_INTR(&sc->semaphore);
+
+	if (sw->status != FR_CHILD_RUNNING) {
+		fr_log(sc->log, L_ERR, "Worker %d failed to start", id);
+		sc->num_workers--;
+		fr_dlist_remove(&sw->entry);
+		talloc_free(sw);
+		return;
+	}
+
+	atomic_store_explicit(&sc->load_workers, sc->num_workers, memory_order_relaxed);
+
+	fr_log(sc->log, L_INFO, "Added worker %d, now %d workers", id, sc->num_workers);
+}
+
+/** Move a retiring worker towards exiting.
+ *
+ *  The network threads stop sending the worker new requests, and ask
+ *  it to close its channels.  Once it has finished with the requests
+ *  it has, it closes the channels, and hands its reply message sets
+ *  to the network threads.  Nothing else refers to the worker, so it
+ *  can then exit.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] sw the worker being retired
+ * @return
+ *	- true if the worker has exited
+ *	- false if it's still being retired
+ */
+static bool fr_schedule_worker_retire(fr_schedule_t *sc, fr_schedule_worker_t *sw)
+{
+	int i;
+	fr_worker_load_t load;
+
+	if (!sw->retiring) {
+		fr_log(sc->log, L_INFO, "Retiring idle worker %d", sw->id);
+
+		sw->retiring = fr_time();
+		for (i = 0; i < sc->num_networks; i++) {
+			(void) fr_network_worker_remove(sc->sn[i].rc, sw->worker);
+		}
+		return false;
+	}
+
+	fr_worker_load(sw->worker, &load);
+	if (load.num_channels > 0) return false;
+
+	fr_worker_exit(sw->worker);
+	SEM_WAIT_INTR(&sc->semaphore);
+
+	sc->num_workers--;
+	fr_dlist_remove(&sw->entry);
+	talloc_free(sw);
+
+	atomic_store_explicit(&sc->load_workers, sc->num_workers, memory_order_relaxed);
+
+	fr_log(sc->log, L_INFO, "Now %d workers", sc->num_workers);
+	return true;
+}
+
+/** Grow or shrink the worker pool, based on how busy the workers are.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] now the current time
+ */
+static void fr_schedule_monitor_check(fr_schedule_t *sc, fr_time_t now)
+{
+	int num_workers = 0;
+	int backlog = 0;
+	fr_time_t running = 0;
+	fr_time_t elapsed;
+	fr_dlist_t *entry, *next;
+	fr_schedule_worker_t *retiring = NULL;
+	fr_schedule_worker_t *newest = NULL;
+
+	elapsed = now - sc->checked;
+	sc->checked = now;
+
+	for (entry = FR_DLIST_FIRST(sc->workers);
+	     entry != NULL;
+	     entry = next) {
+		fr_schedule_worker_t *sw;
+		fr_worker_load_t load;
+
+		next = FR_DLIST_NEXT(sc->workers, entry);
+		sw = fr_ptr_to_type(fr_schedule_worker_t, entry, entry);
+
+		if (sw->status != FR_CHILD_RUNNING) continue;
+
+		if (sw->retiring) {
+			retiring = sw;
+			continue;
+		}
+
+		fr_worker_load(sw->worker, &load);
+
+		num_workers++;
+		backlog += load.backlog;
+		running += load.running - sw->running;
+		sw->running = load.running;
+
+		/*
+		 *	The list is in newest-first order.
+		 */
+		if (!newest) newest = sw;
+	}
+
+	/*
+	 *	Only retire one worker at a time.
+	 */
+	if (retiring) {
+		(void) fr_schedule_worker_retire(sc, retiring);
+		return;
+	}
+
+	if (!num_workers || !elapsed) return;
+
+	/*
+	 *	The workers are busy, or have messages queued up.  Add
+	 *	another one.
+	 */
+	if ((backlog > num_workers) ||
+	    ((running * 100) >= (FR_SCHEDULE_BUSY * elapsed * num_workers))) {
+		sc->quiet_since = 0;
+		if (sc->num_workers < sc->max_workers) fr_schedule_worker_grow(sc);
+		return;
+	}
+
+	/*
+	 *	The remaining workers would have plenty of spare
+	 *	capacity.  If that stays true for long enough, retire
+	 *	the newest worker.
+	 */
+	if ((num_workers <= sc->min_workers) || backlog ||
+	    ((running * 100) >= (FR_SCHEDULE_IDLE * elapsed * (num_workers - 1)))) {
+		sc->quiet_since = 0;
+		return;
+	}
+
+	if (!sc->quiet_since) {
+		sc->quiet_since = now;
+		return;
+	}
+
+	if ((now - sc->quiet_since) < FR_SCHEDULE_COOLDOWN) return;
+
+	sc->quiet_since = 0;
+	(void) fr_schedule_worker_retire(sc, newest);
+}
+
+/** Monitor the workers, and grow or shrink the pool as needed.
+ *
+ * @param[in] arg the fr_schedule_t
+ * @return NULL
+ */
+static void *fr_schedule_monitor_thread(void *arg)
+{
+	fr_schedule_t *sc = arg;
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = FR_SCHEDULE_TICK;
+
+	sc->checked = fr_time();
+
+	while (atomic_load(&sc->running)) {
+		(void) nanosleep(&ts, NULL);
+		if (!atomic_load(&sc->running)) break;
+
+		fr_schedule_monitor_check(sc, fr_time());
+	}
+
+	return NULL;
+}
+#endif	/* HAVE_PTHREAD_H */
+
 /** Create a scheduler and spawn the child threads.
  *
  * @param[in] ctx the talloc context
  * @param[in] el the event list, only for single-threaded mode.
  * @param[in] logger the destination for all logging messages
  * @param[in] max_networks the number of network threads
- * @param[in] max_workers the number of worker threads
+ * @param[in] min_workers the number of worker threads to start with.  The pool never shrinks below this.
+ * @param[in] max_workers the maximum number of worker threads.  If larger than min_workers,
+ *			  workers are added when the existing ones are busy, and retired
+ *			  when they have been idle for a while.
+ * @param[in] cpus which CPUs to run the threads on.  May be NULL.
  * @param[in] worker_thread_instantiate callback for new worker threads
  * @param[in] worker_thread_ctx context for callback
  * @return
@@ -311,7 +778,7 @@ fail:
  *	- fr_schedule_t new scheduler
  */
 fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t *logger,
-				  int max_networks, int max_workers,
+				  int max_networks, int min_workers, int max_workers, fr_schedule_cpus_t const *cpus,
 				  fr_schedule_thread_instantiate_t worker_thread_instantiate,
 				  void *worker_thread_ctx)
 {
@@ -327,7 +794,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 	 *	Single-threaded mode MUST have event list, and zero
 	 *	networks or workers
 	 */
-	if (el && (max_networks || max_workers)) {
+	if (el && (max_networks || min_workers || max_workers)) {
 		fr_strerror_printf("Cannot specify event list and networks or workers");
 		return NULL;
 	}
@@ -336,11 +803,17 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 	 *	Multi-threaded mode must NOT have an event list, and
 	 *	non-zero networks and workers.
 	 */
-	if (!el && (!max_networks || !max_workers)) {
+	if (!el && (!max_networks || !min_workers || !max_workers)) {
 		fr_strerror_printf("Must specify the number of networks and workers");
 		return NULL;
 	}
 
+	if (min_workers > max_workers) {
+		fr_strerror_printf("Minimum number of workers (%d) is larger than the maximum (%d)",
+				   min_workers, max_workers);
+		return NULL;
+	}
+
 	sc = talloc_zero(ctx, fr_schedule_t);
 	if (!sc) {
 		fr_strerror_printf("Failed allocating memory");
@@ -349,6 +822,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 
 	sc->el = el;
 	sc->max_networks = max_networks;
+	sc->min_workers = min_workers;
 	sc->max_workers = max_workers;
 	sc->num_workers = 0;
 	sc->log = logger;
@@ -356,7 +830,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 	sc->worker_thread_instantiate = worker_thread_instantiate;
 	sc->worker_instantiate_ctx = worker_thread_ctx;
 
-	sc->running = true;
+	atomic_init(&sc->running, true);
 
 	/*
 	 *	If we're single-threaded, create network / worker, and insert them into the event loop.
@@ -376,12 +850,28 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 			return NULL;
 		}
 
-		(void) fr_network_worker_add(sc->single_network, sc->single_worker);
+		(void) fr_network_worker_add(sc->single_network, sc->single_worker, false);
 		fr_log(sc->log, L_DBG, "Scheduler created in single-threaded mode");
 		return sc;
 	}
 
 #ifdef HAVE_PTHREAD_H
+	if (cpus && cpus->network) {
+		sc->num_network_cpus = fr_schedule_cpus_parse(sc, &sc->network_cpu, cpus->network);
+		if (sc->num_network_cpus < 0) {
+			talloc_free(sc);
+			return NULL;
+		}
+	}
+
+	if (cpus && cpus->worker) {
+		sc->num_worker_cpus = fr_schedule_cpus_parse(sc, &sc->worker_cpu, cpus->worker);
+		if (sc->num_worker_cpus < 0) {
+			talloc_free(sc);
+			return NULL;
+		}
+	}
+
 	(void) pthread_attr_init(&attr);
 	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
@@ -398,57 +888,61 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 	}
 
 	/*
-	 *	Create the network thread first.
-	 *	@todo - create multiple network threads
+	 *	Create the network threads first, so that the workers
+	 *	can add themselves to all of them.
 	 */
-	sc->sn = talloc_zero(sc, fr_schedule_network_t);
-	sc->sn->sc = sc;
-	sc->sn->id = 0;
-
-	rcode = pthread_create(&sc->sn->pthread_id, &attr, fr_schedule_network_thread, sc->sn);
-	if (rcode != 0) {
-		fr_strerror_printf("Failed creating network thread: %s", fr_syserror(errno));
+	sc->sn = talloc_zero_array(sc, fr_schedule_network_t, sc->max_networks);
+	if (!sc->sn) {
+		fr_strerror_printf("Failed allocating memory");
 		goto fail;
 	}
 
-	SEM_WAIT_INTR(&sc->semaphore);
-	if (sc->sn->status != FR_CHILD_RUNNING) {
-	fail:
-		TALLOC_FREE(sc->sn);
-		fr_schedule_destroy(sc);
-		return NULL;
-	}
+	for (i = 0; i < sc->max_networks; i++) {
+		fr_schedule_network_t *sn = &sc->sn[i];
 
-	/*
-	 *	Create all of the workers.
-	 */
-	for (i = 0; i < sc->max_workers; i++) {
-		fr_schedule_worker_t *sw;
+		sn->sc = sc;
+		sn->id = i;
+		sn->numa_node = -1;
+		sn->status = FR_CHILD_INITIALIZING;
 
-		fr_log(sc->log, L_DBG, "Creating %d/%d workers\n", i, sc->max_workers);
+		rcode = pthread_create(&sn->pthread_id, &attr, fr_schedule_network_thread, sn);
+		if (rcode != 0) {
+			fr_strerror_printf("Failed creating network thread %d: %s", i, fr_syserror(errno));
+			goto fail;
+		}
 
 		/*
-		 *	Create a worker "glue" structure
+		 *	The thread either starts, or exits.  Either
+		 *	way, we're told about it.
 		 */
-		sw = talloc(NULL, fr_schedule_worker_t);
-		if (!sw) {
-			fr_log(sc->log, L_ERR, "Worker %d - Failed allocating memory", i);
-			break;
+		sc->num_networks++;
+
+		SEM_WAIT_INTR(&sc->semaphore);
+		if (sn->status != FR_CHILD_RUNNING) {
+		fail:
+			fr_schedule_destroy(sc);
+			return NULL;
 		}
+	}
 
-		sw->id = i;
-		sw->sc = sc;
-		sw->status = FR_CHILD_INITIALIZING;
-		fr_dlist_insert_head(&sc->workers, &sw->entry);
+	/*
+	 *	Idle workers can take work from busy ones.  The group
+	 *	is freed along with the scheduler, after all of the
+	 *	workers have exited.
+	 */
+	if (sc->max_workers > 1) {
+		sc->steal = fr_worker_steal_create(sc, sc->max_workers);
+		if (!sc->steal) goto fail;
+	}
 
-		rcode = pthread_create(&sw->pthread_id, &attr, fr_schedule_worker_thread, sw);
-		if (rcode != 0) {
-			fr_log(sc->log, L_ERR, "Failed creating worker %d: %s\n", i, fr_syserror(errno));
-			talloc_free(sw);
-			break;
-		}
+	/*
+	 *	Create the initial workers.  The monitor thread
+	 *	creates more as needed.
+	 */
+	for (i = 0; i < sc->min_workers; i++) {
+		fr_log(sc->log, L_DBG, "Creating %d/%d workers\n", i, sc->min_workers);
 
-		sc->num_workers++;
+		if (!fr_schedule_worker_spawn(sc, i)) break;
 	}
 
 	/*
@@ -484,14 +978,25 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t
 	/*
 	 *	Failed to start some workers, refuse to do anything!
 	 */
-	if (sc->num_workers < sc->max_workers) {
-		fr_schedule_destroy(sc);
-		sc = NULL;
+	if (sc->num_workers < sc->min_workers) goto fail;
+
+	atomic_init(&sc->load_workers, sc->num_workers);
+
+	/*
+	 *	Grow and shrink the worker pool as the load changes.
+	 */
+	if (sc->min_workers < sc->max_workers) {
+		rcode = pthread_create(&sc->monitor_id, NULL, fr_schedule_monitor_thread, sc);
+		if (rcode != 0) {
+			fr_strerror_printf("Failed creating monitor thread: %s", fr_syserror(rcode));
+			goto fail;
+		}
+		sc->monitor_running = true;
 	}
 #endif
 
-	if (sc) fr_log(sc->log, L_INFO, "Scheduler created successfully with %d networks and %d workers",
-		       sc->max_networks, sc->num_workers);
+	fr_log(sc->log, L_INFO, "Scheduler created successfully with %d networks and %d workers (max %d)",
+	       sc->max_networks, sc->num_workers, sc->max_workers);
 
 	return sc;
 }
@@ -508,7 +1013,7 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 	int i;
 	fr_schedule_worker_t *sw;
 
-	sc->running = false;
+	atomic_store(&sc->running, false);
 
 #ifdef HAVE_PTHREAD_H
 	fr_dlist_t	*entry, *next;
@@ -524,7 +1029,13 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		goto done;
 	}
 
-	rad_assert(sc->num_workers > 0);
+	/*
+	 *	Stop adding and removing workers.
+	 */
+	if (sc->monitor_running) {
+		(void) pthread_join(sc->monitor_id, NULL);
+		sc->monitor_running = false;
+	}
 
 	/*
 	 *	Signal all of the workers to exit.
@@ -563,10 +1074,12 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 	}
 
 	/*
-	 *	If the network thread is running, tell it to exit.
+	 *	Tell the running network threads to exit.
 	 */
-	if (sc->sn->status == FR_CHILD_RUNNING) {
-		fr_network_exit(sc->sn->rc);
+	for (i = 0; i < sc->num_networks; i++) {
+		if (sc->sn[i].status != FR_CHILD_RUNNING) continue;
+
+		fr_network_exit(sc->sn[i].rc);
 		SEM_WAIT_INTR(&sc->semaphore);
 	}
 
@@ -586,7 +1099,42 @@ done:
 	return 0;
 }
 
+/** Return the number of network threads in a scheduler.
+ *
+ *  Applications which open one socket per network thread (e.g. with
+ *  SO_REUSEPORT) should open this many sockets, and add each one via
+ *  fr_schedule_socket_add().
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads.
+ */
+int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return sc->num_networks;
+}
+
+/** Return the number of worker threads in a scheduler.
+ *
+ *  The monitor thread may add or retire workers at any time, so the
+ *  value may be slightly out of date.
+ *
+ * @param[in] sc the scheduler
+ * @return the number of worker threads.
+ */
+int fr_schedule_num_workers(fr_schedule_t *sc)
+{
+	if (sc->el) return 1;
+
+	return atomic_load_explicit(&sc->load_workers, memory_order_relaxed);
+}
+
 /** Add a socket to a scheduler.
+ *
+ *  Sockets are assigned to network threads in round-robin order.  So
+ *  N consecutive calls will add the sockets to N different network
+ *  threads, where N is the value returned by fr_schedule_num_networks().
  *
  * @param[in] sc the scheduler
  * @param[in] io the ctx and callbacks for the transport.
@@ -603,10 +1151,72 @@ fr_network_t *fr_schedule_socket_add(fr_schedule_t *sc, fr_listen_t const *io)
 	if (sc->el) {
 		nr = sc->single_network;
 	} else {
-		nr = sc->sn->rc;
+		nr = sc->sn[sc->next_network].rc;
+		sc->next_network = (sc->next_network + 1) % sc->num_networks;
 	}
 
 	if (fr_network_socket_add(nr, io) < 0) return NULL;
 
 	return nr;
 }
+
+/** Ask every network to write its debug information
+ *
+ *  Each network writes to fp from its own thread, via
+ *  fr_network_debug().  The caller must not close fp until all of
+ *  the networks have serviced the request.
+ *
+ * @param[in] sc the scheduler
+ * @param[in] fp where the debug output is written
+ * @return
+ *	- <0 on error
+ *	- the number of networks which were asked.
+ */
+int fr_schedule_debug(fr_schedule_t *sc, FILE *fp)
+{
+	int i, num = 0;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) return (fr_network_debug_request(sc->single_network, fp) < 0) ? -1 : 1;
+
+	for (i = 0; i < sc->num_networks; i++) {
+		if (!sc->sn[i].rc) continue;
+
+		if (fr_network_debug_request(sc->sn[i].rc, fp) < 0) return -1;
+		num++;
+	}
+
+	return num;
+}
+
+/** Ask every network for its predicted processing costs
+ *
+ *  Each network runs the callback from its own thread, once for each
+ *  (listener, packet code) it has seen replies for, and then once with
+ *  listen == NULL.  See fr_network_stats_request().
+ *
+ * @param[in] sc the scheduler
+ * @param[in] callback to call with the statistics
+ * @param[in] ctx for the callback
+ * @return
+ *	- <0 on error
+ *	- the number of networks which were asked.
+ */
+int fr_schedule_stats(fr_schedule_t *sc, fr_network_stats_callback_t callback, void *ctx)
+{
+	int i, num = 0;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) return (fr_network_stats_request(sc->single_network, callback, ctx) < 0) ? -1 : 1;
+
+	for (i = 0; i < sc->num_networks; i++) {
+		if (!sc->sn[i].rc) continue;
+
+		if (fr_network_stats_request(sc->sn[i].rc, callback, ctx) < 0) return -1;
+		num++;
+	}
+
+	return num;
+}
@@ -36,14 +36,35 @@ extern "C" {
 typedef struct fr_schedule_t fr_schedule_t;
 typedef int (*fr_schedule_thread_instantiate_t)(void *ctx, fr_event_list_t *el);
 
-fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t *log, int max_inputs, int max_workers,
+/**
+ *  Which CPUs the threads run on.
+ *
+ *  Each list is of the form "0-3,8,10-11".  Network thread N is
+ *  pinned to the Nth CPU in its list, and worker N to the Nth CPU in
+ *  its list, wrapping around if there are more threads than CPUs.
+ *  A NULL list means that the threads are not pinned.
+ */
+typedef struct fr_schedule_cpus_t {
+	char const	*network;	//!< CPUs for the network threads
+	char const	*worker;	//!< CPUs for the worker threads
+} fr_schedule_cpus_t;
+
+fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t *log, int max_inputs,
+					    int min_workers, int max_workers, fr_schedule_cpus_t const *cpus,
 					    fr_schedule_thread_instantiate_t worker_thread_instantiate,
 					    void *worker_thread_ctx) CC_HINT(nonnull(3));
 /* schedulers are async, so there's no fr_schedule_run() */
 int			fr_schedule_destroy(fr_schedule_t *sc);
 
+int			fr_schedule_num_networks(fr_schedule_t const *sc) CC_HINT(nonnull);
+int			fr_schedule_num_workers(fr_schedule_t *sc) CC_HINT(nonnull);
+
 fr_network_t		*fr_schedule_socket_add(fr_schedule_t *sc, fr_listen_t const *io) CC_HINT(nonnull);
 
+int			fr_schedule_debug(fr_schedule_t *sc, FILE *fp) CC_HINT(nonnull);
+int			fr_schedule_stats(fr_schedule_t *sc, fr_network_stats_callback_t callback,
+					  void *ctx) CC_HINT(nonnull(1,2));
+
 #ifdef __cplusplus
 }
 #endif
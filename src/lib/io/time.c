@@ -26,6 +26,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 #include <freeradius-devel/io/time.h>
+#include <freeradius-devel/threads.h>
 
 /*
  *	Avoid too many ifdef's later in the code.
@@ -47,6 +48,67 @@ USES_APPLE_DEPRECATED_API
 #  include <mach/mach_time.h>
 #endif
 
+/*
+ *	On x86_64 we can read the TSC directly, which is a great deal
+ *	cheaper than clock_gettime(), even via the vDSO.  But we only
+ *	do that when the TSC ticks at a constant rate, and the kernel
+ *	trusts it enough to use it as its own clock source.
+ *
+ *	A short calibration can be off by a few parts per million,
+ *	which adds up over hours.  So once every TSC_CHECK, the TSC is
+ *	compared with CLOCK_MONOTONIC.  If they're close, the rate is
+ *	re-calculated over the whole time since the server started,
+ *	and adjusted so that any difference is smoothed out over the
+ *	next TSC_CHECK.  If they're too far apart, we stop trusting
+ *	the TSC, and use clock_gettime() from then on.
+ *
+ *	The calibration is shared by all threads.  It's protected by
+ *	a sequence count, and each thread keeps its own copy, so that
+ *	fr_time() only checks whether the copy is stale.
+ */
+#if defined(HAVE_CLOCK_GETTIME) && defined(__x86_64__) && defined(__SIZEOF_INT128__) && (defined(__GNUC__) || defined(__clang__))
+#  define HAVE_TSC
+#  include <cpuid.h>
+#  include <string.h>
+#  include <x86intrin.h>
+
+#  ifdef HAVE_STDATOMIC_H
+#    include <stdatomic.h>
+#  else
+#    include <freeradius-devel/stdatomic.h>
+#  endif
+
+#  define TSC_CALIBRATE	(NANOSEC / 100)		//!< how long we spend calibrating the TSC
+#  define TSC_CHECK	(NANOSEC)		//!< how often we compare the TSC with CLOCK_MONOTONIC
+#  define TSC_MAX_DRIFT	(NANOSEC / 1000)	//!< beyond this, the TSC is not used
+#  define TSC_SHIFT	(32)
+
+/**
+ *  How to convert the TSC to fr_time_t.
+ */
+typedef struct fr_time_tsc_t {
+	uint64_t		seq;		//!< of the shared calibration this was copied from
+	uint64_t		mult;		//!< nanoseconds per tick, as a 32.32 fixed point number.
+						//!< 0 if the TSC is not used.
+	uint64_t		started;	//!< TSC value at the last calibration
+	fr_time_t		when;		//!< fr_time() at the last calibration
+	fr_time_t		check;		//!< when the calibration should next be checked
+	fr_time_t		offset;		//!< added to CLOCK_MONOTONIC if the TSC is not used
+} fr_time_tsc_t;
+
+static atomic_uint_fast64_t tsc_seq;		//!< odd while the calibration is being changed
+static atomic_uint_fast64_t tsc_mult;
+static atomic_uint_fast64_t tsc_started;
+static atomic_uint_fast64_t tsc_when;
+static atomic_uint_fast64_t tsc_offset;
+static atomic_bool tsc_busy;			//!< a thread is checking the calibration
+
+static uint64_t tsc_base;			//!< TSC value at the start of calibration
+static fr_time_t tsc_base_when;			//!< CLOCK_MONOTONIC at the start of calibration
+
+static _Thread_local fr_time_tsc_t tsc_local;	//!< this thread's copy of the calibration
+#endif
+
 static struct timeval tm_started = { 0, 0};
 
 #ifdef HAVE_CLOCK_GETTIME
@@ -57,6 +119,218 @@ static mach_timebase_info_data_t timebase;
 static uint64_t abs_started;
 #endif
 
+static _Thread_local fr_time_t fr_time_now;
+
+#ifdef HAVE_CLOCK_GETTIME
+/** Read CLOCK_MONOTONIC, relative to ts_started.
+ *
+ *  On Linux this goes via the vDSO, so it does not enter the kernel.
+ */
+static inline fr_time_t fr_time_monotonic(void)
+{
+	fr_time_t now;
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (ts.tv_nsec < ts_started.tv_nsec) {
+		ts.tv_sec--;
+		ts.tv_nsec += NANOSEC;
+	}
+
+	ts.tv_sec = ts.tv_sec - ts_started.tv_sec;
+	ts.tv_nsec = ts.tv_nsec - ts_started.tv_nsec;
+
+	now = ts.tv_sec * NANOSEC;
+	now += ts.tv_nsec;
+
+	return now;
+}
+#endif
+
+#ifdef HAVE_TSC
+/** Check whether the TSC is usable as a clock source.
+ *
+ * @return
+ *	- true if the TSC is invariant, and the kernel is using it.
+ *	- false otherwise.
+ */
+static bool fr_time_tsc_usable(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+#ifdef __linux__
+	FILE *fp;
+	char buffer[32];
+#endif
+
+	/*
+	 *	CPUID 0x80000007, EDX bit 8 is "invariant TSC".  The
+	 *	TSC then ticks at a constant rate, regardless of
+	 *	frequency scaling or C-states.
+	 */
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+	if ((edx & (1 << 8)) == 0) return false;
+
+#ifdef __linux__
+	/*
+	 *	The kernel checks that the TSC is synchronized across
+	 *	all CPUs before using it.  If it has decided not to,
+	 *	(or we're in a VM with a paravirtual clock), then we
+	 *	don't either.
+	 */
+	fp = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+	if (!fp) return false;
+
+	if (!fgets(buffer, sizeof(buffer), fp)) {
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	if (strncmp(buffer, "tsc", 3) != 0) return false;
+#endif
+
+	return true;
+}
+
+/** Publish a new calibration to all threads.
+ *
+ *  Only one thread may call this at a time.
+ */
+static void fr_time_tsc_publish(uint64_t mult, uint64_t started, fr_time_t when, fr_time_t offset)
+{
+	uint64_t seq;
+
+	seq = atomic_load_explicit(&tsc_seq, memory_order_relaxed);
+	atomic_store_explicit(&tsc_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	atomic_store_explicit(&tsc_mult, mult, memory_order_relaxed);
+	atomic_store_explicit(&tsc_started, started, memory_order_relaxed);
+	atomic_store_explicit(&tsc_when, when, memory_order_relaxed);
+	atomic_store_explicit(&tsc_offset, offset, memory_order_relaxed);
+
+	atomic_store_explicit(&tsc_seq, seq + 2, memory_order_release);
+}
+
+/** Update this thread's copy of the calibration.
+ *
+ */
+static void fr_time_tsc_load(void)
+{
+	uint64_t seq;
+
+	for (;;) {
+		seq = atomic_load_explicit(&tsc_seq, memory_order_acquire);
+		if (seq & 1) continue;
+
+		tsc_local.mult = atomic_load_explicit(&tsc_mult, memory_order_relaxed);
+		tsc_local.started = atomic_load_explicit(&tsc_started, memory_order_relaxed);
+		tsc_local.when = atomic_load_explicit(&tsc_when, memory_order_relaxed);
+		tsc_local.offset = atomic_load_explicit(&tsc_offset, memory_order_relaxed);
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&tsc_seq, memory_order_relaxed) == seq) break;
+	}
+
+	tsc_local.seq = seq;
+	tsc_local.check = tsc_local.when + TSC_CHECK;
+}
+
+/** Convert a TSC value to fr_time_t, using this thread's calibration.
+ *
+ */
+static inline fr_time_t fr_time_tsc(uint64_t tsc)
+{
+	return tsc_local.when + (fr_time_t) (((unsigned __int128) (tsc - tsc_local.started) * tsc_local.mult) >> TSC_SHIFT);
+}
+
+/** Compare the TSC with CLOCK_MONOTONIC, and re-calibrate it, or stop using it.
+ *
+ *  If another thread is already doing this, we do nothing, and pick
+ *  up the new calibration later.
+ */
+static void fr_time_tsc_check(void)
+{
+	uint64_t	t1, t2, tsc, mult;
+	fr_time_t	mono, now;
+	int64_t		drift;
+
+	if (atomic_exchange_explicit(&tsc_busy, true, memory_order_acquire)) return;
+
+	fr_time_tsc_load();
+
+	/*
+	 *	Someone else checked it while we were getting here.
+	 */
+	if (!tsc_local.mult || (fr_time_tsc(__rdtsc()) < tsc_local.check)) goto done;
+
+	/*
+	 *	Read CLOCK_MONOTONIC between two reads of the TSC, and
+	 *	assume it was read half way between them.
+	 */
+	t1 = __rdtsc();
+	mono = fr_time_monotonic();
+	t2 = __rdtsc();
+	tsc = t1 + ((t2 - t1) / 2);
+
+	now = fr_time_tsc(tsc);
+	drift = (int64_t) (now - mono);
+
+	/*
+	 *	The TSC is too far out.  Use CLOCK_MONOTONIC from now
+	 *	on.  If the TSC was ahead, keep adding the difference,
+	 *	so that fr_time() doesn't go backwards.
+	 */
+	if ((drift > TSC_MAX_DRIFT) || (drift < -TSC_MAX_DRIFT)) {
+		fr_time_tsc_publish(0, 0, 0, (drift > 0) ? (fr_time_t) drift : 0);
+		goto done;
+	}
+
+	/*
+	 *	The rate over the whole time since calibration, sped
+	 *	up or slowed down so that we're back in step with
+	 *	CLOCK_MONOTONIC by the next check.
+	 */
+	mult = (((unsigned __int128) (mono - tsc_base_when)) << TSC_SHIFT) / (tsc - tsc_base);
+	mult = ((unsigned __int128) mult * (uint64_t) (TSC_CHECK - drift)) / TSC_CHECK;
+
+	fr_time_tsc_publish(mult, tsc, now, 0);
+
+done:
+	atomic_store_explicit(&tsc_busy, false, memory_order_release);
+	fr_time_tsc_load();
+}
+
+/** Calibrate the TSC against CLOCK_MONOTONIC.
+ *
+ *  We spin for TSC_CALIBRATE nanoseconds, and compare the number of
+ *  ticks with the number of nanoseconds which have passed.
+ */
+static void fr_time_tsc_calibrate(void)
+{
+	uint64_t tsc_start, tsc_end;
+	fr_time_t start, end;
+
+	if (!fr_time_tsc_usable()) return;
+
+	start = fr_time_monotonic();
+	tsc_start = __rdtsc();
+
+	do {
+		end = fr_time_monotonic();
+		tsc_end = __rdtsc();
+	} while ((end - start) < TSC_CALIBRATE);
+
+	if (tsc_end <= tsc_start) return;
+
+	tsc_base = tsc_start;
+	tsc_base_when = start;
+
+	fr_time_tsc_publish(((end - start) << TSC_SHIFT) / (tsc_end - tsc_start), tsc_end, end, 0);
+}
+#endif
+
 /**  Initialize the local time.
  *
  *  MUST be called when the program starts.  MUST NOT be called after
@@ -73,7 +347,13 @@ int fr_time_start(void)
 	(void) gettimeofday(&tm_started, NULL);
 
 #ifdef HAVE_CLOCK_GETTIME
-	return clock_gettime(CLOCK_MONOTONIC, &ts_started);
+	if (clock_gettime(CLOCK_MONOTONIC, &ts_started) < 0) return -1;
+
+#ifdef HAVE_TSC
+	fr_time_tsc_calibrate();
+#endif
+
+	return 0;
 
 #else  /* __MACH__ is defined */
 	mach_timebase_info(&timebase);
@@ -83,6 +363,22 @@ int fr_time_start(void)
 #endif
 }
 
+/** Return the name of the clock source used by fr_time()
+ *
+ */
+char const *fr_time_source(void)
+{
+#ifdef HAVE_TSC
+	if (atomic_load_explicit(&tsc_mult, memory_order_relaxed)) return "tsc";
+#endif
+
+#ifdef HAVE_CLOCK_GETTIME
+	return "clock_gettime";
+#else
+	return "mach_absolute_time";
+#endif
+}
+
 
 /** Return a relative time since the server ts_started.
  *
@@ -94,23 +390,22 @@ int fr_time_start(void)
 fr_time_t fr_time(void)
 {
 #ifdef HAVE_CLOCK_GETTIME
-	fr_time_t now;
-	struct timespec ts;
+#ifdef HAVE_TSC
+	if (atomic_load_explicit(&tsc_seq, memory_order_acquire) != tsc_local.seq) fr_time_tsc_load();
 
-	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (tsc_local.mult) {
+		fr_time_t now = fr_time_tsc(__rdtsc());
 
-	if (ts.tv_nsec < ts_started.tv_nsec) {
-		ts.tv_sec--;
-		ts.tv_nsec += NANOSEC;
-	}
+		if (now < tsc_local.check) return now;
 
-	ts.tv_sec = ts.tv_sec - ts_started.tv_sec;
-	ts.tv_nsec = ts.tv_nsec - ts_started.tv_nsec;
-
-	now = ts.tv_sec * NANOSEC;
-	now += ts.tv_nsec;
+		fr_time_tsc_check();
+		if (tsc_local.mult) return fr_time_tsc(__rdtsc());
+	}
 
-	return now;
+	return fr_time_monotonic() + tsc_local.offset;
+#else
+	return fr_time_monotonic();
+#endif
 
 #else  /* __MACH__ is defined */
 
@@ -123,6 +418,39 @@ fr_time_t fr_time(void)
 #endif
 }
 
+/** Update the cached time for this thread, and return it.
+ *
+ *  Each event loop runs in its own thread, and should call this
+ *  once per pass through the loop.
+ *
+ * @returns fr_time_t the current time.
+ */
+fr_time_t fr_time_sync(void)
+{
+	fr_time_now = fr_time();
+
+	return fr_time_now;
+}
+
+/** Return the time as of the last call to fr_time_sync() in this thread.
+ *
+ *  This is much cheaper than fr_time(), but is only as accurate as
+ *  the last pass through the event loop.  It should be used where
+ *  we need a timestamp, but don't care about the precise time.
+ *
+ *  Threads which never call fr_time_sync() (e.g. an event loop
+ *  driven by the caller in single-threaded mode) get the current
+ *  time, as there is nothing to keep the cached time up to date.
+ *
+ * @returns fr_time_t the cached time.
+ */
+fr_time_t fr_time_cached(void)
+{
+	if (!fr_time_now) return fr_time();
+
+	return fr_time_now;
+}
+
 /** Convert a fr_time_t to a struct timeval.
  *
  * @param[out] tv the timeval to update
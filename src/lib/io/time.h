@@ -62,7 +62,9 @@ typedef struct fr_dlist_t {
  *  same fr_time_t to update the threads tracking structure.
  *
  *  While fr_time() is fast, it is also called very often.  We should
- *  therefore be careful to call it only when necessary.
+ *  therefore be careful to call it only when necessary.  Where a
+ *  timestamp from the current pass through the event loop is good
+ *  enough, use fr_time_cached() instead.
  */
 typedef struct fr_time_tracking_t {
 	fr_time_t	when;			//!< last time we changed a field
@@ -121,7 +123,10 @@ static inline void fr_dlist_remove(fr_dlist_t *entry)
 #define FR_DLIST_TAIL(head) (head.prev == &head) ? NULL : head.prev
 
 int fr_time_start(void);
+char const *fr_time_source(void);
 fr_time_t fr_time(void);
+fr_time_t fr_time_sync(void);
+fr_time_t fr_time_cached(void);
 void fr_time_to_timeval(struct timeval *tv, fr_time_t when) CC_HINT(nonnull);
 
 void fr_time_tracking_start(fr_time_tracking_t *tt, fr_time_t when) CC_HINT(nonnull);
@@ -25,62 +25,243 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/io/track.h>
-#include <freeradius-devel/rbtree.h>
+#include <freeradius-devel/hash.h>
 #include <freeradius-devel/rad_assert.h>
 
+#define FR_TRACKING_NUM_SLOTS	(1024)		//!< initial size of the hash table
+#define FR_TRACKING_SLAB_SIZE	(256)		//!< minimum number of entries allocated at once
+#define FR_TRACKING_MAX_REPLY	(64 * 1024 * 1024)	//!< maximum bytes of cached replies
+
+/**
+ *  One slot in the hash table for unconnected sockets.
+ *
+ *  We cache the hash in the slot, so that probing doesn't need to
+ *  touch the entries.
+ */
+typedef struct fr_tracking_slot_t {
+	uint32_t		hash;		//!< of the entry
+	fr_tracking_entry_t	*entry;		//!< NULL if the slot is empty
+} fr_tracking_slot_t;
+
 /**
  *  RADIUS-specific tracking table.
  *
- *  It's a fixed-size array of 256 entries, indexed by ID.
+ *  For connected sockets, it's a fixed-size array of 256 entries
+ *  per packet code, indexed by ID.
+ *
+ *  For unconnected sockets, it's an open addressing hash table
+ *  (with linear probing), keyed by code, ID, and src/dst
+ *  information.  The entries are allocated from slabs, and are
+ *  kept on a free list when not in use.
  *
- *  @todo add a "reply" heap / list, ordered by when we need to
- *  clean up the replies.  The heap should contain nothing more than
- *  the time and the ID of the packet which needs cleaning up.
+ *  Entries which have a reply are kept on an expiry list, ordered by
+ *  the time the reply was sent.  The total size of the cached
+ *  replies is bounded.  When it's exceeded, the oldest entries are
+ *  deleted.
  *
  *  @todo allow for Request Authenticator to be used as part of the
- *  identifier.  With provisions for which attribute is used, and a
- *  slab allocator, as we can now have more than 256 packets
- *  outstanding.
+ *  identifier.  With provisions for which attribute is used, as we
+ *  can now have more than 256 packets outstanding.
  */
 struct fr_tracking_t {
 	int			num_entries;	//!< number of used entries.
 
 	size_t			src_dst_size;	//!< size of per-packet src/dst information
+	size_t			entry_size;	//!< size of an entry, including src/dst information
 
-	rbtree_t		*tree;		//!< for unconnected sockets
+	uint32_t		num_slots;	//!< size of the hash table.  Always a power of 2.
+	fr_tracking_slot_t	*slots;		//!< for unconnected sockets
+
+	uint32_t		num_allocated;	//!< number of entries in all of the slabs
+	fr_dlist_t		free;		//!< entries which aren't in use
+
+	fr_dlist_t		expire;		//!< entries with a reply, oldest first
+	size_t			reply_size;	//!< total size of cached replies
+	size_t			max_reply_size;	//!< maximum size of cached replies
+
+	uint64_t		num_lookups;	//!< number of hash table lookups
+	uint64_t		num_probes;	//!< number of slots checked during lookups
+	uint64_t		num_evicted;	//!< entries deleted to make room for new replies
 
 	fr_tracking_entry_t	*codes[];
 };
 
 
-static int entry_cmp(void const *one, void const *two)
+/** Hash code, ID, and src/dst information.
+ *
+ *  But NOT the Request Authenticator.
+ */
+static inline uint32_t entry_hash(fr_tracking_t const *ft, uint8_t const *packet, void const *src_dst)
 {
-	fr_tracking_entry_t const *a = one;
-	fr_tracking_entry_t const *b = two;
+	return fr_hash_update(src_dst, ft->src_dst_size, fr_hash(packet, 2));
+}
+
+/** Find an entry in the hash table
+ *
+ */
+static fr_tracking_entry_t *slot_find(fr_tracking_t *ft, uint32_t hash, uint8_t const *packet, void const *src_dst)
+{
+	uint32_t i, mask;
+
+	mask = ft->num_slots - 1;
+	ft->num_lookups++;
 
 	/*
-	 *	Check Code and Identifier.
-	 *
-	 *	But NOT the Request Authenticator.
+	 *	The table is never full, so this always terminates.
 	 */
-	if (a->data[0] < b->data[0]) return -1;
-	if (a->data[0] > b->data[0]) return +1;
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		fr_tracking_entry_t *entry = ft->slots[i].entry;
+
+		ft->num_probes++;
+
+		if (!entry) return NULL;
+
+		if (ft->slots[i].hash != hash) continue;
+
+		if ((entry->data[0] == packet[0]) &&
+		    (entry->data[1] == packet[1]) &&
+		    (memcmp(entry->src_dst, src_dst, ft->src_dst_size) == 0)) return entry;
+	}
+}
+
+/** Put an entry into the first free slot for its hash.
+ *
+ */
+static void slot_insert(fr_tracking_slot_t *slots, uint32_t num_slots, fr_tracking_entry_t *entry)
+{
+	uint32_t i, mask;
+
+	mask = num_slots - 1;
+
+	for (i = entry->hash & mask; slots[i].entry != NULL; i = (i + 1) & mask) {
+		/* nothing */
+	}
+
+	slots[i].hash = entry->hash;
+	slots[i].entry = entry;
+}
+
+/** Remove an entry from the hash table
+ *
+ *  We don't use tombstones.  Instead, any entries after the deleted
+ *  one which would have been placed in its slot are shifted back.
+ */
+static void slot_delete(fr_tracking_t *ft, fr_tracking_entry_t *entry)
+{
+	uint32_t i, j, k, mask;
+
+	mask = ft->num_slots - 1;
+
+	for (i = entry->hash & mask; ft->slots[i].entry != entry; i = (i + 1) & mask) {
+		if (!rad_cond_assert(ft->slots[i].entry != NULL)) return;
+	}
+
+	for (j = (i + 1) & mask; ft->slots[j].entry != NULL; j = (j + 1) & mask) {
+		k = ft->slots[j].hash & mask;
+
+		/*
+		 *	The entry at "j" is where it should be, if its
+		 *	home slot "k" is cyclically within (i, j].
+		 */
+		if (i <= j) {
+			if ((i < k) && (k <= j)) continue;
+		} else {
+			if ((i < k) || (k <= j)) continue;
+		}
 
-	if (a->data[1] < b->data[1]) return -1;
-	if (a->data[1] > b->data[1]) return +1;
+		ft->slots[i] = ft->slots[j];
+		i = j;
+	}
+
+	ft->slots[i].entry = NULL;
+}
+
+/** Double the size of the hash table
+ *
+ */
+static int slots_grow(fr_tracking_t *ft)
+{
+	uint32_t i, num_slots;
+	fr_tracking_slot_t *slots;
+
+	num_slots = ft->num_slots * 2;
+
+	slots = talloc_zero_array(ft, fr_tracking_slot_t, num_slots);
+	if (!slots) return -1;
+
+	for (i = 0; i < ft->num_slots; i++) {
+		if (!ft->slots[i].entry) continue;
+
+		slot_insert(slots, num_slots, ft->slots[i].entry);
+	}
+
+	talloc_free(ft->slots);
+	ft->slots = slots;
+	ft->num_slots = num_slots;
+
+	return 0;
+}
+
+/** Get an unused entry, allocating a new slab if necessary.
+ *
+ */
+static fr_tracking_entry_t *entry_alloc(fr_tracking_t *ft)
+{
+	fr_dlist_t *head;
+
+	head = FR_DLIST_FIRST(ft->free);
+	if (!head) {
+		uint32_t i, num;
+		size_t align;
+		uint8_t *slab;
+
+		align = sizeof(fr_tracking_entry_t);
+		align += 15;
+		align &= ~(15);
+
+		/*
+		 *	Double the number of entries each time, so
+		 *	that the number of slabs stays small.
+		 */
+		num = ft->num_allocated;
+		if (num < FR_TRACKING_SLAB_SIZE) num = FR_TRACKING_SLAB_SIZE;
+
+		slab = talloc_zero_size(ft, num * ft->entry_size);
+		if (!slab) return NULL;
+
+		for (i = 0; i < num; i++) {
+			fr_tracking_entry_t *entry = (fr_tracking_entry_t *) (slab + (i * ft->entry_size));
+
+			entry->ft = ft;
+			entry->src_dst = ((uint8_t *) entry) + align;
+			entry->src_dst_size = ft->src_dst_size;
+			fr_dlist_insert_tail(&ft->free, &entry->list);
+		}
+
+		ft->num_allocated += num;
+		head = FR_DLIST_FIRST(ft->free);
+	}
+
+	fr_dlist_remove(head);
 
-	return memcmp(a->src_dst, b->src_dst, a->src_dst_size);
+	return fr_ptr_to_type(fr_tracking_entry_t, list, head);
 }
 
-/** Free one entry.
+/** Free the reply for an entry, and take it off of the expiry list
  *
- *  @todo - use a slab allocator.
  */
-static void entry_free(void *data)
+static void entry_reply_clear(fr_tracking_t *ft, fr_tracking_entry_t *entry)
 {
-	fr_tracking_entry_t *entry = data;
+	if (entry->list.next != &entry->list) fr_dlist_remove(&entry->list);
 
-	talloc_free(entry);
+	if (entry->reply) {
+		ft->reply_size -= entry->reply_len;
+		talloc_const_free(entry->reply);
+		entry->reply = NULL;
+	}
+
+	entry->reply_len = 0;
+	entry->reply_time = 0;
 }
 
 
@@ -102,7 +283,7 @@ static void entry_free(void *data)
 fr_tracking_t *fr_radius_tracking_create(TALLOC_CTX *ctx, size_t src_dst_size,
 					 bool const allowed_packets[FR_MAX_PACKET_CODE])
 {
-	int i;
+	int i, j;
 	size_t ft_size;
 	fr_tracking_t *ft;
 
@@ -123,12 +304,27 @@ fr_tracking_t *fr_radius_tracking_create(TALLOC_CTX *ctx, size_t src_dst_size,
 
 	ft->num_entries = 0;
 	ft->src_dst_size = src_dst_size;
+	ft->max_reply_size = FR_TRACKING_MAX_REPLY;
+
+	FR_DLIST_INIT(ft->free);
+	FR_DLIST_INIT(ft->expire);
 
 	/*
 	 *	The socket is unconnected.  We need to track entries by src/dst ip/port.
 	 */
 	if (src_dst_size > 0) {
-		ft->tree = rbtree_create(ft, entry_cmp, entry_free, RBTREE_FLAG_NONE);
+		ft->entry_size = sizeof(fr_tracking_entry_t);
+		ft->entry_size += 15;
+		ft->entry_size &= ~(15);
+		ft->entry_size += (src_dst_size + 15) & ~((size_t) 15);
+
+		ft->num_slots = FR_TRACKING_NUM_SLOTS;
+		ft->slots = talloc_zero_array(ft, fr_tracking_slot_t, ft->num_slots);
+		if (!ft->slots) {
+			talloc_free(ft);
+			return NULL;
+		}
+
 		return ft;
 	}
 
@@ -144,6 +340,11 @@ fr_tracking_t *fr_radius_tracking_create(TALLOC_CTX *ctx, size_t src_dst_size,
 			talloc_free(ft);
 			return NULL;
 		}
+
+		for (j = 0; j < 256; j++) {
+			ft->codes[i][j].ft = ft;
+			FR_DLIST_INIT(ft->codes[i][j].list);
+		}
 	}
 
 	return ft;
@@ -169,11 +370,7 @@ int fr_radius_tracking_entry_delete(fr_tracking_t *ft, fr_tracking_entry_t *entr
 	/*
 	 *	Mark the reply (if any) as done.
 	 */
-	if (entry->reply) {
-		talloc_const_free(entry->reply);
-		entry->reply = NULL;
-		entry->reply_len = 0;
-	}
+	entry_reply_clear(ft, entry);
 
 	/*
 	 *	If we're not tracking src/dst ip/port, just return.
@@ -182,9 +379,11 @@ int fr_radius_tracking_entry_delete(fr_tracking_t *ft, fr_tracking_entry_t *entr
 
 	/*
 	 *	We are tracking src/dst ip/port, we have to remove
-	 *	this entry from the tracking tree, and then free it.
+	 *	this entry from the hash table, and then put it back
+	 *	on the free list.
 	 */
-	rbtree_deletebydata(ft->tree, entry);
+	slot_delete(ft, entry);
+	fr_dlist_insert_head(&ft->free, &entry->list);
 
 	return 0;
 }
@@ -206,7 +405,7 @@ fr_tracking_status_t fr_radius_tracking_entry_insert(fr_tracking_entry_t **p_ent
 						     fr_tracking_t *ft, uint8_t *packet, fr_time_t timestamp,
 						     void *src_dst)
 {
-	bool			insert = false;
+	uint32_t		hash = 0;
 	fr_tracking_entry_t	*entry;
 
 	(void) talloc_get_type_abort(ft, fr_tracking_t);
@@ -224,120 +423,84 @@ fr_tracking_status_t fr_radius_tracking_entry_insert(fr_tracking_entry_t **p_ent
 		/*
 		 *	The entry is unused, insert it.
 		 */
-		if (entry->timestamp == 0) {
-			entry->ft = ft;
-			entry->timestamp = timestamp;
-			entry->reply = NULL;
-			entry->reply_len = 0;
-
-			memcpy(&entry->data[0], packet, sizeof(entry->data));
-			*p_entry = entry;
-
-			ft->num_entries++;
-			return FR_TRACKING_NEW;
-		}
-
-		/*
-		 *	Is it the same packet?  If so, return that.
-		 */
-		if (memcmp(&entry->data[0], packet, sizeof(entry->data)) == 0) {
-			*p_entry = entry;
-			return FR_TRACKING_SAME;
-		}
-
-		/*
-		 *	It's in use, but the new packet is different.  update
-		 *	the timestamp, so that anyone checking it knows it's
-		 *	no longer relevant.
-		 */
-		entry->timestamp = timestamp;
-
-		if (entry->reply) {
-			talloc_const_free(entry->reply);
-			entry->reply_len = 0;
-		}
+		if (entry->timestamp == 0) goto new_entry;
 
 	} else {
-		fr_tracking_entry_t my_entry;
-
 		/*
-		 *	Unconnected socket: we have to allocate the
-		 *	entry ourselves.
-		 *
-		 *	@todo - use a slab allocator
+		 *	Unconnected socket: look in the hash table.
 		 */
-		my_entry.src_dst = src_dst;
-		my_entry.src_dst_size = ft->src_dst_size;
-		memcpy(my_entry.data, packet, sizeof(my_entry.data));
-
-		/*
-		 *	See if we're adding a duplicate, or
-		 *	over-writing an existing one.
-		 */
-		entry = rbtree_finddata(ft->tree, &my_entry);
-		if (entry) {
-			/*
-			 *	Duplicate, tell the caller so.
-			 */
-			if (memcmp(&entry->data[0], packet, sizeof(entry->data)) == 0) {
-				*p_entry = entry;
-				return FR_TRACKING_SAME;
-			}
+		hash = entry_hash(ft, packet, src_dst);
 
+		entry = slot_find(ft, hash, packet, src_dst);
+		if (!entry) {
 			/*
-			 *	Over-write an existing entry.
+			 *	Keep the fill ratio below 3/4, so
+			 *	that probe sequences stay short.
 			 */
-			entry->timestamp = timestamp;
-
-			if (entry->reply) {
-				talloc_const_free(entry->reply);
-				entry->reply_len = 0;
+			if (((uint32_t) (ft->num_entries + 1) * 4) > (ft->num_slots * 3)) {
+				if (slots_grow(ft) < 0) return FR_TRACKING_ERROR;
 			}
 
-		/*
-		 *	Don't change src_dst.  It MUST have
-		 *	the same data as the previous entry.
-		 */
-		} else {
-			size_t align;
-			uint8_t *p;
-
-			/*
-			 *	Ensure that structures are aligned.
-			 */
-			align = sizeof(fr_tracking_entry_t);
-			align += 15;
-			align &= ~(15);
-
-			/*
-			 *	No existing entry, create a new one.
-			 */
-			entry = talloc_size(ft->tree, align + ft->src_dst_size);
+			entry = entry_alloc(ft);
 			if (!entry) return FR_TRACKING_ERROR;
 
-			memset(entry, 0, align + ft->src_dst_size);
-			entry->ft = ft;
-			entry->timestamp = timestamp;
-			insert = true;
-
 			/*
 			 *	Copy the src_dst information over to the entry.
 			 */
-			entry->src_dst = p = ((uint8_t *) entry) + align;
-			entry->src_dst_size = ft->src_dst_size;
-			memcpy(p, src_dst, entry->src_dst_size);
+			entry->hash = hash;
+			memcpy(entry->src_dst, src_dst, ft->src_dst_size);
+			slot_insert(ft->slots, ft->num_slots, entry);
+			goto new_entry;
 		}
 	}
 
+	/*
+	 *	Is it the same packet?  If so, return that.
+	 *
+	 *	If we've already replied, the duplicate extends the
+	 *	lifetime of the cached reply.
+	 */
+	if (memcmp(&entry->data[0], packet, sizeof(entry->data)) == 0) {
+		if (entry->list.next != &entry->list) {
+			fr_dlist_remove(&entry->list);
+			entry->reply_time = timestamp;
+			fr_dlist_insert_tail(&ft->expire, &entry->list);
+		}
+
+		*p_entry = entry;
+		return FR_TRACKING_SAME;
+	}
+
+	/*
+	 *	It's in use, but the new packet is different.  update
+	 *	the timestamp, so that anyone checking it knows it's
+	 *	no longer relevant.
+	 *
+	 *	Don't change src_dst.  It MUST have the same data as
+	 *	the previous entry.
+	 */
+	entry->timestamp = timestamp;
+	entry_reply_clear(ft, entry);
+
 	/*
 	 *	Copy the new packet over top of the old one.
 	 */
 	memcpy(&entry->data[0], packet, sizeof(entry->data));
 	*p_entry = entry;
 
-	if (insert) rbtree_insert(ft->tree, entry);
-
 	return FR_TRACKING_DIFFERENT;
+
+new_entry:
+	entry->timestamp = timestamp;
+	entry->reply = NULL;
+	entry->reply_len = 0;
+	entry->reply_time = 0;
+
+	memcpy(&entry->data[0], packet, sizeof(entry->data));
+	*p_entry = entry;
+
+	ft->num_entries++;
+	return FR_TRACKING_NEW;
 }
 
 /** Insert a (possibly new) packet and a timestamp
@@ -352,21 +515,109 @@ fr_tracking_status_t fr_radius_tracking_entry_insert(fr_tracking_entry_t **p_ent
  *	- 0 on success
  */
 int fr_radius_tracking_entry_reply(fr_tracking_t *ft, fr_tracking_entry_t *entry,
-				   UNUSED fr_time_t reply_time,
+				   fr_time_t reply_time,
 				   uint8_t const *reply, size_t reply_len)
 {
 	(void) talloc_get_type_abort(ft, fr_tracking_t);
 
+	entry_reply_clear(ft, entry);
+
 	/*
 	 *	Bad packets are "don't reply"
 	 */
 	if (reply_len < 20) {
 		entry->reply_len = 1;
-		return 0;
+
+	} else {
+		/*
+		 *	Make room for the new reply by throwing away
+		 *	the oldest ones.
+		 */
+		while ((ft->reply_size + reply_len) > ft->max_reply_size) {
+			fr_dlist_t *head;
+
+			head = FR_DLIST_FIRST(ft->expire);
+			if (!head) break;
+
+			(void) fr_radius_tracking_entry_delete(ft, fr_ptr_to_type(fr_tracking_entry_t, list, head));
+			ft->num_evicted++;
+		}
+
+		entry->reply = talloc_memdup(ft, reply, reply_len);
+		if (!entry->reply) return -1;
+
+		entry->reply_len = reply_len;
+		ft->reply_size += reply_len;
 	}
 
-	entry->reply = talloc_memdup(ft, reply, reply_len);
-	entry->reply_len = reply_len;
+	entry->reply_time = reply_time;
+	fr_dlist_insert_tail(&ft->expire, &entry->list);
 
 	return 0;
 }
+
+/** Delete all entries which were replied to at or before a particular time
+ *
+ * @param[in] ft		the tracking table.
+ * @param[in] when		delete entries with replies sent at or before this time.
+ * @return the number of entries deleted.
+ */
+int fr_radius_tracking_expire(fr_tracking_t *ft, fr_time_t when)
+{
+	int num = 0;
+	fr_dlist_t *head;
+
+	(void) talloc_get_type_abort(ft, fr_tracking_t);
+
+	while ((head = FR_DLIST_FIRST(ft->expire)) != NULL) {
+		fr_tracking_entry_t *entry = fr_ptr_to_type(fr_tracking_entry_t, list, head);
+
+		if (entry->reply_time > when) break;
+
+		(void) fr_radius_tracking_entry_delete(ft, entry);
+		num++;
+	}
+
+	return num;
+}
+
+/** Return the time of the oldest reply in the tracking table
+ *
+ * @param[in] ft		the tracking table.
+ * @return
+ *	- 0 if there are no replies.
+ *	- the time the oldest reply was sent.
+ */
+fr_time_t fr_radius_tracking_oldest_reply(fr_tracking_t *ft)
+{
+	fr_dlist_t *head;
+	fr_tracking_entry_t *entry;
+
+	head = FR_DLIST_FIRST(ft->expire);
+	if (!head) return 0;
+
+	entry = fr_ptr_to_type(fr_tracking_entry_t, list, head);
+	return entry->reply_time;
+}
+
+/** Print debug information about the tracking table
+ *
+ * @param[in] ft		the tracking table.
+ * @param[in] fp		the file where the debug output is printed.
+ */
+void fr_radius_tracking_debug(fr_tracking_t *ft, FILE *fp)
+{
+	fprintf(fp, "\t\tnum_entries = %d\n", ft->num_entries);
+	fprintf(fp, "\t\treply_size = %zu\n", ft->reply_size);
+	fprintf(fp, "\t\tmax_reply_size = %zu\n", ft->max_reply_size);
+	fprintf(fp, "\t\tnum_evicted = %" PRIu64 "\n", ft->num_evicted);
+
+	if (!ft->src_dst_size) return;
+
+	fprintf(fp, "\t\tnum_slots = %u\n", ft->num_slots);
+	fprintf(fp, "\t\tnum_allocated = %u\n", ft->num_allocated);
+	fprintf(fp, "\t\tfill = %.3f\n", ((double) ft->num_entries) / ft->num_slots);
+	fprintf(fp, "\t\tnum_lookups = %" PRIu64 "\n", ft->num_lookups);
+	fprintf(fp, "\t\tprobes_per_lookup = %.3f\n",
+		ft->num_lookups ? ((double) ft->num_probes) / ft->num_lookups : 0.0);
+}
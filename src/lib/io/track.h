@@ -38,14 +38,19 @@ typedef struct fr_tracking_t fr_tracking_t;
  *  An entry for the tracking table.  It contains the minimum
  *  information required to track RADIUS packets.
  *
- *  @todo include event information, so that this tracking entry can
- *  be cleaned up at an appropriate time.
+ *  Entries are never moved once allocated, so callers can hold
+ *  pointers to them.  But once an entry has been deleted, it may be
+ *  re-used for another packet.  Callers should therefore check that
+ *  the timestamp is still the one they expect.
  */
 typedef struct fr_tracking_entry_t {
-	fr_tracking_t		*ft;		//!< for cleanup_delay
-	fr_event_timer_t	*ev;		//!< for cleanup_delay
+	fr_tracking_t		*ft;		//!< the table this entry is in
+	fr_dlist_t		list;		//!< in the free list, or the expiry list
+
+	uint32_t		hash;		//!< of code, ID, and src/dst
 
 	fr_time_t		timestamp;	//!< when the request was received
+	fr_time_t		reply_time;	//!< when the reply was sent, or a duplicate last arrived
 	void			*src_dst;	//!< information about src/dst IP/port
 	size_t			src_dst_size;	//!< size of the data in src_dst
 	uint8_t const		*reply;		//!< the response (if any);
@@ -77,6 +82,12 @@ fr_tracking_status_t		fr_radius_tracking_entry_insert(fr_tracking_entry_t **p_en
 int				fr_radius_tracking_entry_reply(fr_tracking_t *ft, fr_tracking_entry_t *entry,
 							       fr_time_t reply_time,
 							       uint8_t const *reply, size_t reply_len);
+
+int				fr_radius_tracking_expire(fr_tracking_t *ft, fr_time_t when) CC_HINT(nonnull);
+
+fr_time_t			fr_radius_tracking_oldest_reply(fr_tracking_t *ft) CC_HINT(nonnull);
+
+void				fr_radius_tracking_debug(fr_tracking_t *ft, FILE *fp) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
 #endif
@@ -57,6 +57,15 @@
  *  yeilded, it is placed onto the yielded list in the worker
  *  "tracking" data structure.
  *
+ *  Workers which are part of a steal group (see
+ *  fr_worker_steal_create()) share work.  When a worker has a backlog
+ *  of messages in the "to_decode" heap, it offers the oldest ones to
+ *  its peers via a lock-free queue, and wakes up a peer.  An idle
+ *  worker takes offered messages, and processes them.  The reply is
+ *  passed back to the original worker, which sends it on the
+ *  originating channel.  The channels are single producer, so only
+ *  the worker which owns a channel may write to it.
+ *
  * @copyright 2016 Alan DeKok <aland@freeradius.org>
  */
 RCSID("$Id$")
@@ -66,6 +75,91 @@ RCSID("$Id$")
 #include <freeradius-devel/io/message.h>
 #include <freeradius-devel/io/listen.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+/*
+ *	Maximum number of messages a worker may have offered to
+ *	other workers, and not yet had back.
+ */
+#define FR_WORKER_STEAL_MAX	(64)
+
+/*
+ *	Messages which have been waiting longer than this are copied
+ *	out of the channel, so that they don't block the ring buffer.
+ */
+#define FR_WORKER_LOCALIZE_DELAY	(NANOSEC / 100)
+
+/*
+ *	Messages from listeners without admission control are NAKed
+ *	when they have been waiting longer than this.
+ */
+#define FR_WORKER_MAX_DELAY	(NANOSEC)
+
+/*
+ *	Each REQUEST is a talloc pool (arena), as are its packet and
+ *	reply.  When the request is done, it is reset, which empties
+ *	the pools.  The REQUEST is then kept as a "shell" for the next
+ *	message, without going back to malloc(), or re-initializing
+ *	it.
+ */
+#define FR_WORKER_ARENA_MIN	(4096)		//!< at least enough for a REQUEST
+#define FR_WORKER_ARENA_CLASSES	(9)		//!< size classes, from ARENA_MIN to ARENA_MIN << 8
+#define FR_WORKER_SHELL_CACHE	(64)		//!< maximum number of unused shells kept by a worker
+#define FR_WORKER_ARENA_SAMPLE	(64)		//!< measure one request in this many
+#define FR_WORKER_ARENA_ADJUST	(256)		//!< re-size the arenas after this many measurements
+
+/*
+ *	An approximation of the per-chunk overhead of talloc, so that
+ *	we can estimate how much of an arena a request used.
+ */
+#define FR_WORKER_TALLOC_OVERHEAD	(96)
+
+/**
+ *  Messages one worker has offered to other workers, and the
+ *  replies to those messages.
+ *
+ *  The slots are owned by the steal group, and not by the worker.
+ *  That way they remain valid until all of the workers have exited.
+ */
+typedef struct fr_worker_steal_slot_t {
+	fr_atomic_queue_t	*offered;	//!< messages which other workers may take
+	fr_atomic_queue_t	*returned;	//!< replies to taken messages, for the owner to send
+
+	atomic_bool		joined;		//!< whether the owner has joined the group
+	fr_control_t		*control;	//!< to wake up the owner
+} fr_worker_steal_slot_t;
+
+/**
+ *  A group of workers which can steal work from each other.
+ */
+struct fr_worker_steal_t {
+	int			num_workers;	//!< number of slots
+	fr_worker_steal_slot_t	*slot;		//!< one per worker
+};
+
+/**
+ *  A reply to a stolen message.
+ *
+ *  This is allocated with malloc(), and not talloc, as it is freed
+ *  by a different thread from the one which allocated it.
+ */
+typedef struct fr_worker_stolen_t {
+	fr_channel_t		*ch;		//!< channel the request was received on
+	fr_listen_t const	*listen;	//!< for the reply
+	void			*packet_ctx;	//!< for the reply
+
+	uint32_t		code;		//!< class of the request
+	fr_time_t		processing_time; //!< time spent processing the request
+	fr_time_t		request_time;	//!< timestamp of the request packet
+
+	size_t			data_size;	//!< size of the reply
+	uint8_t			data[];		//!< the encoded reply
+} fr_worker_stolen_t;
+
 /**
  *  Track things by priority and time.
  */
@@ -98,6 +192,7 @@ struct fr_worker_t {
 	uintptr_t		aq_ident;	//!< identifier for control-plane events
 
 	fr_control_t		*control;	//!< the control plane
+	int			control_fd;	//!< eventfd for control-plane events, or -1
 
 	fr_event_list_t		*el;		//!< our event list
 
@@ -110,11 +205,20 @@ struct fr_worker_t {
 	int                     ring_buffer_size; //!< default start size for the ring buffers
 
 	size_t			talloc_pool_size; //!< for each REQUEST
+	REQUEST			*shells[FR_WORKER_SHELL_CACHE];	//!< unused REQUESTs
+	int			num_shells;	//!< number of unused REQUESTs
+	uint64_t		num_shells_reused; //!< number of requests which re-used a shell
+	uint64_t		num_shells_alloc; //!< number of requests which needed a new shell
+	uint32_t		arena_sizes[FR_WORKER_ARENA_CLASSES]; //!< histogram of request sizes
+	uint32_t		num_arena_samples; //!< number of requests in the histogram
+	uint32_t		num_arena_new;	//!< number of samples since the arena size was last checked
 
 	fr_time_t		checked_timeout; //!< when we last checked the tails of the queues
 
 	fr_worker_heap_t	to_decode;	//!< messages from the master, to be decoded or localized
 	fr_worker_heap_t       	localized;	//!< localized messages to be decoded
+	int			num_queued[FR_LISTEN_NUM_PRIORITIES]; //!< messages in the two heaps, by priority
+	fr_time_t		min_delay;	//!< smallest maximum queue delay of any message we've seen
 
 	fr_heap_t      		*runnable;	//!< current runnable requests which we've spent time processing
 	fr_dlist_t		time_order;	//!< time order of requests
@@ -125,15 +229,37 @@ struct fr_worker_t {
 	int			num_decoded;	//!< number of messages which have been decoded
 	int			num_replies;	//!< number of messages which were replied to
 	int			num_timeouts;	//!< number of messages which timed out
+	int			num_shed;	//!< number of messages NAKed by admission control
 
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
 	bool			exiting;	//!< are we exiting?
 
 	fr_channel_t		**channel;	//!< list of channels
+	bool			*closing;	//!< channels which the master has asked us to close
+	int			num_closing;	//!< number of channels waiting to be closed
+
+	atomic_int		load_backlog;	//!< published for the scheduler, see fr_worker_load()
+	atomic_int		load_channels;	//!< published for the scheduler
+	atomic_uint_least64_t	load_running;	//!< published for the scheduler
+
+	fr_worker_steal_t	*steal;		//!< group of workers we share work with
+	fr_worker_steal_slot_t	*steal_slot;	//!< our slot in the steal group
+	int			steal_id;	//!< our index in the steal group
+	int			steal_next;	//!< next peer to wake up, or steal from
+
+	int			num_offered;	//!< messages offered to other workers
+	int			num_outstanding; //!< offered messages not yet returned, or reclaimed
+	int			num_reclaimed;	//!< offered messages we processed ourselves
+	int			num_stolen;	//!< messages we took from other workers
+	int			num_holding;	//!< messages we took, and haven't yet returned
+	int			num_returned;	//!< replies from other workers, to our messages
 };
 
 static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void *uctx);
+static int worker_message_cmp(void const *one, void const *two);
+static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_worker_steal_slot_t *stolen_from,
+			  fr_time_t start);
 
 /*
  *	We need wrapper macros because we have multiple instances of
@@ -143,6 +269,7 @@ static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void
 		FR_DLIST_INIT(worker->_name.list); \
 		worker->_name.heap = fr_heap_create(_func, offsetof(_type, _member)); \
 		if (!worker->_name.heap) { \
+			if (worker->control_fd >= 0) (void) fr_event_fd_delete(worker->el, worker->control_fd); \
 			(void) fr_event_user_delete(worker->el, fr_worker_evfilt_user, worker); \
 			talloc_free(worker); \
 			goto nomem; \
@@ -152,18 +279,104 @@ static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void
 #define WORKER_HEAP_INSERT(_name, _var, _member) do { \
 		fr_dlist_insert_head(&worker->_name.list, &_var->_member); \
 		(void) fr_heap_insert(worker->_name.heap, _var);        \
+		fr_worker_queued(worker, _var, +1); \
 	} while (0)
 
 #define WORKER_HEAP_POP(_name, _var, _member) do { \
 		_var = fr_heap_pop(worker->_name.heap); \
-		if (_var) fr_dlist_remove(&_var->_member); \
+		if (_var) { \
+			fr_dlist_remove(&_var->_member); \
+			fr_worker_queued(worker, _var, -1); \
+		} \
 	} while (0)
 
 #define WORKER_HEAP_EXTRACT(_name, _var, _member) do { \
                (void) fr_heap_extract(worker->_name.heap, _var); \
                fr_dlist_remove(&_var->_member);			 \
+               fr_worker_queued(worker, _var, -1); \
        } while (0)
 
+/** Account for a message entering or leaving the worker queues
+ *
+ * @param[in] worker the worker
+ * @param[in] cd the message
+ * @param[in] delta +1 when it is queued, -1 when it is removed.
+ */
+static inline void fr_worker_queued(fr_worker_t *worker, fr_channel_data_t const *cd, int delta)
+{
+	rad_assert(cd->priority < FR_LISTEN_NUM_PRIORITIES);
+
+	worker->num_queued[cd->priority] += delta;
+
+	if (cd->listen->admit) atomic_fetch_add_explicit(&cd->listen->admit->backlog, delta, memory_order_relaxed);
+}
+
+/** The longest time a message may wait in the queues
+ *
+ * @param[in] cd the message
+ * @return the maximum queue delay for the message.
+ */
+static inline fr_time_t fr_worker_max_delay(fr_channel_data_t const *cd)
+{
+	if (!cd->listen->admit) return FR_WORKER_MAX_DELAY;
+
+	return cd->listen->admit->max_delay;
+}
+
+/** Decide whether a message is queued, or shed
+ *
+ *  A message is shed if the listener already has "max_backlog"
+ *  messages queued, or if it is predicted to wait longer than the
+ *  listener's "max_delay" before it is run.  The predicted wait is
+ *  the time it has already waited, plus the average run time of the
+ *  requests and messages which would run before it.  Messages of a
+ *  lower priority aren't counted, so that important packets are
+ *  still admitted while less important ones are shed.
+ *
+ *  Messages of the highest priority are never shed because of the
+ *  backlog, so that the server still answers Status-Server when it
+ *  is busy.
+ *
+ * @param[in] worker the worker
+ * @param[in] cd the message
+ * @param[in,out] now the current time, or 0 if it hasn't been looked up yet.
+ * @return
+ *	- true if the message should be queued.
+ *	- false if the message should be NAKed.
+ */
+static bool fr_worker_admit(fr_worker_t *worker, fr_channel_data_t const *cd, fr_time_t *now)
+{
+	uint32_t		i;
+	int			ahead;
+	fr_time_t		waiting;
+	fr_listen_admit_t	*admit = cd->listen->admit;
+
+	if (admit->max_delay < worker->min_delay) worker->min_delay = admit->max_delay;
+
+	if (admit->max_backlog && (cd->priority > 0) &&
+	    (atomic_load_explicit(&admit->backlog, memory_order_relaxed) >= (int) admit->max_backlog)) {
+		atomic_fetch_add_explicit(&admit->num_shed_backlog, 1, memory_order_relaxed);
+		return false;
+	}
+
+	/*
+	 *	No requests have finished yet, so we can't predict
+	 *	anything.
+	 */
+	if (!worker->tracking.predicted) return true;
+
+	ahead = fr_heap_num_elements(worker->runnable);
+	for (i = 0; i <= cd->priority; i++) ahead += worker->num_queued[i];
+
+	if (!*now) *now = fr_time_cached();
+	waiting = (*now > cd->m.when) ? (*now - cd->m.when) : 0;
+
+	if ((waiting + (ahead * worker->tracking.predicted)) <= admit->max_delay) return true;
+
+	atomic_fetch_add_explicit(&admit->num_shed_delay, 1, memory_order_relaxed);
+	return false;
+}
+
 
 /** Drain the input channel
  *
@@ -173,6 +386,9 @@ static void fr_worker_post_event(fr_event_list_t *el, struct timeval *now, void
  */
 static void fr_worker_drain_input(fr_worker_t *worker, fr_channel_t *ch, fr_channel_data_t *cd)
 {
+	fr_time_t	now = 0;
+	fr_dlist_t	shed, *entry;
+
 	if (!cd) {
 		cd = fr_channel_recv_request(ch);
 		if (!cd) {
@@ -181,15 +397,447 @@ static void fr_worker_drain_input(fr_worker_t *worker, fr_channel_t *ch, fr_chan
 		}
 	}
 
+	FR_DLIST_INIT(shed);
+
 	do {
 		worker->num_requests++;
 		fr_log(worker->log, L_DBG, "\t%sreceived request %d", worker->name, worker->num_requests);
 		cd->channel.ch = ch;
+
+		if (cd->listen->admit && !fr_worker_admit(worker, cd, &now)) {
+			fr_dlist_insert_tail(&shed, &cd->request.list);
+			continue;
+		}
+
 		WORKER_HEAP_INSERT(to_decode, cd, request.list);
 	} while ((cd = fr_channel_recv_request(ch)) != NULL);
+
+	/*
+	 *	NAK the shed messages after we're done reading the
+	 *	channel, as sending a reply may read it, too.
+	 */
+	while ((entry = FR_DLIST_FIRST(shed)) != NULL) {
+		cd = fr_ptr_to_type(fr_channel_data_t, request.list, entry);
+		fr_dlist_remove(&cd->request.list);
+
+		fr_log(worker->log, L_DBG, "\t%sshedding request", worker->name);
+		worker->num_shed++;
+		fr_worker_nak(worker, cd, NULL, fr_time());
+	}
+}
+
+
+/** Wake up a worker in the steal group
+ *
+ *  This may be called from any thread.
+ *
+ * @param[in] slot of the worker to wake up
+ */
+static void fr_worker_steal_wake(fr_worker_steal_slot_t *slot)
+{
+	if (!atomic_load_explicit(&slot->joined, memory_order_acquire)) return;
+
+	(void) fr_control_signal(slot->control);
+}
+
+
+/** Offer some of our backlog to other workers
+ *
+ *  We keep one message for ourselves.  The oldest of the rest are
+ *  offered, as they are the ones most likely to time out while we're
+ *  busy.
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_steal_offer(fr_worker_t *worker)
+{
+	int			i, peer = 0, num = 0, offered;
+	fr_dlist_t		*entry;
+	fr_channel_data_t	*cd;
+	fr_channel_data_t	*batch[FR_WORKER_STEAL_MAX];
+
+	if (!worker->steal_slot) return;
+
+	if (fr_heap_num_elements(worker->to_decode.heap) <= 1) return;
+
+	/*
+	 *	Find a peer to take the work, starting after the one
+	 *	we woke up last time.  If the other workers have all
+	 *	exited, there's no one to offer it to.
+	 */
+	for (i = 1; i <= worker->steal->num_workers; i++) {
+		peer = (worker->steal_next + i) % worker->steal->num_workers;
+		if (peer == worker->steal_id) continue;
+
+		if (atomic_load_explicit(&worker->steal->slot[peer].joined, memory_order_acquire)) break;
+	}
+	if (i > worker->steal->num_workers) return;
+
+	while ((fr_heap_num_elements(worker->to_decode.heap) > 1) &&
+	       ((worker->num_outstanding + num) < FR_WORKER_STEAL_MAX)) {
+		entry = FR_DLIST_TAIL(worker->to_decode.list);
+		rad_assert(entry != NULL);
+
+		cd = fr_ptr_to_type(fr_channel_data_t, request.list, entry);
+		WORKER_HEAP_EXTRACT(to_decode, cd, request.list);
+
+		batch[num++] = cd;
+	}
+
+	if (!num) return;
+
+	offered = fr_atomic_queue_push_n(worker->steal_slot->offered, (void **) batch, num);
+
+	/*
+	 *	Can't happen, as the queue is as large as the
+	 *	maximum number of outstanding messages.  Put them
+	 *	back where they were, oldest first.
+	 */
+	for (i = num - 1; i >= offered; i--) {
+		fr_dlist_insert_tail(&worker->to_decode.list, &batch[i]->request.list);
+		(void) fr_heap_insert(worker->to_decode.heap, batch[i]);
+		fr_worker_queued(worker, batch[i], +1);
+	}
+
+	worker->num_offered += offered;
+	worker->num_outstanding += offered;
+
+	if (!offered) return;
+
+	fr_log(worker->log, L_DBG, "	%soffered %d messages to other workers", worker->name, offered);
+
+	/*
+	 *	Wake up the peer, so that it can take some of the
+	 *	work.  It will keep taking work until there's nothing
+	 *	left to take.
+	 */
+	worker->steal_next = peer;
+	fr_worker_steal_wake(&worker->steal->slot[peer]);
+}
+
+
+/** Take back messages we offered, and which no one else has taken
+ *
+ *  We're about to go to sleep, or to check for timeouts.  The other
+ *  workers may all be busy, or gone, in which case the messages
+ *  would sit in the queue.
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_steal_reclaim(fr_worker_t *worker)
+{
+	int			i, num;
+	fr_channel_data_t	*batch[FR_WORKER_STEAL_MAX];
+
+	if (!worker->steal_slot || !worker->num_outstanding) return;
+
+	num = fr_atomic_queue_pop_n(worker->steal_slot->offered, (void **) batch, FR_WORKER_STEAL_MAX);
+	if (num <= 0) return;
+
+	/*
+	 *	Put them back where they were, oldest first.
+	 */
+	for (i = num - 1; i >= 0; i--) {
+		fr_dlist_insert_tail(&worker->to_decode.list, &batch[i]->request.list);
+		(void) fr_heap_insert(worker->to_decode.heap, batch[i]);
+		fr_worker_queued(worker, batch[i], +1);
+	}
+
+	rad_assert(worker->num_outstanding >= num);
+	worker->num_outstanding -= num;
+	worker->num_reclaimed += num;
+
+	fr_log(worker->log, L_DBG, "	%stook back %d offered messages", worker->name, num);
+}
+
+
+/** Take an offered message
+ *
+ *  We first take back messages which we offered, and which no one
+ *  else has taken.  Then we look for messages offered by other
+ *  workers.
+ *
+ * @param[in] worker the worker
+ * @param[out] p_slot the slot of the worker the message was stolen from,
+ *	or NULL if it was one of our own messages.
+ * @return
+ *	- NULL if there are no messages to take.
+ *	- the message
+ */
+static fr_channel_data_t *fr_worker_steal(fr_worker_t *worker, fr_worker_steal_slot_t **p_slot)
+{
+	int			i, id;
+	fr_channel_data_t	*cd;
+	fr_worker_steal_slot_t	*slot;
+
+	*p_slot = NULL;
+
+	if (!worker->steal_slot) return NULL;
+
+	if (fr_atomic_queue_pop(worker->steal_slot->offered, (void **) &cd)) {
+		rad_assert(worker->num_outstanding > 0);
+		worker->num_outstanding--;
+		worker->num_reclaimed++;
+		return cd;
+	}
+
+	for (i = 1; i < worker->steal->num_workers; i++) {
+		id = (worker->steal_id + i) % worker->steal->num_workers;
+		slot = &worker->steal->slot[id];
+
+		if (!fr_atomic_queue_pop(slot->offered, (void **) &cd)) continue;
+
+		fr_log(worker->log, L_DBG, "	%sstole request from worker %d", worker->name, id);
+		worker->num_stolen++;
+		worker->num_holding++;
+
+		/*
+		 *	There may be more work to steal.  Wake
+		 *	ourselves up when we're done with this
+		 *	message, so that we check again.
+		 */
+		fr_worker_steal_wake(worker->steal_slot);
+
+		*p_slot = slot;
+		return cd;
+	}
+
+	return NULL;
+}
+
+
+/** Allocate a reply for a stolen message
+ *
+ * @param[in] size of the reply data
+ * @return the reply
+ */
+static fr_worker_stolen_t *fr_worker_stolen_alloc(size_t size)
+{
+	fr_worker_stolen_t *st;
+
+	st = malloc(sizeof(*st) + size);
+	rad_assert(st != NULL);
+	memset(st, 0, sizeof(*st));
+
+	return st;
+}
+
+
+/** Return the reply to a stolen message to the worker which owns the channel
+ *
+ * @param[in] worker the worker
+ * @param[in] slot of the worker the message was stolen from
+ * @param[in] st the reply
+ */
+static void fr_worker_steal_return(fr_worker_t *worker, fr_worker_steal_slot_t *slot, fr_worker_stolen_t *st)
+{
+	rad_assert(worker->num_holding > 0);
+	worker->num_holding--;
+
+	/*
+	 *	Can't happen, as the queue is as large as the maximum
+	 *	number of outstanding messages.
+	 */
+	if (!fr_atomic_queue_push(slot->returned, st)) {
+		fr_log(worker->log, L_ERR, "%sFailed returning reply to stolen request", worker->name);
+		free(st);
+		return;
+	}
+
+	fr_worker_steal_wake(slot);
+}
+
+
+/** Send the replies to messages which other workers have taken from us
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_steal_service(fr_worker_t *worker)
+{
+	int			i;
+	fr_worker_stolen_t	*st;
+	fr_channel_data_t	*reply, *cd;
+	fr_message_set_t	*ms;
+
+	if (!worker->steal_slot) return;
+
+	while (fr_atomic_queue_pop(worker->steal_slot->returned, (void **) &st)) {
+		rad_assert(worker->num_outstanding > 0);
+		worker->num_outstanding--;
+		worker->num_returned++;
+
+		/*
+		 *	The channel may have been closed while
+		 *	another worker was processing the request.
+		 */
+		for (i = 0; i < worker->max_channels; i++) {
+			if (worker->channel[i] == st->ch) break;
+		}
+		if (i == worker->max_channels) {
+			free(st);
+			continue;
+		}
+
+		ms = fr_channel_worker_ctx_get(st->ch);
+		rad_assert(ms != NULL);
+
+		reply = (fr_channel_data_t *) fr_message_reserve(ms, st->data_size);
+		rad_assert(reply != NULL);
+
+		if (st->data_size) {
+			memcpy(reply->m.data, st->data, st->data_size);
+			cd = (fr_channel_data_t *) fr_message_alloc(ms, &reply->m, st->data_size);
+			rad_assert(cd == reply);
+		}
+
+		/*
+		 *	Replies on a channel have to be in time order,
+		 *	and we may have sent our own replies since the
+		 *	other worker created this one.
+		 */
+		reply->m.when = fr_time();
+		reply->reply.cpu_time = worker->tracking.running;
+		reply->reply.processing_time = st->processing_time;
+		reply->reply.request_time = st->request_time;
+
+		reply->code = st->code;
+		reply->listen = st->listen;
+		reply->packet_ctx = st->packet_ctx;
+
+		if (fr_channel_send_reply(st->ch, reply, &cd) < 0) {
+			fr_log(worker->log, L_DBG, "	%sfails sending reply", worker->name);
+			cd = NULL;
+		}
+
+		worker->num_replies++;
+
+		if (cd) fr_worker_drain_input(worker, st->ch, cd);
+
+		free(st);
+	}
+}
+
+
+/** Return the requests we took from other workers, without replies
+ *
+ *  We're exiting, and the workers we took them from still count
+ *  them as outstanding.  An empty reply lets the owner tell the
+ *  network side that the requests are done.
+ *
+ * @param[in] worker the worker
+ * @param[in] head of a list of requests, linked by their "time_order" entry.
+ */
+static void fr_worker_steal_abandon(fr_worker_t *worker, fr_dlist_t *head)
+{
+	fr_dlist_t		*entry;
+	fr_async_t		*async;
+	fr_worker_stolen_t	*st;
+
+	for (entry = head->next; entry != head; entry = entry->next) {
+		async = fr_ptr_to_type(fr_async_t, time_order, entry);
+		if (!async->stolen_from) continue;
+
+		st = fr_worker_stolen_alloc(0);
+		st->ch = async->channel;
+		st->code = async->code;
+		st->listen = async->listen;
+		st->packet_ctx = async->packet_ctx;
+		st->processing_time = async->tracking.running;
+		st->request_time = async->recv_time;
+
+		fr_log(worker->log, L_DBG, "	%sreturning unfinished request", worker->name);
+
+		fr_worker_steal_return(worker, async->stolen_from, st);
+		async->stolen_from = NULL;
+	}
+}
+
+
+/** See if the worker has any work in progress
+ *
+ * @param[in] worker the worker
+ * @return
+ *	- true if there are no messages or requests, and no messages offered to other workers.
+ *	- false otherwise.
+ */
+static bool fr_worker_idle(fr_worker_t *worker)
+{
+	if (fr_heap_num_elements(worker->runnable) > 0) return false;
+	if (fr_heap_num_elements(worker->localized.heap) > 0) return false;
+	if (fr_heap_num_elements(worker->to_decode.heap) > 0) return false;
+	if (worker->time_order.next != &worker->time_order) return false;
+	if (worker->waiting_to_die.next != &worker->waiting_to_die) return false;
+
+	return (worker->num_outstanding == 0);
+}
+
+/** Acknowledge that a channel is closed, and give up its message set
+ *
+ *  The master may not have written all of the replies yet, and they
+ *  live in our message set.  So we hand the message set to the
+ *  master, which frees it once it's done with them.  We don't touch
+ *  the message set or the channel after this.
+ *
+ * @param[in] worker the worker
+ * @param[in] ch the channel to close
+ */
+static void fr_worker_channel_close(fr_worker_t *worker, fr_channel_t *ch)
+{
+	fr_message_set_t *ms;
+
+	fr_log(worker->log, L_DBG, "\t%sclosing channel %p", worker->name, ch);
+
+	ms = fr_channel_worker_ctx_get(ch);
+	if (ms) (void) talloc_steal(NULL, ms);
+
+	(void) fr_channel_worker_ack_close(ch);
+}
+
+/** Close channels which the master has asked us to close
+ *
+ *  Replies to requests may still need to be sent on the channel, and
+ *  we don't track which request came from which channel.  So we wait
+ *  until the worker is idle, and then close all of the pending
+ *  channels at once.
+ *
+ * @param[in] worker the worker
+ */
+static void fr_worker_close_channels(fr_worker_t *worker)
+{
+	int i;
+
+	if (!worker->num_closing || !fr_worker_idle(worker)) return;
+
+	i = 0;
+	while (i < worker->num_channels) {
+		if (!worker->closing[i]) {
+			i++;
+			continue;
+		}
+
+		fr_worker_channel_close(worker, worker->channel[i]);
+
+		/*
+		 *	Keep the array dense.  Other code walks
+		 *	it from 0..num_channels.
+		 */
+		worker->num_channels--;
+		worker->channel[i] = worker->channel[worker->num_channels];
+		worker->closing[i] = worker->closing[worker->num_channels];
+		worker->channel[worker->num_channels] = NULL;
+		worker->closing[worker->num_channels] = false;
+		worker->num_closing--;
+	}
+
+	rad_assert(worker->num_closing == 0);
+
+	/*
+	 *	The scheduler waits for this to drop to zero before
+	 *	it tells a retiring worker to exit.
+	 */
+	atomic_store_explicit(&worker->load_channels, worker->num_channels, memory_order_relaxed);
 }
 
-
 /** Handle a worker control message for a channel
  *
  * @param[in] ctx the worker
@@ -265,34 +913,28 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 		rad_assert(ch != NULL);
 
 		ok = false;
-		for (i = 0; i < worker->max_channels; i++) {
-			if (!worker->channel[i]) continue;
-
+		for (i = 0; i < worker->num_channels; i++) {
 			if (worker->channel[i] != ch) continue;
 
 			/*
-			 *	@todo check the status, and
-			 *	put the channel into a
-			 *	"closing" list if we can't
-			 *	close it right now.  Then,
-			 *	wake up after a time and try
-			 *	to close it again.
+			 *	Pick up anything the master sent
+			 *	before it asked us to close.  The
+			 *	channel is closed once we've finished
+			 *	with all of it.
 			 */
-			(void) fr_channel_worker_ack_close(ch);
-
-			ms = fr_channel_worker_ctx_get(ch);
-			rad_assert(ms != NULL);
-			fr_message_set_gc(ms);
-			talloc_free(ms);
+			fr_worker_drain_input(worker, ch, NULL);
 
-			worker->channel[i] = NULL;
-			rad_assert(worker->num_channels > 0);
-			worker->num_channels--;
+			if (!worker->closing[i]) {
+				worker->closing[i] = true;
+				worker->num_closing++;
+			}
 			ok = true;
 			break;
 		}
 
 		rad_cond_assert(ok);
+
+		fr_worker_close_channels(worker);
 		break;
 	}
 }
@@ -318,33 +960,83 @@ static void fr_worker_evfilt_user(UNUSED int kq, UNUSED struct kevent const *kev
 	 *	Service all available control-plane events
 	 */
 	fr_control_service(worker->control, data, sizeof(data), now);
+
+	/*
+	 *	Other workers may have replies for us to send.
+	 */
+	fr_worker_steal_service(worker);
+}
+
+
+/** Service a control-plane eventfd.
+ *
+ * @param[in] el the event list
+ * @param[in] fd the eventfd
+ * @param[in] flags from the event
+ * @param[in] ctx the fr_worker_t
+ */
+static void fr_worker_control_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *ctx)
+{
+	fr_worker_t *worker = talloc_get_type_abort(ctx, fr_worker_t);
+
+	fr_control_wakeup_clear(worker->control);
+
+	fr_worker_evfilt_user(worker->kq, NULL, worker);
 }
 
 
 /** Send a NAK to the network thread
  *
  *  The network thread believes that a worker is running a request until that request has been NAK'd.
+ *  The caller counts why the message was NAK'd.
  *
  * @param[in] worker the worker
  * @param[in] cd the message to NAK
- * @param[in] now when the message is NAKd
+ * @param[in] stolen_from the worker the message was stolen from, if any
+ * @param[in] start when we started working on the message
  */
-static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_worker_steal_slot_t *stolen_from,
+			  fr_time_t start)
 {
 	size_t			size;
+	fr_time_t		now;
 	fr_channel_data_t	*reply;
 	fr_channel_t		*ch;
 	fr_message_set_t	*ms;
 	fr_listen_t const	*listen;
 
-	worker->num_timeouts++;
-
 	/*
 	 *	Cache the outbound channel.  We'll need it later.
 	 */
 	ch = cd->channel.ch;
 	listen = cd->listen;
 
+	/*
+	 *	We can't write to another worker's channel, so
+	 *	the NAK goes back to the worker which owns it.
+	 */
+	if (stolen_from) {
+		fr_worker_stolen_t *st;
+
+		st = fr_worker_stolen_alloc(listen->app_io->default_message_size);
+		st->data_size = listen->app_io->nak(listen->app_io_instance, cd->m.data, cd->m.data_size,
+						    st->data, listen->app_io->default_message_size);
+
+		now = fr_time();
+
+		st->ch = ch;
+		st->code = FR_CHANNEL_CODE_NONE;
+		st->listen = cd->listen;
+		st->packet_ctx = cd->packet_ctx;
+		st->processing_time = (now > start) ? (now - start) : 0;
+		st->request_time = cd->m.when;
+
+		fr_message_done(&cd->m);
+
+		fr_worker_steal_return(worker, stolen_from, st);
+		return;
+	}
+
 	ms = fr_channel_worker_ctx_get(ch);
 	rad_assert(ms != NULL);
 
@@ -363,13 +1055,17 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	(void) fr_message_alloc(ms, &reply->m, size);
 
 	/*
-	 *	Fill in the NAK.
+	 *	Fill in the NAK.  The processing time is however long
+	 *	we spent on the message, including creating the NAK.
 	 */
+	now = fr_time();
+
 	reply->m.when = now;
 	reply->reply.cpu_time = worker->tracking.running;
-	reply->reply.processing_time = 10; /* @todo - set to something better? */
+	reply->reply.processing_time = (now > start) ? (now - start) : 0;
 	reply->reply.request_time = cd->m.when;
 
+	reply->code = FR_CHANNEL_CODE_NONE;
 	reply->listen = cd->listen;
 	reply->packet_ctx = cd->packet_ctx;
 
@@ -392,6 +1088,159 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 }
 
 
+/** Encode a reply
+ *
+ * @param[in] worker the worker
+ * @param[in] request the request to encode
+ * @param[out] buffer where the reply is written
+ * @param[in] buffer_len the size of the buffer
+ * @return the length of the reply.  Zero on error.
+ */
+static size_t fr_worker_encode(fr_worker_t *worker, REQUEST *request, uint8_t *buffer, size_t buffer_len)
+{
+	ssize_t slen = 0;
+	fr_listen_t const *listen = request->async->listen;
+
+	if (listen->app->encode) {
+		slen = listen->app->encode(listen->app_instance, request, buffer, buffer_len);
+	} else if (listen->app_io->encode) {
+		slen = listen->app_io->encode(listen->app_io_instance, request, buffer, buffer_len);
+	}
+	if (slen < 0) {
+		fr_log(worker->log, L_DBG, "\t%sfails encode", worker->name);
+		slen = 0;
+	}
+
+	return slen;
+}
+
+/** Get a REQUEST for a new message.
+ *
+ *  Re-use a shell if we have one.  Otherwise allocate a new REQUEST.
+ *
+ * @param[in] worker the worker
+ * @return
+ *	- NULL on error
+ *	- an empty REQUEST on success
+ */
+static REQUEST *fr_worker_request_alloc(fr_worker_t *worker)
+{
+	REQUEST *request;
+
+	if (worker->num_shells > 0) {
+		request = worker->shells[--worker->num_shells];
+		(void) talloc_steal(NULL, request);
+		memset(request->async, 0, sizeof(*request->async));
+		worker->num_shells_reused++;
+		return request;
+	}
+
+	request = request_alloc_pooled(NULL, worker->talloc_pool_size);
+	if (!request) return NULL;
+
+	/*
+	 *	Allocated outside of the request's pool, as it lives
+	 *	as long as the request does.
+	 */
+	request->async = talloc_zero(NULL, fr_async_t);
+	if (!request->async) {
+		talloc_free(request);
+		return NULL;
+	}
+	(void) talloc_steal(request, request->async);
+
+	worker->num_shells_alloc++;
+
+	return request;
+}
+
+/** Finish with a request, and keep it as a shell if we can.
+ *
+ * @param[in] worker the worker
+ * @param[in] request the request to free
+ */
+static void fr_worker_request_free(fr_worker_t *worker, REQUEST *request)
+{
+	if ((worker->num_shells == FR_WORKER_SHELL_CACHE) ||
+	    (request_reset(request) < 0)) {
+		talloc_free(request);
+		return;
+	}
+
+	/*
+	 *	Keep it parented by the worker, so that it is cleaned
+	 *	up when the worker is freed.
+	 */
+	(void) talloc_steal(worker, request);
+	worker->shells[worker->num_shells++] = request;
+}
+
+/** Track how much memory requests use, and adjust the arena size to match.
+ *
+ *  Walking the request is expensive, so we only measure one request
+ *  in FR_WORKER_ARENA_SAMPLE.  After every FR_WORKER_ARENA_ADJUST
+ *  new samples, the arena size is set to the smallest size class
+ *  which holds 90% of the requests in the histogram.
+ *
+ * @param[in] worker the worker
+ * @param[in] request the request which is about to be freed
+ */
+static void fr_worker_arena_sample(fr_worker_t *worker, REQUEST *request)
+{
+	int i;
+	size_t size;
+	uint32_t total;
+
+	if ((request->number % FR_WORKER_ARENA_SAMPLE) != 0) return;
+
+	size = talloc_total_size(request) + (talloc_total_blocks(request) * FR_WORKER_TALLOC_OVERHEAD);
+
+	for (i = 0; i < (FR_WORKER_ARENA_CLASSES - 1); i++) {
+		if (size <= ((size_t) FR_WORKER_ARENA_MIN << i)) break;
+	}
+
+	worker->arena_sizes[i]++;
+	worker->num_arena_samples++;
+
+	/*
+	 *	Count new samples separately.  Once the histogram has
+	 *	been aged, it already holds about half of
+	 *	FR_WORKER_ARENA_ADJUST samples.
+	 */
+	if (++worker->num_arena_new < FR_WORKER_ARENA_ADJUST) return;
+	worker->num_arena_new = 0;
+
+	total = 0;
+	for (i = 0; i < (FR_WORKER_ARENA_CLASSES - 1); i++) {
+		total += worker->arena_sizes[i];
+		if ((total * 10) >= (worker->num_arena_samples * 9)) break;
+	}
+
+	size = (size_t) FR_WORKER_ARENA_MIN << i;
+
+	/*
+	 *	The cached shells are the wrong size.  Throw them
+	 *	away, and allocate new ones as needed.
+	 */
+	if (size != worker->talloc_pool_size) {
+		fr_log(worker->log, L_DBG, "\t%schanging arena size from %zu to %zu", worker->name,
+		       worker->talloc_pool_size, size);
+
+		while (worker->num_shells > 0) talloc_free(worker->shells[--worker->num_shells]);
+		worker->talloc_pool_size = size;
+	}
+
+	/*
+	 *	Age the histogram, so that we follow changes in the
+	 *	traffic.
+	 */
+	worker->num_arena_samples = 0;
+	for (i = 0; i < FR_WORKER_ARENA_CLASSES; i++) {
+		worker->arena_sizes[i] /= 2;
+		worker->num_arena_samples += worker->arena_sizes[i];
+	}
+}
+
 /** Reply to a request
  *
  *  And clean it up.
@@ -406,12 +1255,37 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	fr_channel_t *ch;
 	fr_message_set_t *ms;
 
-	/*
-	 *	Allocate and send the reply.
-	 */
 	ch = request->async->channel;
 	rad_assert(ch != NULL);
 
+	/*
+	 *	The request was stolen from another worker, which
+	 *	sends the reply for us.
+	 */
+	if (request->async->stolen_from) {
+		fr_worker_stolen_t *st;
+
+		st = fr_worker_stolen_alloc(size);
+		if (size) st->data_size = fr_worker_encode(worker, request, st->data, size);
+
+		fr_time_tracking_end(&request->async->tracking, fr_time(), &worker->tracking);
+
+		st->ch = ch;
+		st->code = request->async->code;
+		st->listen = request->async->listen;
+		st->packet_ctx = request->async->packet_ctx;
+		st->processing_time = request->async->tracking.running;
+		st->request_time = request->async->recv_time;
+
+		fr_log(worker->log, L_DBG, "(%"PRIu64") finished, returning reply", request->number);
+
+		fr_worker_steal_return(worker, request->async->stolen_from, st);
+		goto done;
+	}
+
+	/*
+	 *	Allocate and send the reply.
+	 */
 	ms = fr_channel_worker_ctx_get(ch);
 	rad_assert(ms != NULL);
 
@@ -422,25 +1296,14 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	 *	Encode it, if required.
 	 */
 	if (size) {
-		ssize_t slen = 0;
-		fr_listen_t const *listen = request->async->listen;
-
-		if (listen->app->encode) {
-			slen = listen->app->encode(listen->app_instance, request,
-						   reply->m.data, reply->m.rb_size);
-		} else if (listen->app_io->encode) {
-			slen = listen->app_io->encode(listen->app_io_instance, request,
-						      reply->m.data, reply->m.rb_size);
-		}
-		if (slen < 0) {
-			fr_log(worker->log, L_DBG, "\t%sfails encode", worker->name);
-			slen = 0;
-		}
+		size_t len;
+
+		len = fr_worker_encode(worker, request, reply->m.data, reply->m.rb_size);
 
 		/*
 		 *	Resize the buffer to the actual packet size.
 		 */
-		cd = (fr_channel_data_t *) fr_message_alloc(ms, &reply->m, slen);
+		cd = (fr_channel_data_t *) fr_message_alloc(ms, &reply->m, len);
 		rad_assert(cd == reply);
 	}
 
@@ -459,6 +1322,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	reply->reply.processing_time = request->async->tracking.running;
 	reply->reply.request_time = request->async->recv_time;
 
+	reply->code = request->async->code;
 	reply->listen = request->async->listen;
 	reply->packet_ctx = request->async->packet_ctx;
 
@@ -480,12 +1344,23 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	 */
 	if (cd) fr_worker_drain_input(worker, ch, cd);
 
-	/*
-	 *	@todo Use a talloc pool for the request.  Clean it up,
-	 *	and insert it back into a slab allocator.
-	 */
+done:
 	fr_dlist_remove(&request->async->time_order);
-	talloc_free(request);
+	fr_worker_arena_sample(worker, request);
+	fr_worker_request_free(worker, request);
+}
+
+/** NAK a message which has been waiting for too long
+ *
+ * @param[in] worker the worker
+ * @param[in] cd the message
+ */
+static void fr_worker_timeout(fr_worker_t *worker, fr_channel_data_t *cd)
+{
+	worker->num_timeouts++;
+	if (cd->listen->admit) atomic_fetch_add_explicit(&cd->listen->admit->num_timeouts, 1, memory_order_relaxed);
+
+	fr_worker_nak(worker, cd, NULL, fr_time());
 }
 
 /** Check timeouts on the various queues
@@ -495,6 +1370,13 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
  *  When that happens, the low priority events will be in the queues for
  *  "too long", and will need to be cleaned up.
  *
+ *  Each listener sets how long its messages may wait.  See
+ *  #fr_listen_admit_t.
+ *
+ *  Messages which we offered to other workers, and which no one has
+ *  taken, are still ours.  We take them back first, so that they're
+ *  checked, too.  They're offered again after the check.
+ *
  * @param[in] worker the worker
  * @param[in] now the current time
  */
@@ -503,56 +1385,79 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 	fr_time_t waiting;
 	fr_dlist_t *entry;
 
+	fr_worker_steal_reclaim(worker);
+
 	/*
 	 *	Check the "localized" queue for old packets.
 	 *
 	 *	We check it before the "to_decode" list, so that we
 	 *	don't check packets twice.
+	 *
+	 *	Listeners may have different deadlines, so we walk
+	 *	from the oldest message, until we find one which is
+	 *	newer than any deadline.
 	 */
-	while ((entry = FR_DLIST_TAIL(worker->localized.list)) != NULL) {
+	entry = worker->localized.list.prev;
+	while (entry != &worker->localized.list) {
 		fr_channel_data_t *cd;
 
 		cd = fr_ptr_to_type(fr_channel_data_t, request.list, entry);
+		entry = entry->prev;
+		if (cd->m.when > now) break;
 		waiting = now - cd->m.when;
 
-		if (waiting < NANOSEC) break;
+		if (waiting < worker->min_delay) break;
+
+		if (waiting < fr_worker_max_delay(cd)) continue;
 
 		/*
 		 *	Waiting too long, delete it.
 		 */
 		WORKER_HEAP_EXTRACT(localized, cd, request.list);
-		fr_worker_nak(worker, cd, now);
+		fr_worker_timeout(worker, cd);
 	}
 
 	/*
 	 *	Check the "to_decode" queue for old packets.
 	 */
-	while ((entry = FR_DLIST_TAIL(worker->to_decode.list)) != NULL) {
+	entry = worker->to_decode.list.prev;
+	while (entry != &worker->to_decode.list) {
 		fr_message_t *lm;
 		fr_channel_data_t *cd;
 
 		cd = fr_ptr_to_type(fr_channel_data_t, request.list, entry);
+		entry = entry->prev;
+		if (cd->m.when > now) break;
 		waiting = now - cd->m.when;
 
-		if (waiting < (NANOSEC / 100)) break;
+		if ((waiting < FR_WORKER_LOCALIZE_DELAY) && (waiting < worker->min_delay)) break;
 
 		/*
 		 *	Waiting too long, delete it.
 		 */
-		if (waiting > NANOSEC) {
+		if (waiting >= fr_worker_max_delay(cd)) {
 			WORKER_HEAP_EXTRACT(to_decode, cd, request.list);
-		nak:
-			fr_worker_nak(worker, cd, now);
+			fr_worker_timeout(worker, cd);
 			continue;
 		}
 
+		if (waiting < FR_WORKER_LOCALIZE_DELAY) continue;
+
 		/*
-		 *	0.01 to 1s.  Localize it.
+		 *	Waiting for a while.  Localize it.
 		 */
 		WORKER_HEAP_EXTRACT(to_decode, cd, request.list);
-		lm = fr_message_localize(worker, &cd->m, sizeof(cd->m));
-		if (!lm) goto nak;
+		lm = fr_message_localize(worker, &cd->m, sizeof(*cd));
+		if (!lm) {
+			fr_worker_timeout(worker, cd);
+			continue;
+		}
 
+		/*
+		 *	The original message now belongs to the
+		 *	master, so we use the copy.
+		 */
+		cd = (fr_channel_data_t *) lm;
 		WORKER_HEAP_INSERT(localized, cd, request.list);
 	}
 
@@ -631,13 +1536,12 @@ static void fr_worker_check_timeouts(fr_worker_t *worker, fr_time_t now)
 static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 {
 	int			ret = -1;
+	fr_time_t		start;
 	fr_channel_data_t	*cd;
 	REQUEST			*request;
 	fr_dlist_t		*entry;
 	fr_listen_t const	*listen;
-#ifndef HAVE_TALLOC_POOLED_OBJECT
-	TALLOC_CTX		*ctx;
-#endif
+	fr_worker_steal_slot_t	*stolen_from = NULL;
 
 	/*
 	 *	Grab a runnable request, and resume it.
@@ -651,15 +1555,27 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 
 	/*
 	 *	Find either a localized message, or one which is in
-	 *	the "to_decode" queue.
+	 *	the "to_decode" queue.  Localized messages are only
+	 *	older, not more important.  So we take whichever one
+	 *	has the higher priority.
 	 */
 	do {
-		WORKER_HEAP_POP(localized, cd, request.list);
-		if (!cd) {
+		cd = fr_heap_peek(worker->to_decode.heap);
+		if (cd) {
+			fr_channel_data_t *old = fr_heap_peek(worker->localized.heap);
+
+			if (old && (worker_message_cmp(old, cd) <= 0)) cd = NULL;
+		}
+
+		if (cd) {
 			WORKER_HEAP_POP(to_decode, cd, request.list);
+		} else {
+			WORKER_HEAP_POP(localized, cd, request.list);
 		}
+		if (!cd) cd = fr_worker_steal(worker, &stolen_from);
 		if (!cd) return NULL;
 
+		start = fr_time();
 		worker->num_decoded++;
 
 		/*
@@ -669,22 +1585,18 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 		if (cd->request.recv_time && (cd->m.when != *cd->request.recv_time)) {
 			fr_log(worker->log, L_DBG, "\t%sIGNORING old message: was %zd now %zd", worker->name,
 				*cd->request.recv_time, cd->m.when);
-			fr_worker_nak(worker, cd, fr_time());
+			worker->num_timeouts++;
+			fr_worker_nak(worker, cd, stolen_from, start);
 			cd = NULL;
+			stolen_from = NULL;
 		}
 	} while (!cd);
 
-	ctx = request = request_alloc(NULL);
+	request = fr_worker_request_alloc(worker);
 	if (!request) goto nak;
 
 	request->el = worker->el;
 	request->backlog = worker->runnable;
-	request->packet = fr_radius_alloc(request, false);
-	rad_assert(request->packet != NULL);
-	request->reply = fr_radius_alloc(request, false);
-	rad_assert(request->reply != NULL);
-
-	request->async = talloc_zero(request, fr_async_t);
 	request->server_cs = cd->listen->server_cs;
 
 	/*
@@ -708,10 +1620,26 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	request->async->el = worker->el;
 	request->number = worker->number++;
 
+	request->async->priority = cd->priority;
+	request->async->code = cd->code;
 	request->async->listen = cd->listen;
 	request->async->packet_ctx = cd->packet_ctx;
+	request->async->stolen_from = stolen_from;
 	listen = request->async->listen;
 
+	/*
+	 *	Let the decoder point VALUE_PAIRs at the message data,
+	 *	instead of copying it.  The message is then held until
+	 *	nothing refers to it.
+	 */
+	if (listen->zero_copy) {
+		request->async->message = fr_message_ref_alloc(request, &cd->m);
+		if (!request->async->message) {
+			fr_worker_request_free(worker, request);
+			goto nak;
+		}
+	}
+
 	/*
 	 *	Now that the "request" structure has been initialized, go decode the packet.
 	 *
@@ -725,9 +1653,10 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 
 	if (ret < 0) {
 		fr_log(worker->log, L_DBG, "\t%sFAILED decode of request %"PRIu64, worker->name, request->number);
-		talloc_free(ctx);
+		if (request->async->message) fr_message_ref_detach(request->async->message);
+		fr_worker_request_free(worker, request);
 nak:
-		fr_worker_nak(worker, cd, fr_time());
+		fr_worker_nak(worker, cd, stolen_from, start);
 		return NULL;
 	}
 
@@ -745,9 +1674,16 @@ nak:
 	if (!cd->request.recv_time) request->async->original_recv_time = &request->async->recv_time;
 
 	/*
-	 *	We're done with this message.
+	 *	We're done with this message.  If the decoder kept
+	 *	references to it, it's marked done when the last of
+	 *	them is freed.
 	 */
-	fr_message_done(&cd->m);
+	if (request->async->message) {
+		(void) talloc_unlink(request, request->async->message);
+		request->async->message = NULL;
+	} else {
+		fr_message_done(&cd->m);
+	}
 
 	/*
 	 *	New requests are inserted into the time order list in
@@ -890,6 +1826,17 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 
 	WORKER_VERIFY;
 
+	/*
+	 *	Let the scheduler know how busy we are.
+	 */
+	atomic_store_explicit(&worker->load_backlog,
+			      (int) (fr_heap_num_elements(worker->runnable) +
+				     fr_heap_num_elements(worker->localized.heap) +
+				     fr_heap_num_elements(worker->to_decode.heap)) +
+			      worker->num_outstanding, memory_order_relaxed);
+	atomic_store_explicit(&worker->load_channels, worker->num_channels, memory_order_relaxed);
+	atomic_store_explicit(&worker->load_running, worker->tracking.running, memory_order_relaxed);
+
 	/*
 	 *	The application is polling the event loop, but has
 	 *	other work to do.  Don't bother decoding any packets.
@@ -903,7 +1850,10 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	 */
 	sleeping = (fr_heap_num_elements(worker->runnable) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->localized.heap) == 0);
-	if (sleeping) sleeping = (fr_heap_num_elements(worker->to_decode.heap) == 0);
+	if (sleeping) {
+		fr_worker_steal_reclaim(worker);
+		sleeping = (fr_heap_num_elements(worker->to_decode.heap) == 0);
+	}
 
 	/*
 	 *	Tell the event loop that there is new work to do.  We
@@ -912,6 +1862,12 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	 */
 	if (!sleeping) return 1;
 
+	/*
+	 *	Nothing to do, so we can finish closing any channels
+	 *	the master has asked us to close.
+	 */
+	fr_worker_close_channels(worker);
+
 	fr_log(worker->log, L_DBG, "\t%ssleeping running %zd, localized %zd, to_decode %zd",
 	       worker->name,
 	       fr_heap_num_elements(worker->runnable),
@@ -997,21 +1953,55 @@ void fr_worker_destroy(fr_worker_t *worker)
 		fr_message_done(&cd->m);
 	}
 
+	/*
+	 *	Take back any messages we offered to other workers,
+	 *	and stop other workers from waking us up.  Replies
+	 *	from other workers are cleaned up when the steal
+	 *	group is freed.
+	 *
+	 *	Requests we took from other workers are returned
+	 *	without a reply, so that their owners don't wait
+	 *	for them forever.
+	 */
+	if (worker->steal_slot) {
+		atomic_store_explicit(&worker->steal_slot->joined, false, memory_order_release);
+
+		while (fr_atomic_queue_pop(worker->steal_slot->offered, (void **) &cd)) {
+			fr_message_done(&cd->m);
+		}
+
+		fr_worker_steal_abandon(worker, &worker->time_order);
+		fr_worker_steal_abandon(worker, &worker->waiting_to_die);
+		rad_assert(worker->num_holding == 0);
+
+		/*
+		 *	Our peers may have offered work which they
+		 *	expected us to take.  Wake them up, so that
+		 *	they take it back.
+		 */
+		for (i = 0; i < worker->steal->num_workers; i++) {
+			if (i == worker->steal_id) continue;
+
+			fr_worker_steal_wake(&worker->steal->slot[i]);
+		}
+	}
+
 	/*
 	 *	Signal the channels that we're closing.
 	 *
 	 *	The other end owns the channel, and will take care of
 	 *	popping messages in the TO_WORKER queue, and marking
-	 *	them FR_MESSAGE_DONE.  It will ignore the messages in
-	 *	the FROM_WORKER queue, as we own those.  They will be
-	 *	automatically freed when our talloc context is freed.
+	 *	them FR_MESSAGE_DONE.  It takes the message sets for
+	 *	the FROM_WORKER queue from us, and frees them once it
+	 *	has written the replies.
 	 */
 	for (i = 0; i < worker->num_channels; i++) {
-		fr_channel_worker_ack_close(worker->channel[i]);
+		fr_worker_channel_close(worker, worker->channel[i]);
 	}
 
 	(void) fr_event_pre_delete(worker->el, fr_worker_pre_event, worker);
 	(void) fr_event_post_delete(worker->el, fr_worker_post_event, worker);
+	if (worker->control_fd >= 0) (void) fr_event_fd_delete(worker->el, worker->control_fd);
 
 	talloc_free(worker);
 }
@@ -1048,16 +2038,24 @@ nomem:
 		goto nomem;
 	}
 
+	worker->closing = talloc_zero_array(worker, bool, max_channels);
+	if (!worker->closing) {
+		talloc_free(worker);
+		goto nomem;
+	}
+
 	worker->el = el;
 	worker->log = logger;
+	worker->control_fd = -1;
 
 	/*
 	 *	@todo make these configurable
 	 */
 	worker->max_channels = max_channels;
-	worker->talloc_pool_size = 4096; /* at least enough for a REQUEST */
+	worker->talloc_pool_size = FR_WORKER_ARENA_MIN;
 	worker->message_set_size = 1024;
 	worker->ring_buffer_size = (1 << 16);
+	worker->min_delay = FR_WORKER_MAX_DELAY;
 
 	if (fr_event_pre_insert(worker->el, fr_worker_pre_event, worker) < 0) {
 		fr_strerror_printf("Failed adding pre-check to event list");
@@ -1094,6 +2092,7 @@ nomem:
 	if (!worker->control) {
 		fr_strerror_printf("Failed creating control plane: %s", fr_strerror());
 	fail2:
+		if (worker->control_fd >= 0) (void) fr_event_fd_delete(worker->el, worker->control_fd);
 		(void) fr_event_user_delete(worker->el, fr_worker_evfilt_user, worker);
 		goto fail;
 	}
@@ -1103,13 +2102,24 @@ nomem:
 		goto fail2;
 	}
 
+	/*
+	 *	Channels signal us once per wakeup, instead of once
+	 *	per message.  And on Linux, via an eventfd.
+	 */
+	worker->control_fd = fr_control_wakeup_fd(worker->control);
+	if ((worker->control_fd >= 0) &&
+	    (fr_event_fd_insert(worker->el, worker->control_fd, fr_worker_control_read, NULL, NULL, worker) < 0)) {
+		fr_strerror_printf("Failed adding control eventfd: %s", fr_strerror());
+		goto fail2;
+	}
+
 	WORKER_HEAP_INIT(to_decode, worker_message_cmp, fr_channel_data_t, channel.heap_id);
 	WORKER_HEAP_INIT(localized, worker_message_cmp, fr_channel_data_t, channel.heap_id);
 
 	worker->runnable = fr_heap_create(worker_request_cmp, offsetof(REQUEST, heap_id));
 	if (!worker->runnable) {
 		fr_strerror_printf("Failed creating runnable heap");
-		goto fail;
+		goto fail2;
 	}
 	FR_DLIST_INIT(worker->time_order);
 	FR_DLIST_INIT(worker->waiting_to_die);
@@ -1182,6 +2192,12 @@ static void fr_worker_post_event(UNUSED fr_event_list_t *el, UNUSED struct timev
 		fr_worker_check_timeouts(worker, now);
 	}
 
+	/*
+	 *	If we have a backlog, let other workers take some of
+	 *	it.
+	 */
+	fr_worker_steal_offer(worker);
+
 	/*
 	 *	Get a runnable request.  If there isn't one, continue.
 	 *
@@ -1219,10 +2235,13 @@ void fr_worker(fr_worker_t *worker)
 		WORKER_VERIFY;
 
 		/*
-		 *	There are runnable requests.  We still service
-		 *	the event loop, but we don't wait for events.
+		 *	There are runnable requests, or messages to
+		 *	decode.  We still service the event loop, but
+		 *	we don't wait for events.
 		 */
 		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+		if (wait_for_event) wait_for_event = (fr_heap_num_elements(worker->localized.heap) == 0);
+		if (wait_for_event) wait_for_event = (fr_heap_num_elements(worker->to_decode.heap) == 0);
 		fr_log(worker->log, L_DBG, "\t%sWaiting for events %d", worker->name, wait_for_event);
 
 		/*
@@ -1230,6 +2249,7 @@ void fr_worker(fr_worker_t *worker)
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		num_events = fr_event_corral(worker->el, wait_for_event);
+		fr_time_sync();
 		fr_log(worker->log, L_DBG, "\t%sGot num_events %d", worker->name, num_events);
 		if (num_events < 0) {
 			if (worker->exiting) break; /* don't complain if we're exiting */
@@ -1239,9 +2259,12 @@ void fr_worker(fr_worker_t *worker)
 		}
 
 		/*
-		 *	Service outstanding events.
+		 *	Service outstanding events.  If we have work
+		 *	to do, service the event list even when there
+		 *	are no events, as the post-event callback is
+		 *	what runs the requests.
 		 */
-		if (num_events > 0) {
+		if ((num_events > 0) || !wait_for_event) {
 			fr_log(worker->log, L_DBG, "\t%sservicing events", worker->name);
 			fr_event_service(worker->el);
 		}
@@ -1261,14 +2284,47 @@ void fr_worker_debug(fr_worker_t *worker, FILE *fp)
 	fprintf(fp, "\tkq = %d\n", worker->kq);
 	fprintf(fp, "\tnum_channels = %d\n", worker->num_channels);
 	fprintf(fp, "\tnum_requests = %d\n", worker->num_requests);
+	fprintf(fp, "\tnum_timeouts = %d\n", worker->num_timeouts);
+	fprintf(fp, "\tnum_shed = %d\n", worker->num_shed);
+
+	fprintf(fp, "\tnum_offered = %d\n", worker->num_offered);
+	fprintf(fp, "\tnum_reclaimed = %d\n", worker->num_reclaimed);
+	fprintf(fp, "\tnum_returned = %d\n", worker->num_returned);
+	fprintf(fp, "\tnum_stolen = %d\n", worker->num_stolen);
+	fprintf(fp, "\tnum_holding = %d\n", worker->num_holding);
+
+	fprintf(fp, "\tarena_size = %zu\n", worker->talloc_pool_size);
+	fprintf(fp, "\tnum_shells = %d\n", worker->num_shells);
+	fprintf(fp, "\tnum_shells_alloc = %" PRIu64 "\n", worker->num_shells_alloc);
+	fprintf(fp, "\tnum_shells_reused = %" PRIu64 "\n", worker->num_shells_reused);
+	fprintf(fp, "\tshell hit rate = %.3f\n",
+		(worker->num_shells_alloc + worker->num_shells_reused) ?
+		((double) worker->num_shells_reused) / (worker->num_shells_alloc + worker->num_shells_reused) : 0.0);
 
 	fprintf(fp, "\tcalculated (predicted) total CPU time = %zd\n", worker->tracking.predicted * worker->num_requests);
-	fprintf(fp, "\tcalculated (counted) per request time = %zd\n", worker->tracking.running / worker->num_requests);
+	fprintf(fp, "\tcalculated (counted) per request time = %zd\n",
+		worker->num_requests ? worker->tracking.running / worker->num_requests : 0);
 
 	fr_time_tracking_debug(&worker->tracking, fp);
 
 }
 
+/** Get a snapshot of how busy the worker is
+ *
+ *  This function may be called from any thread.  The values are
+ *  updated by the worker every time it goes through its event loop,
+ *  and may be slightly out of date.
+ *
+ * @param[in] worker the worker
+ * @param[out] load where the snapshot is written
+ */
+void fr_worker_load(fr_worker_t *worker, fr_worker_load_t *load)
+{
+	load->backlog = atomic_load_explicit(&worker->load_backlog, memory_order_relaxed);
+	load->num_channels = atomic_load_explicit(&worker->load_channels, memory_order_relaxed);
+	load->running = atomic_load_explicit(&worker->load_running, memory_order_relaxed);
+}
+
 /** Create a channel to the worker
  *
  *  Called by the master (i.e. network) thread when it needs to create
@@ -1300,6 +2356,114 @@ fr_channel_t *fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 }
 
 
+static int _worker_steal_free(fr_worker_steal_t *ws)
+{
+	int			i;
+	fr_worker_stolen_t	*st;
+
+	for (i = 0; i < ws->num_workers; i++) {
+		while (fr_atomic_queue_pop(ws->slot[i].returned, (void **) &st)) {
+			free(st);
+		}
+	}
+
+	return 0;
+}
+
+/** Create a group of workers which can steal work from each other
+ *
+ *  The group MUST be freed only after all of the workers in it have
+ *  exited.
+ *
+ * @param[in] ctx the talloc context
+ * @param[in] num_workers the maximum number of workers in the group
+ * @return
+ *	- NULL on error
+ *	- fr_worker_steal_t on success
+ */
+fr_worker_steal_t *fr_worker_steal_create(TALLOC_CTX *ctx, int num_workers)
+{
+	int i;
+	fr_worker_steal_t *ws;
+
+	if (num_workers <= 0) {
+		fr_strerror_printf("Invalid number of workers %d", num_workers);
+		return NULL;
+	}
+
+	ws = talloc_zero(ctx, fr_worker_steal_t);
+	if (!ws) {
+	nomem:
+		fr_strerror_printf("Failed allocating memory");
+		return NULL;
+	}
+
+	ws->num_workers = num_workers;
+	ws->slot = talloc_zero_array(ws, fr_worker_steal_slot_t, num_workers);
+	if (!ws->slot) {
+		talloc_free(ws);
+		goto nomem;
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		ws->slot[i].offered = fr_atomic_queue_create(ws, FR_WORKER_STEAL_MAX);
+		ws->slot[i].returned = fr_atomic_queue_create(ws, FR_WORKER_STEAL_MAX);
+		if (!ws->slot[i].offered || !ws->slot[i].returned) {
+			talloc_free(ws);
+			goto nomem;
+		}
+
+		ws->slot[i].control = NULL;
+		atomic_init(&ws->slot[i].joined, false);
+	}
+
+	talloc_set_destructor(ws, _worker_steal_free);
+
+	return ws;
+}
+
+/** Add a worker to a steal group
+ *
+ *  This function MUST be called from the worker thread, before the
+ *  worker starts processing packets.
+ *
+ * @param[in] worker the worker
+ * @param[in] ws the steal group
+ * @param[in] id the index of the worker in the group
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *ws, int id)
+{
+	fr_worker_steal_slot_t *slot;
+
+	WORKER_VERIFY;
+
+	if ((id < 0) || (id >= ws->num_workers)) {
+		fr_strerror_printf("Invalid worker ID %d", id);
+		return -1;
+	}
+
+	slot = &ws->slot[id];
+	if (atomic_load_explicit(&slot->joined, memory_order_acquire)) {
+		fr_strerror_printf("Worker ID %d is already in use", id);
+		return -1;
+	}
+
+	slot->control = worker->control;
+
+	worker->steal = ws;
+	worker->steal_slot = slot;
+	worker->steal_id = id;
+	worker->steal_next = id;
+
+	atomic_store_explicit(&slot->joined, true, memory_order_release);
+
+	return 0;
+}
+
+
 /** Set the name of a worker.
  *
  *  Called by the master (i.e. network) thread when it needs to create
@@ -44,6 +44,20 @@ extern "C" {
  */
 typedef struct fr_worker_t fr_worker_t;
 
+/**
+ *  A group of workers which can steal work from each other.
+ */
+typedef struct fr_worker_steal_t fr_worker_steal_t;
+
+/**
+ *  A snapshot of how busy a worker is, for the scheduler.
+ */
+typedef struct fr_worker_load_t {
+	int		backlog;	//!< messages and requests waiting to be run, or offered to other workers
+	int		num_channels;	//!< number of open channels
+	fr_time_t	running;	//!< total time the worker has spent running requests
+} fr_worker_load_t;
+
 fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t const *logger, uint32_t flags) CC_HINT(nonnull(2,3));
 void fr_worker_destroy(fr_worker_t *worker) CC_HINT(nonnull);
 int fr_worker_kq(fr_worker_t *worker) CC_HINT(nonnull);
@@ -51,7 +65,10 @@ fr_event_list_t *fr_worker_el(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker_exit(fr_worker_t *worker) CC_HINT(nonnull);
 void fr_worker_debug(fr_worker_t *worker, FILE *fp) CC_HINT(nonnull);
+void fr_worker_load(fr_worker_t *worker, fr_worker_load_t *load) CC_HINT(nonnull);
 void fr_worker_name(fr_worker_t *worker, char const *name) CC_HINT(nonnull);
+fr_worker_steal_t *fr_worker_steal_create(TALLOC_CTX *ctx, int num_workers);
+int fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *ws, int id) CC_HINT(nonnull);
 fr_channel_t *fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_control_t *master) CC_HINT(nonnull);
 
 #ifdef __cplusplus
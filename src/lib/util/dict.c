@@ -67,6 +67,35 @@ typedef struct dict_enum_fixup_t {
 	struct dict_enum_fixup_t *next;	//!< Next in the linked list of fixups.
 } dict_enum_fixup_t;
 
+/** A slot in the perfect hash of vendors
+ *
+ */
+typedef struct dict_vendor_slot {
+	unsigned int		vendorpec;		//!< PEN of the vendor in this slot.
+	fr_dict_attr_t const	*da;			//!< Vendor attribute, or NULL if the slot is empty.
+	fr_dict_vendor_t const	*dv;			//!< Vendor definition.
+} dict_vendor_slot_t;
+
+/** Perfect hash of the vendors under a VSA or EVS attribute
+ *
+ * Built by fr_dict_freeze() using "hash and displace".  The PEN is hashed
+ * to find a bucket, and the displacement for that bucket seeds a second
+ * hash, which gives the slot.  Displacements are picked so that no two
+ * vendors share a slot, so a lookup is two hashes and one comparison.
+ */
+struct dict_vendor_index {
+	uint32_t		bucket_mask;		//!< Number of buckets - 1.
+	uint32_t		slot_mask;		//!< Number of slots - 1.
+	uint16_t		*disp;			//!< Displacement for each bucket.
+	dict_vendor_slot_t	*slot;			//!< Vendor slots.
+};
+
+/*
+ *	Frozen lookup tables are read for every attribute we decode,
+ *	so start them on a cache line.
+ */
+#define DICT_CACHE_LINE	(64)
+
 /** Vendors and attribute names
  *
  * It's very likely that the same vendors will operate in multiple
@@ -587,6 +616,202 @@ int fr_dict_vendor_add(fr_dict_t *dict, char const *name, unsigned int num)
 	return 0;
 }
 
+/** Allocate a zeroed table which starts on a cache line
+ *
+ * The table is freed along with ctx.
+ */
+static void *dict_table_alloc(TALLOC_CTX *ctx, size_t size)
+{
+	uint8_t *p;
+
+	p = talloc_zero_array(ctx, uint8_t, size + DICT_CACHE_LINE - 1);
+	if (!p) return NULL;
+
+	return (void *)(((uintptr_t) p + DICT_CACHE_LINE - 1) & ~((uintptr_t) DICT_CACHE_LINE - 1));
+}
+
+/** Point an entry in the dense child table at the child fr_dict_attr_child_by_num() would find in the bins
+ *
+ */
+static void dict_child_index_set(fr_dict_attr_t *parent, unsigned int attr)
+{
+	fr_dict_attr_t const *bin;
+
+	for (bin = parent->children[attr]; bin; bin = bin->next) {
+		if (bin->attr == attr) break;
+	}
+
+	parent->child_index[attr] = bin;
+}
+
+static inline uint32_t dict_vendor_hash(uint32_t vendorpec, uint32_t seed)
+{
+	uint32_t hash = (vendorpec ^ seed) * 0x9e3779b1;
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+
+	return hash;
+}
+
+#define DICT_VENDOR_SEED(_disp) ((((uint32_t) (_disp)) + 1) * 0x27d4eb2f)
+
+static inline dict_vendor_slot_t const *dict_vendor_index_find(struct dict_vendor_index const *index,
+							       unsigned int vendorpec)
+{
+	dict_vendor_slot_t const *slot;
+	uint16_t disp;
+
+	disp = index->disp[dict_vendor_hash(vendorpec, 0) & index->bucket_mask];
+	slot = &index->slot[dict_vendor_hash(vendorpec, DICT_VENDOR_SEED(disp)) & index->slot_mask];
+
+	if (!slot->da || (slot->vendorpec != vendorpec)) return NULL;
+
+	return slot;
+}
+
+typedef struct dict_vendor_key {
+	fr_dict_attr_t const	*da;
+	uint32_t		bucket;
+} dict_vendor_key_t;
+
+typedef struct dict_vendor_bucket {
+	uint32_t		bucket;
+	uint32_t		start;			//!< First key in this bucket.
+	uint32_t		num;			//!< Number of keys in this bucket.
+} dict_vendor_bucket_t;
+
+static int dict_vendor_key_cmp(void const *one, void const *two)
+{
+	dict_vendor_key_t const *a = one, *b = two;
+
+	return (a->bucket > b->bucket) - (a->bucket < b->bucket);
+}
+
+static int dict_vendor_bucket_cmp(void const *one, void const *two)
+{
+	dict_vendor_bucket_t const *a = one, *b = two;
+
+	return (a->num < b->num) - (a->num > b->num);	/* biggest first */
+}
+
+/** Build the perfect hash of the vendors under a VSA or EVS attribute
+ *
+ * @param[in] dict	the attribute is in.  Used to find the vendor definitions.
+ * @param[in] parent	VSA or EVS attribute.  Its children are all vendors.
+ * @return
+ *	- The new index, allocated in the context of parent.
+ *	- NULL on error.
+ */
+static struct dict_vendor_index *dict_vendor_index_alloc(fr_dict_t *dict, fr_dict_attr_t *parent)
+{
+	struct dict_vendor_index	*index = NULL;
+	dict_vendor_key_t		*key;
+	dict_vendor_bucket_t		*bucket;
+	uint32_t			*placed;
+	fr_dict_attr_t const		*bin;
+	uint32_t			num = 0, num_buckets, buckets = 1, slots = 1;
+	uint32_t			i, j, k, disp, s;
+
+	for (i = 0; i < talloc_array_length(parent->children); i++) {
+		for (bin = parent->children[i]; bin; bin = bin->next) num++;
+	}
+
+	key = talloc_array(NULL, dict_vendor_key_t, num + 1);
+	bucket = talloc_array(key, dict_vendor_bucket_t, num + 1);
+	placed = talloc_array(key, uint32_t, num + 1);
+	if (!key || !bucket || !placed) {
+	oom:
+		fr_strerror_printf("%s: Out of memory", __FUNCTION__);
+		talloc_free(key);
+		talloc_free(index);
+		return NULL;
+	}
+
+	/*
+	 *	About two keys per bucket, and the table no more
+	 *	than half full, so that displacements are found quickly.
+	 */
+	while (buckets < ((num + 1) / 2)) buckets <<= 1;
+	while (slots < (num * 2)) slots <<= 1;
+
+	for (i = 0, j = 0; i < talloc_array_length(parent->children); i++) {
+		for (bin = parent->children[i]; bin; bin = bin->next) {
+			key[j].da = bin;
+			key[j].bucket = dict_vendor_hash(bin->attr, 0) & (buckets - 1);
+			j++;
+		}
+	}
+
+	/*
+	 *	Group the keys by bucket, and place the biggest
+	 *	buckets first, while there's still lots of room.
+	 */
+	qsort(key, num, sizeof(*key), dict_vendor_key_cmp);
+
+	for (i = 0, num_buckets = 0; i < num; i++) {
+		if ((num_buckets == 0) || (bucket[num_buckets - 1].bucket != key[i].bucket)) {
+			bucket[num_buckets].bucket = key[i].bucket;
+			bucket[num_buckets].start = i;
+			bucket[num_buckets].num = 0;
+			num_buckets++;
+		}
+		bucket[num_buckets - 1].num++;
+	}
+
+	qsort(bucket, num_buckets, sizeof(*bucket), dict_vendor_bucket_cmp);
+
+retry:
+	index = talloc_zero(parent, struct dict_vendor_index);
+	if (!index) goto oom;
+
+	index->bucket_mask = buckets - 1;
+	index->slot_mask = slots - 1;
+	index->disp = talloc_zero_array(index, uint16_t, buckets);
+	index->slot = dict_table_alloc(index, sizeof(*index->slot) * slots);
+	if (!index->disp || !index->slot) goto oom;
+
+	for (i = 0; i < num_buckets; i++) {
+		dict_vendor_key_t *this = &key[bucket[i].start];
+
+		for (disp = 0; disp <= UINT16_MAX; disp++) {
+			for (k = 0; k < bucket[i].num; k++) {
+				s = dict_vendor_hash(this[k].da->attr, DICT_VENDOR_SEED(disp)) & index->slot_mask;
+				if (index->slot[s].da) break;
+
+				index->slot[s].da = this[k].da;
+				placed[k] = s;
+			}
+			if (k == bucket[i].num) break;
+
+			while (k > 0) index->slot[placed[--k]].da = NULL;
+		}
+
+		/*
+		 *	Very unlikely, but we can always make more room.
+		 */
+		if (disp > UINT16_MAX) {
+			TALLOC_FREE(index);
+			slots <<= 1;
+			goto retry;
+		}
+
+		index->disp[bucket[i].bucket] = disp;
+	}
+
+	for (i = 0; i < slots; i++) {
+		if (!index->slot[i].da) continue;
+
+		index->slot[i].vendorpec = index->slot[i].da->attr;
+		index->slot[i].dv = fr_dict_vendor_by_num(dict, index->slot[i].da->attr);
+	}
+
+	talloc_free(key);
+
+	return index;
+}
+
 /** Add a child to a parent.
  *
  * @param parent we're adding a child to.
@@ -668,6 +893,14 @@ static inline int fr_dict_attr_child_add(fr_dict_attr_t *parent, fr_dict_attr_t
 	child->next = *this;
 	*this = child;
 
+	/*
+	 *	Keep the frozen lookup tables in sync.  The vendor
+	 *	hash can't be updated in place, so we throw it away,
+	 *	and fall back to the bins until the next fr_dict_freeze().
+	 */
+	if (parent->child_index && (child->attr <= UINT8_MAX)) dict_child_index_set(parent, child->attr);
+	if (parent->vendor_index) TALLOC_FREE(parent->vendor_index);
+
 	return 0;
 }
 
@@ -2852,6 +3085,8 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 	fr_hash_table_walk(dict->values_by_da, hash_null_callback, NULL);
 	fr_hash_table_walk(dict->values_by_alias, hash_null_callback, NULL);
 
+	if (fr_dict_freeze(dict) < 0) goto error;
+
 	*out = dict;
 
 	return 0;
@@ -2859,6 +3094,8 @@ int fr_dict_from_file(TALLOC_CTX *ctx, fr_dict_t **out, char const *dir, char co
 
 int fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename)
 {
+	int rcode;
+
 	INTERNAL_IF_NULL(dict);
 
 	if (!dict->attributes_by_name) {
@@ -2866,7 +3103,184 @@ int fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename)
 		return -1;
 	}
 
-	return dict_from_file(dict, dir, filename, NULL, 0);
+	rcode = dict_from_file(dict, dir, filename, NULL, 0);
+	if (rcode < 0) return rcode;	/* -2 means the file doesn't exist */
+
+	return fr_dict_freeze(dict);
+}
+
+/** Build the header template used by the encoder
+ *
+ * @param[in] da to build the template for.
+ */
+static void dict_attr_hdr_init(fr_dict_attr_t const *da)
+{
+	fr_dict_attr_t		*mutable;
+	fr_dict_attr_t const	*dv, *vsa;
+	fr_dict_attr_hdr_t	hdr;
+	uint8_t			*p;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	switch (da->type) {
+	case FR_TYPE_STRUCTURAL:
+		goto done;
+
+	default:
+		break;
+	}
+
+	if (da->flags.is_unknown || da->flags.internal || da->flags.concat) goto done;
+
+	/*
+	 *	RFC attribute: attr, len
+	 */
+	if (da->parent->flags.is_root) {
+		if (da->vendor || (da->attr == 0) || (da->attr > UINT8_MAX)) goto done;
+
+		hdr.data[0] = da->attr;
+		hdr.data[1] = 2;
+		hdr.length_offset[0] = 1;
+		hdr.len = 2;
+		goto done;
+	}
+
+	/*
+	 *	VSA: 26, len, vendor-id, then the vendor's own
+	 *	type and length fields.  WiMAX does its own thing.
+	 */
+	dv = da->parent;
+	if (dv->type != FR_TYPE_VENDOR) goto done;
+
+	vsa = dv->parent;
+	if ((vsa->type != FR_TYPE_VSA) || (vsa->attr != FR_VENDOR_SPECIFIC) ||
+	    !vsa->parent->flags.is_root || (dv->attr == VENDORPEC_WIMAX)) goto done;
+
+	switch (dv->flags.type_size) {
+	case 1:
+		if ((dv->flags.length == 1) && (da->attr > UINT8_MAX)) goto done;
+		break;
+
+	case 2:
+	case 4:
+		break;
+
+	default:
+		goto done;
+	}
+
+	if (dv->flags.length > 2) goto done;
+
+	hdr.data[0] = FR_VENDOR_SPECIFIC;
+	hdr.data[2] = (dv->attr >> 24) & 0xff;
+	hdr.data[3] = (dv->attr >> 16) & 0xff;
+	hdr.data[4] = (dv->attr >> 8) & 0xff;
+	hdr.data[5] = dv->attr & 0xff;
+	hdr.length_offset[0] = 1;
+
+	p = hdr.data + 6;
+	switch (dv->flags.type_size) {
+	case 4:
+		*p++ = 0;	/* attr must be 24-bit */
+		*p++ = (da->attr >> 16) & 0xff;
+		/* FALL-THROUGH */
+
+	case 2:
+		*p++ = (da->attr >> 8) & 0xff;
+		/* FALL-THROUGH */
+
+	case 1:
+		*p++ = da->attr & 0xff;
+		break;
+	}
+
+	switch (dv->flags.length) {
+	case 2:
+		*p++ = 0;
+		/* FALL-THROUGH */
+
+	case 1:
+		hdr.length_offset[1] = p - hdr.data;
+		*p++ = dv->flags.type_size + dv->flags.length;
+		break;
+
+	default:
+		break;
+	}
+
+	hdr.len = p - hdr.data;
+	hdr.data[1] = hdr.len;
+
+done:
+	memcpy(&mutable, &da, sizeof(mutable));
+	mutable->hdr = hdr;
+}
+
+static int dict_freeze(fr_dict_t *dict, fr_dict_attr_t const *da)
+{
+	fr_dict_attr_t		*parent;
+	fr_dict_attr_t const	*bin;
+	unsigned int		i;
+
+	if (!da->children) return 0;
+
+	memcpy(&parent, &da, sizeof(parent));
+
+	switch (da->type) {
+	/*
+	 *	Children are vendors, numbered by PEN.
+	 */
+	case FR_TYPE_VSA:
+	case FR_TYPE_EVS:
+		TALLOC_FREE(parent->vendor_index);
+		parent->vendor_index = dict_vendor_index_alloc(dict, parent);
+		if (!parent->vendor_index) return -1;
+		break;
+
+	default:
+		if (!parent->child_index) {
+			parent->child_index = dict_table_alloc(parent, sizeof(parent->child_index[0]) * (UINT8_MAX + 1));
+			if (!parent->child_index) {
+				fr_strerror_printf("%s: Out of memory", __FUNCTION__);
+				return -1;
+			}
+		}
+
+		for (i = 0; i <= UINT8_MAX; i++) dict_child_index_set(parent, i);
+		break;
+	}
+
+	for (i = 0; i < talloc_array_length(da->children); i++) {
+		for (bin = da->children[i]; bin; bin = bin->next) {
+			dict_attr_hdr_init(bin);
+			if (dict_freeze(dict, bin) < 0) return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Build the flat lookup tables and header templates used by the decoder and encoder
+ *
+ * Every attribute with children gets a dense, cache aligned, table of its
+ * children numbered 0..255.  Every VSA and EVS attribute gets a perfect hash
+ * of its vendors, which also holds the vendor definitions.  RFC attributes and
+ * VSAs also get the header template the encoder copies in front of the value.
+ *
+ * This is done automatically by fr_dict_from_file() and fr_dict_read().
+ * Attributes added afterwards are still found, but vendors added afterwards
+ * are found via the slower path until the dictionary is frozen again.
+ *
+ * @param[in] dict to freeze.  If NULL the internal dictionary will be used.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_freeze(fr_dict_t *dict)
+{
+	INTERNAL_IF_NULL(dict);
+
+	return dict_freeze(dict, dict->root);
 }
 
 /*
@@ -4171,6 +4585,18 @@ inline fr_dict_attr_t const *fr_dict_attr_child_by_num(fr_dict_attr_t const *par
 {
 	fr_dict_attr_t const *bin;
 
+	/*
+	 *	Frozen dictionaries have flat tables.
+	 */
+	if (parent->child_index && (attr <= UINT8_MAX)) return parent->child_index[attr];
+
+	if (parent->vendor_index) {
+		dict_vendor_slot_t const *slot;
+
+		slot = dict_vendor_index_find(parent->vendor_index, attr);
+		return slot ? slot->da : NULL;
+	}
+
 	if (!parent->children) return NULL;
 
 	/*
@@ -4200,6 +4626,39 @@ inline fr_dict_attr_t const *fr_dict_attr_child_by_num(fr_dict_attr_t const *par
 	return NULL;
 }
 
+/** Find the vendor attribute, and vendor definition, for a PEN
+ *
+ * Used by decoders which need both for every VSA.  With a frozen dictionary
+ * this is a single perfect hash lookup.
+ *
+ * @param[in] parent	VSA or EVS attribute.
+ * @param[in] vendor	PEN to look for.
+ * @param[out] dv	Where to write the vendor definition.  May be NULL.
+ * @return
+ *	- The vendor attribute on success.
+ *	- NULL if the vendor does not exist under parent.
+ */
+fr_dict_attr_t const *fr_dict_vendor_child_by_num(fr_dict_attr_t const *parent, unsigned int vendor,
+						  fr_dict_vendor_t const **dv)
+{
+	fr_dict_attr_t const *da;
+
+	if (parent->vendor_index) {
+		dict_vendor_slot_t const *slot;
+
+		slot = dict_vendor_index_find(parent->vendor_index, vendor);
+		if (!slot) return NULL;
+
+		if (dv) *dv = slot->dv;
+		return slot->da;
+	}
+
+	da = fr_dict_attr_child_by_num(parent, vendor);
+	if (da && dv) *dv = fr_dict_vendor_by_num(fr_dict_by_da(parent), vendor);
+
+	return da;
+}
+
 /** Lookup the structure representing an enum value in a #fr_dict_attr_t
  *
  * @param[in] dict	of protocol context we're operating in.
@@ -32,8 +32,45 @@ RCSID("$Id$")
 #include <freeradius-devel/event.h>
 #include <freeradius-devel/io/time.h>
 
+/*
+ *	On Linux, kqueue is provided by libkqueue, which translates
+ *	every call into epoll.  When configured --with-epoll, we use
+ *	epoll directly for file descriptors, a timerfd for timers, and
+ *	an eventfd for exit signals.  A kqueue is still created, and watched via epoll,
+ *	so that EVFILT_USER events sent to fr_event_list_kq() work as
+ *	before.
+ */
+#if defined(WITH_EPOLL) && defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#  define USE_EPOLL
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#  include <sys/timerfd.h>
+#endif
+
 #define FR_EV_BATCH_FDS (256)
 
+/*
+ *	Timers which are due more than a couple of ticks in the
+ *	future go into a hierarchical timing wheel, where insert and
+ *	delete are O(1).  Shortly before they're due, they're moved
+ *	to the heap, which runs them at exactly the right time, and in
+ *	order.  Most timers are deleted long before they're due, and
+ *	so never touch the heap.
+ *
+ *	With 1ms ticks, and 4 levels of 256 slots, the wheel covers
+ *	about 49 days.  Anything later goes straight into the heap.
+ */
+#define FR_EVENT_WHEEL_TICK	(1000)				//!< microseconds per tick
+#define FR_EVENT_WHEEL_BITS	(8)
+#define FR_EVENT_WHEEL_SLOTS	(1 << FR_EVENT_WHEEL_BITS)
+#define FR_EVENT_WHEEL_MASK	(FR_EVENT_WHEEL_SLOTS - 1)
+#define FR_EVENT_WHEEL_LEVELS	(4)
+
+/*
+ *	Timers are allocated this many at a time, and re-used.
+ */
+#define FR_EVENT_TIMER_SLAB	(256)
+
 #undef USEC
 #define USEC (1000000)
 
@@ -48,9 +85,13 @@ struct fr_event_timer_t {
 	fr_event_callback_t	callback;		//!< Callback to execute when the timer fires.
 	void const		*ctx;			//!< Context pointer to pass to the callback.
 	struct timeval		when;			//!< When this timer should fire.
+	uint64_t		tick;			//!< The wheel tick when this timer should fire.
 
 	fr_event_timer_t	**parent;		//!< Previous timer.
 	int			heap;			//!< Where to store opaque heap data.
+
+	bool			in_wheel;		//!< In the wheel, rather than the heap.
+	fr_dlist_t		entry;			//!< Entry in a wheel slot, or in the free list.
 };
 
 /** A file descriptor event
@@ -79,6 +120,12 @@ typedef struct fr_event_fd_t {
 	bool			do_delete;		//!< Deferred deletion flag.  Delete this event *after*
 							//!< the handlers complete.
 
+#ifdef USE_EPOLL
+	bool			always_ready;		//!< epoll won't watch regular files, so we call
+							//!< their handlers on every loop, as kqueue does.
+	fr_dlist_t		entry;			//!< Entry in the list of always ready FDs.
+#endif
+
 	void			*ctx;			//!< Context pointer to pass to each file descriptor callback.
 } fr_event_fd_t;
 
@@ -118,7 +165,20 @@ typedef struct fr_event_user_t {
  */
 struct fr_event_list_t {
 	fr_heap_t		*times;			//!< of timer events to be executed.
+
+	fr_dlist_t		wheel[FR_EVENT_WHEEL_LEVELS][FR_EVENT_WHEEL_SLOTS];	//!< of timers which aren't due yet.
+	uint64_t		wheel_tick;		//!< All timers due at or before this tick are in the heap.
+	uint64_t		wheel_next;		//!< No timers need to leave the wheel before this tick.
+	int			num_wheel;		//!< Number of timers in the wheel.
+
+	fr_dlist_t		timer_free;		//!< of unused timers.
+#ifdef USE_EPOLL
+	fr_event_fd_t		**fd_map;		//!< FD events, indexed by FD.
+	int			fd_map_size;		//!< Number of entries in fd_map.
+	fr_dlist_t		always_ready;		//!< FDs which epoll can't watch.
+#else
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
+#endif
 
 	int			exit;
 
@@ -130,12 +190,23 @@ struct fr_event_list_t {
 	int			num_fd_events;		//!< Number of events in this event list.
 
 	int			kq;			//!< instance associated with this event list.
+#ifdef USE_EPOLL
+	int			epfd;			//!< epoll instance which does the real work.
+	int			wakeup_fd;		//!< eventfd used to signal that we're exiting.
+	int			timer_fd;		//!< timerfd armed for the first timer event.
+	struct timeval		timer_armed;		//!< when timer_fd will fire, or zero.
+#endif
 
 	fr_dlist_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_t		user_callbacks;		//!< EVFILT_USER callbacks
 	fr_dlist_t		post_callbacks;		//!< post-processing callbacks
 
+#ifdef USE_EPOLL
+	struct epoll_event	events[FR_EV_BATCH_FDS]; /* so it doesn't go on the stack every time */
+	struct kevent		user_events[FR_EV_BATCH_FDS];
+#else
 	struct kevent		events[FR_EV_BATCH_FDS]; /* so it doesn't go on the stack every time */
+#endif
 };
 
 /** Compare two timer events to see which one should occur first
@@ -161,6 +232,54 @@ static int fr_event_timer_cmp(void const *a, void const *b)
 	return 0;
 }
 
+#ifdef USE_EPOLL
+/** Find the handle for a file descriptor
+ *
+ * @param[in] el	to search in.
+ * @param[in] fd	to search for.
+ * @return
+ *	- NULL if the file descriptor isn't in the event list.
+ *	- the handle for the file descriptor.
+ */
+static inline fr_event_fd_t *fr_event_fd_find(fr_event_list_t *el, int fd)
+{
+	if ((fd < 0) || (fd >= el->fd_map_size)) return NULL;
+
+	return el->fd_map[fd];
+}
+
+/** Add the handle for a file descriptor
+ *
+ * @param[in] el	to add the handle to.
+ * @param[in] ef	to add.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_event_fd_map_insert(fr_event_list_t *el, fr_event_fd_t *ef)
+{
+	if (ef->fd >= el->fd_map_size) {
+		int size = el->fd_map_size ? el->fd_map_size : 64;
+		fr_event_fd_t **fd_map;
+
+		while (size <= ef->fd) size *= 2;
+
+		fd_map = talloc_realloc(el, el->fd_map, fr_event_fd_t *, size);
+		if (!fd_map) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		memset(fd_map + el->fd_map_size, 0, sizeof(*fd_map) * (size - el->fd_map_size));
+
+		el->fd_map = fd_map;
+		el->fd_map_size = size;
+	}
+
+	el->fd_map[ef->fd] = ef;
+
+	return 0;
+}
+#else
 /** Compare two file descriptor handles
  *
  * @param[in] a the first file descriptor handle.
@@ -180,6 +299,25 @@ static int fr_event_fd_cmp(void const *a, void const *b)
 	return 0;
 }
 
+/** Find the handle for a file descriptor
+ *
+ * @param[in] el	to search in.
+ * @param[in] fd	to search for.
+ * @return
+ *	- NULL if the file descriptor isn't in the event list.
+ *	- the handle for the file descriptor.
+ */
+static inline fr_event_fd_t *fr_event_fd_find(fr_event_list_t *el, int fd)
+{
+	fr_event_fd_t find;
+
+	memset(&find, 0, sizeof(find));
+	find.fd = fd;
+
+	return rbtree_finddata(el->fds, &find);
+}
+#endif
+
 /** Return the number of file descriptors is_registered with this event loop
  *
  */
@@ -199,7 +337,7 @@ int fr_event_list_num_elements(fr_event_list_t *el)
 {
 	if (!el) return -1;
 
-	return fr_heap_num_elements(el->times);
+	return fr_heap_num_elements(el->times) + el->num_wheel;
 }
 
 /** Return the kq associated with an event list.
@@ -251,12 +389,9 @@ int fr_event_list_time(struct timeval *when, fr_event_list_t *el)
  */
 int fr_event_fd_delete(fr_event_list_t *el, int fd)
 {
-	fr_event_fd_t *ef, find;
+	fr_event_fd_t *ef;
 
-	memset(&find, 0, sizeof(find));
-	find.fd = fd;
-
-	ef = rbtree_finddata(el->fds, &find);
+	ef = fr_event_fd_find(el, fd);
 	if (!ef) {
 		fr_strerror_printf("No events is_registered for fd %i", fd);
 		return -1;
@@ -289,11 +424,25 @@ int fr_event_fd_delete(fr_event_list_t *el, int fd)
  */
 static int _fr_event_fd_free(fr_event_fd_t *ef)
 {
+	fr_event_list_t	*el = talloc_parent(ef);
+
+#ifdef USE_EPOLL
+	if (ef->is_registered) {
+		/*
+		 *	Closed FDs are removed from the epoll set
+		 *	automatically, so EBADF isn't an error.
+		 */
+		if ((epoll_ctl(el->epfd, EPOLL_CTL_DEL, ef->fd, NULL) < 0) && (errno != EBADF)) {
+			fr_strerror_printf("Failed removing filters for FD %i: %s", ef->fd, fr_syserror(errno));
+			return -1;
+		}
+	}
+	if (ef->always_ready) fr_dlist_remove(&ef->entry);
+	if ((ef->fd < el->fd_map_size) && (el->fd_map[ef->fd] == ef)) el->fd_map[ef->fd] = NULL;
+#else
 	int		filter = 0;
 	struct kevent	evset;
 
-	fr_event_list_t	*el = talloc_parent(ef);
-
 	if (ef->read) filter |= EVFILT_READ;
 	if (ef->write) filter |= EVFILT_WRITE;
 
@@ -305,6 +454,7 @@ static int _fr_event_fd_free(fr_event_fd_t *ef)
 		}
 	}
 	rbtree_deletebydata(el->fds, ef);
+#endif
 	ef->is_registered = false;
 
 	el->num_fds--;
@@ -312,6 +462,46 @@ static int _fr_event_fd_free(fr_event_fd_t *ef)
 	return 0;
 }
 
+#ifdef USE_EPOLL
+/** Tell epoll which events we want for a file descriptor
+ *
+ *  epoll refuses to watch regular files, which are always readable
+ *  and writable.  kqueue will happily watch them, so we emulate that
+ *  by running their handlers on every loop.
+ *
+ * @param[in] el	the event list.
+ * @param[in] ef	the file descriptor handle.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_event_fd_epoll_update(fr_event_list_t *el, fr_event_fd_t *ef)
+{
+	struct epoll_event	evset;
+
+	if (ef->always_ready) return 0;
+
+	memset(&evset, 0, sizeof(evset));
+	if (ef->read) evset.events |= EPOLLIN | EPOLLRDHUP;
+	if (ef->write) evset.events |= EPOLLOUT;
+	evset.data.ptr = ef;
+
+	if (epoll_ctl(el->epfd, ef->is_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, ef->fd, &evset) == 0) {
+		ef->is_registered = true;
+		return 0;
+	}
+
+	if ((errno == EPERM) && ef->is_file) {
+		ef->always_ready = true;
+		fr_dlist_insert_tail(&el->always_ready, &ef->entry);
+		return 0;
+	}
+
+	fr_strerror_printf("Failed adding filter for FD %i: %s", ef->fd, fr_syserror(errno));
+	return -1;
+}
+#endif
+
 /** Associate a callback with an file descriptor
  *
  * @param[in] el	to insert fd callback into.
@@ -330,9 +520,11 @@ int fr_event_fd_insert(fr_event_list_t *el, int fd,
 		       fr_event_fd_handler_t error,
 		       void *ctx)
 {
+#ifndef USE_EPOLL
 	int	      	filter = 0;
 	struct kevent	evset;
-	fr_event_fd_t	*ef, find;
+#endif
+	fr_event_fd_t	*ef;
 	bool		pre_existing;
 
 	if (!el) {
@@ -355,13 +547,10 @@ int fr_event_fd_insert(fr_event_list_t *el, int fd,
 		return -1;
 	}
 
-	memset(&find, 0, sizeof(find));
-
 	/*
 	 *	Get the existing fr_event_fd_t if it exists.
 	 */
-	find.fd = fd;
-	ef = rbtree_finddata(el->fds, &find);
+	ef = fr_event_fd_find(el, fd);
 	if (!ef) {
 		int             sock_type;
 		socklen_t       opt_len = sizeof(sock_type);
@@ -401,7 +590,14 @@ int fr_event_fd_insert(fr_event_list_t *el, int fd,
                 }
 #endif
 
+#ifdef USE_EPOLL
+		if (fr_event_fd_map_insert(el, ef) < 0) {
+			talloc_free(ef);
+			return -1;
+		}
+#else
 		rbtree_insert(el->fds, ef);
+#endif
 
 	/*
 	 *	Existing filters will be overwritten if there's
@@ -412,6 +608,14 @@ int fr_event_fd_insert(fr_event_list_t *el, int fd,
 	} else {
 		pre_existing = true;
 
+#ifdef USE_EPOLL
+		/*
+		 *	epoll replaces the whole set of events in one
+		 *	go, so we just forget the old handlers.
+		 */
+		if (!read_fn) ef->read = NULL;
+		if (!write_fn) ef->write = NULL;
+#else
 		if (ef->read && !read_fn) filter |= EVFILT_READ;
 		if (ef->write && !write_fn) filter |= EVFILT_WRITE;
 
@@ -430,6 +634,7 @@ int fr_event_fd_insert(fr_event_list_t *el, int fd,
 			}
 			filter = 0;
 		}
+#endif
 
 		/*
 		 *	I/O handler may delete an event, then
@@ -441,6 +646,16 @@ int fr_event_fd_insert(fr_event_list_t *el, int fd,
 
 	ef->ctx = ctx;
 
+#ifdef USE_EPOLL
+	if (read_fn) ef->read = read_fn;
+	if (write_fn) ef->write = write_fn;
+	ef->error = error;
+
+	if (fr_event_fd_epoll_update(el, ef) < 0) {
+		if (!pre_existing) talloc_free(ef);
+		return -1;
+	}
+#else
 	if (read_fn) {
 		ef->read = read_fn;
 		filter |= EVFILT_READ;
@@ -459,10 +674,247 @@ int fr_event_fd_insert(fr_event_list_t *el, int fd,
 		return -1;
 	}
 	ef->is_registered = true;
+#endif
+
+	return 0;
+}
+
+
+/** Convert a time to a wheel tick
+ *
+ */
+static inline uint64_t fr_event_tick(struct timeval const *when)
+{
+	return ((((uint64_t) when->tv_sec) * USEC) + when->tv_usec) / FR_EVENT_WHEEL_TICK;
+}
+
+/** Get a timer from the free list, allocating more if necessary
+ *
+ * @param[in] el	to allocate the timer in.
+ * @return
+ *	- NULL on error.
+ *	- a zeroed timer.
+ */
+static fr_event_timer_t *fr_event_timer_alloc(fr_event_list_t *el)
+{
+	fr_dlist_t		*entry;
+	fr_event_timer_t	*ev;
+
+	if (el->timer_free.next == &el->timer_free) {
+		int			i;
+		fr_event_timer_t	*slab;
+
+		slab = talloc_array(el, fr_event_timer_t, FR_EVENT_TIMER_SLAB);
+		if (!slab) {
+			fr_strerror_printf("Out of memory");
+			return NULL;
+		}
+
+		for (i = 0; i < FR_EVENT_TIMER_SLAB; i++) {
+			fr_dlist_insert_tail(&el->timer_free, &slab[i].entry);
+		}
+	}
+
+	entry = el->timer_free.next;
+	fr_dlist_remove(entry);
+
+	ev = fr_ptr_to_type(fr_event_timer_t, entry, entry);
+	memset(ev, 0, sizeof(*ev));
+
+	return ev;
+}
+
+/** Return a timer to the free list
+ *
+ * @param[in] el	the timer was allocated in.
+ * @param[in] ev	to free.
+ */
+static inline void fr_event_timer_release(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	ev->parent = NULL;
+	ev->callback = NULL;
+	fr_dlist_insert_head(&el->timer_free, &ev->entry);
+}
+
+/** Put a timer into the wheel, or into the heap if it's due soon
+ *
+ *  The slot for a timer at level N is emptied when the lower N
+ *  levels wrap around, which is never later than the timer is due.
+ *
+ * @param[in] el	to insert the timer into.
+ * @param[in] ev	to insert.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_event_timer_place(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (ev->tick > (el->wheel_tick + 1)) {
+		int		level;
+		uint64_t	delta = ev->tick - el->wheel_tick;
+
+		for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+			int		shift = level * FR_EVENT_WHEEL_BITS;
+			uint64_t	cascade;
+
+			if (delta >= (((uint64_t) 1) << (shift + FR_EVENT_WHEEL_BITS))) continue;
+
+			fr_dlist_insert_tail(&el->wheel[level][(ev->tick >> shift) & FR_EVENT_WHEEL_MASK], &ev->entry);
+			ev->in_wheel = true;
+			el->num_wheel++;
+
+			cascade = (ev->tick >> shift) << shift;
+			if (cascade < el->wheel_next) el->wheel_next = cascade;
+
+			return 0;
+		}
+	}
+
+	if (!fr_heap_insert(el->times, ev)) {
+		fr_strerror_printf("Failed inserting event into heap");
+		return -1;
+	}
 
 	return 0;
 }
 
+/** Remove a timer from the wheel, or from the heap
+ *
+ * @param[in] el	containing the timer.
+ * @param[in] ev	to remove.
+ * @return
+ *	- 1 on success.
+ *	- 0 if the timer wasn't found.
+ */
+static int fr_event_timer_unlink(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (ev->in_wheel) {
+		fr_dlist_remove(&ev->entry);
+		ev->in_wheel = false;
+		el->num_wheel--;
+		return 1;
+	}
+
+	return fr_heap_extract(el->times, ev);
+}
+
+/** Find the next tick at which a timer has to leave the wheel
+ *
+ *  The first non-empty slot at a higher level is always later than
+ *  the first one at a lower level, so we stop as soon as we can.
+ *
+ * @param[in] el	containing the wheel.
+ */
+static void fr_event_wheel_scan(fr_event_list_t *el)
+{
+	int		level, i;
+	uint64_t	next = UINT64_MAX;
+
+	for (level = 0; (level < FR_EVENT_WHEEL_LEVELS) && (el->num_wheel > 0); level++) {
+		int		shift = level * FR_EVENT_WHEEL_BITS;
+		uint64_t	base = el->wheel_tick >> shift;
+
+		if (((base + 1) << shift) >= next) break;
+
+		for (i = 1; i <= FR_EVENT_WHEEL_SLOTS; i++) {
+			fr_dlist_t *head = &el->wheel[level][(base + i) & FR_EVENT_WHEEL_MASK];
+
+			if (head->next == head) continue;
+
+			if (((base + i) << shift) < next) next = (base + i) << shift;
+			break;
+		}
+	}
+
+	el->wheel_next = next;
+}
+
+/** Move all of the timers in a wheel slot to a lower level, or to the heap
+ *
+ * @param[in] el	containing the wheel.
+ * @param[in] head	of the slot.
+ */
+static void fr_event_wheel_cascade(fr_event_list_t *el, fr_dlist_t *head)
+{
+	while (head->next != head) {
+		fr_event_timer_t *ev;
+
+		ev = fr_ptr_to_type(fr_event_timer_t, entry, head->next);
+		(void) fr_event_timer_unlink(el, ev);
+		(void) fr_event_timer_place(el, ev);
+	}
+}
+
+/** Move the timers which are due soon from the wheel to the heap
+ *
+ *  We skip straight to the next tick which has timers in it, so
+ *  this is cheap no matter how long it's been since we were last
+ *  called.
+ *
+ * @param[in] el	containing the wheel.
+ * @param[in] now	the current time.
+ */
+static void fr_event_wheel_advance(fr_event_list_t *el, struct timeval const *now)
+{
+	uint64_t target = fr_event_tick(now) + 1;
+
+	while (el->wheel_tick < target) {
+		int		level;
+		uint64_t	tick;
+
+		if (el->wheel_next > target) {
+			el->wheel_tick = target;
+			return;
+		}
+
+		tick = el->wheel_next;
+		el->wheel_tick = tick;
+
+		for (level = FR_EVENT_WHEEL_LEVELS - 1; level >= 0; level--) {
+			int shift = level * FR_EVENT_WHEEL_BITS;
+
+			if ((tick & ((((uint64_t) 1) << shift) - 1)) != 0) continue;
+
+			fr_event_wheel_cascade(el, &el->wheel[level][(tick >> shift) & FR_EVENT_WHEEL_MASK]);
+		}
+
+		fr_event_wheel_scan(el);
+	}
+}
+
+/** Find when we next need to look at the timers
+ *
+ * @param[in] el	containing the timers.
+ * @param[out] when	the time of the first timer in the heap, or when
+ *			we have to move timers out of the wheel.
+ * @return
+ *	- true if there are timers.
+ *	- false if there are no timers.
+ */
+static bool fr_event_timer_next(fr_event_list_t *el, struct timeval *when)
+{
+	bool			found = false;
+	fr_event_timer_t	*ev;
+
+	ev = fr_heap_peek(el->times);
+	if (ev) {
+		*when = ev->when;
+		found = true;
+	}
+
+	if ((el->num_wheel > 0) && (el->wheel_next != UINT64_MAX)) {
+		struct timeval	wake;
+		uint64_t	usec = (el->wheel_next - 1) * FR_EVENT_WHEEL_TICK;
+
+		wake.tv_sec = usec / USEC;
+		wake.tv_usec = usec % USEC;
+
+		if (!found || (fr_timeval_cmp(&wake, when) < 0)) *when = wake;
+		found = true;
+	}
+
+	return found;
+}
 
 /** Delete a timer event from the event list
  *
@@ -481,7 +933,7 @@ int fr_event_timer_delete(fr_event_list_t *el, fr_event_timer_t **parent)
 	}
 
 	if (!parent) {
-		fr_strerror_printf("Invalid arguments: NULL event pointer");
+		fr_strerror_printf("Invalid arguments: NULL parent");
 		return -1;
 	}
 
@@ -493,24 +945,28 @@ int fr_event_timer_delete(fr_event_list_t *el, fr_event_timer_t **parent)
 	/*
 	 *  Validate the event_t struct to detect memory issues early.
 	 */
-	ev = talloc_get_type_abort(*parent, fr_event_timer_t);
+	ev = *parent;
+	if (!fr_cond_assert(ev->callback != NULL)) {
+		fr_strerror_printf("Event has already been freed");
+		return -1;
+	}
 	if (ev->parent) {
 		(void)fr_cond_assert(*(ev->parent) == ev);
 		*ev->parent = NULL;
 	}
 	*parent = NULL;
 
-	ret = fr_heap_extract(el->times, ev);
+	ret = fr_event_timer_unlink(el, ev);
 
 	/*
-	 *	Events MUST be in the heap
+	 *	Events MUST be in the wheel or the heap
 	 */
 	if (!fr_cond_assert(ret == 1)) {
 		fr_strerror_printf("Event not found in heap");
-		talloc_free(ev);
+		fr_event_timer_release(el, ev);
 		return -1;
 	}
-	talloc_free(ev);
+	fr_event_timer_release(el, ev);
 
 	return ret;
 }
@@ -564,25 +1020,26 @@ int fr_event_timer_insert(fr_event_list_t *el, fr_event_callback_t callback, voi
 	if (*parent) {
 		int ret;
 
-		ev = talloc_get_type_abort(*parent, fr_event_timer_t);
+		ev = *parent;
 
-		ret = fr_heap_extract(el->times, ev);
-		if (!fr_cond_assert(ret == 1)) return -1;	/* events MUST be in the heap */
+		ret = fr_event_timer_unlink(el, ev);
+		if (!fr_cond_assert(ret == 1)) return -1;	/* events MUST be in the wheel or heap */
 
 		memset(ev, 0, sizeof(*ev));
 	} else {
-		ev = talloc_zero(el, fr_event_timer_t);
+		ev = fr_event_timer_alloc(el);
 		if (!ev) return -1;
 	}
 
 	ev->callback = callback;
 	ev->ctx = ctx;
 	ev->when = *when;
+	ev->tick = fr_event_tick(when);
 	ev->parent = parent;
 
-	if (!fr_heap_insert(el->times, ev)) {
-		fr_strerror_printf("Failed inserting event into heap");
-		talloc_free(ev);
+	if (fr_event_timer_place(el, ev) < 0) {
+		if (*parent == ev) *parent = NULL;
+		fr_event_timer_release(el, ev);
 		return -1;
 	}
 
@@ -783,16 +1240,17 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 
 	if (!el) return 0;
 
-	if (fr_heap_num_elements(el->times) == 0) {
-		when->tv_sec = 0;
-		when->tv_usec = 0;
-		return 0;
-	}
+	/*
+	 *	Move any timers which are due soon out of the wheel.
+	 */
+	fr_event_wheel_advance(el, when);
 
 	ev = fr_heap_peek(el->times);
 	if (!ev) {
-		when->tv_sec = 0;
-		when->tv_usec = 0;
+		if (!fr_event_timer_next(el, when)) {
+			when->tv_sec = 0;
+			when->tv_usec = 0;
+		}
 		return 0;
 	}
 
@@ -802,7 +1260,7 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 	if ((ev->when.tv_sec > when->tv_sec) ||
 	    ((ev->when.tv_sec == when->tv_sec) &&
 	     (ev->when.tv_usec > when->tv_usec))) {
-		*when = ev->when;
+		(void) fr_event_timer_next(el, when);
 		return 0;
 	}
 
@@ -830,7 +1288,11 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 int fr_event_corral(fr_event_list_t *el, bool wait)
 {
 	struct timeval when, *wake;
+#ifdef USE_EPOLL
+	int timeout;
+#else
 	struct timespec ts_when, *ts_wake;
+#endif
 	fr_dlist_t *entry;
 
 	if (el->exit) {
@@ -847,22 +1309,16 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	wake = &when;
 
 	if (wait) {
-		if (fr_heap_num_elements(el->times) > 0) {
-			fr_event_timer_t *ev;
-
-			ev = fr_heap_peek(el->times);
-			if (!fr_cond_assert(ev)) {
-				fr_strerror_printf("Timer heap says it is non-empty, but there are no entries in it.");
-				return -1;
-			}
+		struct timeval next;
 
+		if (fr_event_timer_next(el, &next)) {
 			gettimeofday(&el->now, NULL);
 
 			/*
 			 *	Next event is in the future, get the time
 			 *	between now and that event.
 			 */
-			if (fr_timeval_cmp(&ev->when, &el->now) > 0) fr_timeval_subtract(&when, &ev->when, &el->now);
+			if (fr_timeval_cmp(&next, &el->now) > 0) fr_timeval_subtract(&when, &next, &el->now);
 
 			wake = &when;
 
@@ -889,6 +1345,65 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 		}
 	}
 
+#ifdef USE_EPOLL
+	/*
+	 *	Files which epoll can't watch are always ready, so
+	 *	we don't wait if there are any.
+	 */
+	if (el->always_ready.next != &el->always_ready) {
+		wake = &when;
+		when.tv_sec = 0;
+		when.tv_usec = 0;
+	}
+
+	/*
+	 *	epoll only does milliseconds, which is too coarse for
+	 *	timers.  So we arm the timerfd instead, and only when
+	 *	the first timer has changed.
+	 */
+	timeout = -1;
+	if (wake) {
+		if (!when.tv_sec && !when.tv_usec) {
+			timeout = 0;
+
+		} else {
+			struct timeval deadline;
+
+			fr_timeval_add(&deadline, &el->now, &when);
+			if (fr_timeval_cmp(&deadline, &el->timer_armed) != 0) {
+				struct itimerspec its;
+
+				memset(&its, 0, sizeof(its));
+				its.it_value.tv_sec = when.tv_sec;
+				its.it_value.tv_nsec = when.tv_usec * 1000;
+
+				if (timerfd_settime(el->timer_fd, 0, &its, NULL) < 0) {
+					fr_strerror_printf("Failed arming timer: %s", fr_syserror(errno));
+					return -1;
+				}
+				el->timer_armed = deadline;
+			}
+		}
+	}
+
+	/*
+	 *	Populate el->events with the list of I/O events
+	 *	that occurred since this function was last called
+	 *	or wait for the next timer event.
+	 */
+	el->num_fd_events = epoll_wait(el->epfd, el->events, FR_EV_BATCH_FDS, timeout);
+
+	/*
+	 *	Interrupt is different from timeout / FD events.
+	 */
+	if (el->num_fd_events < 0) {
+		if (errno == EINTR) {
+			el->num_fd_events = 0;
+		} else {
+			fr_strerror_printf("Failed calling epoll_wait: %s", fr_syserror(errno));
+		}
+	}
+#else
 	if (wake) {
 		ts_wake = &ts_when;
 		ts_when.tv_sec = when.tv_sec;
@@ -914,10 +1429,112 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 			fr_strerror_printf("Failed calling kevent: %s", fr_syserror(errno));
 		}
 	}
+#endif
 
 	return el->num_fd_events;
 }
 
+/** Run the callback for a user event
+ *
+ * @param[in] el	the event list.
+ * @param[in] kev	the EVFILT_USER event.
+ */
+static inline void fr_event_user_service(fr_event_list_t *el, struct kevent *kev)
+{
+	fr_event_user_t *user;
+
+	/*
+	 *	This is just a "wakeup" event, which
+	 *	is always ignored.
+	 */
+	if (kev->ident == 0) return;
+
+	user = (fr_event_user_t *) kev->ident;
+
+	(void) talloc_get_type_abort(user, fr_event_user_t);
+	rad_assert(user->ident == kev->ident);
+
+	user->callback(el->kq, kev, user->ctx);
+}
+
+/** Run the callbacks for a file descriptor event
+ *
+ * @param[in] el	the event list.
+ * @param[in] ev	the file descriptor handle.
+ * @param[in] flags	kevent style flags, EV_ERROR, EV_EOF, etc.
+ * @param[in] readable	whether we should call the read callback.
+ * @param[in] writable	whether we should call the write callback.
+ */
+static void fr_event_fd_service(fr_event_list_t *el, fr_event_fd_t *ev, int flags, bool readable, bool writable)
+{
+#ifdef USE_EPOLL
+	if (!fr_cond_assert(ev->is_registered || ev->always_ready)) return;
+#else
+	if (!fr_cond_assert(ev->is_registered)) return;
+#endif
+
+        if (flags & EV_ERROR) {
+        ev_error:
+                /*
+                 *      Call the error handler which should
+                 *      tear down the connection.
+                 */
+                if (ev->error) {
+                        ev->error(el, ev->fd, flags, ev->ctx);
+                        return;
+                }
+                fr_event_fd_delete(el, ev->fd);
+                return;
+        }
+
+        /*
+         *      EOF can indicate we've actually reached
+         *      the end of a file, but for sockets it usually
+         *      indicates the other end of the connection
+         *      has gone away.
+         */
+        if (flags & EV_EOF) {
+		/*
+		 *	This is fine, the callback will get notified
+		 *	via the flags field.
+		 */
+		if (ev->is_file) goto service;
+#if defined(__linux__) && defined(SO_GET_FILTER)
+		/*
+		 *      There seems to be an issue with the
+		 *      ioctl(...SIOCNQ...) call libkqueue
+		 *      uses to determine the number of bytes
+		 *	readable.  When ioctl returns, the number
+		 *	of bytes available is set to zero, which
+		 *	libkqueue interprets as EOF.
+		 *
+		 *      As a workaround, if we're not reading
+		 *	a file, and are operating on a raw socket
+		 *	with a packet filter attached, we ignore
+		 *	the EOF flag and continue.
+		 */
+		if ((ev->sock_type == SOCK_RAW) && ev->pf_attached) goto service;
+#endif
+		goto ev_error;
+        }
+
+service:
+	ev->in_handler = true;
+	if (ev->read && readable) {
+		ev->read(el, ev->fd, flags, ev->ctx);
+	}
+	if (ev->write && writable && !ev->do_delete) {
+		ev->write(el, ev->fd, flags, ev->ctx);
+	}
+	ev->in_handler = false;
+
+	/*
+	 *	Process any deferred deletes performed
+	 *	by the I/O handler.
+	 */
+	if (ev->do_delete) fr_event_fd_delete(el, ev->fd);
+}
+
 /** Service any outstanding timer or file descriptor events
  *
  * @param[in] el containing events to service.
@@ -930,105 +1547,130 @@ void fr_event_service(fr_event_list_t *el)
 
 	if (el->exit) return;
 
+#ifdef USE_EPOLL
 	/*
 	 *	Run all of the file descriptor events.
 	 */
 	for (i = 0; i < el->num_fd_events; i++) {
 		fr_event_fd_t *ev;
-		int flags = el->events[i].flags;
+		uint32_t events = el->events[i].events;
+		int flags = 0;
 
 		/*
-		 *	Process any user events
+		 *	We're being woken up to exit.
 		 */
-		if (el->events[i].filter == EVFILT_USER) {
-			fr_event_user_t *user;
+		if (el->events[i].data.ptr == &el->wakeup_fd) {
+			eventfd_t value;
 
-			/*
-			 *	This is just a "wakeup" event, which
-			 *	is always ignored.
-			 */
-			if (el->events[i].ident == 0) continue;
+			(void) eventfd_read(el->wakeup_fd, &value);
+			continue;
+		}
 
-			user = (fr_event_user_t *) el->events[i].ident;
+		/*
+		 *	A timer is due.  Reset the timerfd, and the
+		 *	timers are run below.
+		 */
+		if (el->events[i].data.ptr == &el->timer_fd) {
+			uint64_t expired;
 
-			(void) talloc_get_type_abort(user, fr_event_user_t);
-			rad_assert(user->ident == el->events[i].ident);
+			if (read(el->timer_fd, &expired, sizeof(expired)) == sizeof(expired)) {
+				el->timer_armed.tv_sec = 0;
+				el->timer_armed.tv_usec = 0;
+			}
+			continue;
+		}
+
+		/*
+		 *	Someone sent an EVFILT_USER event to our
+		 *	kqueue.  Get all of them, and process them.
+		 */
+		if (el->events[i].data.ptr == &el->kq) {
+			struct timespec ts_zero = { 0, 0 };
+			int j, num;
+
+			num = kevent(el->kq, NULL, 0, el->user_events, FR_EV_BATCH_FDS, &ts_zero);
+			for (j = 0; j < num; j++) {
+				if (el->user_events[j].filter != EVFILT_USER) continue;
 
-			user->callback(el->kq, &el->events[i], user->ctx);
+				fr_event_user_service(el, &el->user_events[j]);
+			}
 			continue;
 		}
 
-		ev = talloc_get_type_abort(el->events[i].udata, fr_event_fd_t);
+		ev = talloc_get_type_abort(el->events[i].data.ptr, fr_event_fd_t);
 
-		if (!fr_cond_assert(ev->is_registered)) continue;
-
-                if (flags & EV_ERROR) {
-                ev_error:
-                        /*
-                         *      Call the error handler which should
-                         *      tear down the connection.
-                         */
-                        if (ev->error) {
-                                ev->error(el, ev->fd, flags, ev->ctx);
-                                continue;
-                        }
-                        fr_event_fd_delete(el, ev->fd);
-                }
+		/*
+		 *	Map the epoll events to the kevent flags
+		 *	which the handlers expect.
+		 */
+		if (events & EPOLLERR) flags |= EV_ERROR;
+		if (events & (EPOLLHUP | EPOLLRDHUP)) flags |= EV_EOF;
 
-                /*
-                 *      EOF can indicate we've actually reached
-                 *      the end of a file, but for sockets it usually
-                 *      indicates the other end of the connection
-                 *      has gone away.
-                 */
-                if (flags & EV_EOF) {
-			/*
-			 *	This is fine, the callback will get notified
-			 *	via the flags field.
-			 */
-			if (ev->is_file) goto service;
-#if defined(__linux__) && defined(SO_GET_FILTER)
-			/*
-			 *      There seems to be an issue with the
-			 *      ioctl(...SIOCNQ...) call libkqueue
-			 *      uses to determine the number of bytes
-			 *	readable.  When ioctl returns, the number
-			 *	of bytes available is set to zero, which
-			 *	libkqueue interprets as EOF.
-			 *
-			 *      As a workaround, if we're not reading
-			 *	a file, and are operating on a raw socket
-			 *	with a packet filter attached, we ignore
-			 *	the EOF flag and continue.
-			 */
-			if ((ev->sock_type == SOCK_RAW) && ev->pf_attached) goto service;
-#endif
-			goto ev_error;
-                }
+		fr_event_fd_service(el, ev, flags,
+				    (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) != 0,
+				    (events & EPOLLOUT) != 0);
+	}
 
-service:
-		ev->in_handler = true;
-		if (ev->read && (el->events[i].filter == EVFILT_READ)) {
-			ev->read(el, ev->fd, flags, ev->ctx);
+	/*
+	 *	Regular files are always readable and writable.
+	 *
+	 *	The handlers can delete any of these FDs, not just
+	 *	their own, which frees the fr_event_fd_t, and removes
+	 *	it from the list.  So we take a copy of the FDs first,
+	 *	and look each one up again before servicing it.
+	 */
+	if (FR_DLIST_FIRST(el->always_ready)) {
+		int num = 0;
+		int fds[FR_EV_BATCH_FDS];
+
+		for (entry = FR_DLIST_FIRST(el->always_ready);
+		     (entry != NULL) && (num < FR_EV_BATCH_FDS);
+		     entry = FR_DLIST_NEXT(el->always_ready, entry)) {
+			fr_event_fd_t *ev;
+
+			ev = fr_ptr_to_type(fr_event_fd_t, entry, entry);
+			fds[num++] = ev->fd;
 		}
-		if (ev->write && (el->events[i].filter == EVFILT_WRITE) && !ev->do_delete) {
-			ev->write(el, ev->fd, flags, ev->ctx);
+
+		for (i = 0; i < num; i++) {
+			fr_event_fd_t *ev;
+
+			ev = fr_event_fd_find(el, fds[i]);
+			if (!ev || !ev->always_ready || ev->do_delete) continue;
+
+			fr_event_fd_service(el, ev, 0, true, true);
 		}
-		ev->in_handler = false;
+	}
+#else
+	/*
+	 *	Run all of the file descriptor events.
+	 */
+	for (i = 0; i < el->num_fd_events; i++) {
+		fr_event_fd_t *ev;
+		int flags = el->events[i].flags;
 
 		/*
-		 *	Process any deferred deletes performed
-		 *	by the I/O handler.
+		 *	Process any user events
 		 */
-		if (ev->do_delete) fr_event_fd_delete(el, ev->fd);
+		if (el->events[i].filter == EVFILT_USER) {
+			fr_event_user_service(el, &el->events[i]);
+			continue;
+		}
+
+		ev = talloc_get_type_abort(el->events[i].udata, fr_event_fd_t);
+
+		fr_event_fd_service(el, ev, flags,
+				    (el->events[i].filter == EVFILT_READ),
+				    (el->events[i].filter == EVFILT_WRITE));
 	}
+#endif
 
 	gettimeofday(&el->now, NULL);
 
 	/*
 	 *	Run all of the timer events.
 	 */
-	if (fr_heap_num_elements(el->times) > 0) {
+	if (fr_event_list_num_elements(el) > 0) {
 		do {
 			when = el->now;
 		} while (fr_event_timer_run(el, &when) == 1);
@@ -1058,7 +1700,9 @@ service:
  */
 void fr_event_loop_exit(fr_event_list_t *el, int code)
 {
+#ifndef USE_EPOLL
 	struct kevent kev;
+#endif
 
 	if (!el) return;
 
@@ -1067,8 +1711,12 @@ void fr_event_loop_exit(fr_event_list_t *el, int code)
 	/*
 	 *	Signal the control plane to exit.
 	 */
+#ifdef USE_EPOLL
+	(void) eventfd_write(el->wakeup_fd, 1);
+#else
 	EV_SET(&kev, 0, EVFILT_USER, 0, NOTE_TRIGGER | NOTE_FFNOP, 0, NULL);
 	(void) kevent(el->kq, &kev, 1, NULL, 0, NULL);
+#endif
 }
 
 /** Check to see whether the event loop is in the process of exiting
@@ -1111,15 +1759,30 @@ int fr_event_loop(fr_event_list_t *el)
  */
 static int _event_list_free(fr_event_list_t *el)
 {
+	int i, j;
 	fr_event_timer_t *ev;
 
 	while ((ev = fr_heap_peek(el->times)) != NULL) {
 		fr_event_timer_delete(el, &ev);
 	}
 
+	for (i = 0; i < FR_EVENT_WHEEL_LEVELS; i++) {
+		for (j = 0; j < FR_EVENT_WHEEL_SLOTS; j++) {
+			while (el->wheel[i][j].next != &el->wheel[i][j]) {
+				ev = fr_ptr_to_type(fr_event_timer_t, entry, el->wheel[i][j].next);
+				fr_event_timer_delete(el, &ev);
+			}
+		}
+	}
+
 	talloc_free(el->times);
 
-	close(el->kq);
+#ifdef USE_EPOLL
+	if (el->timer_fd >= 0) close(el->timer_fd);
+	if (el->wakeup_fd >= 0) close(el->wakeup_fd);
+	if (el->epfd >= 0) close(el->epfd);
+#endif
+	if (el->kq >= 0) close(el->kq);
 
 	return 0;
 }
@@ -1135,13 +1798,34 @@ static int _event_list_free(fr_event_list_t *el)
  */
 fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_t status, void *status_ctx)
 {
+	int i, j;
+	struct timeval now;
 	fr_event_list_t *el;
 	struct kevent kev;
+#ifdef USE_EPOLL
+	struct epoll_event evset;
+#endif
 
 	el = talloc_zero(ctx, fr_event_list_t);
 	if (!fr_cond_assert(el)) {
 		return NULL;
 	}
+	el->kq = -1;
+#ifdef USE_EPOLL
+	el->epfd = -1;
+	el->wakeup_fd = -1;
+	el->timer_fd = -1;
+#endif
+	for (i = 0; i < FR_EVENT_WHEEL_LEVELS; i++) {
+		for (j = 0; j < FR_EVENT_WHEEL_SLOTS; j++) {
+			FR_DLIST_INIT(el->wheel[i][j]);
+		}
+	}
+	FR_DLIST_INIT(el->timer_free);
+	el->wheel_next = UINT64_MAX;
+	gettimeofday(&now, NULL);
+	el->wheel_tick = fr_event_tick(&now);
+
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_heap_create(fr_event_timer_cmp, offsetof(fr_event_timer_t, heap));
@@ -1149,7 +1833,11 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_t status,
 		talloc_free(el);
 		return NULL;
 	}
+#ifdef USE_EPOLL
+	FR_DLIST_INIT(el->always_ready);
+#else
 	el->fds = rbtree_create(el, fr_event_fd_cmp, NULL, 0);
+#endif
 
 	el->kq = kqueue();
 	if (el->kq < 0) {
@@ -1172,6 +1860,50 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_t status,
 		return NULL;
 	}
 
+#ifdef USE_EPOLL
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		talloc_free(el);
+		return NULL;
+	}
+
+	el->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (el->wakeup_fd < 0) {
+		talloc_free(el);
+		return NULL;
+	}
+
+	memset(&evset, 0, sizeof(evset));
+	evset.events = EPOLLIN;
+	evset.data.ptr = &el->wakeup_fd;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->wakeup_fd, &evset) < 0) {
+		talloc_free(el);
+		return NULL;
+	}
+
+	el->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (el->timer_fd < 0) {
+		talloc_free(el);
+		return NULL;
+	}
+
+	evset.data.ptr = &el->timer_fd;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->timer_fd, &evset) < 0) {
+		talloc_free(el);
+		return NULL;
+	}
+
+	/*
+	 *	The kqueue descriptor becomes readable when it has
+	 *	events pending, which are then all EVFILT_USER.
+	 */
+	evset.data.ptr = &el->kq;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->kq, &evset) < 0) {
+		talloc_free(el);
+		return NULL;
+	}
+#endif
+
 	return el;
 }
 
@@ -175,6 +175,81 @@ void fr_md5_final(uint8_t out[MD5_DIGEST_LENGTH], FR_MD5_CTX *ctx)
 /* This is the central step in the MD5 algorithm. */
 #define MD5STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s),  w += x)
 
+/*
+ *	All 64 steps.  These are shared by the scalar, and the
+ *	multi-buffer transforms, which only differ in the type of a, b,
+ *	c, d, and in[].
+ */
+#define MD5_ROUNDS(a, b, c, d, in) do {\
+	MD5STEP(F1, a, b, c, d, in[ 0] + 0xd76aa478,  7);\
+	MD5STEP(F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12);\
+	MD5STEP(F1, c, d, a, b, in[ 2] + 0x242070db, 17);\
+	MD5STEP(F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22);\
+	MD5STEP(F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7);\
+	MD5STEP(F1, d, a, b, c, in[ 5] + 0x4787c62a, 12);\
+	MD5STEP(F1, c, d, a, b, in[ 6] + 0xa8304613, 17);\
+	MD5STEP(F1, b, c, d, a, in[ 7] + 0xfd469501, 22);\
+	MD5STEP(F1, a, b, c, d, in[ 8] + 0x698098d8,  7);\
+	MD5STEP(F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12);\
+	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);\
+	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);\
+	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122,  7);\
+	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);\
+	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);\
+	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);\
+\
+	MD5STEP(F2, a, b, c, d, in[ 1] + 0xf61e2562,  5);\
+	MD5STEP(F2, d, a, b, c, in[ 6] + 0xc040b340,  9);\
+	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);\
+	MD5STEP(F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20);\
+	MD5STEP(F2, a, b, c, d, in[ 5] + 0xd62f105d,  5);\
+	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453,  9);\
+	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);\
+	MD5STEP(F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20);\
+	MD5STEP(F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5);\
+	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6,  9);\
+	MD5STEP(F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14);\
+	MD5STEP(F2, b, c, d, a, in[ 8] + 0x455a14ed, 20);\
+	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905,  5);\
+	MD5STEP(F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9);\
+	MD5STEP(F2, c, d, a, b, in[ 7] + 0x676f02d9, 14);\
+	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);\
+\
+	MD5STEP(F3, a, b, c, d, in[ 5] + 0xfffa3942,  4);\
+	MD5STEP(F3, d, a, b, c, in[ 8] + 0x8771f681, 11);\
+	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);\
+	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);\
+	MD5STEP(F3, a, b, c, d, in[ 1] + 0xa4beea44,  4);\
+	MD5STEP(F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11);\
+	MD5STEP(F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16);\
+	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);\
+	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6,  4);\
+	MD5STEP(F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11);\
+	MD5STEP(F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16);\
+	MD5STEP(F3, b, c, d, a, in[ 6] + 0x04881d05, 23);\
+	MD5STEP(F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4);\
+	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);\
+	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);\
+	MD5STEP(F3, b, c, d, a, in[2 ] + 0xc4ac5665, 23);\
+\
+	MD5STEP(F4, a, b, c, d, in[ 0] + 0xf4292244,  6);\
+	MD5STEP(F4, d, a, b, c, in[7 ] + 0x432aff97, 10);\
+	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);\
+	MD5STEP(F4, b, c, d, a, in[5 ] + 0xfc93a039, 21);\
+	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3,  6);\
+	MD5STEP(F4, d, a, b, c, in[3 ] + 0x8f0ccc92, 10);\
+	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);\
+	MD5STEP(F4, b, c, d, a, in[1 ] + 0x85845dd1, 21);\
+	MD5STEP(F4, a, b, c, d, in[8 ] + 0x6fa87e4f,  6);\
+	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);\
+	MD5STEP(F4, c, d, a, b, in[6 ] + 0xa3014314, 15);\
+	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);\
+	MD5STEP(F4, a, b, c, d, in[4 ] + 0xf7537e82,  6);\
+	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);\
+	MD5STEP(F4, c, d, a, b, in[2 ] + 0x2ad7d2bb, 15);\
+	MD5STEP(F4, b, c, d, a, in[9 ] + 0xeb86d391, 21);\
+} while (0)
+
 /** The core of the MD5 algorithm
  *
  * This alters an existing MD5 hash to reflect the addition of 16
@@ -201,77 +276,215 @@ void fr_md5_transform(uint32_t state[4], uint8_t const block[MD5_BLOCK_LENGTH])
 	c = state[2];
 	d = state[3];
 
-	MD5STEP(F1, a, b, c, d, in[ 0] + 0xd76aa478,  7);
-	MD5STEP(F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12);
-	MD5STEP(F1, c, d, a, b, in[ 2] + 0x242070db, 17);
-	MD5STEP(F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22);
-	MD5STEP(F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7);
-	MD5STEP(F1, d, a, b, c, in[ 5] + 0x4787c62a, 12);
-	MD5STEP(F1, c, d, a, b, in[ 6] + 0xa8304613, 17);
-	MD5STEP(F1, b, c, d, a, in[ 7] + 0xfd469501, 22);
-	MD5STEP(F1, a, b, c, d, in[ 8] + 0x698098d8,  7);
-	MD5STEP(F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12);
-	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122,  7);
-	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);
-	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);
-	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-	MD5STEP(F2, a, b, c, d, in[ 1] + 0xf61e2562,  5);
-	MD5STEP(F2, d, a, b, c, in[ 6] + 0xc040b340,  9);
-	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-	MD5STEP(F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20);
-	MD5STEP(F2, a, b, c, d, in[ 5] + 0xd62f105d,  5);
-	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453,  9);
-	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-	MD5STEP(F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20);
-	MD5STEP(F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5);
-	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6,  9);
-	MD5STEP(F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14);
-	MD5STEP(F2, b, c, d, a, in[ 8] + 0x455a14ed, 20);
-	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905,  5);
-	MD5STEP(F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9);
-	MD5STEP(F2, c, d, a, b, in[ 7] + 0x676f02d9, 14);
-	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-	MD5STEP(F3, a, b, c, d, in[ 5] + 0xfffa3942,  4);
-	MD5STEP(F3, d, a, b, c, in[ 8] + 0x8771f681, 11);
-	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-	MD5STEP(F3, a, b, c, d, in[ 1] + 0xa4beea44,  4);
-	MD5STEP(F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11);
-	MD5STEP(F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16);
-	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6,  4);
-	MD5STEP(F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11);
-	MD5STEP(F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16);
-	MD5STEP(F3, b, c, d, a, in[ 6] + 0x04881d05, 23);
-	MD5STEP(F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4);
-	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-	MD5STEP(F3, b, c, d, a, in[2 ] + 0xc4ac5665, 23);
-
-	MD5STEP(F4, a, b, c, d, in[ 0] + 0xf4292244,  6);
-	MD5STEP(F4, d, a, b, c, in[7 ] + 0x432aff97, 10);
-	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-	MD5STEP(F4, b, c, d, a, in[5 ] + 0xfc93a039, 21);
-	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3,  6);
-	MD5STEP(F4, d, a, b, c, in[3 ] + 0x8f0ccc92, 10);
-	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-	MD5STEP(F4, b, c, d, a, in[1 ] + 0x85845dd1, 21);
-	MD5STEP(F4, a, b, c, d, in[8 ] + 0x6fa87e4f,  6);
-	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-	MD5STEP(F4, c, d, a, b, in[6 ] + 0xa3014314, 15);
-	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-	MD5STEP(F4, a, b, c, d, in[4 ] + 0xf7537e82,  6);
-	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-	MD5STEP(F4, c, d, a, b, in[2 ] + 0x2ad7d2bb, 15);
-	MD5STEP(F4, b, c, d, a, in[9 ] + 0xeb86d391, 21);
+	MD5_ROUNDS(a, b, c, d, in);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+/*
+ *	Multi-buffer MD5.
+ *
+ *	Independent messages are hashed in parallel, one message per
+ *	lane of a vector.  We use the compiler's generic vectors, so
+ *	the instructions (SSE2, AVX2, AVX-512, NEON) are chosen by the
+ *	target flags, and other compilers just get the scalar code.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#  define MD5_MULTI_BUFFER 1
+
+typedef uint32_t md5_vec_t __attribute__((vector_size(FR_MD5_MULTI_LANES * sizeof(uint32_t))));
+
+/** Per-lane information for md5_multi_lanes()
+ *
+ */
+typedef struct {
+	uint8_t const	*data;					//!< Message data.
+	size_t		full;					//!< Number of full blocks in the message.
+	size_t		blocks;					//!< Total number of blocks, including padding.
+	uint8_t		tail[2 * MD5_BLOCK_LENGTH];		//!< Last partial block, padding, and length.
+} md5_lane_t;
+
+static const uint8_t ZERO_BLOCK[MD5_BLOCK_LENGTH] = { 0 };
+
+/** The core of the MD5 algorithm, for one block in each lane
+ *
+ * @param[in,out] state of each lane.
+ * @param[in] in 16 longwords of data for each lane.
+ */
+static void md5_multi_transform(md5_vec_t state[4], md5_vec_t const in[MD5_BLOCK_LENGTH / 4])
+{
+	md5_vec_t a, b, c, d;
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+
+	MD5_ROUNDS(a, b, c, d, in);
 
 	state[0] += a;
 	state[1] += b;
 	state[2] += c;
 	state[3] += d;
 }
+
+/** Hash up to FR_MD5_MULTI_LANES messages in parallel
+ *
+ * Each message is padded in its lane.  Lanes which run out of blocks
+ * keep hashing a zero block, and we copy their digest out as soon as
+ * their last real block has been processed.
+ *
+ * @param[out] out Where to write the digests.
+ * @param[in] ctx Starting contexts, which MUST be on a block boundary.  May be NULL.
+ * @param[in] in Message data.
+ * @param[in] inlen Message lengths.
+ * @param[in] idx Which entries of the arrays to hash.
+ * @param[in] num Number of entries in idx.
+ */
+static void md5_multi_lanes(uint8_t out[][MD5_DIGEST_LENGTH], FR_MD5_CTX const * const ctx[],
+			    uint8_t const * const in[], size_t const inlen[], size_t const idx[], size_t num)
+{
+	md5_lane_t	lane[FR_MD5_MULTI_LANES];
+	md5_vec_t	state[4], block[MD5_BLOCK_LENGTH / 4];
+	size_t		i, j, k, max = 0;
+
+	for (i = 0; i < FR_MD5_MULTI_LANES; i++) {
+		uint32_t	count[2] = { 0, 0 };
+		uint32_t	init[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+		size_t		rem, len;
+
+		if (i >= num) {
+			lane[i].full = 0;
+			lane[i].blocks = 0;
+			for (j = 0; j < 4; j++) state[j][i] = 0;
+			continue;
+		}
+
+		len = inlen[idx[i]];
+		if (ctx && ctx[idx[i]]) {
+			memcpy(init, ctx[idx[i]]->state, sizeof(init));
+			count[0] = ctx[idx[i]]->count[0];
+			count[1] = ctx[idx[i]]->count[1];
+		}
+		for (j = 0; j < 4; j++) state[j][i] = init[j];
+
+		/* Same as fr_md5_update() */
+		if ((count[0] += ((uint32_t)len << 3)) < (uint32_t)len) count[1]++;
+		count[1] += ((uint32_t)len >> 29);
+
+		lane[i].data = in[idx[i]];
+		lane[i].full = len / MD5_BLOCK_LENGTH;
+		rem = len & (MD5_BLOCK_LENGTH - 1);
+
+		memset(lane[i].tail, 0, sizeof(lane[i].tail));
+		if (rem) memcpy(lane[i].tail, lane[i].data + (lane[i].full * MD5_BLOCK_LENGTH), rem);
+		lane[i].tail[rem] = 0x80;
+
+		lane[i].blocks = lane[i].full + 1;
+		if (rem >= (MD5_BLOCK_LENGTH - 8)) lane[i].blocks++;
+		PUT_64BIT_LE(lane[i].tail + ((lane[i].blocks - lane[i].full) * MD5_BLOCK_LENGTH) - 8, count);
+
+		if (lane[i].blocks > max) max = lane[i].blocks;
+	}
+
+	for (k = 0; k < max; k++) {
+		for (i = 0; i < FR_MD5_MULTI_LANES; i++) {
+			uint8_t const *p;
+
+			if (k < lane[i].full) {
+				p = lane[i].data + (k * MD5_BLOCK_LENGTH);
+			} else if (k < lane[i].blocks) {
+				p = lane[i].tail + ((k - lane[i].full) * MD5_BLOCK_LENGTH);
+			} else {
+				p = ZERO_BLOCK;
+			}
+
+			for (j = 0; j < MD5_BLOCK_LENGTH / 4; j++) {
+				block[j][i] = (uint32_t)(
+				    (uint32_t)(p[j * 4 + 0]) |
+				    (uint32_t)(p[j * 4 + 1]) <<  8 |
+				    (uint32_t)(p[j * 4 + 2]) << 16 |
+				    (uint32_t)(p[j * 4 + 3]) << 24);
+			}
+		}
+
+		md5_multi_transform(state, block);
+
+		for (i = 0; i < num; i++) {
+			if ((k + 1) != lane[i].blocks) continue;
+
+			for (j = 0; j < 4; j++) PUT_32BIT_LE(out[idx[i]] + j * 4, state[j][i]);
+		}
+	}
+}
+#endif	/* __GNUC__ */
+#endif	/* HAVE_OPENSSL_EVP_H */
+
+/** Hash one message, for fr_md5_multi()
+ *
+ */
+static void md5_multi_one(uint8_t out[MD5_DIGEST_LENGTH], FR_MD5_CTX const *ctx, uint8_t const *in, size_t inlen)
+{
+	FR_MD5_CTX context;
+
+	if (ctx) {
+		fr_md5_copy(&context, ctx);
+	} else {
+		fr_md5_init(&context);
+	}
+	fr_md5_update(&context, in, inlen);
+	fr_md5_final(out, &context);
+}
+
+/** Calculate the MD5 hashes of many independent messages
+ *
+ * Where possible, FR_MD5_MULTI_LANES messages are hashed at once
+ * using vector instructions.  Otherwise, this is the same as calling
+ * fr_md5_update() and fr_md5_final() for each message.
+ *
+ * @param[out] out Where to write the digests, one per message.
+ * @param[in] ctx Contexts to continue from, or NULL to start each
+ *	message from fr_md5_init().  Individual entries may also be NULL.
+ * @param[in] in Message data.
+ * @param[in] inlen Message lengths.
+ * @param[in] num Number of messages.
+ */
+void fr_md5_multi(uint8_t out[][MD5_DIGEST_LENGTH], FR_MD5_CTX const * const ctx[],
+		  uint8_t const * const in[], size_t const inlen[], size_t num)
+{
+	size_t i;
+#ifdef MD5_MULTI_BUFFER
+	size_t idx[FR_MD5_MULTI_LANES];
+	size_t n = 0;
+
+	for (i = 0; i < num; i++) {
+		/*
+		 *	The lanes can only start on a block boundary.
+		 */
+		if (ctx && ctx[i] && ((ctx[i]->count[0] >> 3) & (MD5_BLOCK_LENGTH - 1))) {
+			md5_multi_one(out[i], ctx[i], in[i], inlen[i]);
+			continue;
+		}
+
+		idx[n++] = i;
+		if (n < FR_MD5_MULTI_LANES) continue;
+
+		md5_multi_lanes(out, ctx, in, inlen, idx, n);
+		n = 0;
+	}
+
+	/*
+	 *	A single message is faster on its own.
+	 */
+	if (n == 1) {
+		md5_multi_one(out[idx[0]], ctx ? ctx[idx[0]] : NULL, in[idx[0]], inlen[idx[0]]);
+	} else if (n > 1) {
+		md5_multi_lanes(out, ctx, in, inlen, idx, n);
+	}
+#else
+	for (i = 0; i < num; i++) md5_multi_one(out[i], ctx ? ctx[i] : NULL, in[i], inlen[i]);
 #endif
+}
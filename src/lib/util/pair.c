@@ -268,6 +268,10 @@ VALUE_PAIR *fr_pair_copy(TALLOC_CTX *ctx, VALUE_PAIR const *vp)
 }
 
 /** Steal one VP
+ *
+ *  If the value is borrowed from a buffer (e.g. the packet it was
+ *  decoded from), the VP gets its own copy.  The new context may
+ *  outlive the buffer.
  *
  * @param[in] ctx to move VALUE_PAIR into
  * @param[in] vp VALUE_PAIR to move into the new context.
@@ -276,6 +280,8 @@ void fr_pair_steal(TALLOC_CTX *ctx, VALUE_PAIR *vp)
 {
 	(void) talloc_steal(ctx, vp);
 
+	(void) fr_value_box_unborrow(vp, &vp->data);
+
 	/*
 	 *	The DA may be unknown.  If we're stealing the VPs to a
 	 *	different context, copy the unknown DA.  We use the VP
@@ -1712,6 +1718,10 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 				break;
 
 			case FR_TYPE_OCTETS:
+				if (i->data.borrowed) {
+					fr_pair_value_memcpy(found, i->vp_octets, i->vp_length);
+					break;
+				}
 				fr_pair_value_memsteal(found, i->vp_octets);
 				i->vp_octets = NULL;
 				break;
@@ -2671,7 +2681,10 @@ inline void fr_pair_verify(char const *file, int line, VALUE_PAIR const *vp)
 
 	fr_dict_verify(file, line, vp->da);
 
-	if (vp->vp_ptr) switch (vp->vp_type) {
+	/*
+	 *	Borrowed buffers aren't talloced.
+	 */
+	if (vp->vp_ptr && !vp->data.borrowed) switch (vp->vp_type) {
 	case FR_TYPE_OCTETS:
 	{
 		size_t len;
@@ -237,3 +237,214 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 
 	return received;
 }
+
+/** Read multiple UDP packets
+ *
+ * Uses recvmmsg() where available, so that many packets can be read
+ * with one system call.  If recvmmsg() is not available, only one
+ * packet is read.
+ *
+ * Packets with an unknown source address family are returned with
+ * data_len set to zero, and should be ignored by the caller.
+ *
+ * @param[in] sockfd we're reading from.
+ * @param[in,out] msgs array of buffers where the packets will be written.
+ * @param[in] num number of entries in msgs.
+ * @return
+ *	- > 0 on success (number of entries in msgs which were used).
+ *	- 0 if there were no packets to read.
+ *	- < 0 on failure.
+ */
+int udp_recv_mmsg(int sockfd, udp_mmsg_t *msgs, int num)
+{
+#ifdef HAVE_RECVMMSG
+	int			i, received;
+	struct timeval		now;
+	struct mmsghdr		msgvec[UDP_MMSG_MAX];
+	struct iovec		iov[UDP_MMSG_MAX];
+	struct sockaddr_storage	src[UDP_MMSG_MAX];
+#ifdef WITH_UDPFROMTO
+	uint8_t			cbuf[UDP_MMSG_MAX][256];
+#endif
+	struct sockaddr_storage	local;
+	socklen_t		sizeof_local = sizeof(local);
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	/*
+	 *	recvmsg() doesn't return the destination port, so we
+	 *	start off with the local address of the socket.
+	 */
+	if (getsockname(sockfd, (struct sockaddr *)&local, &sizeof_local) < 0) return -1;
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = msgs[i].data;
+		iov[i].iov_len = msgs[i].data_len;
+
+		msgvec[i].msg_hdr.msg_name = &src[i];
+		msgvec[i].msg_hdr.msg_namelen = sizeof(src[i]);
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+#ifdef WITH_UDPFROMTO
+		msgvec[i].msg_hdr.msg_control = cbuf[i];
+		msgvec[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+#endif
+	}
+
+	received = recvmmsg(sockfd, msgvec, num, MSG_DONTWAIT, NULL);
+	if (received < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("recvmmsg failed: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	now.tv_sec = 0;
+	now.tv_usec = 0;
+
+	for (i = 0; i < received; i++) {
+		struct sockaddr_storage	dst;
+		socklen_t		sizeof_dst = sizeof_local;
+		uint16_t		port;
+
+		msgs[i].data_len = msgvec[i].msg_len;
+		memcpy(&dst, &local, sizeof_local);
+
+#ifdef WITH_UDPFROMTO
+		udpfromto_cmsg(&msgvec[i].msg_hdr, (struct sockaddr *)&dst, &sizeof_dst,
+			       &msgs[i].if_index, &msgs[i].when);
+#else
+		msgs[i].if_index = 0;
+		msgs[i].when.tv_sec = 0;
+		msgs[i].when.tv_usec = 0;
+#endif
+
+		if (fr_ipaddr_from_sockaddr(&src[i], msgvec[i].msg_hdr.msg_namelen,
+					    &msgs[i].src_ipaddr, &port) < 0) {
+			FR_DEBUG_STRERROR_PRINTF("Unknown address family");
+			msgs[i].data_len = 0;
+			continue;
+		}
+		msgs[i].src_port = port;
+
+		fr_ipaddr_from_sockaddr(&dst, sizeof_dst, &msgs[i].dst_ipaddr, &port);
+		msgs[i].dst_port = port;
+
+		/*
+		 *	All of the packets were read at the same time.
+		 */
+		if (!msgs[i].when.tv_sec) {
+			if (!now.tv_sec) gettimeofday(&now, NULL);
+			msgs[i].when = now;
+		}
+	}
+
+	return received;
+#else
+	ssize_t			received;
+
+	if (num < 1) return 0;
+
+	received = udp_recv(sockfd, msgs[0].data, msgs[0].data_len, 0,
+			    &msgs[0].src_ipaddr, &msgs[0].src_port,
+			    &msgs[0].dst_ipaddr, &msgs[0].dst_port, &msgs[0].if_index,
+			    &msgs[0].when);
+	if (received < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+		return -1;
+	}
+
+	msgs[0].data_len = received;
+	return 1;
+#endif
+}
+
+/** Send multiple UDP packets
+ *
+ * Uses sendmmsg() where available, so that many packets can be sent
+ * with one system call.  If sendmmsg() is not available, the packets
+ * are sent one at a time via udp_send().
+ *
+ * @param[in] sockfd we're writing to.
+ * @param[in] msgs array of packets to send.
+ * @param[in] num number of entries in msgs.
+ * @return
+ *	- >= 0 on success (number of packets sent).
+ *	- < 0 on failure.
+ */
+int udp_send_mmsg(int sockfd, udp_mmsg_t *msgs, int num)
+{
+#ifdef HAVE_SENDMMSG
+	int			i, sent, rcode;
+	struct mmsghdr		msgvec[UDP_MMSG_MAX];
+	struct iovec		iov[UDP_MMSG_MAX];
+	struct sockaddr_storage	dst[UDP_MMSG_MAX];
+#ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_MMSG_MAX][256];
+#endif
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
+	for (i = 0; i < num; i++) {
+		socklen_t	sizeof_dst;
+
+		if (fr_ipaddr_to_sockaddr(&msgs[i].dst_ipaddr, msgs[i].dst_port, &dst[i], &sizeof_dst) < 0) return -1;
+
+		iov[i].iov_base = msgs[i].data;
+		iov[i].iov_len = msgs[i].data_len;
+
+		msgvec[i].msg_hdr.msg_name = &dst[i];
+		msgvec[i].msg_hdr.msg_namelen = sizeof_dst;
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+
+#ifdef WITH_UDPFROMTO
+		/*
+		 *	And if they don't specify a source IP address, don't
+		 *	use udpfromto.
+		 */
+		if ((msgs[i].src_ipaddr.af != AF_UNSPEC) && (msgs[i].dst_ipaddr.af != AF_UNSPEC) &&
+		    !fr_ipaddr_is_inaddr_any(&msgs[i].src_ipaddr)) {
+			struct sockaddr_storage	src;
+			socklen_t		sizeof_src;
+
+			fr_ipaddr_to_sockaddr(&msgs[i].src_ipaddr, msgs[i].src_port, &src, &sizeof_src);
+
+			if (udpfromto_cmsg_set(sockfd, &msgvec[i].msg_hdr, cbuf[i],
+					       (struct sockaddr *)&src, sizeof_src, msgs[i].if_index) < 0) {
+				fr_strerror_printf("udp_send_mmsg failed: %s", fr_syserror(errno));
+				return -1;
+			}
+		}
+#endif
+	}
+
+	sent = 0;
+	while (sent < num) {
+		rcode = sendmmsg(sockfd, msgvec + sent, num - sent, 0);
+		if (rcode < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("udp_send_mmsg failed: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (!rcode) break;
+
+		sent += rcode;
+	}
+
+	return sent;
+#else
+	int			i;
+
+	for (i = 0; i < num; i++) {
+		if (udp_send(sockfd, msgs[i].data, msgs[i].data_len, 0,
+			     &msgs[i].src_ipaddr, msgs[i].src_port, msgs[i].if_index,
+			     &msgs[i].dst_ipaddr, msgs[i].dst_port) < 0) return -1;
+	}
+
+	return num;
+#endif
+}
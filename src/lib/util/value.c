@@ -248,7 +248,11 @@ inline void fr_value_box_clear(fr_value_box_t *data)
 	switch (data->type) {
 	case FR_TYPE_OCTETS:
 	case FR_TYPE_STRING:
-		TALLOC_FREE(data->datum.ptr);
+		if (data->borrowed) {
+			data->datum.ptr = NULL;
+		} else {
+			TALLOC_FREE(data->datum.ptr);
+		}
 		data->datum.length = 0;
 		break;
 
@@ -264,6 +268,7 @@ inline void fr_value_box_clear(fr_value_box_t *data)
 	}
 
 	data->tainted = false;
+	data->borrowed = false;
 	data->type = FR_TYPE_INVALID;
 }
 
@@ -286,6 +291,7 @@ static inline void fr_value_box_copy_meta(fr_value_box_t *dst, fr_value_box_t co
 	dst->enumv = src->enumv;
 	dst->type = src->type;
 	dst->tainted = src->tainted;
+	dst->borrowed = false;
 }
 
 /** Compare two values
@@ -2303,8 +2309,18 @@ void fr_value_box_copy_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_bo
 
 	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		/*
+		 *	We don't know who owns a borrowed buffer, so
+		 *	we can't add a reference to it.
+		 */
+		if (ctx && src->borrowed) {
+			fr_value_box_copy(ctx, dst, src);
+			break;
+		}
+
 		dst->datum.ptr = ctx ? talloc_reference(ctx, src->datum.ptr) : src->datum.ptr;
 		fr_value_box_copy_meta(dst, src);
+		dst->borrowed = src->borrowed;
 		break;
 	}
 }
@@ -2322,6 +2338,11 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t cons
 {
 	if (!fr_cond_assert(src->type != FR_TYPE_INVALID)) return -1;
 
+	/*
+	 *	Borrowed buffers can't be stolen.
+	 */
+	if (src->borrowed) return fr_value_box_copy(ctx, dst, src);
+
 	switch (src->type) {
 	default:
 		return fr_value_box_copy(ctx, dst, src);
@@ -2713,6 +2734,68 @@ int fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_
 	return 0;
 }
 
+/** Assign part of a buffer owned by something else to a box, but don't copy it
+ *
+ * The box is marked as borrowed, so the buffer is never freed or stolen
+ * through it.  The caller must keep the buffer valid for as long as the
+ * box exists, usually by holding one reference for all of the boxes which
+ * borrow from it.  Boxes which may outlive that reference must be copied
+ * with fr_value_box_unborrow() first.
+ *
+ * @param[in] dst 	to assign buffer to.
+ * @param[in] enumv	Aliases for values.
+ * @param[in] src	buffer, which need not be talloced.
+ * @param[in] len	of buffer.
+ * @param[in] tainted	Whether the value came from a trusted source.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_memdup_borrow(fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+			       uint8_t const *src, size_t len, bool tainted)
+{
+	dst->type = FR_TYPE_OCTETS;
+	dst->tainted = tainted;
+	dst->borrowed = true;
+	dst->vb_octets = src;
+	dst->datum.length = len;
+	dst->enumv = enumv;
+	dst->next = NULL;
+
+	return 0;
+}
+
+/** Give a box its own copy of a borrowed buffer
+ *
+ * Does nothing if the box isn't borrowing.
+ *
+ * @param[in] ctx 	to allocate the copy in.
+ * @param[in] vb 	to copy the buffer of.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_unborrow(TALLOC_CTX *ctx, fr_value_box_t *vb)
+{
+	uint8_t *bin = NULL;
+
+	if (!vb->borrowed) return 0;
+
+	if (vb->datum.length) {
+		bin = talloc_memdup(ctx, vb->vb_octets, vb->datum.length);
+		if (!bin) {
+			fr_strerror_printf("Failed allocating octets buffer");
+			return -1;
+		}
+		talloc_set_type(bin, uint8_t);
+	}
+
+	vb->vb_octets = bin;
+	vb->borrowed = false;
+
+	return 0;
+}
+
 /** Convert integer encoded as string to a fr_value_box_t type
  *
  * @param[out] dst		where to write parsed value.
@@ -1075,6 +1075,11 @@ RADCLIENT *client_afrom_cs(TALLOC_CTX *ctx, CONF_SECTION *cs, CONF_SECTION *serv
 		}
 	}
 
+	/*
+	 *	Hash the secret once here, instead of for every packet.
+	 */
+	fr_md5_secret_init(&c->secret_state, (uint8_t const *) c->secret, strlen(c->secret));
+
 #ifdef WITH_COA
 	{
 		CONF_PAIR *cp;
@@ -1193,6 +1198,7 @@ RADCLIENT *client_afrom_query(TALLOC_CTX *ctx, char const *identifier, char cons
 	 *	Other values (secret, shortname, nas_type, virtual_server)
 	 */
 	c->secret = talloc_typed_strdup(c, secret);
+	fr_md5_secret_init(&c->secret_state, (uint8_t const *) c->secret, strlen(c->secret));
 	if (shortname) c->shortname = talloc_typed_strdup(c, shortname);
 	if (type) c->nas_type = talloc_typed_strdup(c, type);
 	if (server) c->server = talloc_typed_strdup(c, server);
@@ -1451,6 +1457,7 @@ RADCLIENT *client_afrom_request(RADCLIENT_LIST *clients, REQUEST *request)
 		       fr_inet_ntoh(&request->packet->src_ipaddr, buffer, sizeof(buffer)));
 		goto error;
 	}
+	fr_md5_secret_init(&c->secret_state, (uint8_t const *) c->secret, strlen(c->secret));
 
 	if (!client_add_dynamic(clients, request->client, c)) {
 		return NULL;
@@ -1658,7 +1658,7 @@ static int auth_socket_send(NDEBUG_UNUSED rad_listen_t *listener, REQUEST *reque
 #endif
 
 	if (fr_radius_packet_send(request->reply, request->packet,
-			   request->client->secret) < 0) {
+			   request->client->secret, &request->client->secret_state) < 0) {
 		RERROR("Failed sending reply: %s",
 			       fr_strerror());
 		return -1;
@@ -1698,7 +1698,7 @@ static int acct_socket_send(NDEBUG_UNUSED rad_listen_t *listener, REQUEST *reque
 #  endif
 
 	if (fr_radius_packet_send(request->reply, request->packet,
-			   request->client->secret) < 0) {
+			   request->client->secret, &request->client->secret_state) < 0) {
 		RERROR("Failed sending reply: %s",
 			       fr_strerror());
 		return -1;
@@ -1720,7 +1720,8 @@ static int proxy_socket_send(NDEBUG_UNUSED rad_listen_t *listener, REQUEST *requ
 	rad_assert(listener->send == proxy_socket_send);
 
 	if (fr_radius_packet_send(request->proxy->packet, NULL,
-			   request->proxy->home_server->secret) < 0) {
+			   request->proxy->home_server->secret,
+			   &request->proxy->home_server->secret_state) < 0) {
 		RERROR("Failed sending proxied request: %s",
 			       fr_strerror());
 		return -1;
@@ -2429,7 +2430,8 @@ static int client_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 {
 	if (!request->reply->code) return 0;
 
-	if (fr_radius_packet_encode(request->reply, request->packet, request->client->secret) < 0) {
+	if (fr_radius_packet_encode(request->reply, request->packet,
+				    request->client->secret, &request->client->secret_state) < 0) {
 		RPERROR("Failed encoding packet");
 
 		return -1;
@@ -2440,7 +2442,8 @@ static int client_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 			request->reply->data_len, MAX_PACKET_LEN);
 	}
 
-	if (fr_radius_packet_sign(request->reply, request->packet, request->client->secret) < 0) {
+	if (fr_radius_packet_sign(request->reply, request->packet,
+				  request->client->secret, &request->client->secret_state) < 0) {
 		RPERROR("Failed signing packet");
 
 		return -1;
@@ -2457,7 +2460,7 @@ static int client_socket_decode(UNUSED rad_listen_t *listener, REQUEST *request)
 #endif
 
 	if (fr_radius_packet_verify(request->packet, NULL,
-			     request->client->secret) < 0) {
+			     request->client->secret, &request->client->secret_state) < 0) {
 		if (request->reply) request->reply->id = -1;
 		return -1;
 	}
@@ -2483,13 +2486,14 @@ static int client_socket_decode(UNUSED rad_listen_t *listener, REQUEST *request)
 #endif
 
 	return fr_radius_packet_decode(request->packet, NULL,
-				request->client->secret);
+				request->client->secret, &request->client->secret_state);
 }
 
 #ifdef WITH_PROXY
 static int proxy_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 {
-	if (fr_radius_packet_encode(request->proxy->packet, NULL, request->proxy->home_server->secret) < 0) {
+	if (fr_radius_packet_encode(request->proxy->packet, NULL, request->proxy->home_server->secret,
+				    &request->proxy->home_server->secret_state) < 0) {
 		RPERROR("Failed encoding proxied packet");
 
 		return -1;
@@ -2500,7 +2504,8 @@ static int proxy_socket_encode(UNUSED rad_listen_t *listener, REQUEST *request)
 			request->proxy->packet->data_len, MAX_PACKET_LEN);
 	}
 
-	if (fr_radius_packet_sign(request->proxy->packet, NULL, request->proxy->home_server->secret) < 0) {
+	if (fr_radius_packet_sign(request->proxy->packet, NULL, request->proxy->home_server->secret,
+				  &request->proxy->home_server->secret_state) < 0) {
 		RPERROR("Failed signing proxied packet");
 
 		return -1;
@@ -2517,7 +2522,8 @@ static int proxy_socket_decode(UNUSED rad_listen_t *listener, REQUEST *request)
 	 */
 
 	return fr_radius_packet_decode(request->proxy->reply, request->proxy->packet,
-				request->proxy->home_server->secret);
+				request->proxy->home_server->secret,
+				&request->proxy->home_server->secret_state);
 }
 #endif
 
@@ -955,7 +955,7 @@ static int send_one_packet(rc_request_t *request)
 	/*
 	 *	Send the packet.
 	 */
-	if (fr_radius_packet_send(request->packet, NULL, secret) < 0) {
+	if (fr_radius_packet_send(request->packet, NULL, secret, NULL) < 0) {
 		REDEBUG("Failed to send packet for ID %d", request->packet->id);
 		deallocate_id(request);
 		request->done = true;
@@ -1049,7 +1049,7 @@ static int recv_one_packet(int wait_time)
 	 *	Fails the signature validation: not a real reply.
 	 *	FIXME: Silently drop it and listen for another packet.
 	 */
-	if (fr_radius_packet_verify(reply, request->packet, secret) < 0) {
+	if (fr_radius_packet_verify(reply, request->packet, secret, NULL) < 0) {
 		REDEBUG("Reply verification failed");
 		stats.lost++;
 		goto packet_done; /* shared secret is incorrect */
@@ -1066,7 +1066,7 @@ static int recv_one_packet(int wait_time)
 	/*
 	 *	If this fails, we're out of memory.
 	 */
-	if (fr_radius_packet_decode(request->reply, request->packet, secret) != 0) {
+	if (fr_radius_packet_decode(request->reply, request->packet, secret, NULL) != 0) {
 		REDEBUG("Reply decode failed");
 		stats.lost++;
 		goto packet_done;
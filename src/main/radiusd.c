@@ -179,6 +179,10 @@ int main(int argc, char *argv[])
 	memset(&main_config, 0, sizeof(main_config));
 	main_config.daemonize = true;
 	main_config.spawn_workers = true;
+	main_config.num_networks = 1;
+	main_config.min_workers = 1;
+	main_config.max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if ((int) main_config.max_workers <= 0) main_config.max_workers = 1;
 
 	p = strrchr(argv[0], FR_DIR_SEP);
 	if (!p) {
@@ -587,20 +591,24 @@ int main(int argc, char *argv[])
 	 *	async listeners, then we open the sockets.
 	 */
 	if (!check_config && main_config.namespace) {
-		int networks = 1;
-		int workers = 4;
+		int networks = main_config.num_networks;
+		int min_workers = main_config.min_workers;
+		int max_workers = main_config.max_workers;
+		fr_schedule_cpus_t cpus = { .network = main_config.network_cpus, .worker = main_config.worker_cpus };
 		fr_event_list_t *el = NULL;
 
 		if (!main_config.spawn_workers) {
 			networks = 0;
-			workers = 0;
+			min_workers = 0;
+			max_workers = 0;
 			el = process_global_event_list(EVENT_CORRAL_MAIN);
 		}
 
-		sc = fr_schedule_create(NULL, el, &default_log, networks, workers,
+		sc = fr_schedule_create(NULL, el, &default_log, networks, min_workers, max_workers, &cpus,
 					(fr_schedule_thread_instantiate_t) modules_thread_instantiate,
 					main_config.config);
 		if (!sc) {
+			PERROR("Failed creating scheduler");
 			exit(EXIT_FAILURE);
 		}
 
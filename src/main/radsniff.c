@@ -1375,7 +1375,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			FILE *log_fp = fr_log_fp;
 
 			fr_log_fp = NULL;
-			ret = fr_radius_packet_verify(current, original->expect, conf->radius_secret);
+			ret = fr_radius_packet_verify(current, original->expect, conf->radius_secret, NULL);
 			fr_log_fp = log_fp;
 			if (ret != 0) {
 				REDEBUG("Failed verifying packet ID %d", current->id);
@@ -1393,7 +1393,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			FILE *log_fp = fr_log_fp;
 
 			fr_log_fp = NULL;
-			ret = fr_radius_packet_decode(current, original ? original->expect : NULL, conf->radius_secret);
+			ret = fr_radius_packet_decode(current, original ? original->expect : NULL, conf->radius_secret, NULL);
 			fr_log_fp = log_fp;
 			if (ret != 0) {
 				fr_radius_free(&current);
@@ -1499,7 +1499,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			FILE *log_fp = fr_log_fp;
 
 			fr_log_fp = NULL;
-			ret = fr_radius_packet_decode(current, NULL, conf->radius_secret);
+			ret = fr_radius_packet_decode(current, NULL, conf->radius_secret, NULL);
 			fr_log_fp = log_fp;
 
 			if (ret != 0) {
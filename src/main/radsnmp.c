@@ -754,11 +754,11 @@ static int radsnmp_send_recv(radsnmp_conf_t *conf, int fd)
 			unsigned int	ret;
 			unsigned int	i;
 
-			if (fr_radius_packet_encode(request, NULL, conf->secret) < 0) {
+			if (fr_radius_packet_encode(request, NULL, conf->secret, NULL) < 0) {
 				ERROR("Failed encoding request: %s", fr_strerror());
 				return EXIT_FAILURE;
 			}
-			if (fr_radius_packet_sign(request, NULL, conf->secret) < 0) {
+			if (fr_radius_packet_sign(request, NULL, conf->secret, NULL) < 0) {
 				ERROR("Failed signing request: %s", fr_strerror());
 				return EXIT_FAILURE;
 			}
@@ -806,7 +806,7 @@ static int radsnmp_send_recv(radsnmp_conf_t *conf, int fd)
 						talloc_free(request);
 						continue;
 					}
-					if (fr_radius_packet_decode(reply, request, conf->secret) < 0) {
+					if (fr_radius_packet_decode(reply, request, conf->secret, NULL) < 0) {
 						ERROR("Failed decoding reply: %s", fr_strerror());
 						goto recv_error;
 					}
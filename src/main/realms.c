@@ -424,6 +424,13 @@ void realm_home_server_sanitize(home_server_t *home, CONF_SECTION *cs)
 		main_config.init_delay = home->response_window;
 	}
 
+	/*
+	 *	Hash the secret once here, instead of for every packet.
+	 */
+	if (home->secret) {
+		fr_md5_secret_init(&home->secret_state, (uint8_t const *) home->secret, strlen(home->secret));
+	}
+
 	FR_INTEGER_BOUND_CHECK("zombie_period", home->zombie_period, >=, 1);
 	FR_INTEGER_BOUND_CHECK("zombie_period", home->zombie_period, <=, 120);
 	FR_INTEGER_BOUND_CHECK("zombie_period", home->zombie_period, >=, (uint32_t) home->response_window.tv_sec);
@@ -1480,6 +1487,7 @@ static int old_server_add(realm_config_t *rc, CONF_SECTION *cs,
 		home->name = name;
 		home->type = type;
 		home->secret = secret;
+		if (secret) fr_md5_secret_init(&home->secret_state, (uint8_t const *) secret, strlen(secret));
 		home->cs = cs;
 		home->proto = IPPROTO_UDP;
 
@@ -80,6 +80,28 @@ static int _request_free(REQUEST *request)
 	return 0;
 }
 
+/** Initialise the fields of a REQUEST which are the same for every request
+ *
+ */
+static void request_init(REQUEST *request)
+{
+#ifndef NDEBUG
+	request->magic = REQUEST_MAGIC;
+#endif
+
+	/*
+	 *	These may be changed later by request_pre_handler
+	 */
+	request->log.lvl = req_debug_lvl;	/* Default to global debug level */
+	request->log.dst->func = vradlog_request;
+	request->log.dst->uctx = &default_log;
+
+	request->module = NULL;
+	request->component = "<core>";
+
+	request->heap_id = -1;
+}
+
 /** Create a new REQUEST data structure
  *
  */
@@ -90,9 +112,6 @@ REQUEST *request_alloc(TALLOC_CTX *ctx)
 	request = talloc_zero(ctx, REQUEST);
 	if (!request) return NULL;
 	talloc_set_destructor(request, _request_free);
-#ifndef NDEBUG
-	request->magic = REQUEST_MAGIC;
-#endif
 #ifdef WITH_PROXY
 	request->proxy = NULL;
 #endif
@@ -101,16 +120,7 @@ REQUEST *request_alloc(TALLOC_CTX *ctx)
 	request->username = NULL;
 	request->password = NULL;
 
-	/*
-	 *	These may be changed later by request_pre_handler
-	 */
-	request->log.lvl = req_debug_lvl;	/* Default to global debug level */
 	request->log.dst = talloc_zero(request, log_dst_t);
-	request->log.dst->func = vradlog_request;
-	request->log.dst->uctx = &default_log;
-
-	request->module = NULL;
-	request->component = "<core>";
 
 #ifdef HAVE_TALLOC_POOLED_OBJECT
 	/*
@@ -131,13 +141,167 @@ REQUEST *request_alloc(TALLOC_CTX *ctx)
 #else
 	request->stack = talloc_zero(request, unlang_stack_t);
 #endif
-	request->heap_id = -1;
+	request_init(request);
+
+	request->state_ctx = talloc_init("session-state");
+
+	return request;
+}
+
+/*
+ *	Allocate an object which is also a talloc pool, if we can.
+ *	The memory is NOT zeroed.
+ */
+#ifdef HAVE_TALLOC_POOLED_OBJECT
+#  define request_pooled_object(_ctx, _type, _size) talloc_pooled_object(_ctx, _type, (_size) / 128, _size)
+#else
+#  define request_pooled_object(_ctx, _type, _size) ((void) (_size), talloc(_ctx, _type))
+#endif
+
+/** Create a REQUEST which can be recycled with request_reset()
+ *
+ *  The REQUEST, its packet, and its reply are each talloc pools (if
+ *  talloc supports it), so that anything allocated beneath them
+ *  while processing the request comes from the pool.
+ *
+ *  The long-lived children of the REQUEST are allocated outside of
+ *  its pool.  When request_reset() frees everything else, the pools
+ *  are empty, and talloc resets them.
+ *
+ * @param[in] ctx		to allocate the request in.
+ * @param[in] pool_size		size of the pool for the REQUEST.
+ *				The packet and reply get a quarter of this each.
+ * @return
+ *	- NULL on error.
+ *	- a new REQUEST on success.
+ */
+REQUEST *request_alloc_pooled(TALLOC_CTX *ctx, size_t pool_size)
+{
+	REQUEST		*request;
+	RADIUS_PACKET	*packet, *reply;
+
+	request = request_pooled_object(ctx, REQUEST, pool_size);
+	if (!request) return NULL;
+
+	memset(request, 0, sizeof(*request));
+	talloc_set_destructor(request, _request_free);
+
+	packet = request_pooled_object(NULL, RADIUS_PACKET, pool_size / 4);
+	if (!packet) {
+	error:
+		talloc_free(request);
+		return NULL;
+	}
+	memset(packet, 0, sizeof(*packet));
+	packet->id = -1;
+	request->packet = talloc_steal(request, packet);
+
+	reply = request_pooled_object(NULL, RADIUS_PACKET, pool_size / 4);
+	if (!reply) goto error;
+	memset(reply, 0, sizeof(*reply));
+	reply->id = -1;
+	request->reply = talloc_steal(request, reply);
+
+	request->log.dst = talloc_zero(NULL, log_dst_t);
+	if (!request->log.dst) goto error;
+	(void) talloc_steal(request, request->log.dst);
+
+#ifdef HAVE_TALLOC_POOLED_OBJECT
+	request->stack = talloc_pooled_object(NULL, unlang_stack_t, UNLANG_STACK_MAX / 4,
+					      sizeof(unlang_stack_state_t));
+	if (request->stack) memset(request->stack, 0, sizeof(unlang_stack_t));
+#else
+	request->stack = talloc_zero(NULL, unlang_stack_t);
+#endif
+	if (!request->stack) goto error;
+	(void) talloc_steal(request, request->stack);
+
+	request_init(request);
 
 	request->state_ctx = talloc_init("session-state");
 
 	return request;
 }
 
+/** Reset a REQUEST created by request_alloc_pooled(), so that it can be used again
+ *
+ *  Everything allocated beneath the REQUEST while it was being
+ *  processed is freed.  The packet, reply, log destination, stack,
+ *  state ctx and async structure are kept, and emptied.  The caller
+ *  is responsible for re-initialising the contents of the async
+ *  structure.
+ *
+ * @param[in] request		to reset.
+ * @return
+ *	- <0 if the request cannot be re-used, and should be freed.
+ *	- 0 on success.
+ */
+int request_reset(REQUEST *request)
+{
+	RADIUS_PACKET	*packet = request->packet;
+	RADIUS_PACKET	*reply = request->reply;
+	log_dst_t	*dst = request->log.dst;
+	void		*stack = request->stack;
+	TALLOC_CTX	*state_ctx = request->state_ctx;
+	fr_async_t	*async = request->async;
+
+	if (request->in_request_hash || request->ev) return -1;
+#ifdef WITH_PROXY
+	if (request->in_proxy_hash) return -1;
+#endif
+#ifdef WITH_COA
+	if (request->coa) return -1;
+#endif
+
+	/*
+	 *	Something replaced one of the long-lived children.
+	 */
+	if (!packet || !reply || !dst || !stack || !state_ctx ||
+	    (talloc_parent(packet) != request) || (talloc_parent(reply) != request) ||
+	    (talloc_parent(dst) != request) || (talloc_parent(stack) != request)) return -1;
+
+	/*
+	 *	Take the long-lived children out of the REQUEST, free
+	 *	everything else, and then put them back.
+	 */
+	(void) talloc_steal(NULL, packet);
+	(void) talloc_steal(NULL, reply);
+	(void) talloc_steal(NULL, dst);
+	(void) talloc_steal(NULL, stack);
+	if (async) (void) talloc_steal(NULL, async);
+
+	talloc_free_children(request);
+	talloc_free_children(packet);
+	talloc_free_children(reply);
+	talloc_free_children(dst);
+	talloc_free_children(stack);
+	talloc_free_children(state_ctx);
+	if (async) talloc_free_children(async);
+
+	memset(request, 0, sizeof(*request));
+
+	memset(packet, 0, sizeof(*packet));
+	packet->id = -1;
+	request->packet = talloc_steal(request, packet);
+
+	memset(reply, 0, sizeof(*reply));
+	reply->id = -1;
+	request->reply = talloc_steal(request, reply);
+
+	memset(dst, 0, sizeof(*dst));
+	request->log.dst = talloc_steal(request, dst);
+
+	memset(stack, 0, sizeof(unlang_stack_t));
+	request->stack = talloc_steal(request, stack);
+
+	if (async) request->async = talloc_steal(request, async);
+
+	request->state_ctx = state_ctx;
+
+	request_init(request);
+
+	return 0;
+}
 
 /*
  *	Create a new REQUEST, based on an old one.
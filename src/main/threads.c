@@ -179,6 +179,11 @@ static const CONF_PARSER thread_config[] = {
 	{ FR_CONF_POINTER("cleanup_delay", FR_TYPE_UINT32, &thread_pool.cleanup_delay), .dflt = "5" },
 	{ FR_CONF_POINTER("max_queue_size", FR_TYPE_UINT32, &thread_pool.max_queue_size), .dflt = "65536" },
 	{ FR_CONF_POINTER("queue_priority", FR_TYPE_STRING, &thread_pool.queue_priority), .dflt = NULL },
+	{ FR_CONF_POINTER("num_networks", FR_TYPE_UINT32, &main_config.num_networks), .dflt = "1" },
+	{ FR_CONF_POINTER("min_workers", FR_TYPE_UINT32, &main_config.min_workers), .dflt = "1" },
+	{ FR_CONF_POINTER("max_workers", FR_TYPE_UINT32, &main_config.max_workers) },	/* defaults to the number of CPUs */
+	{ FR_CONF_POINTER("network_cpus", FR_TYPE_STRING, &main_config.network_cpus) },
+	{ FR_CONF_POINTER("worker_cpus", FR_TYPE_STRING, &main_config.worker_cpus) },
 #ifdef WITH_STATS
 #ifdef WITH_ACCOUNTING
 	{ FR_CONF_POINTER("auto_limit_acct", FR_TYPE_BOOL, &thread_pool.auto_limit_acct) },
@@ -803,6 +808,13 @@ int thread_pool_bootstrap(CONF_SECTION *cs, bool *spawn_workers)
 	FR_INTEGER_BOUND_CHECK("max_servers", thread_pool.max_threads, >=, 1);
 	FR_INTEGER_BOUND_CHECK("start_servers", thread_pool.start_threads, <=, thread_pool.max_threads);
 
+	FR_INTEGER_BOUND_CHECK("num_networks", main_config.num_networks, >=, 1);
+	FR_INTEGER_BOUND_CHECK("num_networks", main_config.num_networks, <=, 64);
+
+	FR_INTEGER_BOUND_CHECK("min_workers", main_config.min_workers, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_workers", main_config.max_workers, <=, 1024);
+	FR_INTEGER_BOUND_CHECK("min_workers", main_config.min_workers, <=, main_config.max_workers);
+
 #ifdef WITH_TLS
 	/*
 	 *	So TLS knows what to do.
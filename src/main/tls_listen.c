@@ -395,7 +395,7 @@ int dual_tls_send(rad_listen_t *listener, REQUEST *request)
 	 *	Pack the VPs
 	 */
 	if (fr_radius_packet_encode(request->reply, request->packet,
-			     request->client->secret) < 0) {
+			     request->client->secret, &request->client->secret_state) < 0) {
 		RPERROR("Failed encoding packet");
 		return 0;
 	}
@@ -409,7 +409,7 @@ int dual_tls_send(rad_listen_t *listener, REQUEST *request)
 	 *	Sign the packet.
 	 */
 	if (fr_radius_packet_sign(request->reply, request->packet,
-			   request->client->secret) < 0) {
+			   request->client->secret, &request->client->secret_state) < 0) {
 		RPERROR("Failed signing packet");
 		return 0;
 	}
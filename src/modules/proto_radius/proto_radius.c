@@ -48,6 +48,14 @@ static CONF_PARSER const proto_radius_config[] = {
 	 */
 	{ FR_CONF_OFFSET("default_message_size", FR_TYPE_UINT32, proto_radius_t, default_message_size) } ,
 	{ FR_CONF_OFFSET("num_messages", FR_TYPE_UINT32, proto_radius_t, num_messages) } ,
+	{ FR_CONF_OFFSET("max_batch", FR_TYPE_UINT32, proto_radius_t, max_batch) } ,
+	{ FR_CONF_OFFSET("zero_copy", FR_TYPE_BOOL, proto_radius_t, zero_copy), .dflt = "no" } ,
+
+	/*
+	 *	Admission control.  See also the "priority" subsection.
+	 */
+	{ FR_CONF_OFFSET("max_queue_delay", FR_TYPE_TIMEVAL, proto_radius_t, max_queue_delay), .dflt = "1.0" } ,
+	{ FR_CONF_OFFSET("max_backlog", FR_TYPE_UINT32, proto_radius_t, max_backlog) } ,
 
 	CONF_PARSER_TERMINATOR
 };
@@ -169,12 +177,34 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 	request->reply->id = data[1];
 	memcpy(request->packet->vector, data + 4, sizeof(request->packet->vector));
 
-	request->packet->data = talloc_memdup(request->packet, data, data_len);
 	request->packet->data_len = data_len;
 
-	if (fr_radius_packet_decode(request->packet, NULL, client->secret) < 0) {
-		RDEBUG("Failed decoding packet: %s", fr_strerror());
-		return -1;
+	/*
+	 *	The worker holds the message for us, so we can use
+	 *	it directly, instead of copying it.  The packet takes
+	 *	one reference, which covers all of the attributes
+	 *	pointing into the data.
+	 */
+	if (request->async->message) {
+		if (!talloc_reference(request->packet, request->async->message)) {
+			RDEBUG("Failed referencing packet data");
+			return -1;
+		}
+		request->packet->data = data;
+
+		if (fr_radius_packet_decode_shallow(request->packet, NULL, client->secret,
+						    &client->secret_state) < 0) {
+			RDEBUG("Failed decoding packet: %s", fr_strerror());
+			return -1;
+		}
+
+	} else {
+		request->packet->data = talloc_memdup(request->packet, data, data_len);
+
+		if (fr_radius_packet_decode(request->packet, NULL, client->secret, &client->secret_state) < 0) {
+			RDEBUG("Failed decoding packet: %s", fr_strerror());
+			return -1;
+		}
 	}
 
 	/*
@@ -193,12 +223,12 @@ static ssize_t mod_encode(void const *instance, REQUEST *request, uint8_t *buffe
 	client = inst->app_io_private->client(inst->app_io, request->async->packet_ctx);
 	rad_assert(client);
 
-	if (fr_radius_packet_encode(request->reply, request->packet, client->secret) < 0) {
+	if (fr_radius_packet_encode(request->reply, request->packet, client->secret, &client->secret_state) < 0) {
 		RDEBUG("Failed encoding RADIUS reply: %s", fr_strerror());
 		return -1;
 	}
 
-	if (fr_radius_packet_sign(request->reply, request->packet, client->secret) < 0) {
+	if (fr_radius_packet_sign(request->reply, request->packet, client->secret, &client->secret_state) < 0) {
 		RDEBUG("Failed signing RADIUS reply: %s", fr_strerror());
 		return -1;
 	}
@@ -230,32 +260,26 @@ static void mod_process_set(void const *instance, REQUEST *request)
 	request->async->process = process;
 }
 
-/** Open listen sockets/connect to external event source
+/** Build the #fr_listen_t for one socket
  *
- * @param[in] instance	Ctx data for this application.
- * @param[in] sc	to add our file descriptor to.
- * @param[in] conf	Listen section parsed to give us isntance.
- * @return
- *	- 0 on success.
- *	- -1 on failure.
+ *  This describes the complete path, data takes from the socket to
+ *  the decoder and back again.
+ *
+ * @param[in] inst		Ctx data for this application.
+ * @param[in] app_io_instance	the I/O instance for the socket.
+ * @return the new listener.
  */
-static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
+static fr_listen_t *listen_alloc(proto_radius_t *inst, void *app_io_instance)
 {
 	fr_listen_t	*listen;
-	proto_radius_t 	*inst = talloc_get_type_abort(instance, proto_radius_t);
 
-	/*
-	 *	Build the #fr_listen_t.  This describes the complete
-	 *	path, data takes from the socket to the decoder and
-	 *	back again.
-	 */
-	listen = talloc_zero(inst, fr_listen_t);
+	MEM(listen = talloc_zero(inst, fr_listen_t));
 
 	listen->app_io = inst->app_io;
-	listen->app_io_instance = inst->app_io_instance;
+	listen->app_io_instance = app_io_instance;
 
 	listen->app = &proto_radius;
-	listen->app_instance = instance;
+	listen->app_instance = inst;
 	listen->server_cs = inst->server_cs;
 
 	/*
@@ -263,6 +287,45 @@ static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
 	 */
 	listen->default_message_size = inst->default_message_size;
 	listen->num_messages = inst->default_message_size;
+	listen->max_batch = inst->max_batch;
+	listen->zero_copy = inst->zero_copy;
+
+	/*
+	 *	All of the shards share one backlog, and one set of
+	 *	counters.  The first socket reports them.
+	 */
+	if (!inst->admit) {
+		MEM(inst->admit = talloc_zero(inst, fr_listen_admit_t));
+		inst->admit->owner = listen;
+		inst->admit->max_delay = ((fr_time_t) inst->max_queue_delay.tv_sec) * NANOSEC;
+		inst->admit->max_delay += ((fr_time_t) inst->max_queue_delay.tv_usec) * 1000;
+		inst->admit->max_backlog = inst->max_backlog;
+
+		memset(inst->admit->priority, FR_LISTEN_NUM_PRIORITIES - 1, sizeof(inst->admit->priority));
+		memcpy(inst->admit->priority, inst->priority, sizeof(inst->priority));
+	}
+	listen->admit = inst->admit;
+
+	return listen;
+}
+
+/** Open listen sockets/connect to external event source
+ *
+ * @param[in] instance	Ctx data for this application.
+ * @param[in] sc	to add our file descriptor to.
+ * @param[in] conf	Listen section parsed to give us isntance.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
+{
+	int		i, rcode;
+	fr_listen_t	*listen;
+	void		*app_io_instance;
+	proto_radius_t 	*inst = talloc_get_type_abort(instance, proto_radius_t);
+
+	listen = listen_alloc(inst, inst->app_io_instance);
 
 	/*
 	 *	Open the socket, and add it to the scheduler.
@@ -282,6 +345,37 @@ static int mod_open(void *instance, fr_schedule_t *sc, CONF_SECTION *conf)
 
 	inst->listen = listen;	/* Probably won't need it, but doesn't hurt */
 
+	if (!inst->app_io || !inst->app_io->shard) return 0;
+
+	/*
+	 *	If the transport can open multiple sockets for the
+	 *	same address and port, then open one for each of the
+	 *	remaining network threads.  The scheduler adds sockets
+	 *	to network threads in round-robin order, so each
+	 *	shard ends up being serviced by a different thread.
+	 */
+	for (i = 1; i < fr_schedule_num_networks(sc); i++) {
+		rcode = inst->app_io->shard(inst, &app_io_instance, inst->app_io_instance);
+		if (rcode < 0) {
+			cf_log_err(conf, "Failed creating %s shard: %s", inst->app_io->name, fr_strerror());
+			return -1;
+		}
+		if (rcode == 0) break;
+
+		listen = listen_alloc(inst, app_io_instance);
+
+		if (inst->app_io->open(app_io_instance) < 0) {
+			cf_log_err(conf, "Failed opening %s interface shard %d", inst->app_io->name, i);
+			talloc_free(listen);
+			return -1;
+		}
+
+		if (!fr_schedule_socket_add(sc, listen)) {
+			talloc_free(listen);
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
@@ -302,6 +396,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 
 	fr_dict_attr_t const	*da;
 	CONF_PAIR		*cp = NULL;
+	CONF_SECTION		*priority_cs;
 
 	/*
 	 *	The listener is inside of a virtual server.
@@ -365,6 +460,64 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	FR_INTEGER_BOUND_CHECK("default_message_size", inst->default_message_size, >=, 1024);
 	FR_INTEGER_BOUND_CHECK("default_message_size", inst->default_message_size, <=, 65535);
 
+	/*
+	 *	Read multiple packets per wakeup, if the transport
+	 *	supports it.
+	 */
+	if (!inst->max_batch) inst->max_batch = 1;
+
+	FR_INTEGER_BOUND_CHECK("max_batch", inst->max_batch, <=, 64);
+
+	FR_TIMEVAL_BOUND_CHECK("max_queue_delay", &inst->max_queue_delay, >=, 0, 10000);
+	FR_TIMEVAL_BOUND_CHECK("max_queue_delay", &inst->max_queue_delay, <=, 60, 0);
+
+	/*
+	 *	Status-Server is always answered first, so that
+	 *	clients don't think we're dead.  Authentication is
+	 *	more important than accounting, which can be retried.
+	 */
+	memset(inst->priority, FR_LISTEN_NUM_PRIORITIES - 1, sizeof(inst->priority));
+	inst->priority[FR_CODE_STATUS_SERVER] = 0;
+	inst->priority[FR_CODE_ACCESS_REQUEST] = 1;
+	inst->priority[FR_CODE_COA_REQUEST] = 2;
+	inst->priority[FR_CODE_DISCONNECT_REQUEST] = 2;
+	inst->priority[FR_CODE_ACCOUNTING_REQUEST] = 2;
+
+	/*
+	 *	priority {
+	 *		Access-Request = 0
+	 *		...
+	 *	}
+	 */
+	priority_cs = cf_section_find(conf, "priority", NULL);
+	if (priority_cs) {
+		cp = NULL;
+		while ((cp = cf_pair_find_next(priority_cs, cp, NULL))) {
+			fr_dict_enum_t const	*enumv;
+			unsigned long		priority;
+			char			*end;
+
+			enumv = fr_dict_enum_by_alias(NULL, da, cf_pair_attr(cp));
+			if (!enumv || (enumv->value->vb_uint32 >= FR_CODE_MAX)) {
+				cf_log_err(cp, "Unknown packet type '%s'", cf_pair_attr(cp));
+				return -1;
+			}
+
+			if (!cf_pair_value(cp)) {
+				cf_log_err(cp, "Missing priority for '%s'", cf_pair_attr(cp));
+				return -1;
+			}
+
+			priority = strtoul(cf_pair_value(cp), &end, 10);
+			if (*end || (priority >= FR_LISTEN_NUM_PRIORITIES)) {
+				cf_log_err(cp, "Priority must be an integer between 0 and %d", FR_LISTEN_NUM_PRIORITIES - 1);
+				return -1;
+			}
+
+			inst->priority[enumv->value->vb_uint32] = priority;
+		}
+	}
+
 	return 0;
 }
 
@@ -76,6 +76,13 @@ typedef struct {
 
 	uint32_t			default_message_size;		//!< for message ring buffer
 	uint32_t			num_messages;			//!< for message ring buffer
+	uint32_t			max_batch;			//!< maximum number of packets to read per wakeup
+	bool				zero_copy;			//!< decode octets attributes without copying them
+
+	struct timeval			max_queue_delay;		//!< NAK packets which would wait longer than this
+	uint32_t			max_backlog;			//!< NAK packets when this many are queued
+	uint8_t				priority[FR_CODE_MAX];		//!< admission priority of each packet code
+	fr_listen_admit_t		*admit;				//!< admission control, shared by all sockets
 
 	bool				code_allowed[FR_CODE_MAX];	//!< Lookup allowed packet codes.
 
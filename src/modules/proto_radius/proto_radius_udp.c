@@ -42,17 +42,29 @@ typedef struct {
 	uint16_t			src_port;
 	uint16_t 			dst_port;
 
-	fr_time_t			timestamp;
-
 	RADCLIENT			*client;
 } proto_radius_udp_address_t;
 
+/** Statistics for one socket
+ *
+ *  Each shard has its own socket, and therefore its own statistics.
+ */
+typedef struct {
+	uint64_t			packets;		//!< RADIUS packets accepted for processing
+	uint64_t			replies;		//!< replies written
+	uint64_t			dup;			//!< duplicate packets
+	uint64_t			malformed;		//!< packets which weren't RADIUS
+	uint64_t			unknown_client;		//!< packets from unknown clients
+	uint64_t			bad_signature;		//!< packets which failed signature validation
+} proto_radius_udp_stats_t;
+
 typedef struct {
 	proto_radius_t	const		*parent;		//!< The module that spawned us!
 
 	int				sockfd;
 
 	fr_event_list_t			*el;			//!< for cleanup timers on Access-Request
+	fr_event_timer_t		*ev;			//!< for cleanup_delay
 
 	fr_ipaddr_t			ipaddr;			//!< Ipaddr to listen on.
 
@@ -68,8 +80,16 @@ typedef struct {
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
 								//!< buffer value.
 
+	bool				reuse_port;		//!< open one socket per network thread,
+								//!< using SO_REUSEPORT.
+	uint32_t			shard;			//!< which shard this is.  The configured
+								//!< instance is shard 0.
+	uint32_t			num_shards;		//!< number of shards created from this instance.
+
 	fr_tracking_t			*ft;			//!< tracking table
 	uint32_t			cleanup_delay;		//!< cleanup delay for Access-Request packets
+
+	proto_radius_udp_stats_t	stats;			//!< statistics for this socket
 } proto_radius_udp_t;
 
 static const CONF_PARSER udp_listen_config[] = {
@@ -82,18 +102,59 @@ static const CONF_PARSER udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, proto_radius_udp_t, port) },
 	{ FR_CONF_IS_SET_OFFSET("recv_buff", FR_TYPE_UINT32, proto_radius_udp_t, recv_buff) },
+	{ FR_CONF_OFFSET("reuse_port", FR_TYPE_BOOL, proto_radius_udp_t, reuse_port) },
 
 	{ FR_CONF_OFFSET("cleanup_delay", FR_TYPE_UINT32, proto_radius_udp_t, cleanup_delay), .dflt = "5" },
 
 	CONF_PARSER_TERMINATOR
 };
 
+static void mod_cleanup_delay(fr_event_list_t *el, struct timeval *now, void *uctx);
+
+/** Arm the cleanup timer for the oldest reply in the tracking table
+ *
+ */
+static void mod_cleanup_schedule(proto_radius_udp_t *inst)
+{
+	fr_time_t		oldest, when, now;
+	struct timeval		tv;
+
+	oldest = fr_radius_tracking_oldest_reply(inst->ft);
+	if (!oldest) return;
+
+	/*
+	 *	@todo - Move event timers to fr_time_t
+	 */
+	now = fr_time();
+	when = oldest + ((fr_time_t) inst->cleanup_delay) * NANOSEC;
+
+	gettimeofday(&tv, NULL);
+	if (when > now) {
+		when -= now;
+		tv.tv_sec += when / NANOSEC;
+		tv.tv_usec += (when % NANOSEC) / 1000;
+		tv.tv_sec += tv.tv_usec / USEC;
+		tv.tv_usec %= USEC;
+	}
+
+	(void) fr_event_timer_insert(inst->el, mod_cleanup_delay, inst, &tv, &inst->ev);
+}
+
 static void mod_cleanup_delay(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
 {
-	fr_tracking_entry_t *track = uctx;
-	// proto_radius_udp_t const *inst = talloc_parent(track->ft);
+	proto_radius_udp_t *inst = talloc_get_type_abort(uctx, proto_radius_udp_t);
+	fr_time_t when;
 
-	(void) fr_radius_tracking_entry_delete(track->ft, track);
+	/*
+	 *	Delete all of the entries whose replies were sent
+	 *	more than cleanup_delay ago.
+	 */
+	when = fr_time();
+	if (when > ((fr_time_t) inst->cleanup_delay) * NANOSEC) {
+		(void) fr_radius_tracking_expire(inst->ft, when - ((fr_time_t) inst->cleanup_delay) * NANOSEC);
+	}
+
+	mod_cleanup_schedule(inst);
 }
 
 /** Return the src address associated with the packet_ctx
@@ -172,76 +233,82 @@ static int mod_decode(UNUSED void const *instance, REQUEST *request, UNUSED uint
 	return 0;
 }
 
-static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len)
+/** Check a packet which has been read from the network
+ *
+ *  The signature is checked separately, so that a batch of packets
+ *  can be verified together.
+ *
+ * @param[in] inst		of the RADIUS UDP I/O path.
+ * @param[in,out] address	the packet was received from.  The client is filled in.
+ * @param[in] buffer		holding the packet.
+ * @param[in] data_size		size of the data in the buffer.
+ * @return
+ *	- 0 if the packet should be ignored.
+ *	- >0 length of the RADIUS packet.
+ */
+static size_t mod_read_check(proto_radius_udp_t *inst, proto_radius_udp_address_t *address,
+			     uint8_t *buffer, size_t data_size)
 {
-	proto_radius_udp_t const	*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
-
-	ssize_t				data_size;
 	size_t				packet_len;
 	decode_fail_t			reason;
 
-	struct timeval			timestamp;
-	fr_tracking_status_t		tracking_status;
-	fr_tracking_entry_t		*track;
-	proto_radius_udp_address_t	address;
-
-	data_size = udp_recv(inst->sockfd, buffer, buffer_len, 0,
-			     &address.src_ipaddr, &address.src_port,
-			     &address.dst_ipaddr, &address.dst_port,
-			     &address.if_index, &timestamp);
-	if (data_size <= 0) return data_size;
-
 	packet_len = data_size;
 
 	/*
 	 *	If it's not a RADIUS packet, ignore it.
 	 */
-	if (!fr_radius_ok(buffer, &packet_len, false, &reason)) return 0;
-
-	address.timestamp = fr_time();
+	if (!fr_radius_ok(buffer, &packet_len, false, &reason)) {
+		inst->stats.malformed++;
+		return 0;
+	}
 
 	/*
 	 *	Lookup the client - Must exist to continue.
 	 */
-	address.client = client_find(NULL, &address.src_ipaddr, IPPROTO_UDP);
-	if (!address.client) {
+	address->client = client_find(NULL, &address->src_ipaddr, IPPROTO_UDP);
+	if (!address->client) {
 		ERROR("Unknown client at address %pV:%u.  Ignoring...",
-		      fr_box_ipaddr(address.src_ipaddr), address.src_port);
+		      fr_box_ipaddr(address->src_ipaddr), address->src_port);
 
+		inst->stats.unknown_client++;
 		return 0;
 	}
 
-	/*
-	 *	If the signature fails validation, ignore it.
-	 */
-	if (fr_radius_verify(buffer, NULL,
-			     (uint8_t const *)address.client->secret,
-			     talloc_array_length(address.client->secret)) < 0) {
-		return 0;
-	}
+	return packet_len;
+}
+
+/** Add a packet which has been checked and verified to the tracking table
+ *
+ * @param[in] inst		of the RADIUS UDP I/O path.
+ * @param[in] address		the packet was received from.
+ * @param[out] packet_ctx	the tracking entry for the packet.
+ * @param[out] recv_time	when the packet was received.
+ * @param[in] buffer		holding the packet.
+ * @param[in] timestamp		when the packet was received.
+ * @return
+ *	- <0 on error
+ *	- 0 if the packet should be ignored.
+ *	- 1 if the packet should be processed.
+ */
+static int mod_read_track(proto_radius_udp_t *inst, proto_radius_udp_address_t *address,
+			  void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, fr_time_t timestamp)
+{
+	fr_tracking_status_t		tracking_status;
+	fr_tracking_entry_t		*track;
 
-	tracking_status = fr_radius_tracking_entry_insert(&track, inst->ft, buffer, address.timestamp, &address);
+	tracking_status = fr_radius_tracking_entry_insert(&track, inst->ft, buffer, timestamp, address);
 	switch (tracking_status) {
 	case FR_TRACKING_ERROR:
 	case FR_TRACKING_UNUSED:
 		return -1;	/* Fatal */
 
 		/*
-		 *	If the entry already has a cleanup delay, we
-		 *	extend the cleanup delay.  i.e. the cleanup
-		 *	delay is from the last reply we sent, not from
-		 *	the first one.
+		 *	If the entry already has a reply, the tracking
+		 *	table extends the cleanup delay.  i.e. the
+		 *	cleanup delay is from the last duplicate we
+		 *	saw, not from the first reply.
 		 */
 	case FR_TRACKING_SAME:
-		if (track->ev) {
-			struct timeval tv;
-
-			gettimeofday(&tv, NULL);
-			tv.tv_sec += inst->cleanup_delay;
-
-			(void) fr_event_timer_insert(inst->el, mod_cleanup_delay, track, &tv, &track->ev);
-		}
-
 		/*
 		 *	@todo - if track->reply_len == 1, then we are
 		 *	INTENTIONALLY not replying.  In that case,
@@ -251,15 +318,13 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 		 *	is very hard, so we might as well just ignore
 		 *	it.
 		 */
+		inst->stats.dup++;
 		return 0;
 
 	/*
-	 *	Delete any pre-existing cleanup_delay timers.
+	 *	The tracking table has thrown away any cached reply.
 	 */
 	case FR_TRACKING_DIFFERENT:
-		if (track->ev) (void) fr_event_timer_delete(inst->el, &track->ev);
-		break;
-
 	case FR_TRACKING_NEW:
 		break;
 	}
@@ -267,19 +332,231 @@ static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **rec
 	*packet_ctx = track;
 	*recv_time = &track->timestamp;
 
+	inst->stats.packets++;
+
+	return 1;
+}
+
+static ssize_t mod_read(void const *instance, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len)
+{
+	proto_radius_udp_t		*inst;
+
+	ssize_t				data_size;
+	size_t				packet_len;
+	int				rcode;
+
+	struct timeval			timestamp;
+	proto_radius_udp_address_t	address;
+
+	memcpy(&inst, &instance, sizeof(inst)); /* const issues */
+	inst = talloc_get_type_abort(inst, proto_radius_udp_t);
+
+	/*
+	 *	The address is used as a key in the tracking table,
+	 *	so there must be no uninitialized padding.
+	 */
+	memset(&address, 0, sizeof(address));
+
+	data_size = udp_recv(inst->sockfd, buffer, buffer_len, 0,
+			     &address.src_ipaddr, &address.src_port,
+			     &address.dst_ipaddr, &address.dst_port,
+			     &address.if_index, &timestamp);
+	if (data_size <= 0) return data_size;
+
+	packet_len = mod_read_check(inst, &address, buffer, data_size);
+	if (!packet_len) return 0;
+
+	/*
+	 *	If the signature fails validation, ignore it.
+	 */
+	if (fr_radius_verify(buffer, NULL,
+			     (uint8_t const *)address.client->secret,
+			     talloc_array_length(address.client->secret) - 1,
+			     &address.client->secret_state) < 0) {
+		inst->stats.bad_signature++;
+		return 0;
+	}
+
+	rcode = mod_read_track(inst, &address, packet_ctx, recv_time, buffer, fr_time());
+	if (rcode <= 0) return rcode;
+
 	return packet_len;
 }
 
+/** Read multiple packets from the socket
+ *
+ *  All of the packets are checked first, and then their signatures
+ *  are verified together with fr_radius_verify_multi().  Only then
+ *  are they added to the tracking table.
+ *
+ * @param[in] instance	of the RADIUS UDP I/O path.
+ * @param[in,out] vector	array of buffers to read packets into
+ * @param[in] num	number of entries in the vector
+ * @return
+ *	- <0 on error
+ *	- 0 for "no packets available"
+ *	- >0 number of entries in the vector which were used.
+ */
+static int mod_read_vector(void const *instance, fr_io_vector_t *vector, int num)
+{
+	proto_radius_udp_t		*inst;
+
+	int				i, j, received, num_verify;
+	fr_time_t			timestamp;
+	udp_mmsg_t			msgs[UDP_MMSG_MAX];
+	proto_radius_udp_address_t	address[UDP_MMSG_MAX];
+	fr_radius_verify_entry_t	verify[UDP_MMSG_MAX];
+	int				packet[UDP_MMSG_MAX];
+	size_t				packet_len[UDP_MMSG_MAX];
+
+	memcpy(&inst, &instance, sizeof(inst)); /* const issues */
+	inst = talloc_get_type_abort(inst, proto_radius_udp_t);
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	for (i = 0; i < num; i++) {
+		msgs[i].data = vector[i].buffer;
+		msgs[i].data_len = vector[i].buffer_len;
+	}
+
+	received = udp_recv_mmsg(inst->sockfd, msgs, num);
+	if (received <= 0) return received;
+
+	/*
+	 *	Check the packets, and look up their clients.
+	 */
+	num_verify = 0;
+	for (i = 0; i < received; i++) {
+		vector[i].buffer_len = 0;
+
+		if (!msgs[i].data_len) continue;
+
+		/*
+		 *	The address is used as a key in the tracking
+		 *	table, so there must be no uninitialized padding.
+		 */
+		memset(&address[i], 0, sizeof(address[i]));
+		address[i].if_index = msgs[i].if_index;
+		address[i].src_ipaddr = msgs[i].src_ipaddr;
+		address[i].src_port = msgs[i].src_port;
+		address[i].dst_ipaddr = msgs[i].dst_ipaddr;
+		address[i].dst_port = msgs[i].dst_port;
+
+		packet_len[i] = mod_read_check(inst, &address[i], msgs[i].data, msgs[i].data_len);
+		if (!packet_len[i]) continue;
+
+		verify[num_verify] = (fr_radius_verify_entry_t) {
+			.packet = msgs[i].data,
+			.secret = (uint8_t const *) address[i].client->secret,
+			.secret_len = talloc_array_length(address[i].client->secret) - 1,
+			.secret_state = &address[i].client->secret_state
+		};
+		packet[num_verify++] = i;
+	}
+
+	if (!num_verify) return received;
+
+	/*
+	 *	Verify all of the signatures at once.
+	 */
+	(void) fr_radius_verify_multi(verify, num_verify);
+
+	timestamp = fr_time();
+
+	for (j = 0; j < num_verify; j++) {
+		i = packet[j];
+
+		if (verify[j].rcode < 0) {
+			inst->stats.bad_signature++;
+			continue;
+		}
+
+		switch (mod_read_track(inst, &address[i], &vector[i].packet_ctx, &vector[i].recv_time,
+				       msgs[i].data, timestamp)) {
+		case 0:
+			continue;
+
+		case 1:
+			vector[i].buffer_len = packet_len[i];
+			continue;
+
+		default:
+			break;
+		}
+
+		/*
+		 *	The network side closes the socket when we
+		 *	return an error, and never sees the packets we've
+		 *	already tracked.  Remove them from the tracking
+		 *	table, so that they don't leak.
+		 */
+		while (j-- > 0) {
+			i = packet[j];
+
+			if (!vector[i].buffer_len) continue;
+
+			(void) fr_radius_tracking_entry_delete(inst->ft, vector[i].packet_ctx);
+			vector[i].buffer_len = 0;
+		}
+
+		return -1;
+	}
+
+	return received;
+}
+
+/** Update the tracking table after a reply has been sent
+ *
+ * @param[in] inst		of the RADIUS UDP I/O path.
+ * @param[in] track		the tracking entry for the request.
+ * @param[in] reply_time	when the reply was sent.
+ * @param[in] buffer		holding the reply.
+ * @param[in] buffer_len	length of the reply.
+ */
+static void mod_write_track(proto_radius_udp_t *inst, fr_tracking_entry_t *track,
+			    fr_time_t reply_time, uint8_t *buffer, size_t buffer_len)
+{
+	if (buffer_len >= 20) inst->stats.replies++;
+
+	/*
+	 *	Most packets are cleaned up immediately.  Also, if
+	 *	cleanup_delay = 0, then we even clean up
+	 *	Access-Request packets immediately.
+	 */
+	 if ((track->data[0] != FR_CODE_ACCESS_REQUEST) || !inst->el) {
+		(void) fr_radius_tracking_entry_delete(inst->ft, track);
+		return;
+	}
+
+	 /*
+	  *	Add the reply to the tracking entry.
+	  */
+	 if (fr_radius_tracking_entry_reply(inst->ft, track, reply_time,
+					    buffer, buffer_len) < 0) {
+		(void) fr_radius_tracking_entry_delete(inst->ft, track);
+		return;
+	 }
+
+	 /*
+	  *	Clean up after a while.  The timer is for the
+	  *	oldest reply, so we only need to arm it if it isn't
+	  *	already running.
+	  */
+	 if (!inst->ev) mod_cleanup_schedule(inst);
+}
+
 static ssize_t mod_write(void const *instance, void *packet_ctx,
 			 fr_time_t request_time, uint8_t *buffer, size_t buffer_len)
 {
-	proto_radius_udp_t const	*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+	proto_radius_udp_t		*inst;
 	fr_tracking_entry_t		*track = packet_ctx;
 	proto_radius_udp_address_t	*address = track->src_dst;
 
 	ssize_t				data_size;
 	fr_time_t			reply_time;
-	struct timeval			tv;
+
+	memcpy(&inst, &instance, sizeof(inst)); /* const issues */
+	inst = talloc_get_type_abort(inst, proto_radius_udp_t);
 
 	/*
 	 *	The original packet has changed.  Suppress the write,
@@ -308,41 +585,74 @@ static ssize_t mod_write(void const *instance, void *packet_ctx,
 		data_size = buffer_len;
 	}
 
-	/*
-	 *	Most packets are cleaned up immediately.  Also, if
-	 *	cleanup_delay = 0, then we even clean up
-	 *	Access-Request packets immediately.
-	 */
-	 if ((track->data[0] != FR_CODE_ACCESS_REQUEST) || !inst->el) {
-		(void) fr_radius_tracking_entry_delete(inst->ft, track);
-		return data_size;
-	}
+	mod_write_track(inst, track, reply_time, buffer, buffer_len);
 
-	 /*
-	  *	Add the reply to the tracking entry.
-	  */
-	 if (fr_radius_tracking_entry_reply(inst->ft, track, reply_time,
-					    buffer, buffer_len) < 0) {
-		(void) fr_radius_tracking_entry_delete(inst->ft, track);
-		return data_size;
-	 }
+	return data_size;
+}
 
-	 /*
-	  *	@todo - Move event timers to fr_time_t
-	  */
-	 gettimeofday(&tv, NULL);
+/** Write multiple replies to the socket
+ *
+ * @param[in] instance	of the RADIUS UDP I/O path.
+ * @param[in] vector	array of replies to write
+ * @param[in] num	number of entries in the vector
+ * @return
+ *	- <0 on error
+ *	- >=0 number of packets written.
+ */
+static int mod_write_vector(void const *instance, fr_io_vector_t *vector, int num)
+{
+	proto_radius_udp_t		*inst;
 
-	 tv.tv_sec += inst->cleanup_delay;
+	int				i, start, end, num_send;
+	fr_time_t			reply_time;
+	udp_mmsg_t			msgs[UDP_MMSG_MAX];
 
-	 /*
-	  *	Clean up after a while.
-	  */
-	 if (fr_event_timer_insert(inst->el, mod_cleanup_delay, track, &tv, &track->ev) < 0) {
-		(void) fr_radius_tracking_entry_delete(inst->ft, track);
-		return data_size;
-	 }
+	memcpy(&inst, &instance, sizeof(inst)); /* const issues */
+	inst = talloc_get_type_abort(inst, proto_radius_udp_t);
+
+	for (start = 0; start < num; start = end) {
+		end = start + UDP_MMSG_MAX;
+		if (end > num) end = num;
+
+		num_send = 0;
+		for (i = start; i < end; i++) {
+			fr_tracking_entry_t		*track = vector[i].packet_ctx;
+			proto_radius_udp_address_t	*address = track->src_dst;
+
+			/*
+			 *	The original packet has changed, or
+			 *	this is a NAK.  Don't send anything.
+			 */
+			if (track->timestamp != vector[i].request_time) continue;
+			if (vector[i].buffer_len < 20) continue;
+
+			msgs[num_send].data = vector[i].buffer;
+			msgs[num_send].data_len = vector[i].buffer_len;
+			msgs[num_send].src_ipaddr = address->dst_ipaddr;
+			msgs[num_send].src_port = address->dst_port;
+			msgs[num_send].dst_ipaddr = address->src_ipaddr;
+			msgs[num_send].dst_port = address->src_port;
+			msgs[num_send].if_index = address->if_index;
+			num_send++;
+		}
 
-	return data_size;
+		/*
+		 *	Figure out when we've sent the replies.
+		 */
+		reply_time = fr_time();
+
+		if (num_send && (udp_send_mmsg(inst->sockfd, msgs, num_send) < 0)) return -1;
+
+		for (i = start; i < end; i++) {
+			fr_tracking_entry_t	*track = vector[i].packet_ctx;
+
+			if (track->timestamp != vector[i].request_time) continue;
+
+			mod_write_track(inst, track, reply_time, vector[i].buffer, vector[i].buffer_len);
+		}
+	}
+
+	return num;
 }
 
 /** Open a UDP listener for RADIUS
@@ -366,8 +676,25 @@ static int mod_open(void *instance)
 		return -1;
 	}
 
+#ifdef SO_REUSEPORT
+	/*
+	 *	Every shard binds to the same address and port.  The
+	 *	kernel then distributes packets across the sockets.
+	 */
+	if (inst->reuse_port) {
+		int on = 1;
+
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			ERROR("Failed setting SO_REUSEPORT: %s", fr_syserror(errno));
+			close(sockfd);
+			goto error;
+		}
+	}
+#endif
+
 	if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
 		ERROR("Failed binding socket: %s", fr_strerror());
+		close(sockfd);
 		goto error;
 	}
 
@@ -376,6 +703,96 @@ static int mod_open(void *instance)
 	return 0;
 }
 
+/** Log the statistics for one socket, and close it.
+ *
+ */
+static void mod_close_socket(proto_radius_udp_t *inst)
+{
+	DEBUG2("proto_radius_udp shard %u - packets %" PRIu64 ", replies %" PRIu64 ", duplicates %" PRIu64
+	       ", malformed %" PRIu64 ", unknown clients %" PRIu64 ", bad signatures %" PRIu64,
+	       inst->shard, inst->stats.packets, inst->stats.replies, inst->stats.dup,
+	       inst->stats.malformed, inst->stats.unknown_client, inst->stats.bad_signature);
+
+	if (inst->sockfd >= 0) close(inst->sockfd);
+	inst->sockfd = -1;
+}
+
+/** Print the statistics for one socket
+ *
+ */
+static void mod_debug(void const *instance, FILE *fp)
+{
+	proto_radius_udp_t		*inst;
+
+	memcpy(&inst, &instance, sizeof(inst)); /* const issues */
+	inst = talloc_get_type_abort(inst, proto_radius_udp_t);
+
+	fprintf(fp, "\t\tshard = %u\n", inst->shard);
+	fprintf(fp, "\t\tpackets = %" PRIu64 "\n", inst->stats.packets);
+	fprintf(fp, "\t\treplies = %" PRIu64 "\n", inst->stats.replies);
+	fprintf(fp, "\t\tduplicates = %" PRIu64 "\n", inst->stats.dup);
+	fprintf(fp, "\t\tmalformed = %" PRIu64 "\n", inst->stats.malformed);
+	fprintf(fp, "\t\tunknown_clients = %" PRIu64 "\n", inst->stats.unknown_client);
+	fprintf(fp, "\t\tbad_signatures = %" PRIu64 "\n", inst->stats.bad_signature);
+
+	if (inst->ft) fr_radius_tracking_debug(inst->ft, fp);
+}
+
+static int _shard_free(proto_radius_udp_t *inst)
+{
+	mod_close_socket(inst);
+
+	return 0;
+}
+
+/** Create a shard of the listener, for another network thread
+ *
+ *  The shard has its own socket, tracking table, and statistics.
+ *
+ * @param[in] ctx	to allocate the shard in.
+ * @param[out] out	the new shard.
+ * @param[in] instance	of the RADIUS UDP I/O path.
+ * @return
+ *	- <0 on error
+ *	- 0 if reuse_port is not set.
+ *	- 1 on success
+ */
+static int mod_shard(TALLOC_CTX *ctx, void **out, void const *instance)
+{
+	proto_radius_udp_t const	*inst = talloc_get_type_abort(instance, proto_radius_udp_t);
+	proto_radius_udp_t		*original, *shard;
+
+	*out = NULL;
+	memcpy(&original, &inst, sizeof(original)); /* const issues */
+
+	if (!inst->reuse_port) return 0;
+
+	shard = talloc_memdup(ctx, inst, sizeof(*inst));
+	if (!shard) {
+		fr_strerror_printf("Failed allocating memory");
+		return -1;
+	}
+	talloc_set_name_const(shard, talloc_get_name(inst));
+
+	shard->sockfd = -1;
+	shard->el = NULL;
+	shard->ev = NULL;
+	shard->shard = ++original->num_shards;
+	shard->num_shards = 0;
+	memset(&shard->stats, 0, sizeof(shard->stats));
+
+	shard->ft = fr_radius_tracking_create(shard, sizeof(proto_radius_udp_address_t), inst->parent->code_allowed);
+	if (!shard->ft) {
+		talloc_free(shard);
+		return -1;
+	}
+
+	talloc_set_destructor(shard, _shard_free);
+
+	*out = shard;
+	return 1;
+}
+
 /** Get the file descriptor for this socket.
  *
  * @param[in] instance of the RADIUS UDP I/O path.
@@ -453,6 +870,15 @@ static int mod_instantiate(void *instance, CONF_SECTION *cs)
 
 	FR_INTEGER_BOUND_CHECK("cleanup_delay", inst->cleanup_delay, <=, 30);
 
+#ifndef SO_REUSEPORT
+	if (inst->reuse_port) {
+		cf_log_err(cs, "'reuse_port' is not supported on this system");
+		return -1;
+	}
+#endif
+
+	inst->sockfd = -1;
+
 	inst->ft = fr_radius_tracking_create(inst, sizeof(proto_radius_udp_address_t), inst->parent->code_allowed);
 	if (!inst->ft) {
 		cf_log_err(cs, "Failed to create tracking table: %s", fr_strerror());
@@ -489,7 +915,7 @@ static int mod_detach(void *instance)
 	 *	delete our child event loop from the parent on close.
 	 */
 
-	close(inst->sockfd);
+	mod_close_socket(inst);
 	return 0;
 }
 
@@ -517,8 +943,12 @@ fr_app_io_t proto_radius_udp = {
 	.default_message_size	= 4096,
 	.open			= mod_open,
 	.read			= mod_read,
+	.read_vector		= mod_read_vector,
 	.decode			= mod_decode,
 	.write			= mod_write,
+	.write_vector		= mod_write_vector,
 	.fd			= mod_fd,
 	.event_list_set		= mod_event_list_set,
+	.shard			= mod_shard,
+	.debug			= mod_debug,
 };
@@ -196,6 +196,27 @@ size_t fr_radius_attr_len(VALUE_PAIR const *vp)
 	}
 }
 
+/** Initialise an MD5 context with the shared secret
+ *
+ * Password hiding hashes the secret first, and then the packet
+ * specific data.  If we have a precomputed state for the secret, we
+ * just copy it.
+ *
+ * @param[out] context to initialise.
+ * @param[in] secret the shared secret.  MUST be talloc'd.
+ * @param[in] secret_state precomputed MD5 state for the secret, or NULL.
+ */
+void fr_radius_md5_secret_init(FR_MD5_CTX *context, char const *secret, fr_md5_secret_t const *secret_state)
+{
+	if (secret_state) {
+		fr_md5_copy(context, &secret_state->prefix);
+		return;
+	}
+
+	fr_md5_init(context);
+	fr_md5_update(context, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+}
+
 /**  Do Ascend-Send / Recv-Secret calculation.
  *
  * The secret is hidden by xoring with a MD5 digest created from
@@ -291,27 +312,21 @@ invalid:
 	return packet_len;
 }
 
-/** Sign a previously encoded packet
+/** Find the Message-Authenticator, and set up the packet header for calculating it
  *
- * @param packet the raw RADIUS packet (request or response)
- * @param original the raw original request (if this is a response)
- * @param secret the shared secret
- * @param secret_len the length of the secret
+ * @param[in,out] packet the raw RADIUS packet (request or response)
+ * @param[in] original the raw original request (if this is a response)
+ * @param[out] p_msg where the Message-Authenticator value is, or NULL if there isn't one
  * @return
  *	- <0 on error
  *	- 0 on success
  */
-int fr_radius_sign(uint8_t *packet, uint8_t const *original,
-		   uint8_t const *secret, size_t secret_len)
+static int sign_start(uint8_t *packet, uint8_t const *original, uint8_t **p_msg)
 {
 	uint8_t *msg, *end;
 	size_t packet_len = (packet[2] << 8) | packet[3];
-	FR_MD5_CTX	context;
 
-	if (packet_len < RADIUS_HDR_LEN) {
-		fr_strerror_printf("Packet must be encoded before calling fr_radius_sign()");
-		return -1;
-	}
+	*p_msg = NULL;
 
 	/*
 	 *	Find Message-Authenticator.  Its value has to be
@@ -364,7 +379,11 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		case FR_CODE_ACCESS_REJECT:
 		case FR_CODE_ACCESS_CHALLENGE:
 		do_ack:
-			if (!original) goto need_original;
+			if (!original) {
+			need_original:
+				fr_strerror_printf("Cannot sign response packet without a request packet");
+				return -1;
+			}
 			memcpy(packet + 4, original + 4, AUTH_VECTOR_LEN);
 			break;
 
@@ -374,19 +393,32 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			break;
 
 		default:
-			goto bad_packet;
+			fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
+			return -1;
 		}
 
-		/*
-		 *	Force Message-Authenticator to be zero,
-		 *	calculate the HMAC, and put it into the
-		 *	Message-Authenticator attribute.
-		 */
-		memset(msg + 2, 0, AUTH_VECTOR_LEN);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		*p_msg = msg + 2;
 		break;
 	}
 
+	return 0;
+}
+
+/** Calculate the Request Authenticator or Response Authenticator
+ *
+ * @param[in,out] packet the raw RADIUS packet (request or response)
+ * @param[in] original the raw original request (if this is a response)
+ * @param[in] secret the shared secret
+ * @param[in] secret_len the length of the secret
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int sign_finish(uint8_t *packet, uint8_t const *original, uint8_t const *secret, size_t secret_len)
+{
+	size_t packet_len = (packet[2] << 8) | packet[3];
+	FR_MD5_CTX	context;
+
 	/*
 	 *	Initialize the request authenticator.
 	 */
@@ -406,7 +438,6 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	case FR_CODE_COA_ACK:
 	case FR_CODE_COA_NAK:
 		if (!original) {
-		need_original:
 			fr_strerror_printf("Cannot sign response packet without a request packet");
 			return -1;
 		}
@@ -423,7 +454,6 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		return 0;
 
 	default:
-	bad_packet:
 		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
 		return -1;
 	}
@@ -439,6 +469,47 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	return 0;
 }
 
+/** Sign a previously encoded packet
+ *
+ * @param packet the raw RADIUS packet (request or response)
+ * @param original the raw original request (if this is a response)
+ * @param secret the shared secret
+ * @param secret_len the length of the secret
+ * @param secret_state precomputed MD5 state for the secret, or NULL
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign(uint8_t *packet, uint8_t const *original,
+		   uint8_t const *secret, size_t secret_len, fr_md5_secret_t const *secret_state)
+{
+	uint8_t *msg;
+	size_t packet_len = (packet[2] << 8) | packet[3];
+
+	if (packet_len < RADIUS_HDR_LEN) {
+		fr_strerror_printf("Packet must be encoded before calling fr_radius_sign()");
+		return -1;
+	}
+
+	if (sign_start(packet, original, &msg) < 0) return -1;
+
+	/*
+	 *	Force Message-Authenticator to be zero,
+	 *	calculate the HMAC, and put it into the
+	 *	Message-Authenticator attribute.
+	 */
+	if (msg) {
+		memset(msg, 0, AUTH_VECTOR_LEN);
+		if (secret_state) {
+			fr_hmac_md5_secret(msg, packet, packet_len, secret_state);
+		} else {
+			fr_hmac_md5(msg, packet, packet_len, secret, secret_len);
+		}
+	}
+
+	return sign_finish(packet, original, secret, secret_len);
+}
+
 
 /** See if the data pointed to by PTR is a valid RADIUS packet.
  *
@@ -704,126 +775,179 @@ finish:
 
 
 /** Verify a request / response packet
- *
- *  This function does its work by calling fr_radius_sign(), and then
- *  comparing the signature in the packet with the one we calculated.
- *  If they differ, there's a problem.
  *
  * @param packet the raw RADIUS packet (request or response)
  * @param original the raw original request (if this is a response)
  * @param secret the shared secret
  * @param secret_len the length of the secret
+ * @param secret_state precomputed MD5 state for the secret, or NULL
  * @return
- *	- <0 on error
+ *	- <0 on error, including when an authenticator doesn't match.
  *	- 0 on success
  */
 int fr_radius_verify(uint8_t *packet, uint8_t const *original,
-		     uint8_t const *secret, size_t secret_len)
+		     uint8_t const *secret, size_t secret_len, fr_md5_secret_t const *secret_state)
 {
-	int rcode;
-	uint8_t *msg, *end;
-	size_t packet_len = (packet[2] << 8) | packet[3];
-	uint8_t request_authenticator[AUTH_VECTOR_LEN];
-	uint8_t message_authenticator[AUTH_VECTOR_LEN];
+	fr_radius_verify_entry_t entry = {
+		.packet = packet,
+		.original = original,
+		.secret = secret,
+		.secret_len = secret_len,
+		.secret_state = secret_state
+	};
 
-	if (packet_len < RADIUS_HDR_LEN) {
-		fr_strerror_printf("invalid packet length %zd", packet_len);
-		return -1;
-	}
+	(void) fr_radius_verify_multi(&entry, 1);
 
-	memcpy(request_authenticator, packet + 4, sizeof(request_authenticator));
+	return entry.rcode;
+}
 
-	/*
-	 *	Find Message-Authenticator.  Its value has to be
-	 *	calculated before we calculate the Request
-	 *	Authenticator or the Response Authenticator.
-	 */
-	msg = packet + RADIUS_HDR_LEN;
-	end = packet + packet_len;
+/** Verify a batch of request / response packets
+ *
+ *  This function does its work by signing each packet, and then
+ *  comparing the signature in the packet with the one we calculated.
+ *  If they differ, there's a problem, and the original
+ *  authenticators are put back into the packet.
+ *
+ *  The Message-Authenticators of all packets which have a
+ *  precomputed secret state are calculated together, using
+ *  fr_hmac_md5_secret_multi().
+ *
+ * @param entry the packets to verify.  The result for each packet is
+ *	written to its rcode field.
+ * @param num the number of packets.
+ * @return the number of packets which failed verification.
+ */
+int fr_radius_verify_multi(fr_radius_verify_entry_t *entry, size_t num)
+{
+	size_t			i, j, n, m;
+	int			failed = 0;
+	uint8_t			*msg[FR_MD5_MULTI_LANES];
+	uint8_t			request_authenticator[FR_MD5_MULTI_LANES][AUTH_VECTOR_LEN];
+	uint8_t			message_authenticator[FR_MD5_MULTI_LANES][AUTH_VECTOR_LEN];
+	uint8_t			digest[FR_MD5_MULTI_LANES][MD5_DIGEST_LENGTH];
+	uint8_t			batch[FR_MD5_MULTI_LANES][MD5_DIGEST_LENGTH];
+	uint8_t const		*text[FR_MD5_MULTI_LANES];
+	size_t			text_len[FR_MD5_MULTI_LANES];
+	fr_md5_secret_t const	*state[FR_MD5_MULTI_LANES];
+	size_t			idx[FR_MD5_MULTI_LANES];
+
+	for (i = 0; i < num; i += n) {
+		n = num - i;
+		if (n > FR_MD5_MULTI_LANES) n = FR_MD5_MULTI_LANES;
 
-	while (msg < end) {
-		if ((end - msg) < 2) goto invalid_attribute;
+		/*
+		 *	Save the authenticators, and set the packets up
+		 *	for calculating the Message-Authenticator.
+		 */
+		for (j = 0, m = 0; j < n; j++) {
+			fr_radius_verify_entry_t *e = &entry[i + j];
+			size_t packet_len = (e->packet[2] << 8) | e->packet[3];
 
-		if (msg[0] != FR_MESSAGE_AUTHENTICATOR) {
-			if (msg[1] < 2) goto invalid_attribute;
+			e->rcode = 0;
+			msg[j] = NULL;
 
-			if ((msg + msg[1]) > end) {
-			invalid_attribute:
-				fr_strerror_printf("invalid attribute at offset %zd", msg - packet);
-				return -1;
+			if (packet_len < RADIUS_HDR_LEN) {
+				fr_strerror_printf("invalid packet length %zd", packet_len);
+				e->rcode = -1;
+				continue;
 			}
-			msg += msg[1];
-			continue;
+
+			memcpy(request_authenticator[j], e->packet + 4, sizeof(request_authenticator[j]));
+
+			if (sign_start(e->packet, e->original, &msg[j]) < 0) {
+				e->rcode = -1;
+				continue;
+			}
+			if (!msg[j]) continue;
+
+			memcpy(message_authenticator[j], msg[j], sizeof(message_authenticator[j]));
+			memset(msg[j], 0, AUTH_VECTOR_LEN);
+
+			if (!e->secret_state) {
+				fr_hmac_md5(digest[j], e->packet, packet_len, e->secret, e->secret_len);
+				continue;
+			}
+
+			text[m] = e->packet;
+			text_len[m] = packet_len;
+			state[m] = e->secret_state;
+			idx[m++] = j;
 		}
 
-		if (msg[1] < 18) {
-			fr_strerror_printf("too small Message-Authenticator");
-			return -1;
+		if (m > 0) {
+			fr_hmac_md5_secret_multi(batch, text, text_len, state, m);
+			for (j = 0; j < m; j++) memcpy(digest[idx[j]], batch[j], sizeof(digest[idx[j]]));
 		}
 
-		/*
-		 *	Found it, save a copy.
-		 */
-		memcpy(message_authenticator, msg + 2, sizeof(message_authenticator));
-		break;
-	}
+		for (j = 0; j < n; j++) {
+			fr_radius_verify_entry_t *e = &entry[i + j];
 
-	/*
-	 *	Implement verification as a signature, followed by
-	 *	checking our signature against the sent one.  This is
-	 *	slightly more CPU work than having verify-specific
-	 *	functions, but it ends up being cleaner in the code.
-	 */
-	rcode = fr_radius_sign(packet, original, secret, secret_len);
-	if (rcode < 0) {
-		fr_strerror_printf("unknown packet code");
-		return -1;
-	}
+			if (e->rcode < 0) {
+				failed++;
+				continue;
+			}
 
-	/*
-	 *	Check the Message-Authenticator first.
-	 *
-	 *	If it's invalid, restore the original
-	 *	Message-Authenticator and Request Authenticator
-	 *	fields.
-	 */
-	if ((msg < end) &&
-	    (fr_digest_cmp(message_authenticator, msg + 2, sizeof(message_authenticator)) != 0)) {
-		memcpy(msg + 2, message_authenticator, sizeof(message_authenticator));
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
+			/*
+			 *	Check the Message-Authenticator first.
+			 *
+			 *	If it's invalid, restore the original
+			 *	Message-Authenticator and Request Authenticator
+			 *	fields.
+			 */
+			if (msg[j]) {
+				memcpy(msg[j], digest[j], AUTH_VECTOR_LEN);
 
-		fr_strerror_printf("invalid Message-Authenticator (shared secret is incorrect)");
-		return -1;
-	}
+				if (fr_digest_cmp(message_authenticator[j], msg[j], AUTH_VECTOR_LEN) != 0) {
+					memcpy(msg[j], message_authenticator[j], AUTH_VECTOR_LEN);
+					memcpy(e->packet + 4, request_authenticator[j], AUTH_VECTOR_LEN);
 
-	/*
-	 *	These are random numbers, so there's no point in
-	 *	comparing them.
-	 */
-	if ((packet[0] == FR_CODE_ACCESS_REQUEST) || (packet[0] == FR_CODE_STATUS_SERVER)) {
-		return 0;
-	}
+					fr_strerror_printf("invalid Message-Authenticator (shared secret is incorrect)");
+					e->rcode = -1;
+					failed++;
+					continue;
+				}
+			}
 
-	/*
-	 *	Check the Request Authenticator.
-	 */
-	if (fr_digest_cmp(request_authenticator, packet + 4, sizeof(request_authenticator)) != 0) {
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
-		if (original) {
-			fr_strerror_printf("invalid Response Authenticator (shared secret is incorrect)");
-		} else {
-			fr_strerror_printf("invalid Request Authenticator (shared secret is incorrect)");
+			if (sign_finish(e->packet, e->original, e->secret, e->secret_len) < 0) {
+				memcpy(e->packet + 4, request_authenticator[j], AUTH_VECTOR_LEN);
+				e->rcode = -1;
+				failed++;
+				continue;
+			}
+
+			/*
+			 *	These are random numbers, so there's no point in
+			 *	comparing them.
+			 */
+			if ((e->packet[0] == FR_CODE_ACCESS_REQUEST) || (e->packet[0] == FR_CODE_STATUS_SERVER)) {
+				continue;
+			}
+
+			/*
+			 *	Check the Request Authenticator.
+			 */
+			if (fr_digest_cmp(request_authenticator[j], e->packet + 4, AUTH_VECTOR_LEN) != 0) {
+				memcpy(e->packet + 4, request_authenticator[j], AUTH_VECTOR_LEN);
+				if (e->original) {
+					fr_strerror_printf("invalid Response Authenticator (shared secret is incorrect)");
+				} else {
+					fr_strerror_printf("invalid Request Authenticator (shared secret is incorrect)");
+				}
+				e->rcode = -1;
+				failed++;
+			}
 		}
 	}
 
-	return 0;
+	return failed;
 }
 
 /** Encode VPS into a raw RADIUS packet.
  *
  */
 ssize_t fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *original,
-			 char const *secret, UNUSED size_t secret_len, int code, int id, VALUE_PAIR *vps)
+			 char const *secret, UNUSED size_t secret_len, fr_md5_secret_t const *secret_state,
+			 int code, int id, VALUE_PAIR *vps)
 {
 	uint8_t			*ptr;
 	int			total_length;
@@ -833,6 +957,7 @@ ssize_t fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *orig
 	fr_radius_ctx_t		packet_ctx;
 
 	packet_ctx.secret = secret;
+	packet_ctx.secret_state = secret_state;
 	packet_ctx.vector = packet + 4;
 
 	/*
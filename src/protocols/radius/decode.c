@@ -35,11 +35,11 @@ bool fr_tunnel_password_zeros = true;
  * initial intermediate value, to differentiate it from the
  * above.
  */
-ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen, char const *secret, uint8_t const *vector)
+ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen, char const *secret,
+					 fr_md5_secret_t const *secret_state, uint8_t const *vector)
 {
 	FR_MD5_CTX	context, old;
 	uint8_t		digest[AUTH_VECTOR_LEN];
-	int		secretlen;
 	size_t		i, n, encrypted_len, embedded_len;
 
 	encrypted_len = *pwlen;
@@ -73,10 +73,7 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen, char co
 	/*
 	 *	Use the secret to setup the decryption digest
 	 */
-	secretlen = talloc_array_length(secret) - 1;
-
-	fr_md5_init(&context);
-	fr_md5_update(&context, (uint8_t const *) secret, secretlen);
+	fr_radius_md5_secret_init(&context, secret, secret_state);
 	fr_md5_copy(&old, &context); /* save intermediate work */
 
 	/*
@@ -155,12 +152,13 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen, char co
 /** Decode password
  *
  */
-ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret, uint8_t const *vector)
+ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret,
+				  fr_md5_secret_t const *secret_state, uint8_t const *vector)
 {
 	FR_MD5_CTX	context, old;
 	uint8_t		digest[AUTH_VECTOR_LEN];
 	int		i;
-	size_t		n, secretlen;
+	size_t		n;
 
 	/*
 	 *	The RFC's say that the maximum is 128.
@@ -177,10 +175,7 @@ ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret
 	/*
 	 *	Use the secret to setup the decryption digest
 	 */
-	secretlen = talloc_array_length(secret) - 1;
-
-	fr_md5_init(&context);
-	fr_md5_update(&context, (uint8_t const *) secret, secretlen);
+	fr_radius_md5_secret_init(&context, secret, secret_state);
 	fr_md5_copy(&old, &context);	/* save intermediate work */
 
 	/*
@@ -795,7 +790,7 @@ static ssize_t decode_vsa(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dict_attr_t c
 	 *	(unlike DHCP) we know vendor attributes have a
 	 *	standard format, so we can decode the data anyway.
 	 */
-	vendor_da = fr_dict_attr_child_by_num(parent, vendor);
+	vendor_da = fr_dict_vendor_child_by_num(parent, vendor, &dv);
 	if (!vendor_da) {
 		fr_dict_attr_t *n;
 		/*
@@ -826,7 +821,6 @@ static ssize_t decode_vsa(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dict_attr_t c
 		 *	We found an attribute representing the vendor
 		 *	so it *MUST* exist in the vendor tree.
 		 */
-		dv = fr_dict_vendor_by_num(NULL, vendor);
 		if (!fr_cond_assert(dv)) return -1;
 	}
 	FR_PROTO_TRACE("decode context %s -> %s", parent->name, vendor_da->name);
@@ -982,7 +976,7 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dic
 		 */
 		case FLAG_ENCRYPT_USER_PASSWORD:
 			fr_radius_decode_password((char *)buffer, attr_len,
-						  packet_ctx->secret, packet_ctx->vector);
+						  packet_ctx->secret, packet_ctx->secret_state, packet_ctx->vector);
 			buffer[253] = '\0';
 
 			/*
@@ -1016,7 +1010,8 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dic
 		 */
 		case FLAG_ENCRYPT_TUNNEL_PASSWORD:
 			if (fr_radius_decode_tunnel_password(buffer, &data_len,
-							     packet_ctx->secret, packet_ctx->vector) < 0) {
+							     packet_ctx->secret, packet_ctx->secret_state,
+							     packet_ctx->vector) < 0) {
 				goto raw;
 			}
 			break;
@@ -1263,8 +1258,23 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dic
 	vp->tag = tag;
 
 	switch (parent->type) {
-	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		/*
+		 *	Point the value at the packet, if the caller
+		 *	said that's OK, and we haven't had to copy
+		 *	the data to a temporary buffer.
+		 */
+		if (packet_ctx && packet_ctx->borrow &&
+		    (p >= packet_ctx->start) && ((p + data_len) <= packet_ctx->end)) {
+			if (fr_value_box_memdup_borrow(&vp->data, vp->da, p, data_len, true) < 0) {
+				talloc_free(vp);
+				return -1;
+			}
+			break;
+		}
+		/* FALL-THROUGH */
+
+	case FR_TYPE_STRING:
 	case FR_TYPE_IPV4_ADDR:
 	case FR_TYPE_IPV6_ADDR:
 	case FR_TYPE_BOOL:
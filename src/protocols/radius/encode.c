@@ -272,7 +272,7 @@ int fr_radius_encode_password(char *passwd, size_t *pwlen, char const *secret, u
 }
 
 static void encode_password(uint8_t *out, ssize_t *outlen, uint8_t const *input, size_t inlen,
-			    char const *secret, uint8_t const *vector)
+			    char const *secret, fr_md5_secret_t const *secret_state, uint8_t const *vector)
 {
 	FR_MD5_CTX	context, old;
 	uint8_t		digest[AUTH_VECTOR_LEN];
@@ -297,8 +297,7 @@ static void encode_password(uint8_t *out, ssize_t *outlen, uint8_t const *input,
 	}
 	*outlen = len;
 
-	fr_md5_init(&context);
-	fr_md5_update(&context, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+	fr_radius_md5_secret_init(&context, secret, secret_state);
 	fr_md5_copy(&old, &context);
 
 	/*
@@ -322,7 +321,7 @@ static void encode_password(uint8_t *out, ssize_t *outlen, uint8_t const *input,
 
 static void encode_tunnel_password(uint8_t *out, ssize_t *outlen,
 				   uint8_t const *input, size_t inlen, size_t freespace,
-				   char const *secret, uint8_t const *vector)
+				   char const *secret, fr_md5_secret_t const *secret_state, uint8_t const *vector)
 {
 	FR_MD5_CTX	context, old;
 	uint8_t		digest[AUTH_VECTOR_LEN];
@@ -383,8 +382,7 @@ static void encode_tunnel_password(uint8_t *out, ssize_t *outlen,
 	out[1] = fr_rand();
 	out[2] = inlen;	/* length of the password string */
 
-	fr_md5_init(&context);
-	fr_md5_update(&context, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+	fr_radius_md5_secret_init(&context, secret, secret_state);
 	fr_md5_copy(&old, &context);
 
 	fr_md5_update(&context, vector, AUTH_VECTOR_LEN);
@@ -772,7 +770,8 @@ static ssize_t encode_value(uint8_t *out, size_t outlen,
 	 */
 	if (da->type != FR_TYPE_STRUCT) switch (vp->da->flags.encrypt) {
 	case FLAG_ENCRYPT_USER_PASSWORD:
-		encode_password(ptr, &len, data, len, packet_ctx->secret, packet_ctx->vector);
+		encode_password(ptr, &len, data, len,
+				packet_ctx->secret, packet_ctx->secret_state, packet_ctx->vector);
 		break;
 
 	case FLAG_ENCRYPT_TUNNEL_PASSWORD:
@@ -791,7 +790,7 @@ static ssize_t encode_value(uint8_t *out, size_t outlen,
 		if (offset) ptr[0] = TAG_VALID(vp->tag) ? vp->tag : TAG_NONE;
 
 		encode_tunnel_password(ptr + offset, &len, data, len,
-				       outlen - offset, packet_ctx->secret, packet_ctx->vector);
+				       outlen - offset, packet_ctx->secret, packet_ctx->secret_state, packet_ctx->vector);
 		len += offset;
 		break;
 
@@ -1493,6 +1492,51 @@ static int encode_rfc_hdr(uint8_t *out, size_t outlen, fr_dict_attr_t const **tl
 	return encode_rfc_hdr_internal(out, outlen, tlv_stack, depth, cursor, encoder_ctx);
 }
 
+/** Encode an RFC attribute or VSA using the header template from the dictionary
+ *
+ * Produces the same output as encode_rfc_hdr() and encode_vsa_hdr(), but the
+ * headers are copied from the template built by fr_dict_freeze(), instead of
+ * being built up one layer at a time.
+ *
+ * The caller must ensure outlen is greater than the length of the header.
+ */
+static ssize_t encode_hdr_template(uint8_t *out, size_t outlen, fr_dict_attr_t const **tlv_stack,
+				   vp_cursor_t *cursor, void *encoder_ctx)
+{
+	VALUE_PAIR const		*vp = fr_pair_cursor_current(cursor);
+	fr_dict_attr_hdr_t const	*hdr = &vp->da->hdr;
+	ssize_t				len;
+
+	tlv_stack[0] = vp->da;
+	tlv_stack[1] = NULL;
+	FR_PROTO_STACK_PRINT(tlv_stack, 0);
+
+	memcpy(out, hdr->data, hdr->len);
+
+	len = encode_value(out + hdr->len, outlen - hdr->len, tlv_stack, 0, cursor, encoder_ctx);
+	if (len < 0) return len;
+
+	/*
+	 *	encode_vsa_hdr() leaves an empty Vendor-Specific
+	 *	header behind if there was no value.
+	 */
+	if (len == 0) {
+		if (vp->da->parent->flags.is_root) return 0;
+
+		out[1] = 6;
+		return out[1];
+	}
+
+	out[hdr->length_offset[0]] += len;
+	if (hdr->length_offset[1]) out[hdr->length_offset[1]] += len;
+
+#ifndef NDEBUG
+	if ((fr_debug_lvl > 3) && fr_log_fp) FR_PROTO_HEX_DUMP("Done header template", out, hdr->len + len);
+#endif
+
+	return hdr->len + len;
+}
+
 /** Encode a data structure into a RADIUS attribute
  *
  * This is the main entry point into the encoder.  It sets up the encoder array
@@ -1552,7 +1596,22 @@ ssize_t fr_radius_encode_pair(uint8_t *out, size_t outlen, vp_cursor_t *cursor,
 	attr_len = (outlen > UINT8_MAX) ? UINT8_MAX : outlen;
 
 	/*
-	 *	Fast path for the common case.
+	 *	Fastest path for the common case.  RFC attributes and
+	 *	VSAs have their headers pre-built in the dictionary.
+	 *	Message-Authenticator and empty CUIs are special, as
+	 *	is running out of room for the header.
+	 */
+	if (vp->da->hdr.len && (attr_len > vp->da->hdr.len) &&
+	    !(vp->da->parent->flags.is_root &&
+	      ((vp->da->attr == FR_MESSAGE_AUTHENTICATOR) ||
+	       ((vp->da->attr == FR_CHARGEABLE_USER_IDENTITY) && (vp->vp_length == 0))))) {
+		ret = encode_hdr_template(out, attr_len, tlv_stack, cursor, encoder_ctx);
+		if (vp->da->parent->flags.is_root) return ret;
+		goto check;
+	}
+
+	/*
+	 *	Fast path for the rest of the RFC attributes.
 	 */
 	if (vp->da->parent->flags.is_root && !vp->da->flags.concat && (vp->vp_type != FR_TYPE_TLV)) {
 		tlv_stack[0] = vp->da;
@@ -1624,6 +1683,7 @@ ssize_t fr_radius_encode_pair(uint8_t *out, size_t outlen, vp_cursor_t *cursor,
 		return -1;
 	}
 
+check:
 	if (ret < 0) return ret;
 
 	/*
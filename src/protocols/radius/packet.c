@@ -54,7 +54,7 @@ typedef struct radius_packet_t {
  *
  */
 int fr_radius_packet_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-			    char const *secret)
+			    char const *secret, fr_md5_secret_t const *secret_state)
 {
 	uint8_t const *original_data;
 	ssize_t total_length;
@@ -76,7 +76,7 @@ int fr_radius_packet_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original
 	memcpy(data + 4, packet->vector, sizeof(packet->vector));
 
 	total_length = fr_radius_encode(data, sizeof(data), original_data, secret, talloc_array_length(secret) - 1,
-					packet->code, packet->id, packet->vps);
+					secret_state, packet->code, packet->id, packet->vps);
 	if (total_length < 0) {
 		return -1;
 	}
@@ -101,6 +101,8 @@ int fr_radius_packet_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original
 	return 0;
 }
 
+static int radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+				fr_md5_secret_t const *secret_state, bool borrow);
 
 /** Calculate/check digest, and decode radius attributes
  *
@@ -108,7 +110,38 @@ int fr_radius_packet_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original
  *	- 0 on success
  *	- -1 on decoding error.
  */
-int fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret)
+int fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+			    fr_md5_secret_t const *secret_state)
+{
+	return radius_packet_decode(packet, original, secret, secret_state, false);
+}
+
+/** Decode radius attributes, without copying octets values
+ *
+ *  Octets attributes point into packet->data, and the caller must
+ *  keep it valid for as long as the VALUE_PAIRs exist.  One reference
+ *  held by the caller covers all of the attributes.  VALUE_PAIRs which
+ *  are stolen to another context get their own copy of the data.
+ *
+ * @param[in] packet	to decode.
+ * @param[in] original	request, if the packet is a reply.
+ * @param[in] secret	shared secret.
+ * @param[in] secret_state	precomputed MD5 state for the secret, or NULL.
+ * @return
+ *	- 0 on success
+ *	- -1 on decoding error.
+ */
+int fr_radius_packet_decode_shallow(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+				    fr_md5_secret_t const *secret_state)
+{
+	return radius_packet_decode(packet, original, secret, secret_state, true);
+}
+
+/** Calculate/check digest, and decode radius attributes, optionally borrowing octets values
+ *
+ */
+static int radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+				fr_md5_secret_t const *secret_state, bool borrow)
 {
 	int			packet_length;
 	uint32_t		num_attributes;
@@ -119,7 +152,11 @@ int fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char
 	fr_radius_ctx_t		packet_ctx;
 
 	packet_ctx.secret = secret;
+	packet_ctx.secret_state = secret_state;
 	packet_ctx.vector = packet->vector;
+	packet_ctx.borrow = borrow;
+	packet_ctx.start = packet->data;
+	packet_ctx.end = packet->data + packet->data_len;
 
 	switch (packet->code) {
 	case FR_CODE_ACCESS_REQUEST:
@@ -274,7 +311,8 @@ bool fr_radius_packet_ok(RADIUS_PACKET *packet, bool require_ma, decode_fail_t *
 /** Verify the Request/Response Authenticator (and Message-Authenticator if present) of a packet
  *
  */
-int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret)
+int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret,
+			    fr_md5_secret_t const *secret_state)
 {
 	uint8_t const	*original_data;
 	char		buffer[INET6_ADDRSTRLEN];
@@ -288,7 +326,7 @@ int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char
 	}
 
 	if (fr_radius_verify(packet->data, original_data,
-			     (uint8_t const *) secret, talloc_array_length(secret) - 1) < 0) {
+			     (uint8_t const *) secret, talloc_array_length(secret) - 1, secret_state) < 0) {
 		fr_strerror_printf("Received packet from %s with %s",
 				   inet_ntop(packet->src_ipaddr.af, &packet->src_ipaddr.addr,
 					     buffer, sizeof(buffer)),
@@ -304,7 +342,7 @@ int fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char
  *
  */
 int fr_radius_packet_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-			  char const *secret)
+			  char const *secret, fr_md5_secret_t const *secret_state)
 {
 	int rcode;
 	uint8_t const *original_data;
@@ -326,7 +364,7 @@ int fr_radius_packet_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 	}
 
 	rcode = fr_radius_sign(packet->data, original_data,
-			       (uint8_t const *) secret, talloc_array_length(secret) - 1);
+			       (uint8_t const *) secret, talloc_array_length(secret) - 1, secret_state);
 	if (rcode < 0) return rcode;
 
 	memcpy(packet->vector, packet->data + 4, AUTH_VECTOR_LEN);
@@ -460,7 +498,7 @@ RADIUS_PACKET *fr_radius_packet_recv(TALLOC_CTX *ctx, int fd, int flags, bool re
  * Also attach reply attribute value pairs and any user message provided.
  */
 int fr_radius_packet_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-			  char const *secret)
+			  char const *secret, fr_md5_secret_t const *secret_state)
 {
 	/*
 	 *	Maybe it's a fake packet.  Don't send it.
@@ -476,7 +514,7 @@ int fr_radius_packet_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 		/*
 		 *	Encode the packet.
 		 */
-		if (fr_radius_packet_encode(packet, original, secret) < 0) {
+		if (fr_radius_packet_encode(packet, original, secret, secret_state) < 0) {
 			return -1;
 		}
 
@@ -484,7 +522,7 @@ int fr_radius_packet_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
 		 *	Re-sign it, including updating the
 		 *	Message-Authenticator.
 		 */
-		if (fr_radius_packet_sign(packet, original, secret) < 0) {
+		if (fr_radius_packet_sign(packet, original, secret, secret_state) < 0) {
 			return -1;
 		}
 
@@ -27,6 +27,7 @@
 #include <freeradius-devel/cursor.h>
 #include <freeradius-devel/packet.h>
 #include <freeradius-devel/fr_log.h>
+#include <freeradius-devel/md5.h>
 
 #define AUTH_VECTOR_LEN		16
 #define CHAP_VALUE_LENGTH       16
@@ -66,25 +67,44 @@ typedef enum {
 	DECODE_FAIL_MAX
 } decode_fail_t;
 
+/** A packet to verify with fr_radius_verify_multi()
+ *
+ */
+typedef struct fr_radius_verify_entry {
+	uint8_t			*packet;		//!< the raw RADIUS packet (request or response)
+	uint8_t const		*original;		//!< the raw original request (if this is a response)
+	uint8_t const		*secret;		//!< the shared secret
+	size_t			secret_len;		//!< the length of the secret
+	fr_md5_secret_t const	*secret_state;		//!< precomputed MD5 state for the secret, or NULL
+	int			rcode;			//!< <0 if the packet failed verification, else 0
+} fr_radius_verify_entry_t;
+
 /*
  *	protocols/radius/base.c
  */
 size_t		fr_radius_attr_len(VALUE_PAIR const *vp);
 
 int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
-			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+			       uint8_t const *secret, size_t secret_len,
+			       fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
-				 uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+				 uint8_t const *secret, size_t secret_len,
+				 fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
+int		fr_radius_verify_multi(fr_radius_verify_entry_t *entry, size_t num) CC_HINT(nonnull);
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p, bool require_ma,
 			     decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
+void		fr_radius_md5_secret_init(FR_MD5_CTX *context, char const *secret,
+					  fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,2));
+
 void		fr_radius_ascend_secret(uint8_t *digest, uint8_t const *vector,
 					char const *secret, uint8_t const *value) CC_HINT(nonnull);
 
 ssize_t		fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *src_port, unsigned int *code);
 
 ssize_t		fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *original,
-				 char const *secret, UNUSED size_t secret_len, int code, int id, VALUE_PAIR *vps);
+				 char const *secret, UNUSED size_t secret_len, fr_md5_secret_t const *secret_state,
+				 int code, int id, VALUE_PAIR *vps);
 
 
 /*
@@ -96,21 +116,23 @@ RADIUS_PACKET	*fr_radius_copy(TALLOC_CTX *ctx, RADIUS_PACKET const *in);
 void		fr_radius_free(RADIUS_PACKET **);
 
 int		fr_radius_packet_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-					char const *secret) CC_HINT(nonnull (1,3));
+					char const *secret, fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
 int		fr_radius_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original,
-					char const *secret) CC_HINT(nonnull (1,3));
+					char const *secret, fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
+int		fr_radius_packet_decode_shallow(RADIUS_PACKET *packet, RADIUS_PACKET *original,
+						char const *secret, fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
 
 bool		fr_radius_packet_ok(RADIUS_PACKET *packet, bool require_ma,
 				    decode_fail_t *reason) CC_HINT(nonnull (1));
 
 int		fr_radius_packet_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original,
-					char const *secret) CC_HINT(nonnull (1,3));
+					char const *secret, fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
 int		fr_radius_packet_sign(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-				      char const *secret) CC_HINT(nonnull (1,3));
+				      char const *secret, fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
 
 RADIUS_PACKET	*fr_radius_packet_recv(TALLOC_CTX *ctx, int fd, int flags, bool require_ma);
 int		fr_radius_packet_send(RADIUS_PACKET *packet, RADIUS_PACKET const *original,
-				      char const *secret) CC_HINT(nonnull (1,3));
+				      char const *secret, fr_md5_secret_t const *secret_state) CC_HINT(nonnull (1,3));
 
 void		fr_radius_print_hex(RADIUS_PACKET const *packet) CC_HINT(nonnull);
 
@@ -118,6 +140,13 @@ void		fr_radius_print_hex(RADIUS_PACKET const *packet) CC_HINT(nonnull);
 typedef struct fr_radius_ctx {
 	uint8_t const		*vector;		//!< vector for encryption / decryption of data
 	char const		*secret;		//!< shared secret.  MUST be talloc'd
+	fr_md5_secret_t const	*secret_state;		//!< precomputed MD5 state for the secret, or NULL.
+
+	bool			borrow;			//!< octets attributes point into the packet,
+							//!< instead of being copied.  The caller keeps
+							//!< the packet data valid.
+	uint8_t const		*start;			//!< start of the packet data, for "borrow".
+	uint8_t const		*end;			//!< end of the packet data, for "borrow".
 } fr_radius_ctx_t;
 
 /*
@@ -136,12 +165,13 @@ ssize_t		fr_radius_encode_pair(uint8_t *out, size_t outlen, vp_cursor_t *cursor,
  */
 int		fr_radius_decode_tlv_ok(uint8_t const *data, size_t length, size_t dv_type, size_t dv_length);
 
-ssize_t		fr_radius_decode_password(char *encpw, size_t len, char const *secret, uint8_t const *vector);
+ssize_t		fr_radius_decode_password(char *encpw, size_t len, char const *secret,
+					  fr_md5_secret_t const *secret_state, uint8_t const *vector);
 
 extern bool fr_tunnel_password_zeros; /* security check */
 
 ssize_t		fr_radius_decode_tunnel_password(uint8_t *encpw, size_t *len, char const *secret,
-						 uint8_t const *vector);
+						 fr_md5_secret_t const *secret_state, uint8_t const *vector);
 
 ssize_t		fr_radius_decode_pair_value(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dict_attr_t const *parent,
 					    uint8_t const *data, size_t const attr_len, size_t const packet_len,
@@ -85,7 +85,7 @@ static ssize_t mod_encode(void const *ctx, REQUEST *request, uint8_t *buffer, si
 	buffer[2] = 0;
 	buffer[3] = 20;
 
-	(void) fr_radius_sign(buffer, pc->original, pc->secret, pc->secret_len);
+	(void) fr_radius_sign(buffer, pc->original, pc->secret, pc->secret_len, NULL);
 
 	return 20;
 }
@@ -121,7 +121,7 @@ static ssize_t mod_read(int sockfd, void *ctx, uint8_t *buffer, size_t buffer_le
 	/*
 	 *	If the signature fails validation, ignore it.
 	 */
-	if (!fr_radius_verify(buffer, NULL, pc->secret, pc->secret_len)) {
+	if (fr_radius_verify(buffer, NULL, pc->secret, pc->secret_len, NULL) < 0) {
 		return 0;
 	}
 
@@ -1,8 +1,21 @@
-SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk 
+SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk event_test.mk time_test.mk radius_sign_test.mk md5_test.mk radius_decode_test.mk radius_corpus_test.mk request_test.mk track_test.mk
 
 #
 #  These require pthread.
 #
 ifneq "$(findstring thread,${CFLAGS})" ""
-SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk
+SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk network_test.mk
 endif
+
+#
+#  Replay the unit test corpora through the RADIUS decoder and
+#  encoder, and save the results as CSV, so that they can be
+#  compared from one commit to the next.
+#
+RADIUS_CORPORA := $(addprefix $(top_srcdir)/src/tests/unit/,rfc.txt vendor.txt wimax.txt extended.txt tunnel.txt)
+
+.PHONY: tests.radius.bench
+tests.radius.bench: $(TESTBINDIR)/radius_corpus_test $(BUILD_DIR)/share/dictionary
+	${Q}mkdir -p $(BUILD_DIR)/tests
+	${Q}$(TESTBIN)/radius_corpus_test -D $(BUILD_DIR)/share -m $(RADIUS_CORPORA) > $(BUILD_DIR)/tests/radius_bench.csv
+	${Q}cat $(BUILD_DIR)/tests/radius_bench.csv
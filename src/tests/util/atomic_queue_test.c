@@ -32,50 +32,201 @@ RCSID("$Id$")
 #	include <getopt.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#	include <pthread.h>
+#endif
+
+#ifdef HAVE_STDATOMIC_H
+#	include <stdatomic.h>
+#else
+#	include <freeradius-devel/stdatomic.h>
+#endif
+
 #define OFFSET	(1024)
+#define MAX_BATCH (64)
+#define MAX_THREADS (64)
 
 static int		debug_lvl = 0;
 
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: atomic_queue_test [OPTS]\n");
+	fprintf(stderr, "  -b batch               push / pop this many entries at a time in the benchmark.\n");
+	fprintf(stderr, "  -n count               number of entries each producer pushes in the benchmark.\n");
+	fprintf(stderr, "  -s size                set queue size.\n");
+	fprintf(stderr, "  -t threads             run the contention benchmark with up to this many\n");
+	fprintf(stderr, "                         producers, and as many consumers.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
 
-/**********************************************************************/
-typedef struct rad_request REQUEST;
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx);
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request);
-void talloc_const_free(void const *ptr);
+	exit(1);
+}
 
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
+/*
+ *	Push and pop runs of entries, and check that they come out in order.
+ */
+static void test_batch(fr_atomic_queue_t *aq, int size)
 {
-	return NULL;
+	int		i, num, total;
+	intptr_t	val;
+	void		*data[MAX_BATCH];
+
+	/*
+	 *	Fill the queue three entries at a time.  The last push
+	 *	may only partially succeed.
+	 */
+	total = 0;
+	while (total < size) {
+		for (i = 0; i < 3; i++) data[i] = (void *) (intptr_t) (total + i + OFFSET);
+
+		num = fr_atomic_queue_push_n(aq, data, 3);
+		if (num <= 0) {
+			fprintf(stderr, "Failed batch pushing at %d\n", total);
+			exit(1);
+		}
+
+		total += num;
+	}
+
+	if (total != size) {
+		fprintf(stderr, "Batch pushed %d entries into a queue of size %d\n", total, size);
+		exit(1);
+	}
+
+	data[0] = (void *) (intptr_t) OFFSET;
+	if (fr_atomic_queue_push_n(aq, data, 1) != 0) {
+		fprintf(stderr, "Batch pushed an entry past the end of the queue.\n");
+		exit(1);
+	}
+
+	/*
+	 *	Empty it two entries at a time.
+	 */
+	total = 0;
+	while ((num = fr_atomic_queue_pop_n(aq, data, 2)) > 0) {
+		for (i = 0; i < num; i++) {
+			val = (intptr_t) data[i];
+			if (val != (total + i + OFFSET)) {
+				fprintf(stderr, "Batch pop expected %d, got %d\n",
+					total + i + OFFSET, (int) val);
+				exit(1);
+			}
+		}
+		total += num;
+	}
+
+	if (total != size) {
+		fprintf(stderr, "Batch popped %d entries from a queue of size %d\n", total, size);
+		exit(1);
+	}
 }
 
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
+#ifdef HAVE_PTHREAD_H
+typedef struct {
+	fr_atomic_queue_t	*aq;
+	int			count;		//!< for producers, how many to push
+	int			batch;		//!< how many to push / pop at a time
+	atomic_int		remaining;	//!< for consumers, how many are left to pop, in total
+} bench_ctx_t;
+
+static void *bench_producer(void *arg)
 {
+	bench_ctx_t	*bc = arg;
+	int		i, num, done = 0;
+	void		*data[MAX_BATCH];
+
+	for (i = 0; i < bc->batch; i++) data[i] = (void *) (intptr_t) (i + OFFSET);
+
+	while (done < bc->count) {
+		num = bc->count - done;
+		if (num > bc->batch) num = bc->batch;
+
+		if (num == 1) {
+			num = fr_atomic_queue_push(bc->aq, data[0]) ? 1 : 0;
+		} else {
+			num = fr_atomic_queue_push_n(bc->aq, data, num);
+		}
+
+		done += num;
+	}
+
+	return NULL;
 }
 
-void talloc_const_free(void const *ptr)
+static void *bench_consumer(void *arg)
 {
-	void *tmp;
-	if (!ptr) return;
+	bench_ctx_t	*bc = arg;
+	int		num;
+	void		*data[MAX_BATCH];
+
+	while (atomic_load_explicit(&bc->remaining, memory_order_relaxed) > 0) {
+		if (bc->batch == 1) {
+			num = fr_atomic_queue_pop(bc->aq, &data[0]) ? 1 : 0;
+		} else {
+			num = fr_atomic_queue_pop_n(bc->aq, data, bc->batch);
+		}
+		if (!num) continue;
 
-	memcpy(&tmp, &ptr, sizeof(tmp));
-	talloc_free(tmp);
-}
-/**********************************************************************/
+		atomic_fetch_sub_explicit(&bc->remaining, num, memory_order_relaxed);
+	}
 
+	return NULL;
+}
 
-static void NEVER_RETURNS usage(void)
+/*
+ *	Run N producers and N consumers against one queue, and print
+ *	the throughput.
+ */
+static void bench(TALLOC_CTX *ctx, int size, int num_threads, int count, int batch)
 {
-	fprintf(stderr, "usage: atomic_queue_test [OPTS]\n");
-	fprintf(stderr, "  -s size                set queue size.\n");
-	fprintf(stderr, "  -x                     Debugging mode.\n");
+	int		i;
+	pthread_t	producer[MAX_THREADS], consumer[MAX_THREADS];
+	bench_ctx_t	bc;
+	struct timeval	start, end;
+	double		elapsed;
+	fr_atomic_queue_t *aq;
 
-	exit(1);
+	aq = fr_atomic_queue_create(ctx, size);
+	if (!aq) {
+		fprintf(stderr, "Failed creating queue\n");
+		exit(1);
+	}
+
+	bc.aq = aq;
+	bc.count = count;
+	bc.batch = batch;
+	atomic_init(&bc.remaining, count * num_threads);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < num_threads; i++) {
+		if ((pthread_create(&consumer[i], NULL, bench_consumer, &bc) != 0) ||
+		    (pthread_create(&producer[i], NULL, bench_producer, &bc) != 0)) {
+			fprintf(stderr, "Failed creating threads\n");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(producer[i], NULL);
+		pthread_join(consumer[i], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("threads %2d x %2d  batch %2d  %10.0f ops/sec\n",
+	       num_threads, num_threads, batch, (2.0 * count * num_threads) / elapsed);
+
+	talloc_free(aq);
 }
+#endif
 
 int main(int argc, char *argv[])
 {
 	int c, i, rcode = 0;
 	int size;
+	int num_threads = 0, count = 1000000, batch = 1;
 	intptr_t val;
 	void *data;
 	fr_atomic_queue_t *aq;
@@ -83,11 +234,26 @@ int main(int argc, char *argv[])
 
 	size = 4;
 
-	while ((c = getopt(argc, argv, "hs:tx")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "b:hn:s:t:x")) != EOF) switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			if ((batch < 1) || (batch > MAX_BATCH)) usage();
+			break;
+
+		case 'n':
+			count = atoi(optarg);
+			if (count < 1) usage();
+			break;
+
 		case 's':
 			size = atoi(optarg);
 			break;
 
+		case 't':
+			num_threads = atoi(optarg);
+			if ((num_threads < 1) || (num_threads > MAX_THREADS)) usage();
+			break;
+
 		case 'x':
 			debug_lvl++;
 			break;
@@ -101,6 +267,26 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
+	/*
+	 *	Contention benchmark, for 1, 2, 4, ... producers and
+	 *	consumers.
+	 */
+	if (num_threads) {
+#ifdef HAVE_PTHREAD_H
+		if (size < 1024) size = 1024;
+
+		for (i = 1; i <= num_threads; i *= 2) {
+			bench(autofree, size, i, count, batch);
+		}
+
+		talloc_free(autofree);
+		return 0;
+#else
+		fprintf(stderr, "atomic_queue_test: The benchmark needs pthreads\n");
+		exit(1);
+#endif
+	}
+
 	aq = fr_atomic_queue_create(autofree, size);
 
 #ifndef NDEBUG
@@ -190,6 +376,17 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	/*
+	 *	Batch push / pop, starting from part way around the
+	 *	queue, so that the runs wrap.
+	 */
+	if (!fr_atomic_queue_push(aq, data) || !fr_atomic_queue_pop(aq, &data)) {
+		fprintf(stderr, "Failed push / pop before the batch tests\n");
+		exit(1);
+	}
+
+	test_batch(aq, size);
+
 	talloc_free(autofree);
 
 	return rcode;
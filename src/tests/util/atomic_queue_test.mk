@@ -1,6 +1,6 @@
 TARGET := atomic_queue_test
 
-SOURCES		:= atomic_queue_test.c
+SOURCES		:= atomic_queue_test.c stubs.c
 
 TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a libfreeradius-io.a
 TGT_LDLIBS	:= $(LIBS)
@@ -50,34 +50,15 @@ static fr_control_t		*control_master, *control_worker;
 static int			max_messages = 10;
 static int			max_control_plane = 0;
 static int			max_outstanding = 1;
+static int			num_lanes = 1;
+static uint64_t			lane_sent[FR_CHANNEL_NUM_LANES];
 static bool			touch_memory = false;
 
-/**********************************************************************/
-typedef struct rad_request REQUEST;
-
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
-{
-	return NULL;
-}
-
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
-{
-}
-
-void talloc_const_free(void const *ptr)
-{
-	void *tmp;
-	if (!ptr) return;
-
-	memcpy(&tmp, &ptr, sizeof(tmp));
-	talloc_free(tmp);
-}
-/**********************************************************************/
-
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: channel_test [OPTS]\n");
 	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
+	fprintf(stderr, "  -l <lanes>             Spread messages over number of channel lanes.\n");
 	fprintf(stderr, "  -m <messages>	  Send number of messages.\n");
 	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
 	fprintf(stderr, "  -t                     Touch memory for fake packets.\n");
@@ -167,6 +148,8 @@ static void *channel_master(void *arg)
 			num_messages++;
 
 			cd->m.when = fr_time();
+			cd->priority = num_messages % num_lanes;
+			lane_sent[cd->priority]++;
 
 			if (touch_memory) {
 				size_t j, k;
@@ -495,6 +478,9 @@ static void *channel_worker(void *arg)
 int main(int argc, char *argv[])
 {
 	int c;
+	unsigned int	i;
+	uint64_t	num_received = 0;
+	fr_time_t	start, elapsed;
 	fr_channel_t	*channel;
 	TALLOC_CTX	*autofree = talloc_init("main");
 	pthread_attr_t	attr;
@@ -502,7 +488,7 @@ int main(int argc, char *argv[])
 
 	fr_time_start();
 
-	while ((c = getopt(argc, argv, "c:hm:o:tx")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "c:hl:m:o:tx")) != EOF) switch (c) {
 		case 'x':
 			debug_lvl++;
 			break;
@@ -511,6 +497,11 @@ int main(int argc, char *argv[])
 			max_control_plane = atoi(optarg);
 			break;
 
+		case 'l':
+			num_lanes = atoi(optarg);
+			if ((num_lanes <= 0) || (num_lanes > FR_CHANNEL_NUM_LANES)) usage();
+			break;
+
 		case 'm':
 			max_messages = atoi(optarg);
 			break;
@@ -570,17 +561,55 @@ int main(int argc, char *argv[])
 	(void) pthread_attr_init(&attr);
 	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
+	start = fr_time();
+
 	(void) pthread_create(&master_id, &attr, channel_master, channel);
 	(void) pthread_create(&worker_id, &attr, channel_worker, channel);
 
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
+	elapsed = fr_time() - start;
+
 	close(kq_master);
 	close(kq_worker);
 
 	fr_channel_debug(channel, stdout);
 
+	/*
+	 *	Every message the worker received is in the latency
+	 *	histogram for its lane.  No message can have waited
+	 *	longer than the test took, and the top of the bucket
+	 *	is at most 25% more than that.
+	 */
+	for (i = 0; i < FR_CHANNEL_NUM_LANES; i++) {
+		uint64_t	count;
+		fr_time_t	p50, p90, p99;
+
+		count = fr_channel_lane_latency_count(channel, i);
+		p50 = fr_channel_lane_latency(channel, i, 50);
+		p90 = fr_channel_lane_latency(channel, i, 90);
+		p99 = fr_channel_lane_latency(channel, i, 99);
+
+		MPRINT1("lane %u sent %"PRIu64" counted %"PRIu64" p50 %"PRIu64" p90 %"PRIu64" p99 %"PRIu64"\n",
+			i, lane_sent[i], count, p50, p90, p99);
+
+		rad_assert(count == lane_sent[i]);
+		num_received += count;
+
+		if (!count) {
+			rad_assert(p99 == 0);
+			continue;
+		}
+
+		rad_assert(p50 > 0);
+		rad_assert(p50 <= p90);
+		rad_assert(p90 <= p99);
+		rad_assert(p99 <= (elapsed + (elapsed / 4)));
+	}
+	rad_assert(num_received == (uint64_t) max_messages);
+	rad_assert(fr_channel_lane_latency_count(channel, FR_CHANNEL_NUM_LANES) == 0);
+
 	talloc_free(autofree);
 
 	return 0;
@@ -1,6 +1,6 @@
 TARGET := channel_test
 
-SOURCES		:= channel_test.c
+SOURCES		:= channel_test.c stubs.c
 
 TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a libfreeradius-io.a
 TGT_LDLIBS	:= $(LIBS)
@@ -30,6 +30,10 @@ RCSID("$Id$")
 #include <stdio.h>
 #include <string.h>
 
+#ifdef HAVE_SYS_EVENTFD_H
+#	include <sys/eventfd.h>
+#endif
+
 #ifdef HAVE_GETOPT_H
 #	include <getopt.h>
 #endif
@@ -49,31 +53,6 @@ static int		aq_size = 16;
 static fr_control_t	*control = NULL;
 static fr_ring_buffer_t *rb = NULL;
 
-/**********************************************************************/
-typedef struct rad_request REQUEST;
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx);
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request);
-void talloc_const_free(void const *ptr);
-
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
-{
-	return NULL;
-}
-
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
-{
-}
-
-void talloc_const_free(void const *ptr)
-{
-	void *tmp;
-	if (!ptr) return;
-
-	memcpy(&tmp, &ptr, sizeof(tmp));
-	talloc_free(tmp);
-}
-/**********************************************************************/
-
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: control_test [OPTS]\n");
@@ -182,6 +161,72 @@ retry:
 
 
 
+/** Check that a failed wakeup doesn't leave the receiver marked as signalled
+ *
+ *  Otherwise every later wakeup would be coalesced into the one
+ *  which was never delivered, and the receiver would never wake up.
+ */
+static void test_signal_error(TALLOC_CTX *ctx)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+	int			fd, efd, fds[2];
+	eventfd_t		value;
+	uint8_t			data[256];
+	fr_atomic_queue_t	*my_aq;
+	fr_control_t		*c;
+
+	my_aq = fr_atomic_queue_create(ctx, aq_size);
+	rad_assert(my_aq != NULL);
+
+	c = fr_control_create(ctx, kq, my_aq, 1025);
+	rad_assert(c != NULL);
+
+	fd = fr_control_wakeup_fd(c);
+	rad_assert(fd >= 0);
+
+	/*
+	 *	Swap the eventfd for the read end of a pipe, so that
+	 *	writing to it fails.  Both signals have to try, and
+	 *	fail.
+	 */
+	rad_assert(pipe(fds) == 0);
+	rad_assert(dup2(fds[0], fd) == fd);
+	close(fds[0]);
+	close(fds[1]);
+
+	rad_assert(fr_control_signal(c) < 0);
+	rad_assert(fr_control_signal(c) < 0);
+
+	/*
+	 *	Put a working eventfd back.  The next signal is
+	 *	delivered, and the one after that is coalesced into
+	 *	it.
+	 */
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	rad_assert(efd >= 0);
+	rad_assert(dup2(efd, fd) == fd);
+	close(efd);
+
+	rad_assert(fr_control_signal(c) == 0);
+	rad_assert(fr_control_signal(c) == 0);
+	rad_assert(eventfd_read(fd, &value) == 0);
+	rad_assert(value == 1);
+
+	/*
+	 *	Once the receiver has serviced the queue, the next
+	 *	signal is delivered again.
+	 */
+	fr_control_service(c, data, sizeof(data), fr_time());
+	rad_assert(fr_control_signal(c) == 0);
+	rad_assert(eventfd_read(fd, &value) == 0);
+	rad_assert(value == 1);
+
+	talloc_free(c);
+
+	MPRINT1("Signal error test passed.\n");
+#endif
+}
+
 int main(int argc, char *argv[])
 {
 	int c;
@@ -237,6 +282,8 @@ int main(int argc, char *argv[])
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
+	test_signal_error(autofree);
+
 	close(kq);
 
 	talloc_free(autofree);
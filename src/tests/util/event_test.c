@@ -0,0 +1,554 @@
+/*
+ * event_test.c	Tests for event lists
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/event.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_TIMERS	(100)
+#define MAX_WHEEL	(10000)
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: event_test [OPTS]\n");
+	fprintf(stderr, "  -n count               number of wakeups in the latency benchmark.\n");
+	fprintf(stderr, "  -t count               number of timers to arm and cancel in the timer benchmark.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/*
+ *	Timers must run in order, and no earlier than they were
+ *	scheduled for.
+ */
+static struct timeval	timer_last;
+static int		timer_fired;
+
+static void timer_fire(UNUSED fr_event_list_t *el, struct timeval *now, void *uctx)
+{
+	struct timeval *when = uctx;
+
+	if (fr_timeval_cmp(when, &timer_last) < 0) {
+		fprintf(stderr, "Timer %d.%06d ran after %d.%06d\n",
+			(int) when->tv_sec, (int) when->tv_usec,
+			(int) timer_last.tv_sec, (int) timer_last.tv_usec);
+		exit(1);
+	}
+
+	if (fr_timeval_cmp(now, when) < 0) {
+		fprintf(stderr, "Timer %d.%06d ran early\n", (int) when->tv_sec, (int) when->tv_usec);
+		exit(1);
+	}
+
+	if (debug_lvl) printf("\ttimer %d.%06d\n", (int) when->tv_sec, (int) when->tv_usec);
+
+	timer_last = *when;
+	timer_fired++;
+}
+
+static void test_timers(fr_event_list_t *el)
+{
+	int			i;
+	struct timeval		array[MAX_TIMERS];
+	fr_event_timer_t	*ev[MAX_TIMERS];
+
+	memset(ev, 0, sizeof(ev));
+	timer_last.tv_sec = 0;
+	timer_last.tv_usec = 0;
+	timer_fired = 0;
+
+	/*
+	 *	Spread the timers over the next 50ms or so, in random
+	 *	order.
+	 */
+	gettimeofday(&array[0], NULL);
+	for (i = 0; i < MAX_TIMERS; i++) {
+		if (i > 0) array[i] = array[0];
+
+		array[i].tv_usec += fr_rand() & 0xffff;
+		if (array[i].tv_usec >= 1000000) {
+			array[i].tv_usec -= 1000000;
+			array[i].tv_sec++;
+		}
+
+		if (fr_event_timer_insert(el, timer_fire, &array[i], &array[i], &ev[i]) < 0) {
+			fprintf(stderr, "Failed inserting timer: %s\n", fr_strerror());
+			exit(1);
+		}
+	}
+
+	while (fr_event_list_num_elements(el) > 0) {
+		if (fr_event_corral(el, true) < 0) {
+			fprintf(stderr, "Failed corralling events: %s\n", fr_strerror());
+			exit(1);
+		}
+
+		fr_event_service(el);
+	}
+
+	if (timer_fired != MAX_TIMERS) {
+		fprintf(stderr, "Expected %d timers, got %d\n", MAX_TIMERS, timer_fired);
+		exit(1);
+	}
+}
+
+/*
+ *	Timers which are hours away must still run in order, and on
+ *	time, even if most of them are deleted first.  We don't want to
+ *	wait that long, so we pretend that time is passing.
+ */
+static void test_wheel(TALLOC_CTX *ctx, fr_event_list_t *el)
+{
+	int			i, deleted = 0;
+	struct timeval		now, when;
+	struct timeval		*array;
+	fr_event_timer_t	**ev;
+
+	array = talloc_array(ctx, struct timeval, MAX_WHEEL);
+	ev = talloc_zero_array(ctx, fr_event_timer_t *, MAX_WHEEL);
+
+	timer_last.tv_sec = 0;
+	timer_last.tv_usec = 0;
+	timer_fired = 0;
+
+	gettimeofday(&now, NULL);
+	for (i = 0; i < MAX_WHEEL; i++) {
+		uint32_t delay = fr_rand() % (3 * 3600);
+
+		array[i] = now;
+		array[i].tv_sec += delay >> (fr_rand() & 0x0f);
+		array[i].tv_usec = fr_rand() % 1000000;
+
+		if (fr_event_timer_insert(el, timer_fire, &array[i], &array[i], &ev[i]) < 0) {
+			fprintf(stderr, "Failed inserting timer: %s\n", fr_strerror());
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < MAX_WHEEL; i += 2) {
+		if (fr_event_timer_delete(el, &ev[i]) < 0) {
+			fprintf(stderr, "Failed deleting timer: %s\n", fr_strerror());
+			exit(1);
+		}
+		deleted++;
+	}
+
+	if (fr_event_list_num_elements(el) != (MAX_WHEEL - deleted)) {
+		fprintf(stderr, "Expected %d timers, found %d\n", MAX_WHEEL - deleted, fr_event_list_num_elements(el));
+		exit(1);
+	}
+
+	/*
+	 *	Jump to the next time we're told to look at the
+	 *	timers, until there are none left.
+	 */
+	while (fr_event_list_num_elements(el) > 0) {
+		when = now;
+		if (fr_event_timer_run(el, &when) == 1) continue;
+
+		if (fr_timeval_cmp(&when, &now) <= 0) {
+			fprintf(stderr, "Timers didn't move forward from %d.%06d\n", (int) now.tv_sec, (int) now.tv_usec);
+			exit(1);
+		}
+		now = when;
+	}
+
+	if (timer_fired != (MAX_WHEEL - deleted)) {
+		fprintf(stderr, "Expected %d timers, got %d\n", MAX_WHEEL - deleted, timer_fired);
+		exit(1);
+	}
+
+	for (i = 0; i < MAX_WHEEL; i++) {
+		if (ev[i]) {
+			fprintf(stderr, "Timer %d wasn't cleared\n", i);
+			exit(1);
+		}
+	}
+
+	talloc_free(array);
+	talloc_free(ev);
+}
+
+/*
+ *	Data written to a pipe must be read by the handler.
+ */
+static int		fd_read;
+static fr_time_t	fd_sent;
+static fr_time_t	fd_delay;
+
+static void fd_readable(UNUSED fr_event_list_t *el, int sock, UNUSED int flags, UNUSED void *uctx)
+{
+	uint8_t buffer[16];
+
+	fd_delay = fr_time() - fd_sent;
+
+	if (read(sock, buffer, sizeof(buffer)) > 0) fd_read++;
+}
+
+static void fd_write(int fd)
+{
+	uint8_t data = 0;
+
+	fd_sent = fr_time();
+
+	if (write(fd, &data, sizeof(data)) != sizeof(data)) {
+		fprintf(stderr, "Failed writing to pipe: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+}
+
+static void test_fd(fr_event_list_t *el, int fd[2])
+{
+	int num_fds;
+
+	num_fds = fr_event_list_num_fds(el);
+	fd_read = 0;
+
+	if (fr_event_fd_insert(el, fd[0], fd_readable, NULL, NULL, NULL) < 0) {
+		fprintf(stderr, "Failed inserting FD: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (fr_event_list_num_fds(el) != (num_fds + 1)) {
+		fprintf(stderr, "FD count wasn't updated\n");
+		exit(1);
+	}
+
+	/*
+	 *	Nothing to read, so we don't block, and nothing happens.
+	 */
+	if (fr_event_corral(el, false) != 0) {
+		fprintf(stderr, "Got FD events from an empty pipe\n");
+		exit(1);
+	}
+	fr_event_service(el);
+
+	fd_write(fd[1]);
+
+	if (fr_event_corral(el, true) != 1) {
+		fprintf(stderr, "Expected one FD event\n");
+		exit(1);
+	}
+	fr_event_service(el);
+
+	if (fd_read != 1) {
+		fprintf(stderr, "Read handler wasn't called\n");
+		exit(1);
+	}
+
+	if (fr_event_fd_delete(el, fd[0]) < 0) {
+		fprintf(stderr, "Failed deleting FD: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (fr_event_list_num_fds(el) != num_fds) {
+		fprintf(stderr, "FD count wasn't updated\n");
+		exit(1);
+	}
+
+	/*
+	 *	Deleted FDs don't get events.
+	 */
+	fd_write(fd[1]);
+	if (fr_event_corral(el, false) != 0) {
+		fprintf(stderr, "Got FD events from a deleted FD\n");
+		exit(1);
+	}
+	fr_event_service(el);
+
+	if (fd_read != 1) {
+		fprintf(stderr, "Read handler was called for a deleted FD\n");
+		exit(1);
+	}
+
+	fd_readable(el, fd[0], 0, NULL);
+}
+
+/*
+ *	Regular files are always readable.  Each handler deletes its
+ *	own FD, which frees it while we're walking the list of FDs.
+ */
+static int		file_fd[2];
+static int		file_read[2];
+
+static void file_readable(fr_event_list_t *el, int sock, UNUSED int flags, UNUSED void *uctx)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (sock == file_fd[i]) file_read[i]++;
+	}
+
+	if (fr_event_fd_delete(el, sock) < 0) {
+		fprintf(stderr, "Failed deleting file FD: %s\n", fr_strerror());
+		exit(1);
+	}
+}
+
+static void test_file(fr_event_list_t *el)
+{
+	int i, num_fds;
+
+	num_fds = fr_event_list_num_fds(el);
+
+	for (i = 0; i < 2; i++) {
+		FILE *fp;
+
+		fp = tmpfile();
+		if (!fp || (fputs("data", fp) < 0) || (fflush(fp) != 0)) {
+			fprintf(stderr, "Failed creating file: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+		rewind(fp);
+
+		file_fd[i] = dup(fileno(fp));
+		fclose(fp);
+		file_read[i] = 0;
+
+		if (fr_event_fd_insert(el, file_fd[i], file_readable, NULL, NULL, NULL) < 0) {
+			fprintf(stderr, "Failed inserting file FD: %s\n", fr_strerror());
+			exit(1);
+		}
+	}
+
+	(void) fr_event_corral(el, false);
+	fr_event_service(el);
+
+	for (i = 0; i < 2; i++) {
+		if (file_read[i] != 1) {
+			fprintf(stderr, "File handler %d was called %d times\n", i, file_read[i]);
+			exit(1);
+		}
+		close(file_fd[i]);
+	}
+
+	if (fr_event_list_num_fds(el) != num_fds) {
+		fprintf(stderr, "FD count wasn't updated\n");
+		exit(1);
+	}
+}
+
+/*
+ *	Time from a write to the read handler being called, and from
+ *	a timer being due to it running.
+ */
+static fr_time_t	timer_due;
+static fr_time_t	timer_delay;
+
+static void timer_latency(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, UNUSED void *uctx)
+{
+	timer_delay = fr_time() - timer_due;
+}
+
+static void bench(fr_event_list_t *el, int fd[2], int count)
+{
+	int			i;
+	fr_time_t		fd_min = ~(fr_time_t) 0, fd_max = 0, fd_total = 0;
+	fr_time_t		timer_min = ~(fr_time_t) 0, timer_max = 0, timer_total = 0;
+	struct timeval		when;
+	fr_event_timer_t	*ev = NULL;
+
+	if (fr_event_fd_insert(el, fd[0], fd_readable, NULL, NULL, NULL) < 0) {
+		fprintf(stderr, "Failed inserting FD: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	for (i = 0; i < count; i++) {
+		fd_write(fd[1]);
+
+		if (fr_event_corral(el, true) < 0) {
+			fprintf(stderr, "Failed corralling events: %s\n", fr_strerror());
+			exit(1);
+		}
+		fr_event_service(el);
+
+		if (fd_delay < fd_min) fd_min = fd_delay;
+		if (fd_delay > fd_max) fd_max = fd_delay;
+		fd_total += fd_delay;
+	}
+
+	(void) fr_event_fd_delete(el, fd[0]);
+
+	/*
+	 *	Timers are due 100us from now.
+	 */
+	for (i = 0; i < count; i++) {
+		gettimeofday(&when, NULL);
+		when.tv_usec += 100;
+		if (when.tv_usec >= 1000000) {
+			when.tv_usec -= 1000000;
+			when.tv_sec++;
+		}
+		timer_due = fr_time() + (100 * 1000);
+
+		if (fr_event_timer_insert(el, timer_latency, NULL, &when, &ev) < 0) {
+			fprintf(stderr, "Failed inserting timer: %s\n", fr_strerror());
+			exit(1);
+		}
+
+		while (fr_event_list_num_elements(el) > 0) {
+			if (fr_event_corral(el, true) < 0) {
+				fprintf(stderr, "Failed corralling events: %s\n", fr_strerror());
+				exit(1);
+			}
+			fr_event_service(el);
+		}
+
+		if (timer_delay < timer_min) timer_min = timer_delay;
+		if (timer_delay > timer_max) timer_max = timer_delay;
+		timer_total += timer_delay;
+	}
+
+	printf("fd wakeup     min %8.2fus  avg %8.2fus  max %8.2fus\n",
+	       fd_min / 1000.0, (fd_total / 1000.0) / count, fd_max / 1000.0);
+	printf("timer latency min %8.2fus  avg %8.2fus  max %8.2fus\n",
+	       timer_min / 1000.0, (timer_total / 1000.0) / count, timer_max / 1000.0);
+}
+
+/*
+ *	Arm a lot of timers a while in the future, and cancel them all.
+ *	This is what happens to most request timeouts.
+ */
+static void bench_timers(TALLOC_CTX *ctx, fr_event_list_t *el, int count)
+{
+	int			i;
+	struct timeval		now;
+	struct timeval		*array;
+	fr_event_timer_t	**ev;
+	fr_time_t		start, armed, cancelled;
+
+	array = talloc_array(ctx, struct timeval, count);
+	ev = talloc_zero_array(ctx, fr_event_timer_t *, count);
+	if (!array || !ev) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	gettimeofday(&now, NULL);
+	for (i = 0; i < count; i++) {
+		array[i] = now;
+		array[i].tv_sec += 1 + (fr_rand() % 60);
+		array[i].tv_usec = fr_rand() % 1000000;
+	}
+
+	start = fr_time();
+	for (i = 0; i < count; i++) {
+		if (fr_event_timer_insert(el, timer_fire, &array[i], &array[i], &ev[i]) < 0) {
+			fprintf(stderr, "Failed inserting timer: %s\n", fr_strerror());
+			exit(1);
+		}
+	}
+	armed = fr_time();
+
+	for (i = 0; i < count; i++) {
+		(void) fr_event_timer_delete(el, &ev[i]);
+	}
+	cancelled = fr_time();
+
+	printf("timers %d  arm %6.1fns/op  cancel %6.1fns/op\n", count,
+	       ((double) (armed - start)) / count, ((double) (cancelled - armed)) / count);
+
+	talloc_free(array);
+	talloc_free(ev);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	int			count = 0, timers = 0;
+	int			fd[2];
+	fr_event_list_t		*el;
+	TALLOC_CTX		*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hn:t:x")) != EOF) switch (c) {
+		case 'n':
+			count = atoi(optarg);
+			if (count < 1) usage();
+			break;
+
+		case 't':
+			timers = atoi(optarg);
+			if (timers < 1) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "Failed creating event list: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (pipe(fd) < 0) {
+		fprintf(stderr, "Failed creating pipe: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	if (count || timers) {
+		if (count) bench(el, fd, count);
+		if (timers) bench_timers(autofree, el, timers);
+		goto done;
+	}
+
+	test_timers(el);
+	test_wheel(autofree, el);
+	test_fd(el, fd);
+	test_file(el);
+
+	/*
+	 *	Once we're told to exit, we don't wait for anything.
+	 */
+	fr_event_loop_exit(el, 1);
+	if (fr_event_corral(el, true) >= 0) {
+		fprintf(stderr, "Event list didn't exit\n");
+		exit(1);
+	}
+
+done:
+	close(fd[0]);
+	close(fd[1]);
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * md5_test.c	Tests and benchmarks for the scalar and multi-buffer MD5 code
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_LOOPS	(100 * 1000)
+#define MAX_MESSAGES	(3 * FR_MD5_MULTI_LANES + 1)
+#define MAX_LEN		(300)
+
+static int		debug_lvl = 0;
+
+/*
+ *	RFC 1321 test suite.
+ */
+static char const *kat_in[] = {
+	"",
+	"a",
+	"abc",
+	"message digest",
+	"abcdefghijklmnopqrstuvwxyz",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+	"12345678901234567890123456789012345678901234567890123456789012345678901234567890"
+};
+
+static char const *kat_out[] = {
+	"d41d8cd98f00b204e9800998ecf8427e",
+	"0cc175b9c0f1b6a831c399e269772661",
+	"900150983cd24fb0d6963f7d28e17f72",
+	"f96b697d7cb7938d525a2f31aaf161d0",
+	"c3fcd3d76192e4007dfb496cca67e13b",
+	"d174ab98d277d9f5a5611c2c9f419d9f",
+	"57edf4a22be3c955ac49da2e2107b67a"
+};
+
+#define NUM_KAT (sizeof(kat_in) / sizeof(kat_in[0]))
+
+static uint8_t	data[MAX_MESSAGES][MAX_LEN];
+
+static void digest_check(uint8_t const digest[MD5_DIGEST_LENGTH], char const *expected)
+{
+	char	buffer[(MD5_DIGEST_LENGTH * 2) + 1];
+
+	fr_bin2hex(buffer, digest, MD5_DIGEST_LENGTH);
+	if (debug_lvl) printf("%s\n", buffer);
+
+	rad_assert(strcmp(buffer, expected) == 0);
+}
+
+static void test_kat(void)
+{
+	size_t		i, j;
+	uint8_t		digest[NUM_KAT][MD5_DIGEST_LENGTH];
+	uint8_t const	*in[NUM_KAT];
+	size_t		inlen[NUM_KAT];
+
+	for (i = 0; i < NUM_KAT; i++) {
+		in[i] = (uint8_t const *) kat_in[i];
+		inlen[i] = strlen(kat_in[i]);
+
+		fr_md5_calc(digest[i], in[i], inlen[i]);
+		digest_check(digest[i], kat_out[i]);
+	}
+
+	/*
+	 *	All of them at once, and then every sub-batch, so that
+	 *	each message is tried in different lanes.
+	 */
+	for (i = 0; i < NUM_KAT; i++) {
+		memset(digest, 0, sizeof(digest));
+		fr_md5_multi(digest + i, NULL, in + i, inlen + i, NUM_KAT - i);
+
+		for (j = i; j < NUM_KAT; j++) digest_check(digest[j], kat_out[j]);
+	}
+}
+
+/*
+ *	Compare multi-buffer against scalar for lots of lengths,
+ *	batch sizes, and starting contexts.
+ */
+static void test_multi(void)
+{
+	size_t			i, num, len;
+	uint8_t			scalar[MAX_MESSAGES][MD5_DIGEST_LENGTH];
+	uint8_t			multi[MAX_MESSAGES][MD5_DIGEST_LENGTH];
+	uint8_t const		*in[MAX_MESSAGES];
+	size_t			inlen[MAX_MESSAGES];
+	FR_MD5_CTX		prefix[MAX_MESSAGES], context;
+	FR_MD5_CTX const	*ctx[MAX_MESSAGES];
+	fr_md5_secret_t		secret[MAX_MESSAGES];
+	fr_md5_secret_t const	*state[MAX_MESSAGES];
+
+	for (i = 0; i < MAX_MESSAGES; i++) {
+		for (len = 0; len < MAX_LEN; len++) data[i][len] = fr_rand();
+
+		/*
+		 *	Most contexts are on a block boundary, but
+		 *	some aren't, and have to be done the slow way.
+		 */
+		fr_md5_init(&prefix[i]);
+		fr_md5_update(&prefix[i], data[i], (i % 3) ? MD5_BLOCK_LENGTH : 10);
+
+		fr_md5_secret_init(&secret[i], data[i], 1 + (i * 7) % 100);
+		state[i] = &secret[i];
+	}
+
+	for (num = 1; num <= MAX_MESSAGES; num++) {
+		for (len = 0; len < MAX_LEN; len++) {
+			for (i = 0; i < num; i++) {
+				in[i] = data[i];
+				inlen[i] = (len + (i * 13)) % MAX_LEN;
+				ctx[i] = (i & 1) ? &prefix[i] : NULL;
+			}
+
+			/*
+			 *	No contexts.
+			 */
+			for (i = 0; i < num; i++) fr_md5_calc(scalar[i], in[i], inlen[i]);
+			fr_md5_multi(multi, NULL, in, inlen, num);
+			rad_assert(memcmp(scalar, multi, num * MD5_DIGEST_LENGTH) == 0);
+
+			/*
+			 *	Some contexts.
+			 */
+			for (i = 0; i < num; i++) {
+				if (ctx[i]) {
+					fr_md5_copy(&context, ctx[i]);
+				} else {
+					fr_md5_init(&context);
+				}
+				fr_md5_update(&context, in[i], inlen[i]);
+				fr_md5_final(scalar[i], &context);
+			}
+			fr_md5_multi(multi, ctx, in, inlen, num);
+			rad_assert(memcmp(scalar, multi, num * MD5_DIGEST_LENGTH) == 0);
+
+			/*
+			 *	HMAC
+			 */
+			for (i = 0; i < num; i++) fr_hmac_md5_secret(scalar[i], in[i], inlen[i], state[i]);
+			fr_hmac_md5_secret_multi(multi, in, inlen, state, num);
+			rad_assert(memcmp(scalar, multi, num * MD5_DIGEST_LENGTH) == 0);
+		}
+	}
+}
+
+static void bench(size_t len, int loops)
+{
+	int		i;
+	size_t		j;
+	fr_time_t	start, end;
+	uint8_t		digest[FR_MD5_MULTI_LANES][MD5_DIGEST_LENGTH];
+	uint8_t const	*in[FR_MD5_MULTI_LANES];
+	size_t		inlen[FR_MD5_MULTI_LANES];
+	double		scalar, multi;
+
+	for (j = 0; j < FR_MD5_MULTI_LANES; j++) {
+		in[j] = data[j];
+		inlen[j] = len;
+	}
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < FR_MD5_MULTI_LANES; j++) fr_md5_calc(digest[j], in[j], inlen[j]);
+	}
+	end = fr_time();
+	scalar = ((double) loops * FR_MD5_MULTI_LANES * NANOSEC) / (end - start);
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		fr_md5_multi(digest, NULL, in, inlen, FR_MD5_MULTI_LANES);
+	}
+	end = fr_time();
+	multi = ((double) loops * FR_MD5_MULTI_LANES * NANOSEC) / (end - start);
+
+	printf("%4zu octet messages, %2d lanes, scalar %10.0f hashes/s, multi-buffer %10.0f hashes/s (x%.2f)\n",
+	       len, FR_MD5_MULTI_LANES, scalar, multi, multi / scalar);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: md5_test [OPTS]\n");
+	fprintf(stderr, "  -b                     Run benchmarks.\n");
+	fprintf(stderr, "  -n <num>               Number of batches for the benchmarks.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	bool		do_bench = false;
+	int		loops = MAX_LOOPS;
+	size_t		i;
+	size_t		lens[] = { 20, 64, 200, 290 };
+
+	while ((c = getopt(argc, argv, "bhn:x")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+#if 0
+	argc -= (optind - 1);
+	argv += (optind - 1);
+#endif
+
+	test_kat();
+	test_multi();
+
+	if (!do_bench) return 0;
+
+	if (fr_time_start() < 0) {
+		fprintf(stderr, "Failed to start time\n");
+		exit(1);
+	}
+
+	for (i = 0; i < (sizeof(lens) / sizeof(lens[0])); i++) bench(lens[i], loops);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := md5_test
+
+SOURCES		:= md5_test.c stubs.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)
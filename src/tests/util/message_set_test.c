@@ -59,32 +59,6 @@ static size_t		seed_string_len = 3;
 static size_t		reserve_size = 2048;
 static size_t		allocation_mask = 0x3ff;
 
-/**********************************************************************/
-typedef struct rad_request REQUEST;
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx);
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request);
-void talloc_const_free(void const *ptr);
-
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
-{
-	return NULL;
-}
-
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
-{
-}
-
-void talloc_const_free(void const *ptr)
-{
-	void *tmp;
-	if (!ptr) return;
-
-	memcpy(&tmp, &ptr, sizeof(tmp));
-	talloc_free(tmp);
-}
-/**********************************************************************/
-
-
 static void  alloc_blocks(fr_message_set_t *ms, uint32_t *seed, UNUSED int *start, int *end)
 {
 	int i;
@@ -407,6 +381,40 @@ int main(int argc, char *argv[])
 		       my_alloc_size * 10000);
 	}
 
+	/*
+	 *	A held message is done only when nothing refers to
+	 *	its data.
+	 */
+	{
+		fr_message_t		*m;
+		fr_message_ref_t	*ref;
+		TALLOC_CTX		*a, *b;
+
+		m = fr_message_reserve(ms, reserve_size);
+		rad_assert(m != NULL);
+		m = fr_message_alloc(ms, m, 100);
+		rad_assert(m != NULL);
+
+		ref = fr_message_ref_alloc(autofree, m);
+		rad_assert(ref != NULL);
+
+		a = talloc_new(autofree);
+		b = talloc_new(autofree);
+		(void) talloc_reference(a, ref);
+		(void) talloc_reference(b, ref);
+
+		(void) talloc_unlink(autofree, ref);
+		rad_assert(m->status == FR_MESSAGE_USED);
+
+		talloc_free(a);
+		rad_assert(m->status == FR_MESSAGE_USED);
+
+		talloc_free(b);
+		rad_assert(m->status == FR_MESSAGE_DONE);
+
+		MPRINT1("REF test passed\n");
+	}
+
 	/*
 	 *	Force all messages to be garbage collected
 	 */
@@ -0,0 +1,946 @@
+/*
+ * network_test.c	Tests for batched reads on the network side
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/inet.h>
+#include <freeradius-devel/udp.h>
+#include <freeradius-devel/radius.h>
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+#define MAX_NETWORKS (8)
+
+/*
+ *	The packets are read and verified the same way that
+ *	proto_radius_udp does it.  The module itself can't be linked
+ *	into a test program, as it needs the server core.
+ */
+typedef struct fr_test_packet_ctx_t {
+	uint8_t			vector[16];
+	uint8_t			id;
+	fr_ipaddr_t		src_ipaddr;
+	uint16_t		src_port;
+} fr_test_packet_ctx_t;
+
+typedef struct fr_listen_test_t {
+	int			sockfd;
+	fr_ipaddr_t		ipaddr;
+	uint16_t		port;
+
+	fr_test_packet_ctx_t	track[256];	//!< indexed by packet ID
+
+	int			max_read;	//!< largest batch of packets read at once
+	int			num_verified;
+	int			bad_signature;
+
+	fr_time_t		fd_fail_until;	//!< pretend that the socket has gone away until this time
+	int			num_fd_fails;	//!< number of times we did
+} fr_listen_test_t;
+
+/*
+ *	Filled in by the network threads, from fr_schedule_stats().
+ */
+typedef struct fr_test_stats_t {
+	atomic_int		num_done;	//!< networks which have sent all of their statistics
+	atomic_int		num_classes;	//!< (listener, packet code) pairs
+	atomic_int		num_bad;	//!< classes we didn't send, or with no prediction
+	atomic_uint_least64_t	count;		//!< replies the predictions are based on
+} fr_test_stats_t;
+
+static int			debug_lvl = 0;
+static char const		*secret = "testing123";
+static int			process_delay = 0;	//!< microseconds each request takes
+
+static fr_io_final_t test_process(REQUEST *request, fr_io_action_t action)
+{
+	MPRINT1("\t\tPROCESS --- request %"PRIu64" action %d\n", request->number, action);
+	if (process_delay) usleep(process_delay);
+	return FR_IO_REPLY;
+}
+
+static int test_decode(UNUSED void const *instance, REQUEST *request, UNUSED uint8_t *const data, UNUSED size_t data_len)
+{
+	request->async->process = test_process;
+
+	return 0;
+}
+
+static ssize_t test_encode(UNUSED void const *instance, REQUEST *request, uint8_t *buffer, UNUSED size_t buffer_len)
+{
+	fr_test_packet_ctx_t	*track = request->async->packet_ctx;
+
+	buffer[0] = FR_CODE_ACCOUNTING_RESPONSE;
+	buffer[1] = track->id;
+	buffer[2] = 0;
+	buffer[3] = 20;
+	memset(buffer + 4, 0, 16);
+
+	if (fr_radius_sign(buffer, track->vector, (uint8_t const *) secret, strlen(secret), NULL) < 0) return -1;
+
+	return 20;
+}
+
+static size_t test_nak(UNUSED void const *ctx, UNUSED uint8_t *const packet, UNUSED size_t packet_len,
+		       UNUSED uint8_t *reply, UNUSED size_t reply_len)
+{
+	return 1;
+}
+
+static int test_open(void *ctx)
+{
+	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+
+	io_ctx->sockfd = fr_socket_server_udp(&io_ctx->ipaddr, &io_ctx->port, NULL, true);
+	if (io_ctx->sockfd < 0) {
+		fprintf(stderr, "network_test: Failed creating socket: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	if (fr_socket_bind(io_ctx->sockfd, &io_ctx->ipaddr, &io_ctx->port, NULL) < 0) {
+		fprintf(stderr, "network_test: Failed binding to socket: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	return 0;
+}
+
+static int test_read_vector(void const *ctx, fr_io_vector_t *vector, int num)
+{
+	int			i, received, num_verify;
+	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+	udp_mmsg_t		msgs[UDP_MMSG_MAX];
+	fr_radius_verify_entry_t verify[UDP_MMSG_MAX];
+	int			packet[UDP_MMSG_MAX];
+
+	if (num > UDP_MMSG_MAX) num = UDP_MMSG_MAX;
+
+	for (i = 0; i < num; i++) {
+		msgs[i].data = vector[i].buffer;
+		msgs[i].data_len = vector[i].buffer_len;
+	}
+
+	received = udp_recv_mmsg(io_ctx->sockfd, msgs, num);
+	if (received <= 0) return received;
+
+	if (received > io_ctx->max_read) io_ctx->max_read = received;
+
+	num_verify = 0;
+	for (i = 0; i < received; i++) {
+		size_t		packet_len = msgs[i].data_len;
+		decode_fail_t	reason;
+
+		vector[i].buffer_len = 0;
+
+		if (!packet_len || !fr_radius_ok(msgs[i].data, &packet_len, false, &reason)) continue;
+
+		verify[num_verify] = (fr_radius_verify_entry_t) {
+			.packet = msgs[i].data,
+			.secret = (uint8_t const *) secret,
+			.secret_len = strlen(secret)
+		};
+		packet[num_verify++] = i;
+	}
+
+	if (!num_verify) return received;
+
+	(void) fr_radius_verify_multi(verify, num_verify);
+	io_ctx->num_verified += num_verify;
+
+	for (i = 0; i < num_verify; i++) {
+		int			j = packet[i];
+		fr_test_packet_ctx_t	*track;
+
+		if (verify[i].rcode < 0) {
+			io_ctx->bad_signature++;
+			continue;
+		}
+
+		track = &io_ctx->track[msgs[j].data[1]];
+		track->id = msgs[j].data[1];
+		memcpy(track->vector, msgs[j].data + 4, sizeof(track->vector));
+		track->src_ipaddr = msgs[j].src_ipaddr;
+		track->src_port = msgs[j].src_port;
+
+		vector[j].packet_ctx = track;
+		vector[j].buffer_len = msgs[j].data_len;
+	}
+
+	return received;
+}
+
+static ssize_t test_read(UNUSED void const *ctx, UNUSED void **packet_ctx, UNUSED fr_time_t **recv_time,
+			 UNUSED uint8_t *buffer, UNUSED size_t buffer_len)
+{
+	fprintf(stderr, "network_test: Single packet read called instead of read_vector\n");
+	exit(1);
+}
+
+static ssize_t test_write(void const *ctx, void *packet_ctx, UNUSED fr_time_t request_time,
+			  uint8_t *buffer, size_t buffer_len)
+{
+	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+	fr_test_packet_ctx_t	*track = packet_ctx;
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst;
+
+	if (buffer_len < 20) return buffer_len;
+
+	if (fr_ipaddr_to_sockaddr(&track->src_ipaddr, track->src_port, &dst, &sizeof_dst) < 0) return -1;
+
+	return sendto(io_ctx->sockfd, buffer, buffer_len, 0, (struct sockaddr *) &dst, sizeof_dst);
+}
+
+static int test_fd(void const *ctx)
+{
+	fr_listen_test_t	*io_ctx;
+
+	memcpy(&io_ctx, &ctx, sizeof(io_ctx)); /* const issues */
+	io_ctx = talloc_get_type_abort(io_ctx, fr_listen_test_t);
+
+	if (fr_time() < io_ctx->fd_fail_until) {
+		io_ctx->num_fd_fails++;
+		return -1;
+	}
+
+	return io_ctx->sockfd;
+}
+
+static int test_flush(UNUSED void const *ctx)
+{
+	return 0;
+}
+
+static void test_debug(void const *ctx, FILE *fp)
+{
+	fr_listen_test_t	*io_ctx;
+
+	memcpy(&io_ctx, &ctx, sizeof(io_ctx)); /* const issues */
+	io_ctx = talloc_get_type_abort(io_ctx, fr_listen_test_t);
+
+	fprintf(fp, "\t\tverified = %d\n", io_ctx->num_verified);
+	fprintf(fp, "\t\tbad_signatures = %d\n", io_ctx->bad_signature);
+}
+
+static fr_app_io_t app_io = {
+	.name = "network-test",
+	.default_message_size = 4096,
+	.open = test_open,
+	.read = test_read,
+	.read_vector = test_read_vector,
+	.write = test_write,
+	.flush = test_flush,
+	.fd = test_fd,
+	.nak = test_nak,
+	.encode = test_encode,
+	.decode = test_decode,
+	.debug = test_debug
+};
+
+static void test_stats(void *ctx, fr_listen_t const *listen, uint32_t code, fr_time_t predicted,
+		       UNUSED fr_time_t error, uint64_t count)
+{
+	fr_test_stats_t *stats = ctx;
+
+	if (!listen) {
+		atomic_fetch_add(&stats->num_done, 1);
+		return;
+	}
+
+	MPRINT1("Stats code %u predicted %" PRIu64 " count %" PRIu64 "\n", code, predicted, count);
+
+	if ((code != FR_CODE_ACCOUNTING_REQUEST) || !predicted) atomic_fetch_add(&stats->num_bad, 1);
+	atomic_fetch_add(&stats->num_classes, 1);
+	atomic_fetch_add(&stats->count, count);
+}
+
+static void process_set(UNUSED void const *ctx, REQUEST *request)
+{
+	request->async->process = test_process;
+}
+
+static fr_app_t test_app = {
+	.process_set = process_set,
+};
+
+/** Send a batch of Accounting-Request packets to the server
+ *
+ *  Packets with IDs 0..num_good-1 are signed with the correct secret,
+ *  the rest are signed with the wrong one.  The bad packets are sent
+ *  first, so that once all of the good packets have been replied to,
+ *  the network has read all of the bad ones, too.
+ */
+static void send_packets(int sockfd, int num_good, int num_bad)
+{
+	int		i;
+	uint8_t		packet[20];
+
+	for (i = 0; i < num_good + num_bad; i++) {
+		int		id = (i + num_good) % (num_good + num_bad);
+		char const	*my_secret = (id < num_good) ? secret : "wrong-secret";
+
+		packet[0] = FR_CODE_ACCOUNTING_REQUEST;
+		packet[1] = id;
+		packet[2] = 0;
+		packet[3] = sizeof(packet);
+		memset(packet + 4, 0, 16);
+
+		if (fr_radius_sign(packet, NULL, (uint8_t const *) my_secret, strlen(my_secret), NULL) < 0) {
+			fprintf(stderr, "network_test: Failed signing packet: %s\n", fr_strerror());
+			exit(1);
+		}
+
+		if (send(sockfd, packet, sizeof(packet), 0) < 0) {
+			fprintf(stderr, "network_test: Failed sending packet: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+	}
+}
+
+/** Read the replies, and check that they are for the packets we sent.
+ *
+ */
+static int recv_replies(int sockfd, bool *replied)
+{
+	int		num = 0;
+	ssize_t		data_size;
+	uint8_t		packet[4096];
+
+	while ((data_size = recv(sockfd, packet, sizeof(packet), MSG_DONTWAIT)) > 0) {
+		if ((data_size != 20) || (packet[0] != FR_CODE_ACCOUNTING_RESPONSE)) {
+			fprintf(stderr, "network_test: Got unexpected reply\n");
+			exit(1);
+		}
+
+		if (replied[packet[1]]) {
+			fprintf(stderr, "network_test: Got duplicate reply for ID %d\n", packet[1]);
+			exit(1);
+		}
+		replied[packet[1]] = true;
+		num++;
+	}
+
+	return num;
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: network_test [OPTS]\n");
+	fprintf(stderr, "  -b <num>               Set the maximum batch size.\n");
+	fprintf(stderr, "  -g <num>               Send num packets with the correct secret.\n");
+	fprintf(stderr, "  -m <num>               Send num packets with the wrong secret.\n");
+	fprintf(stderr, "  -n <num>               Start num network threads, with one socket each.\n");
+	fprintf(stderr, "  -p                     Check that a paused socket is resumed, even if putting\n");
+	fprintf(stderr, "                         it back into the event loop fails at first.\n");
+	fprintf(stderr, "  -w <num>               Run worker threads, and check that the pool grows to\n");
+	fprintf(stderr, "                         at most num workers under load, and shrinks when idle.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Count how many times a string occurs in a buffer
+ *
+ */
+static int count_str(char const *buf, char const *str)
+{
+	int		num = 0;
+	char const	*p = buf;
+
+	while ((p = strstr(p, str)) != NULL) {
+		num++;
+		p += strlen(str);
+	}
+
+	return num;
+}
+
+/** Open a server socket, and fill in the listener for it
+ *
+ */
+static fr_listen_test_t *test_listen_init(TALLOC_CTX *ctx, fr_listen_t *listen, int max_batch)
+{
+	fr_listen_test_t	*app_io_inst;
+
+	memset(listen, 0, sizeof(*listen));
+	listen->app_io = &app_io;
+	listen->app = &test_app;
+	listen->app_io_instance = app_io_inst = talloc_zero(ctx, fr_listen_test_t);
+	listen->default_message_size = app_io.default_message_size;
+	listen->num_messages = 256;
+	listen->max_batch = max_batch;
+
+	app_io_inst->ipaddr.af = AF_INET;
+	app_io_inst->ipaddr.prefix = 32;
+	app_io_inst->ipaddr.addr.v4.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (listen->app_io->open(listen->app_io_instance) < 0) exit(1);
+
+	return app_io_inst;
+}
+
+/** Open a client socket, connected to a server socket
+ *
+ */
+static int test_client_socket(fr_listen_test_t *app_io_inst)
+{
+	int			sockfd;
+	struct sockaddr_storage	server;
+	socklen_t		sizeof_server;
+
+	sizeof_server = sizeof(server);
+	if (getsockname(app_io_inst->sockfd, (struct sockaddr *) &server, &sizeof_server) < 0) {
+		fprintf(stderr, "network_test: Failed getting server address: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if ((sockfd < 0) || (connect(sockfd, (struct sockaddr *) &server, sizeof_server) < 0)) {
+		fprintf(stderr, "network_test: Failed creating client socket: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	return sockfd;
+}
+
+/** Send a batch of packets, and wait for the worker threads to reply to them.
+ *
+ */
+static void send_burst(int sockfd, int num_good, int num_bad)
+{
+	int		i, num_replies = 0;
+	bool		replied[256];
+	fr_time_t	start;
+
+	memset(replied, 0, sizeof(replied));
+	send_packets(sockfd, num_good, num_bad);
+
+	start = fr_time();
+	while (num_replies < num_good) {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 5)) {
+			fprintf(stderr, "network_test: Timed out with %d replies\n", num_replies);
+			exit(1);
+		}
+
+		usleep(1000);
+		num_replies += recv_replies(sockfd, replied);
+	}
+
+	for (i = 0; i < num_good; i++) rad_assert(replied[i]);
+}
+
+/** Check that the scheduler adds workers under load, and retires them when idle
+ *
+ *  Each request takes a few milliseconds, so that a steady stream of
+ *  packets keeps one worker busy.  Once the pool has grown, the
+ *  packets stop, and the scheduler should retire the extra workers.
+ *  The pool must then still answer packets.
+ */
+static void test_pool(TALLOC_CTX *ctx, int max_workers, int max_batch, int num_good, int num_bad)
+{
+	int			sockfd, num_bursts = 0;
+	fr_time_t		start;
+	fr_schedule_t		*sched;
+	fr_listen_t		listen;
+	fr_listen_test_t	*app_io_inst;
+
+	process_delay = 5000;
+
+	sched = fr_schedule_create(ctx, NULL, &default_log, 1, 1, max_workers, NULL, NULL, NULL);
+	if (!sched) {
+		fprintf(stderr, "network_test: Failed to create scheduler: %s\n", fr_strerror());
+		exit(1);
+	}
+	rad_assert(fr_schedule_num_workers(sched) == 1);
+
+	app_io_inst = test_listen_init(ctx, &listen, max_batch);
+	sockfd = test_client_socket(app_io_inst);
+
+	if (!fr_schedule_socket_add(sched, &listen)) {
+		fprintf(stderr, "network_test: Failed adding socket: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	/*
+	 *	Keep the worker busy until the scheduler adds another.
+	 */
+	start = fr_time();
+	while (fr_schedule_num_workers(sched) < 2) {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 10)) {
+			fprintf(stderr, "network_test: Worker pool did not grow\n");
+			exit(1);
+		}
+
+		send_burst(sockfd, num_good, num_bad);
+		num_bursts++;
+	}
+	MPRINT1("Pool grew to %d workers after %d bursts\n", fr_schedule_num_workers(sched), num_bursts);
+	rad_assert(fr_schedule_num_workers(sched) <= max_workers);
+
+	/*
+	 *	Go quiet, and wait for it to retire the extra workers.
+	 */
+	start = fr_time();
+	while (fr_schedule_num_workers(sched) > 1) {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 30)) {
+			fprintf(stderr, "network_test: Worker pool did not shrink\n");
+			exit(1);
+		}
+
+		usleep(100000);
+	}
+	MPRINT1("Pool shrank to %d workers\n", fr_schedule_num_workers(sched));
+
+	/*
+	 *	The remaining worker still answers packets.
+	 */
+	send_burst(sockfd, num_good, num_bad);
+	num_bursts++;
+
+	close(sockfd);
+
+	fr_schedule_destroy(sched);
+
+	/*
+	 *	The network thread has exited, so we can look at what
+	 *	it did.
+	 */
+	rad_assert(app_io_inst->num_verified == (num_bursts * (num_good + num_bad)));
+	rad_assert(app_io_inst->bad_signature == (num_bursts * num_bad));
+}
+
+/** Service an event list until a reply arrives
+ *
+ */
+static void wait_reply(fr_event_list_t *el, int sockfd, bool *replied)
+{
+	fr_time_t	start;
+
+	start = fr_time();
+	while (!recv_replies(sockfd, replied)) {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 5)) {
+			fprintf(stderr, "network_test: Timed out waiting for a reply\n");
+			exit(1);
+		}
+
+		if (fr_event_corral(el, false) < 0) {
+			fprintf(stderr, "network_test: Failed corralling events: %s\n", fr_strerror());
+			exit(1);
+		}
+		fr_event_service(el);
+		usleep(1000);
+	}
+}
+
+/** Check that a paused socket is resumed, even if it can't be put back into the event loop at first
+ *
+ *  With no workers, the network holds the first packet, and stops
+ *  reading from the socket.  A worker is then added, but the
+ *  transport refuses to give out its file descriptor for a while.
+ *  Nothing else wakes the network up, so the network has to retry
+ *  by itself.  If it doesn't, the second packet is never read.
+ */
+static void test_resume(TALLOC_CTX *ctx, int max_batch)
+{
+	int			sockfd;
+	bool			replied[256];
+	fr_time_t		start;
+	fr_event_list_t		*el;
+	fr_network_t		*nr;
+	fr_worker_t		*worker;
+	fr_listen_t		listen;
+	fr_listen_test_t	*app_io_inst;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!el) {
+		fprintf(stderr, "network_test: Failed creating event list: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	nr = fr_network_create(ctx, el, &default_log);
+	if (!nr) {
+		fprintf(stderr, "network_test: Failed creating network: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	app_io_inst = test_listen_init(ctx, &listen, max_batch);
+	sockfd = test_client_socket(app_io_inst);
+
+	send_packets(sockfd, 1, 0);
+
+	if (fr_network_socket_add(nr, &listen) < 0) {
+		fprintf(stderr, "network_test: Failed adding socket: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	/*
+	 *	No worker will take the packet, so the socket is paused.
+	 */
+	start = fr_time();
+	while (app_io_inst->num_verified < 1) {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 5)) {
+			fprintf(stderr, "network_test: Timed out reading the first packet\n");
+			exit(1);
+		}
+
+		(void) fr_event_corral(el, false);
+		fr_event_service(el);
+		usleep(1000);
+	}
+
+	/*
+	 *	Longer than the network waits between retries, so
+	 *	that it has to retry more than once.
+	 */
+	app_io_inst->fd_fail_until = fr_time() + (NANOSEC / 4);
+
+	worker = fr_worker_create(ctx, el, &default_log, 0);
+	if (!worker) {
+		fprintf(stderr, "network_test: Failed creating worker: %s\n", fr_strerror());
+		exit(1);
+	}
+	(void) fr_network_worker_add(nr, worker, false);
+
+	/*
+	 *	The held packet is sent as soon as the worker is added.
+	 */
+	memset(replied, 0, sizeof(replied));
+	wait_reply(el, sockfd, replied);
+	rad_assert(replied[0]);
+
+	/*
+	 *	The second packet is only read once the socket is back
+	 *	in the event loop.
+	 */
+	memset(replied, 0, sizeof(replied));
+	send_packets(sockfd, 1, 0);
+	wait_reply(el, sockfd, replied);
+	rad_assert(replied[0]);
+
+	MPRINT1("Socket resumed after %d failures\n", app_io_inst->num_fd_fails);
+	rad_assert(app_io_inst->num_fd_fails > 0);
+	rad_assert(app_io_inst->num_verified == 2);
+
+	close(sockfd);
+
+	fr_worker_destroy(worker);
+	fr_network_destroy(nr);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, j;
+	int			num_good = 32;
+	int			num_bad = 8;
+	int			num_networks = 0;
+	int			num_sockets;
+	int			num_replies = 0;
+	int			max_batch = 64;
+	int			max_workers = 0;
+	bool			do_resume = false;
+	int			sockfd[MAX_NETWORKS];
+	bool			replied[MAX_NETWORKS][256];
+	fr_time_t		start;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_event_list_t		*el = NULL;
+	fr_schedule_t		*sched;
+	fr_listen_t		listen[MAX_NETWORKS];
+	fr_listen_test_t	*app_io_inst[MAX_NETWORKS];
+	int			debug_pipe[2];
+	FILE			*debug_fp;
+	char			debug_buf[65536];
+	size_t			debug_len = 0;
+	ssize_t			data_size;
+	char			expected[64];
+	fr_test_stats_t		stats;
+
+	fr_time_start();
+
+	fr_log_init(&default_log, false);
+
+	while ((c = getopt(argc, argv, "b:g:m:n:pw:x")) != EOF) switch (c) {
+		case 'b':
+			max_batch = atoi(optarg);
+			if ((max_batch <= 1) || (max_batch > 64)) usage();
+			break;
+
+		case 'g':
+			num_good = atoi(optarg);
+			if ((num_good < 0) || (num_good > 128)) usage();
+			break;
+
+		case 'm':
+			num_bad = atoi(optarg);
+			if ((num_bad < 0) || (num_bad > 128)) usage();
+			break;
+
+		case 'n':
+			num_networks = atoi(optarg);
+			if ((num_networks <= 0) || (num_networks > MAX_NETWORKS)) usage();
+			break;
+
+		case 'p':
+			do_resume = true;
+			break;
+
+		case 'w':
+			max_workers = atoi(optarg);
+			if ((max_workers < 2) || (max_workers > 64)) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			fr_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_fault_setup(NULL, argv[0]);
+
+	if (do_resume) {
+		test_resume(autofree, max_batch);
+		talloc_free(autofree);
+		return 0;
+	}
+
+	if (max_workers) {
+		test_pool(autofree, max_workers, max_batch, num_good, num_bad);
+		talloc_free(autofree);
+		return 0;
+	}
+
+	/*
+	 *	With no network threads, the scheduler runs everything
+	 *	in our event loop.
+	 */
+	if (!num_networks) {
+		el = fr_event_list_alloc(autofree, NULL, NULL);
+		if (!el) {
+			fprintf(stderr, "network_test: Failed creating event list: %s\n", fr_strerror());
+			exit(1);
+		}
+
+		sched = fr_schedule_create(autofree, el, &default_log, 0, 0, 0, NULL, NULL, NULL);
+	} else {
+		sched = fr_schedule_create(autofree, NULL, &default_log, num_networks, 1, 1, NULL, NULL, NULL);
+	}
+	if (!sched) {
+		fprintf(stderr, "network_test: Failed to create scheduler: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	num_sockets = fr_schedule_num_networks(sched);
+	rad_assert(num_sockets == (num_networks ? num_networks : 1));
+
+	/*
+	 *	Open one socket per network thread, and queue all of
+	 *	the packets before adding it to the scheduler, so that
+	 *	they are read in one batch.
+	 */
+	for (i = 0; i < num_sockets; i++) {
+		app_io_inst[i] = test_listen_init(autofree, &listen[i], max_batch);
+		sockfd[i] = test_client_socket(app_io_inst[i]);
+
+		send_packets(sockfd[i], num_good, num_bad);
+		memset(replied[i], 0, sizeof(replied[i]));
+
+		if (!fr_schedule_socket_add(sched, &listen[i])) {
+			fprintf(stderr, "network_test: Failed adding socket: %s\n", fr_strerror());
+			exit(1);
+		}
+	}
+
+	start = fr_time();
+	while (num_replies < (num_good * num_sockets)) {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 5)) {
+			fprintf(stderr, "network_test: Timed out with %d replies\n", num_replies);
+			exit(1);
+		}
+
+		if (el) {
+			if (fr_event_corral(el, false) < 0) {
+				fprintf(stderr, "network_test: Failed corralling events: %s\n", fr_strerror());
+				exit(1);
+			}
+			fr_event_service(el);
+		} else {
+			usleep(1000);
+		}
+
+		for (i = 0; i < num_sockets; i++) num_replies += recv_replies(sockfd[i], replied[i]);
+	}
+
+	/*
+	 *	Give any stray replies a chance to arrive.
+	 */
+	for (i = 0; el && (i < 10); i++) {
+		(void) fr_event_corral(el, false);
+		fr_event_service(el);
+	}
+	usleep(10000);
+	for (i = 0; i < num_sockets; i++) num_replies += recv_replies(sockfd[i], replied[i]);
+
+	rad_assert(num_replies == (num_good * num_sockets));
+	for (i = 0; i < num_sockets; i++) {
+		for (j = 0; j < num_good; j++) rad_assert(replied[i][j]);
+	}
+
+	/*
+	 *	The network counts the reads and packets for each
+	 *	socket, and asks the transport for its own statistics.
+	 *	Ask every network thread for them, and check that they
+	 *	match.
+	 */
+	if (pipe(debug_pipe) < 0) {
+		fprintf(stderr, "network_test: Failed creating pipe: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+	(void) fr_nonblock(debug_pipe[0]);
+	debug_fp = fdopen(debug_pipe[1], "w");
+	rad_assert(debug_fp != NULL);
+
+	rad_assert(fr_schedule_debug(sched, debug_fp) == num_sockets);
+
+	/*
+	 *	Each socket's statistics end with the transport's
+	 *	statistics, so wait until we have all of them.
+	 */
+	snprintf(expected, sizeof(expected), "\t\tbad_signatures = %d\n", num_bad);
+	start = fr_time();
+	do {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 5)) {
+			fprintf(stderr, "network_test: Timed out waiting for statistics\n");
+			exit(1);
+		}
+
+		if (el) {
+			(void) fr_event_corral(el, false);
+			fr_event_service(el);
+		} else {
+			usleep(1000);
+		}
+
+		data_size = read(debug_pipe[0], debug_buf + debug_len, sizeof(debug_buf) - debug_len - 1);
+		if (data_size > 0) debug_len += data_size;
+		debug_buf[debug_len] = '\0';
+	} while (count_str(debug_buf, expected) < num_sockets);
+
+	MPRINT1("%s", debug_buf);
+
+	rad_assert(count_str(debug_buf, "num_sockets = 1\n") == num_sockets);
+
+	snprintf(expected, sizeof(expected), "num_packets = %d\n", num_good + num_bad);
+	rad_assert(count_str(debug_buf, expected) == num_sockets);
+	rad_assert(count_str(debug_buf, "average batch size") == num_sockets);
+
+	snprintf(expected, sizeof(expected), "num_requests = %d\n", num_good);
+	rad_assert(count_str(debug_buf, expected) == num_sockets);
+
+	snprintf(expected, sizeof(expected), "\t\tverified = %d\n", num_good + num_bad);
+	rad_assert(count_str(debug_buf, expected) == num_sockets);
+
+	/*
+	 *	Each network predicts how long each class of request
+	 *	takes.  There's one class per socket, and every good
+	 *	packet was replied to, so all of them were counted.
+	 */
+	atomic_init(&stats.num_done, 0);
+	atomic_init(&stats.num_classes, 0);
+	atomic_init(&stats.num_bad, 0);
+	atomic_init(&stats.count, 0);
+
+	rad_assert(fr_schedule_stats(sched, test_stats, &stats) == num_sockets);
+
+	start = fr_time();
+	while (atomic_load(&stats.num_done) < num_sockets) {
+		if ((fr_time() - start) > ((fr_time_t) NANOSEC * 5)) {
+			fprintf(stderr, "network_test: Timed out waiting for cost statistics\n");
+			exit(1);
+		}
+
+		if (el) {
+			(void) fr_event_corral(el, false);
+			fr_event_service(el);
+		} else {
+			usleep(1000);
+		}
+	}
+
+	rad_assert(atomic_load(&stats.num_classes) == num_sockets);
+	rad_assert(atomic_load(&stats.num_bad) == 0);
+	rad_assert(atomic_load(&stats.count) == (uint64_t) (num_good * num_sockets));
+
+	for (i = 0; i < num_sockets; i++) close(sockfd[i]);
+
+	/*
+	 *	@todo - fr_schedule_destroy() in single-threaded mode
+	 *	frees the worker before the network signals it to
+	 *	close the channel.
+	 */
+	if (!el) {
+		fr_schedule_destroy(sched);
+	} else {
+		talloc_free(sched);
+	}
+
+	/*
+	 *	The network threads have exited, so we can look at
+	 *	what they did.
+	 */
+	for (i = 0; i < num_sockets; i++) {
+		MPRINT1("Socket %d read %d packets, largest batch %d, %d bad signatures\n",
+			i, num_good + num_bad, app_io_inst[i]->max_read, app_io_inst[i]->bad_signature);
+
+		rad_assert(app_io_inst[i]->num_verified == (num_good + num_bad));
+		rad_assert(app_io_inst[i]->bad_signature == num_bad);
+
+		/*
+		 *	The packets were all queued before the first
+		 *	read, so they must have been read more than one
+		 *	at a time.
+		 */
+#ifdef HAVE_RECVMMSG
+		rad_assert(app_io_inst[i]->max_read > 1);
+#endif
+	}
+
+	fclose(debug_fp);
+	close(debug_pipe[0]);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET := network_test
+
+SOURCES		:= network_test.c
+
+TGT_PREREQS	:= libfreeradius-io.a libfreeradius-util.a libfreeradius-radius.a libfreeradius-server.a
+TGT_LDLIBS	:= $(LIBS)
+
@@ -0,0 +1,419 @@
+/*
+ * radius_corpus_test.c	Replay packet corpora through the RADIUS decoder and encoder
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+/*
+ *	The corpora are the unit_test_attribute input files in
+ *	src/tests/unit.  Every "encode <pairs>" line, "decode <hex>" line,
+ *	and "data <hex>" line which follows a "raw" line, is one packet's
+ *	worth of attributes.
+ *
+ *	For each file, every packet is decoded (and the pairs freed)
+ *	"loops" times, and then the decoded pairs are encoded "loops" times.
+ *	Allocations are the talloc blocks and bytes which the call leaves
+ *	behind, i.e. the decoded pairs for decode, and leaks for encode.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/radpaths.h>
+#include <freeradius-devel/conf.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/radius/radius.h>
+
+#include <string.h>
+#include <ctype.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_LOOPS	(1000)
+#define MAX_PACKETS	(1024)
+#define MAX_LINE	(8192)
+
+static int		debug_lvl = 0;
+
+typedef struct corpus_packet {
+	uint8_t			*data;		//!< Encoded attributes.
+	size_t			data_len;	//!< Length of the encoded attributes.
+	VALUE_PAIR		*vps;		//!< Decoded attributes, which we encode.
+} corpus_packet_t;
+
+typedef struct corpus_stats {
+	int			packets;	//!< Number of packets used.
+	double			ns;		//!< Per packet.
+	double			allocs;		//!< Per packet.
+	double			bytes;		//!< Per packet.
+} corpus_stats_t;
+
+static uint8_t		vector[AUTH_VECTOR_LEN];	/* all zeros, as with unit_test_attribute */
+
+static fr_radius_ctx_t	radius_ctx = { .vector = vector };
+
+/** Convert "01 02 0a" to binary
+ *
+ */
+static ssize_t corpus_hex(uint8_t *out, size_t outlen, char const *hex)
+{
+	char const	*p = hex;
+	uint8_t		*q = out;
+
+	while (*p) {
+		if (isspace((int) *p)) {
+			p++;
+			continue;
+		}
+
+		if ((q >= (out + outlen)) || (fr_hex2bin(q, 1, p, 2) != 1)) return -1;
+		q++;
+		p += 2;
+	}
+
+	return q - out;
+}
+
+static int encode(uint8_t *out, size_t outlen, VALUE_PAIR *head)
+{
+	uint8_t		*p = out;
+	ssize_t		slen;
+	vp_cursor_t	cursor;
+
+	fr_pair_cursor_init(&cursor, &head);
+	while (fr_pair_cursor_current(&cursor)) {
+		slen = fr_radius_encode_pair(p, out + outlen - p, &cursor, &radius_ctx);
+		if (slen < 0) return -1;
+		if (slen == 0) break;
+
+		p += slen;
+	}
+
+	return p - out;
+}
+
+/** Read every packet from a unit_test_attribute file
+ *
+ */
+static int corpus_load(TALLOC_CTX *ctx, corpus_packet_t *packet, int max, char const *filename)
+{
+	FILE		*fp;
+	char		line[MAX_LINE];
+	uint8_t		data[4096];
+	ssize_t		len;
+	int		num = 0;
+	bool		raw = false;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "Failed opening %s: %s\n", filename, fr_syserror(errno));
+		exit(1);
+	}
+
+	while ((num < max) && (fgets(line, sizeof(line), fp) != NULL)) {
+		char *p;
+
+		p = strchr(line, '\n');
+		if (p) *p = '\0';
+
+		if (!line[0] || (line[0] == '#')) continue;
+
+		if (debug_lvl > 1) printf("%s\n", line);
+
+		/*
+		 *	The pairs are text, so we have to encode them.
+		 */
+		if ((strncmp(line, "encode ", 7) == 0) && (strcmp(line + 7, "-") != 0)) {
+			VALUE_PAIR *head = NULL;
+
+			raw = false;
+
+			if (fr_pair_list_afrom_str(NULL, line + 7, &head) != T_EOL) {
+				fr_pair_list_free(&head);
+				continue;
+			}
+
+			len = encode(data, sizeof(data), head);
+			fr_pair_list_free(&head);
+
+		} else if ((strncmp(line, "decode ", 7) == 0) && (strcmp(line + 7, "-") != 0)) {
+			raw = false;
+			len = corpus_hex(data, sizeof(data), line + 7);
+
+		} else if (raw && (strncmp(line, "data ", 5) == 0)) {
+			raw = false;
+			len = corpus_hex(data, sizeof(data), line + 5);
+
+		} else {
+			raw = (strncmp(line, "raw ", 4) == 0);
+			continue;
+		}
+
+		if (len <= 0) continue;	/* error messages, etc. */
+
+		packet[num].data = talloc_memdup(ctx, data, len);
+		packet[num].data_len = len;
+		packet[num].vps = NULL;
+		num++;
+	}
+
+	fclose(fp);
+
+	return num;
+}
+
+static int decode(TALLOC_CTX *ctx, VALUE_PAIR **head, fr_dict_t *dict, corpus_packet_t const *packet)
+{
+	uint8_t const	*p = packet->data;
+	size_t		len = packet->data_len;
+	ssize_t		slen;
+	vp_cursor_t	cursor;
+
+	fr_pair_cursor_init(&cursor, head);
+	while (len > 0) {
+		slen = fr_radius_decode_pair(ctx, &cursor, fr_dict_root(dict), p, len, &radius_ctx);
+		if (slen <= 0) return -1;
+
+		p += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+static void corpus_decode(corpus_stats_t *stats, fr_dict_t *dict, corpus_packet_t *packet, int num, int loops)
+{
+	int		i, j;
+	fr_time_t	start, end;
+	TALLOC_CTX	*ctx;
+	VALUE_PAIR	*head;
+	uint64_t	allocs = 0, bytes = 0;
+
+	memset(stats, 0, sizeof(*stats));
+
+	ctx = talloc_init("decode");
+
+	/*
+	 *	Find out which packets we can decode, and how much
+	 *	memory the pairs take.
+	 */
+	for (i = 0; i < num; i++) {
+		head = NULL;
+		if (decode(ctx, &head, dict, &packet[i]) < 0) {
+			if (debug_lvl) printf("skipping packet %d: %s\n", i, fr_strerror());
+			fr_pair_list_free(&head);
+			talloc_free_children(ctx);
+			continue;
+		}
+
+		allocs += talloc_total_blocks(ctx) - 1;
+		bytes += talloc_total_size(ctx);
+
+		fr_pair_list_free(&head);
+		talloc_free_children(ctx);
+
+		/*
+		 *	Keep a copy for encoding.
+		 */
+		if (decode(packet, &packet[i].vps, dict, &packet[i]) < 0) {
+			fr_pair_list_free(&packet[i].vps);
+			continue;
+		}
+		stats->packets++;
+	}
+
+	if (!stats->packets) goto done;
+
+	start = fr_time();
+	for (j = 0; j < loops; j++) {
+		for (i = 0; i < num; i++) {
+			if (!packet[i].vps) continue;
+
+			head = NULL;
+			(void) decode(ctx, &head, dict, &packet[i]);
+			fr_pair_list_free(&head);
+		}
+	}
+	end = fr_time();
+
+	stats->ns = ((double) (end - start)) / ((double) loops * stats->packets);
+	stats->allocs = ((double) allocs) / stats->packets;
+	stats->bytes = ((double) bytes) / stats->packets;
+
+done:
+	talloc_free(ctx);
+}
+
+static void corpus_encode(corpus_stats_t *stats, corpus_packet_t *packet, int num, int loops)
+{
+	int		i, j;
+	fr_time_t	start, end;
+	uint8_t		data[4096];
+	size_t		blocks, size;
+	int64_t		allocs = 0, bytes = 0;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < num; i++) {
+		if (!packet[i].vps) continue;
+
+		blocks = talloc_total_blocks(NULL);
+		size = talloc_total_size(NULL);
+
+		if (encode(data, sizeof(data), packet[i].vps) < 0) {
+			if (debug_lvl) printf("skipping packet %d: %s\n", i, fr_strerror());
+			fr_pair_list_free(&packet[i].vps);
+			continue;
+		}
+
+		allocs += talloc_total_blocks(NULL) - blocks;
+		bytes += talloc_total_size(NULL) - size;
+		stats->packets++;
+	}
+
+	if (!stats->packets) return;
+
+	start = fr_time();
+	for (j = 0; j < loops; j++) {
+		for (i = 0; i < num; i++) {
+			if (!packet[i].vps) continue;
+
+			(void) encode(data, sizeof(data), packet[i].vps);
+		}
+	}
+	end = fr_time();
+
+	stats->ns = ((double) (end - start)) / ((double) loops * stats->packets);
+	stats->allocs = ((double) allocs) / stats->packets;
+	stats->bytes = ((double) bytes) / stats->packets;
+}
+
+static void corpus_print(char const *name, char const *op, corpus_stats_t const *stats, int loops, bool csv)
+{
+	if (csv) {
+		printf("%s,%s,%d,%d,%.1f,%.2f,%.1f\n", name, op, stats->packets, loops,
+		       stats->ns, stats->allocs, stats->bytes);
+		return;
+	}
+
+	printf("%-16s %-6s %8d %12.1f %14.2f %14.1f\n", name, op, stats->packets,
+	       stats->ns, stats->allocs, stats->bytes);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_corpus_test [OPTS] file ...\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -m                     Machine readable (CSV) output.\n");
+	fprintf(stderr, "  -n <num>               Number of times to replay each corpus.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c, i, num;
+	bool		csv = false;
+	int		loops = MAX_LOOPS;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	corpus_packet_t	*packet;
+	corpus_stats_t	stats;
+
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "D:hmn:x")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'm':
+			csv = true;
+			break;
+
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) usage();
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("radius_corpus_test");
+		exit(1);
+	}
+
+	/*
+	 *	The encoder needs a talloc'd secret.
+	 */
+	radius_ctx.secret = talloc_typed_strdup(autofree, "testing123");
+
+	if (fr_time_start() < 0) {
+		fprintf(stderr, "Failed to start time\n");
+		exit(1);
+	}
+
+	/*
+	 *	So that we can see what encode leaves behind.
+	 */
+	talloc_enable_null_tracking();
+
+	if (csv) {
+		printf("corpus,op,packets,loops,ns_per_packet,allocs_per_packet,bytes_per_packet\n");
+	} else {
+		printf("%-16s %-6s %8s %12s %14s %14s\n", "corpus", "op", "packets",
+		       "ns/packet", "allocs/packet", "bytes/packet");
+	}
+
+	for (i = 0; i < argc; i++) {
+		char const *name;
+
+		name = strrchr(argv[i], '/');
+		name = name ? name + 1 : argv[i];
+
+		packet = talloc_zero_array(autofree, corpus_packet_t, MAX_PACKETS);
+		num = corpus_load(packet, packet, MAX_PACKETS, argv[i]);
+
+		corpus_decode(&stats, dict, packet, num, loops);
+		corpus_print(name, "decode", &stats, loops, csv);
+
+		corpus_encode(&stats, packet, num, loops);
+		corpus_print(name, "encode", &stats, loops, csv);
+
+		talloc_free(packet);
+	}
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,399 @@
+/*
+ * radius_decode_test.c	Tests and benchmarks for RADIUS attribute decoding
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/radpaths.h>
+#include <freeradius-devel/conf.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/radius/radius.h>
+
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_LOOPS	(100 * 1000)
+
+static int		debug_lvl = 0;
+
+/*
+ *	A typical Access-Request, with a few common VSAs.
+ */
+static uint8_t const attrs[] = {
+	0x01, 0x11, 'b', 'o', 'b', '@', 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',	/* User-Name */
+	0x04, 0x06, 0xc0, 0x00, 0x02, 0x01,							/* NAS-IP-Address */
+	0x05, 0x06, 0x00, 0x00, 0x00, 0x11,							/* NAS-Port */
+	0x06, 0x06, 0x00, 0x00, 0x00, 0x02,							/* Service-Type */
+	0x08, 0x06, 0xc0, 0x00, 0x02, 0x80,							/* Framed-IP-Address */
+	0x1e, 0x13, '0', '0', '-', '1', '1', '-', '2', '2', '-', '3', '3', '-', '4', '4', '-',
+		    '5', '5',									/* Called-Station-Id */
+	0x1f, 0x13, '6', '6', '-', '7', '7', '-', '8', '8', '-', '9', '9', '-', 'a', 'a', '-',
+		    'b', 'b',									/* Calling-Station-Id */
+	0x20, 0x07, 'n', 'a', 's', '0', '1',							/* NAS-Identifier */
+	0x2c, 0x12, '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',	/* Acct-Session-Id */
+	0x3d, 0x06, 0x00, 0x00, 0x00, 0x13,							/* NAS-Port-Type */
+	0x1a, 0x19, 0x00, 0x00, 0x00, 0x09,							/* Cisco */
+		0x01, 0x13, 's', 'h', 'e', 'l', 'l', ':', 'p', 'r', 'i', 'v', '-', 'l', 'v', 'l', '=',
+			    '1', '5',								/* Cisco-AVPair */
+	0x1a, 0x0f, 0x00, 0x00, 0x39, 0xe7,							/* Aruba */
+		0x01, 0x09, 'e', 'm', 'p', 'l', 'o', 'y', 'e',					/* Aruba-User-Role */
+	0x1a, 0x0d, 0x00, 0x00, 0x0a, 0x4c,							/* Juniper */
+		0x01, 0x07, 'a', 'd', 'm', 'i', 'n',						/* Juniper-Local-User-Name */
+	0x1a, 0x10, 0x00, 0x00, 0x37, 0x2a,							/* WISPr */
+		0x01, 0x0a, 'i', 's', 'o', 'c', 'c', '=', 'u', 's',				/* WISPr-Location-ID */
+};
+
+/*
+ *	Octets attributes, which can be decoded without copying.
+ */
+static uint8_t const octets_attrs[] = {
+	0x18, 0x0a, 's', 't', 'a', 't', 'e', '-', '0', '1',					/* State */
+	0x19, 0x07, 'c', 'l', 'a', 's', 's',							/* Class */
+};
+
+/** Check the frozen tables against a walk of the bins
+ *
+ */
+static void test_lookup(fr_dict_attr_t const *parent)
+{
+	fr_dict_attr_t const	*child, *found;
+	fr_dict_vendor_t const	*dv;
+	unsigned int		i;
+
+	if (!parent->children) return;
+
+	if (debug_lvl > 1) printf("%s\n", parent->name);
+
+	switch (parent->type) {
+	case FR_TYPE_VSA:
+	case FR_TYPE_EVS:
+		rad_assert(parent->vendor_index != NULL);
+		break;
+
+	default:
+		rad_assert(parent->child_index != NULL);
+		break;
+	}
+
+	/*
+	 *	Everything in the range of the dense table.
+	 */
+	for (i = 0; i <= UINT8_MAX; i++) {
+		for (found = parent->children[i]; found; found = found->next) {
+			if (found->attr == i) break;
+		}
+
+		rad_assert(fr_dict_attr_child_by_num(parent, i) == found);
+	}
+
+	/*
+	 *	Every child, including ones which aren't in the dense
+	 *	table, and every vendor.
+	 */
+	for (i = 0; i <= UINT8_MAX; i++) {
+		for (child = parent->children[i]; child; child = child->next) {
+			for (found = parent->children[i]; found; found = found->next) {
+				if (found->attr == child->attr) break;
+			}
+
+			rad_assert(fr_dict_attr_child_by_num(parent, child->attr) == found);
+
+			if (parent->vendor_index) {
+				dv = NULL;
+				rad_assert(fr_dict_vendor_child_by_num(parent, child->attr, &dv) == found);
+				rad_assert(dv == fr_dict_vendor_by_num(fr_dict_by_da(parent), child->attr));
+			}
+
+			if (child == found) test_lookup(child);
+		}
+	}
+
+	/*
+	 *	And some vendors which don't exist.
+	 */
+	if (parent->vendor_index) {
+		for (i = 0; i < 100000; i += 7) {
+			for (found = parent->children[i & 0xff]; found; found = found->next) {
+				if (found->attr == i) break;
+			}
+
+			rad_assert(fr_dict_vendor_child_by_num(parent, i, NULL) == found);
+		}
+	}
+}
+
+static int decode(TALLOC_CTX *ctx, fr_dict_t *dict, VALUE_PAIR **head)
+{
+	uint8_t const	*p = attrs;
+	size_t		len = sizeof(attrs);
+	ssize_t		slen;
+	int		num = 0;
+	vp_cursor_t	cursor;
+	uint8_t		vector[AUTH_VECTOR_LEN] = { 0 };
+	fr_radius_ctx_t	decoder_ctx = { .vector = vector, .secret = "testing123" };
+
+	fr_pair_cursor_init(&cursor, head);
+	while (len > 0) {
+		slen = fr_radius_decode_pair(ctx, &cursor, fr_dict_root(dict), p, len, &decoder_ctx);
+		if (slen <= 0) return -1;
+
+		p += slen;
+		len -= slen;
+	}
+
+	for (fr_pair_cursor_first(&cursor); fr_pair_cursor_current(&cursor); fr_pair_cursor_next(&cursor)) num++;
+
+	return num;
+}
+
+static void test_decode(TALLOC_CTX *ctx, fr_dict_t *dict)
+{
+	VALUE_PAIR	*head = NULL, *vp;
+	int		num;
+
+	num = decode(ctx, dict, &head);
+	rad_assert(num == 14);
+
+	for (vp = head; vp; vp = vp->next) {
+		if (debug_lvl) printf("%s\n", vp->da->name);
+
+		rad_assert(!vp->da->flags.is_unknown);
+	}
+
+	fr_pair_list_free(&head);
+}
+
+/** Check that octets values point into the packet, until the pairs are stolen
+ *
+ */
+static void test_borrow(TALLOC_CTX *ctx, fr_dict_t *dict)
+{
+	uint8_t		*packet;
+	uint8_t const	*p;
+	size_t		len;
+	ssize_t		slen;
+	int		num = 0;
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*head = NULL, *vp;
+	TALLOC_CTX	*other;
+	uint8_t		vector[AUTH_VECTOR_LEN] = { 0 };
+	fr_radius_ctx_t	decoder_ctx = { .vector = vector, .secret = "testing123", .borrow = true };
+
+	packet = talloc_memdup(ctx, octets_attrs, sizeof(octets_attrs));
+	rad_assert(packet != NULL);
+
+	decoder_ctx.start = packet;
+	decoder_ctx.end = packet + sizeof(octets_attrs);
+
+	fr_pair_cursor_init(&cursor, &head);
+	for (p = packet, len = sizeof(octets_attrs); len > 0; p += slen, len -= slen) {
+		slen = fr_radius_decode_pair(ctx, &cursor, fr_dict_root(dict), p, len, &decoder_ctx);
+		rad_assert(slen > 0);
+	}
+
+	for (vp = head; vp; vp = vp->next) {
+		rad_assert(vp->vp_type == FR_TYPE_OCTETS);
+		rad_assert(vp->data.borrowed);
+		rad_assert(vp->vp_octets > decoder_ctx.start);
+		rad_assert((vp->vp_octets + vp->vp_length) <= decoder_ctx.end);
+		num++;
+	}
+	rad_assert(num == 2);
+
+	/*
+	 *	The pairs are leaving the packet, so they need their
+	 *	own copies of the data.
+	 */
+	other = talloc_new(ctx);
+	for (vp = head; vp; vp = vp->next) fr_pair_steal(other, vp);
+
+	memset(packet, 0, sizeof(octets_attrs));
+	talloc_free(packet);
+
+	vp = head;
+	rad_assert(!vp->data.borrowed);
+	rad_assert((vp->vp_length == 8) && (memcmp(vp->vp_octets, "state-01", 8) == 0));
+
+	vp = vp->next;
+	rad_assert(!vp->data.borrowed);
+	rad_assert((vp->vp_length == 5) && (memcmp(vp->vp_octets, "class", 5) == 0));
+
+	talloc_free(other);
+}
+
+static void bench(TALLOC_CTX *ctx, fr_dict_t *dict, int loops)
+{
+	int		i, num = 0;
+	fr_time_t	start, end;
+	VALUE_PAIR	*head = NULL;
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		num += decode(ctx, dict, &head);
+		fr_pair_list_free(&head);
+	}
+	end = fr_time();
+
+	printf("decode %zu octets, %d attributes/packet, %10.0f attributes/s, %8.2f ns/attribute\n",
+	       sizeof(attrs), num / loops, ((double) num * NANOSEC) / (end - start),
+	       ((double) (end - start)) / num);
+}
+
+/*
+ *	Decoding is mostly allocation and copying, so time the
+ *	lookups on their own, too.  The bins are what every lookup
+ *	used before the dictionary was frozen.
+ */
+static void bench_lookup(fr_dict_t *dict, int loops)
+{
+	int			i;
+	size_t			j;
+	fr_time_t		start, end;
+	fr_dict_attr_t const	*vsa, *vendor, *found;
+	fr_dict_vendor_t const	*dv;
+	unsigned int		rfc[] = { 1, 4, 5, 6, 8, 30, 31, 32, 44, 61 };
+	unsigned int		vendors[] = { 9, 14823, 2636, 14122 };
+	double			rate;
+
+	vsa = fr_dict_attr_child_by_num(fr_dict_root(dict), FR_VENDOR_SPECIFIC);
+	rad_assert(vsa != NULL);
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < (sizeof(rfc) / sizeof(rfc[0])); j++) {
+			found = fr_dict_attr_child_by_num(fr_dict_root(dict), rfc[j]);
+			rad_assert(found != NULL);
+		}
+
+		for (j = 0; j < (sizeof(vendors) / sizeof(vendors[0])); j++) {
+			vendor = fr_dict_vendor_child_by_num(vsa, vendors[j], &dv);
+			found = fr_dict_attr_child_by_num(vendor, 1);
+			rad_assert(found != NULL);
+		}
+	}
+	end = fr_time();
+	rate = ((double) loops * 14 * NANOSEC) / (end - start);
+
+	printf("lookup frozen  %10.0f attributes/s, %8.2f ns/attribute\n", rate, (double) NANOSEC / rate);
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < (sizeof(rfc) / sizeof(rfc[0])); j++) {
+			for (found = fr_dict_root(dict)->children[rfc[j] & 0xff]; found; found = found->next) {
+				if (found->attr == rfc[j]) break;
+			}
+			rad_assert(found != NULL);
+		}
+
+		for (j = 0; j < (sizeof(vendors) / sizeof(vendors[0])); j++) {
+			for (vendor = vsa->children[vendors[j] & 0xff]; vendor; vendor = vendor->next) {
+				if (vendor->attr == vendors[j]) break;
+			}
+			dv = fr_dict_vendor_by_num(dict, vendors[j]);
+
+			for (found = vendor->children[1]; found; found = found->next) {
+				if (found->attr == 1) break;
+			}
+			rad_assert(found != NULL);
+		}
+	}
+	end = fr_time();
+	rate = ((double) loops * 14 * NANOSEC) / (end - start);
+
+	printf("lookup bins    %10.0f attributes/s, %8.2f ns/attribute\n", rate, (double) NANOSEC / rate);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_decode_test [OPTS]\n");
+	fprintf(stderr, "  -b                     Run benchmarks.\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <num>               Number of packets for the benchmarks.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	bool		do_bench = false;
+	int		loops = MAX_LOOPS;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "bD:hn:x")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+#if 0
+	argc -= (optind - 1);
+	argv += (optind - 1);
+#endif
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("radius_decode_test");
+		exit(1);
+	}
+
+	test_lookup(fr_dict_root(dict));
+	test_decode(autofree, dict);
+	test_borrow(autofree, dict);
+
+	if (do_bench) {
+		if (fr_time_start() < 0) {
+			fprintf(stderr, "Failed to start time\n");
+			exit(1);
+		}
+
+		bench(autofree, dict, loops);
+		bench_lookup(dict, loops * 10);
+	}
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,396 @@
+/*
+ * radius_sign_test.c	Tests and benchmarks for RADIUS packet signing
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_LOOPS	(1000 * 1000)
+
+#define HDR_LEN		(20)
+#define MA_ATTR		(80)		/* Message-Authenticator */
+#define MA_LEN		(18)
+
+static int		debug_lvl = 0;
+
+/*
+ *	RFC 2104 test vectors.
+ */
+static void test_hmac(void)
+{
+	fr_md5_secret_t	state;
+	uint8_t		digest[MD5_DIGEST_LENGTH];
+	uint8_t		key[16], text[50];
+
+	static uint8_t const	expected[][MD5_DIGEST_LENGTH] = {
+		{ 0x92, 0x94, 0x72, 0x7a, 0x36, 0x38, 0xbb, 0x1c, 0x13, 0xf4, 0x8e, 0xf8, 0x15, 0x8b, 0xfc, 0x9d },
+		{ 0x75, 0x0c, 0x78, 0x3e, 0x6a, 0xb0, 0xb5, 0x03, 0xea, 0xa8, 0x6e, 0x31, 0x0a, 0x5d, 0xb7, 0x38 },
+		{ 0x56, 0xbe, 0x34, 0x52, 0x1d, 0x14, 0x4c, 0x88, 0xdb, 0xb8, 0xc7, 0x33, 0xf0, 0xe8, 0xb3, 0xf6 }
+	};
+
+	memset(key, 0x0b, sizeof(key));
+	fr_hmac_md5(digest, (uint8_t const *) "Hi There", 8, key, sizeof(key));
+	rad_assert(memcmp(digest, expected[0], sizeof(digest)) == 0);
+
+	fr_md5_secret_init(&state, key, sizeof(key));
+	fr_hmac_md5_secret(digest, (uint8_t const *) "Hi There", 8, &state);
+	rad_assert(memcmp(digest, expected[0], sizeof(digest)) == 0);
+
+	fr_md5_secret_init(&state, (uint8_t const *) "Jefe", 4);
+	fr_hmac_md5_secret(digest, (uint8_t const *) "what do ya want for nothing?", 28, &state);
+	rad_assert(memcmp(digest, expected[1], sizeof(digest)) == 0);
+
+	memset(key, 0xaa, sizeof(key));
+	memset(text, 0xdd, sizeof(text));
+	fr_md5_secret_init(&state, key, sizeof(key));
+	fr_hmac_md5_secret(digest, text, sizeof(text), &state);
+	rad_assert(memcmp(digest, expected[2], sizeof(digest)) == 0);
+}
+
+/*
+ *	Build a packet with a Message-Authenticator, and a
+ *	User-Name padded out to "len" octets.
+ */
+static size_t packet_init(uint8_t *packet, uint8_t code, size_t len)
+{
+	size_t i;
+
+	if (len < (HDR_LEN + MA_LEN + 3)) len = HDR_LEN + MA_LEN + 3;
+	if (len > (HDR_LEN + MA_LEN + 255)) len = HDR_LEN + MA_LEN + 255;
+
+	packet[0] = code;
+	packet[1] = 1;
+	packet[2] = len >> 8;
+	packet[3] = len & 0xff;
+	for (i = 0; i < 16; i++) packet[4 + i] = i;
+
+	packet[HDR_LEN] = MA_ATTR;
+	packet[HDR_LEN + 1] = MA_LEN;
+	memset(packet + HDR_LEN + 2, 0, MA_LEN - 2);
+
+	packet[HDR_LEN + MA_LEN] = 1;	/* User-Name */
+	packet[HDR_LEN + MA_LEN + 1] = len - HDR_LEN - MA_LEN;
+	memset(packet + HDR_LEN + MA_LEN + 2, 'a', len - HDR_LEN - MA_LEN - 2);
+
+	return len;
+}
+
+/*
+ *	Signing with the precomputed state has to give exactly the
+ *	same packet as signing with the secret.  Check both a request,
+ *	and a reply, which also has a Response Authenticator.
+ */
+static void test_sign(char const *secret)
+{
+	fr_md5_secret_t	state;
+	uint8_t		original[4096], a[4096], b[4096];
+	size_t		len, secret_len = talloc_array_length(secret) - 1;
+	uint8_t		codes[] = { FR_CODE_ACCESS_REQUEST, FR_CODE_ACCESS_ACCEPT };
+	size_t		i;
+
+	fr_md5_secret_init(&state, (uint8_t const *) secret, secret_len);
+
+	(void) packet_init(original, FR_CODE_ACCESS_REQUEST, 100);
+
+	for (i = 0; i < (sizeof(codes) / sizeof(codes[0])); i++) {
+		len = packet_init(a, codes[i], 100);
+		memcpy(b, a, len);
+
+		rad_assert(fr_radius_sign(a, original, (uint8_t const *) secret, secret_len, NULL) == 0);
+		rad_assert(fr_radius_sign(b, original, (uint8_t const *) secret, secret_len, &state) == 0);
+		rad_assert(memcmp(a, b, len) == 0);
+
+		rad_assert(fr_radius_verify(a, original, (uint8_t const *) secret, secret_len, &state) == 0);
+		rad_assert(fr_radius_verify(b, original, (uint8_t const *) secret, secret_len, NULL) == 0);
+
+		/*
+		 *	And a corrupted Message-Authenticator must fail.
+		 */
+		a[HDR_LEN + 2] ^= 0xff;
+		rad_assert(fr_radius_verify(a, original, (uint8_t const *) secret, secret_len, &state) < 0);
+	}
+}
+
+/*
+ *	Verify a batch of good and bad packets, with and without
+ *	precomputed state.  Each entry has to get the same result as
+ *	verifying it on its own.
+ */
+#define BATCH_SIZE	(2 * FR_MD5_MULTI_LANES + 3)
+
+static void test_verify_multi(char const *secret)
+{
+	fr_md5_secret_t			state;
+	static uint8_t			original[BATCH_SIZE][4096], packet[BATCH_SIZE][4096];
+	fr_radius_verify_entry_t	entry[BATCH_SIZE];
+	size_t				secret_len = talloc_array_length(secret) - 1;
+	size_t				i, len;
+	int				failed = 0;
+
+	fr_md5_secret_init(&state, (uint8_t const *) secret, secret_len);
+
+	for (i = 0; i < BATCH_SIZE; i++) {
+		(void) packet_init(original[i], FR_CODE_ACCESS_REQUEST, 64 + i);
+		len = packet_init(packet[i], (i & 1) ? FR_CODE_ACCESS_ACCEPT : FR_CODE_ACCESS_REQUEST, 64 + (i * 7));
+		rad_assert(fr_radius_sign(packet[i], original[i], (uint8_t const *) secret, secret_len, NULL) == 0);
+
+		/*
+		 *	Corrupt the Message-Authenticator of some, and the
+		 *	contents (which breaks both checks) of others.
+		 */
+		if ((i % 5) == 2) {
+			packet[i][HDR_LEN + 2] ^= 0x01;
+			failed++;
+		} else if ((i % 7) == 3) {
+			packet[i][len - 1] ^= 0x01;
+			failed++;
+		}
+
+		entry[i].packet = packet[i];
+		entry[i].original = original[i];
+		entry[i].secret = (uint8_t const *) secret;
+		entry[i].secret_len = secret_len;
+		entry[i].secret_state = (i % 3) ? &state : NULL;
+	}
+
+	rad_assert(fr_radius_verify_multi(entry, BATCH_SIZE) == failed);
+
+	for (i = 0; i < BATCH_SIZE; i++) {
+		int rcode;
+
+		rcode = fr_radius_verify(packet[i], original[i], (uint8_t const *) secret, secret_len, NULL);
+		if (debug_lvl) printf("entry %zu: multi %d single %d\n", i, entry[i].rcode, rcode);
+
+		rad_assert((entry[i].rcode < 0) == (rcode < 0));
+	}
+}
+
+/*
+ *	Hide a password, and recover it using the other method.
+ */
+static void test_password(char const *secret)
+{
+	fr_md5_secret_t	state;
+	uint8_t		vector[AUTH_VECTOR_LEN];
+	char		a[FR_MAX_STRING_LEN + 1], b[FR_MAX_STRING_LEN + 1];
+	char const	*password = "this is a password which is more than 16 octets";
+	size_t		len, i;
+
+	fr_md5_secret_init(&state, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+	for (i = 0; i < sizeof(vector); i++) vector[i] = 0xf0 - i;
+
+	len = strlen(password);
+	strlcpy(a, password, sizeof(a));
+	rad_assert(fr_radius_encode_password(a, &len, secret, vector) == 0);
+	memcpy(b, a, len);
+
+	rad_assert(fr_radius_decode_password(a, len, secret, &state, vector) == (ssize_t) strlen(password));
+	rad_assert(strcmp(a, password) == 0);
+
+	rad_assert(fr_radius_decode_password(b, len, secret, NULL, vector) == (ssize_t) strlen(password));
+	rad_assert(strcmp(b, password) == 0);
+}
+
+static void bench(char const *name, char const *secret, bool precomputed, bool verify, size_t packet_len, int loops)
+{
+	int		i;
+	fr_time_t	start, end;
+	fr_md5_secret_t	state;
+	uint8_t		original[4096], packet[4096];
+	size_t		secret_len = talloc_array_length(secret) - 1;
+	double		rate;
+
+	fr_md5_secret_init(&state, (uint8_t const *) secret, secret_len);
+
+	/*
+	 *	Replies have both a Message-Authenticator and a
+	 *	Response Authenticator, so they're the worst case.
+	 */
+	(void) packet_init(original, FR_CODE_ACCESS_REQUEST, packet_len);
+	packet_len = packet_init(packet, FR_CODE_ACCESS_ACCEPT, packet_len);
+	(void) fr_radius_sign(packet, original, (uint8_t const *) secret, secret_len, NULL);
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		if (verify) {
+			(void) fr_radius_verify(packet, original, (uint8_t const *) secret, secret_len,
+						precomputed ? &state : NULL);
+		} else {
+			(void) fr_radius_sign(packet, original, (uint8_t const *) secret, secret_len,
+					      precomputed ? &state : NULL);
+		}
+	}
+	end = fr_time();
+
+	rate = ((double) loops * NANOSEC) / (end - start);
+
+	printf("%-8s %-12s %4zu octet packet, %4zu octet secret, %10.0f packets/s, %8.2f ns/packet\n",
+	       name, precomputed ? "precomputed" : "secret", packet_len, secret_len,
+	       rate, ((double) (end - start)) / loops);
+}
+
+/*
+ *	Verify the same packets one at a time, and in batches.
+ */
+static void bench_multi(char const *secret, size_t packet_len, int loops)
+{
+	int				i;
+	size_t				j;
+	fr_time_t			start, end;
+	fr_md5_secret_t			state;
+	static uint8_t			original[FR_MD5_MULTI_LANES][4096], packet[FR_MD5_MULTI_LANES][4096];
+	fr_radius_verify_entry_t	entry[FR_MD5_MULTI_LANES];
+	size_t				secret_len = talloc_array_length(secret) - 1;
+	size_t				len = 0;
+	double				single, multi;
+
+	fr_md5_secret_init(&state, (uint8_t const *) secret, secret_len);
+
+	for (j = 0; j < FR_MD5_MULTI_LANES; j++) {
+		(void) packet_init(original[j], FR_CODE_ACCESS_REQUEST, packet_len);
+		len = packet_init(packet[j], FR_CODE_ACCESS_ACCEPT, packet_len);
+		packet[j][4] = j;	/* make them different */
+		(void) fr_radius_sign(packet[j], original[j], (uint8_t const *) secret, secret_len, &state);
+
+		entry[j].packet = packet[j];
+		entry[j].original = original[j];
+		entry[j].secret = (uint8_t const *) secret;
+		entry[j].secret_len = secret_len;
+		entry[j].secret_state = &state;
+	}
+
+	start = fr_time();
+	for (i = 0; i < loops; i += FR_MD5_MULTI_LANES) {
+		for (j = 0; j < FR_MD5_MULTI_LANES; j++) {
+			(void) fr_radius_verify(packet[j], original[j], (uint8_t const *) secret, secret_len, &state);
+		}
+	}
+	end = fr_time();
+	single = ((double) loops * NANOSEC) / (end - start);
+
+	start = fr_time();
+	for (i = 0; i < loops; i += FR_MD5_MULTI_LANES) {
+		(void) fr_radius_verify_multi(entry, FR_MD5_MULTI_LANES);
+	}
+	end = fr_time();
+	multi = ((double) loops * NANOSEC) / (end - start);
+
+	printf("verify   %-12s %4zu octet packet, %2d per batch, single %10.0f packets/s, batch %10.0f packets/s (x%.2f)\n",
+	       "precomputed", len, FR_MD5_MULTI_LANES,
+	       single, multi, multi / single);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: radius_sign_test [OPTS]\n");
+	fprintf(stderr, "  -b                     Run benchmarks.\n");
+	fprintf(stderr, "  -n <num>               Number of packets for the benchmarks.\n");
+	fprintf(stderr, "  -s <secret>            Shared secret to use.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	bool		do_bench = false;
+	int		loops = MAX_LOOPS;
+	size_t		i;
+	char const	*secret;
+	size_t		packet_lens[] = { 64, 200, 290 };
+
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	secret = talloc_typed_strdup(autofree, "testing123");
+
+	while ((c = getopt(argc, argv, "bhn:s:x")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0) usage();
+			break;
+
+		case 's':
+			secret = talloc_typed_strdup(autofree, optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+#if 0
+	argc -= (optind - 1);
+	argv += (optind - 1);
+#endif
+
+	test_hmac();
+	test_sign(secret);
+	test_password(secret);
+	test_verify_multi(secret);
+
+	/*
+	 *	Secrets longer than an MD5 block are hashed down to a
+	 *	key, so check that path, too.
+	 */
+	test_sign(talloc_typed_strdup(autofree, "a shared secret which is much longer than "
+				      "sixty four octets, so it gets hashed first"));
+
+	if (!do_bench) goto done;
+
+	if (fr_time_start() < 0) {
+		fprintf(stderr, "Failed to start time\n");
+		exit(1);
+	}
+
+	for (i = 0; i < (sizeof(packet_lens) / sizeof(packet_lens[0])); i++) {
+		bench("sign", secret, false, false, packet_lens[i], loops);
+		bench("sign", secret, true, false, packet_lens[i], loops);
+		bench("verify", secret, false, true, packet_lens[i], loops);
+		bench("verify", secret, true, true, packet_lens[i], loops);
+	}
+
+	for (i = 0; i < (sizeof(packet_lens) / sizeof(packet_lens[0])); i++) {
+		bench_multi(secret, packet_lens[i], loops);
+	}
+
+done:
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * request_test.c	Tests for recycling REQUESTs
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define POOL_SIZE	(4096)
+#define MAX_LOOPS	(1000)
+
+static int		debug_lvl = 0;
+
+#define MPRINT1 if (debug_lvl) printf
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: request_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Number of times to re-use a request.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/*
+ *	Allocate a request the same way the worker does.
+ */
+static REQUEST *test_alloc(TALLOC_CTX *ctx)
+{
+	REQUEST *request;
+
+	request = request_alloc_pooled(ctx, POOL_SIZE);
+	rad_assert(request != NULL);
+
+	request->async = talloc_zero(NULL, fr_async_t);
+	rad_assert(request->async != NULL);
+	(void) talloc_steal(request, request->async);
+
+	return request;
+}
+
+/*
+ *	Use the request, the same way that processing a packet does.
+ */
+static void test_use(REQUEST *request, int number)
+{
+	request->number = number;
+	request->component = "test";
+	request->log.lvl = L_DBG_LVL_MAX;
+
+	request->packet->id = number & 0xff;
+	request->packet->code = FR_CODE_ACCESS_REQUEST;
+	request->packet->data = talloc_zero_array(request->packet, uint8_t, 128);
+	request->packet->data_len = 128;
+	rad_assert(request->packet->data != NULL);
+
+	request->reply->code = FR_CODE_ACCESS_ACCEPT;
+	request->reply->data = talloc_zero_array(request->reply, uint8_t, 64);
+	rad_assert(request->reply->data != NULL);
+
+	request->async->priority = number;
+	request->async->packet_ctx = talloc_zero(request->async, uint32_t);
+	rad_assert(request->async->packet_ctx != NULL);
+
+	rad_assert(talloc_strdup(request, "per-request data") != NULL);
+	rad_assert(talloc_zero(request->state_ctx, uint32_t) != NULL);
+	rad_assert(talloc_zero(request->log.dst, uint32_t) != NULL);
+}
+
+/*
+ *	A new request has its long-lived children, and they're
+ *	parented by the request.
+ */
+static void test_fresh(REQUEST *request)
+{
+	rad_assert(request->number == 0);
+	rad_assert(strcmp(request->component, "<core>") == 0);
+	rad_assert(request->module == NULL);
+	rad_assert(request->heap_id == -1);
+
+	rad_assert(request->packet != NULL);
+	rad_assert(talloc_parent(request->packet) == request);
+	rad_assert(request->packet->id == -1);
+	rad_assert(request->packet->code == 0);
+	rad_assert(request->packet->data == NULL);
+	rad_assert(talloc_total_blocks(request->packet) == 1);
+
+	rad_assert(request->reply != NULL);
+	rad_assert(talloc_parent(request->reply) == request);
+	rad_assert(request->reply->id == -1);
+	rad_assert(request->reply->code == 0);
+	rad_assert(talloc_total_blocks(request->reply) == 1);
+
+	rad_assert(request->log.dst != NULL);
+	rad_assert(talloc_parent(request->log.dst) == request);
+	rad_assert(request->log.dst->func != NULL);
+	rad_assert(talloc_total_blocks(request->log.dst) == 1);
+
+	rad_assert(request->stack != NULL);
+	rad_assert(talloc_parent(request->stack) == request);
+
+	rad_assert(request->state_ctx != NULL);
+	rad_assert(talloc_total_blocks(request->state_ctx) == 1);
+}
+
+static void test_reset(TALLOC_CTX *ctx, int loops)
+{
+	int		i;
+	REQUEST		*request;
+	RADIUS_PACKET	*packet, *reply;
+	log_dst_t	*dst;
+	void		*stack;
+	TALLOC_CTX	*state_ctx;
+	fr_async_t	*async;
+	size_t		blocks, size;
+
+	request = test_alloc(ctx);
+	test_fresh(request);
+
+	packet = request->packet;
+	reply = request->reply;
+	dst = request->log.dst;
+	stack = request->stack;
+	state_ctx = request->state_ctx;
+	async = request->async;
+
+	blocks = talloc_total_blocks(request);
+	size = talloc_total_size(request);
+
+	MPRINT1("Request has %zu blocks, %zu bytes\n", blocks, size);
+
+	for (i = 1; i <= loops; i++) {
+		test_use(request, i);
+		rad_assert(talloc_total_blocks(request) > blocks);
+
+		rad_assert(request_reset(request) == 0);
+
+		/*
+		 *	The same request, with the same children, and
+		 *	nothing else.
+		 */
+		rad_assert(request->packet == packet);
+		rad_assert(request->reply == reply);
+		rad_assert(request->log.dst == dst);
+		rad_assert(request->stack == stack);
+		rad_assert(request->state_ctx == state_ctx);
+		rad_assert(request->async == async);
+		rad_assert(talloc_parent(async) == request);
+		rad_assert(talloc_total_blocks(async) == 1);
+
+		test_fresh(request);
+
+		rad_assert(talloc_total_blocks(request) == blocks);
+		rad_assert(talloc_total_size(request) == size);
+	}
+
+#ifdef HAVE_TALLOC_POOLED_OBJECT
+	{
+		uint8_t *first, *again;
+
+		/*
+		 *	The packet is a pool, and resetting the request
+		 *	empties it.  So the next allocation re-uses the
+		 *	same memory.
+		 */
+		first = talloc_array(request->packet, uint8_t, 128);
+		rad_assert(first != NULL);
+
+		rad_assert(request_reset(request) == 0);
+
+		again = talloc_array(request->packet, uint8_t, 128);
+		rad_assert(again == first);
+	}
+#endif
+
+	talloc_free(request);
+}
+
+/*
+ *	Requests which are still in use elsewhere cannot be reset.
+ *	They're left alone, and the caller frees them.
+ */
+static void test_refuse(TALLOC_CTX *ctx)
+{
+	REQUEST		*request;
+	RADIUS_PACKET	*packet;
+	fr_event_timer_t *ev;
+
+	request = test_alloc(ctx);
+	test_use(request, 1);
+
+	/*
+	 *	Still has a timer.
+	 */
+	ev = talloc_zero_size(ctx, 1);
+	request->ev = ev;
+	rad_assert(request_reset(request) < 0);
+	rad_assert(request->number == 1);
+	request->ev = NULL;
+	talloc_free(ev);
+
+	/*
+	 *	Still in the request hash.
+	 */
+	request->in_request_hash = true;
+	rad_assert(request_reset(request) < 0);
+	rad_assert(request->number == 1);
+	request->in_request_hash = false;
+
+	/*
+	 *	Someone took the packet.
+	 */
+	packet = request->packet;
+	(void) talloc_steal(ctx, packet);
+	rad_assert(request_reset(request) < 0);
+	rad_assert(request->number == 1);
+	rad_assert(request->packet == packet);
+	rad_assert(packet->data != NULL);
+
+	talloc_free(request);
+	talloc_free(packet);
+
+	/*
+	 *	Once the request is no longer in use, it can be reset.
+	 */
+	request = test_alloc(ctx);
+	test_use(request, 2);
+	rad_assert(request_reset(request) == 0);
+	test_fresh(request);
+
+	talloc_free(request);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int loops = MAX_LOOPS;
+	TALLOC_CTX *autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "hn:x")) != EOF) switch (c) {
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+#if 0
+	argc -= (optind - 1);
+	argv += (optind - 1);
+#endif
+
+	test_reset(autofree, loops);
+	test_refuse(autofree);
+
+	rad_assert(talloc_total_blocks(autofree) == 1);
+
+	talloc_free(autofree);
+
+	return 0;
+}
@@ -26,6 +26,7 @@ RCSID("$Id$")
 #include <string.h>
 #include <freeradius-devel/hash.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/io/time.h>
 
 #ifdef HAVE_GETOPT_H
 #	include <getopt.h>
@@ -34,6 +35,8 @@ RCSID("$Id$")
 #define ALLOC_SIZE (8)
 #define ARRAY_SIZE (4 * ALLOC_SIZE)
 
+#define BENCH_DEPTH (256)
+
 static size_t		used = 0;
 static size_t 		array[ARRAY_SIZE];
 static uint8_t		*data[ARRAY_SIZE];
@@ -43,31 +46,6 @@ static int		debug_lvl = 0;
 static char const      	*seed_string = "foo";
 static size_t		seed_string_len = 3;
 
-/**********************************************************************/
-typedef struct rad_request REQUEST;
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx);
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request);
-void talloc_const_free(void const *ptr);
-
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
-{
-	return NULL;
-}
-
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
-{
-}
-
-void talloc_const_free(void const *ptr)
-{
-	void *tmp;
-	if (!ptr) return;
-
-	memcpy(&tmp, &ptr, sizeof(tmp));
-	talloc_free(tmp);
-}
-/**********************************************************************/
-
 static void  alloc_blocks(fr_ring_buffer_t *rb, uint32_t *seed, UNUSED int *start, int *end)
 {
 	int i;
@@ -88,10 +66,10 @@ static void  alloc_blocks(fr_ring_buffer_t *rb, uint32_t *seed, UNUSED int *star
 		array[index] = hash;
 		p = fr_ring_buffer_reserve(rb, 2048);
 
-		if (rad_cond_assert(!p)) exit(1);
+		if (!rad_cond_assert(p != NULL)) exit(1);
 
 		data[index] = fr_ring_buffer_alloc(rb, hash);
-		if (rad_cond_assert(data[index] != p)) exit(1);
+		if (!rad_cond_assert(data[index] == p)) exit(1);
 
 		if (debug_lvl > 1) printf("%08x\t", hash);
 
@@ -129,9 +107,71 @@ static void  free_blocks(fr_ring_buffer_t *rb, UNUSED uint32_t *seed, int *start
 	}
 }
 
+/** Time reserve / alloc / free, the way the message sets use them
+ *
+ *  Keep BENCH_DEPTH messages of random size in the ring buffer, and
+ *  free the oldest one each time we add a new one.  Reservations are
+ *  for the largest message, so non-mapped buffers have to wrap early.
+ */
+static void bench(TALLOC_CTX *ctx, size_t rb_size, int loops)
+{
+	int		i, head = 0;
+	uint32_t	seed = 0xabcdef, hash;
+	size_t		sizes[BENCH_DEPTH];
+	uint64_t	failed = 0;
+	fr_time_t	start, end;
+	fr_ring_buffer_t *rb;
+	uint8_t		*p;
+
+	rb = fr_ring_buffer_create(ctx, rb_size);
+	if (!rb) {
+		fprintf(stderr, "Failed creating ring buffer\n");
+		exit(1);
+	}
+
+	memset(sizes, 0, sizeof(sizes));
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		hash = fr_hash_update(seed_string, seed_string_len, seed);
+		seed = hash;
+
+		if (sizes[head]) {
+			(void) fr_ring_buffer_free(rb, sizes[head]);
+			sizes[head] = 0;
+		}
+
+		p = fr_ring_buffer_reserve(rb, 4096);
+		if (!p) {
+			failed++;
+			head = (head + 1) & (BENCH_DEPTH - 1);
+			continue;
+		}
+
+		sizes[head] = 64 + (hash & 0xfff);
+		if (sizes[head] > 4096) sizes[head] = 4096;
+
+		p = fr_ring_buffer_alloc(rb, sizes[head]);
+		rad_assert(p != NULL);
+		p[0] = 1;
+		p[sizes[head] - 1] = 1;
+
+		head = (head + 1) & (BENCH_DEPTH - 1);
+	}
+	end = fr_time();
+
+	fr_ring_buffer_debug(rb, stdout);
+	printf("ring buffer size %zu, %d loops, %8.2f ns/loop, %" PRIu64 " failed reservations\n",
+	       fr_ring_buffer_size(rb), loops, ((double) (end - start)) / loops, failed);
+
+	talloc_free(rb);
+}
+
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: ring_buffer_test [OPTS]\n");
+	fprintf(stderr, "  -b                     Run benchmarks.\n");
+	fprintf(stderr, "  -n <num>               Number of loops for the benchmarks.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 	fprintf(stderr, "  -s <string>            Set random seed to <string>.\n");
 
@@ -141,6 +181,8 @@ static void NEVER_RETURNS usage(void)
 int main(int argc, char *argv[])
 {
 	int c;
+	bool do_bench = false;
+	int loops = 1000000;
 
 	int i, start, end;
 	fr_ring_buffer_t *rb;
@@ -148,7 +190,16 @@ int main(int argc, char *argv[])
 
 	TALLOC_CTX	*autofree = talloc_init("main");
 
-	while ((c = getopt(argc, argv, "hs:x")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "bhn:s:x")) != EOF) switch (c) {
+		case 'b':
+			do_bench = true;
+			break;
+
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0) usage();
+			break;
+
 		case 's':
 			seed_string = optarg;
 			seed_string_len = strlen(optarg);
@@ -197,6 +248,16 @@ int main(int argc, char *argv[])
 	rad_assert(used == 0);
 	rad_assert(fr_ring_buffer_used(rb) == used);
 
+	if (do_bench) {
+		if (fr_time_start() < 0) {
+			fprintf(stderr, "Failed to start time\n");
+			exit(1);
+		}
+
+		bench(autofree, 512 * 1024, loops);
+		bench(autofree, 1024 * 1024, loops);
+	}
+
 	talloc_free(autofree);
 
 	return 0;
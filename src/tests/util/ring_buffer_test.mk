@@ -1,6 +1,6 @@
 TARGET := ring_buffer_test
 
-SOURCES		:= ring_buffer_test.c
+SOURCES		:= ring_buffer_test.c stubs.c
 
 TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a libfreeradius-io.a
 TGT_LDLIBS	:= $(LIBS)
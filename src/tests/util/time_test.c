@@ -0,0 +1,187 @@
+/*
+ * time_test.c	Tests and benchmarks for the time functions
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_LOOPS	(10 * 1000 * 1000)
+#define MAX_DRIFT	(2 * 1000 * 1000)	//!< how far fr_time() may wander from CLOCK_MONOTONIC
+#define DRIFT_TIME	((fr_time_t) NANOSEC * 5 / 2)	//!< long enough for fr_time() to re-check its clock source
+
+static int		debug_lvl = 0;
+
+/*
+ *	So that the compiler can't throw the loops away.
+ */
+static volatile fr_time_t sink;
+
+static fr_time_t clock_gettime_time(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * NANOSEC) + ts.tv_nsec;
+}
+
+static void bench(char const *name, fr_time_t (*get_time)(void), int loops)
+{
+	int i;
+	fr_time_t start, end;
+
+	start = fr_time();
+	for (i = 0; i < loops; i++) {
+		sink = get_time();
+	}
+	end = fr_time();
+
+	printf("%-16s %10d calls, %8.2f ns/call\n", name, loops,
+	       ((double) (end - start)) / loops);
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: time_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Number of calls to time for each source.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int i, loops = MAX_LOOPS;
+	fr_time_t last, now, start, offset;
+	int64_t max_drift = 0;
+	struct timespec ts;
+
+	while ((c = getopt(argc, argv, "hn:x")) != EOF) switch (c) {
+		case 'n':
+			loops = atoi(optarg);
+			if (loops <= 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+#if 0
+	argc -= (optind - 1);
+	argv += (optind - 1);
+#endif
+
+	if (fr_time_start() < 0) {
+		fprintf(stderr, "Failed to start time\n");
+		exit(1);
+	}
+
+	if (debug_lvl) printf("Using clock source %s\n", fr_time_source());
+
+	/*
+	 *	fr_time() must never go backwards.
+	 */
+	last = fr_time();
+	for (i = 0; i < 100000; i++) {
+		now = fr_time();
+		rad_assert(now >= last);
+		last = now;
+	}
+
+	/*
+	 *	And it must keep pace with the real clock.  Sleep for
+	 *	50ms, and check that we measured about that long.
+	 */
+	last = fr_time();
+	ts.tv_sec = 0;
+	ts.tv_nsec = 50 * 1000 * 1000;
+	(void) nanosleep(&ts, NULL);
+	now = fr_time();
+
+	if (debug_lvl) printf("Slept for %" PRIu64 " ns\n", now - last);
+	rad_assert((now - last) >= (fr_time_t) ts.tv_nsec);
+	rad_assert((now - last) < (fr_time_t) (ts.tv_nsec + 10 * 1000 * 1000));
+
+	/*
+	 *	Until this thread syncs the time, the cached time is
+	 *	the current time.
+	 */
+	last = fr_time_cached();
+	(void) nanosleep(&ts, NULL);
+	rad_assert(fr_time_cached() >= (last + (fr_time_t) ts.tv_nsec));
+
+	/*
+	 *	The cached time only changes when we sync it.
+	 */
+	last = fr_time_sync();
+	rad_assert(fr_time_cached() == last);
+	(void) nanosleep(&ts, NULL);
+	rad_assert(fr_time_cached() == last);
+	rad_assert(fr_time_sync() > last);
+
+	/*
+	 *	Over a longer period, fr_time() stays in step with
+	 *	CLOCK_MONOTONIC, and never goes backwards, even when it
+	 *	re-calibrates the clock source.
+	 */
+	ts.tv_nsec = 1000 * 1000;
+	offset = clock_gettime_time() - fr_time();
+	start = last = fr_time();
+	do {
+		int64_t drift;
+
+		(void) nanosleep(&ts, NULL);
+
+		now = fr_time();
+		rad_assert(now >= last);
+		last = now;
+
+		drift = (int64_t) (clock_gettime_time() - now - offset);
+		if (drift < 0) drift = -drift;
+		if (drift > max_drift) max_drift = drift;
+	} while ((now - start) < DRIFT_TIME);
+
+	if (debug_lvl) printf("Using clock source %s, drifted by up to %" PRId64 " ns\n", fr_time_source(), max_drift);
+	rad_assert(max_drift < MAX_DRIFT);
+
+	if (!debug_lvl) return 0;
+
+	bench("clock_gettime", clock_gettime_time, loops);
+	bench("fr_time", fr_time, loops);
+	bench("fr_time_cached", fr_time_cached, loops);
+
+	return 0;
+}
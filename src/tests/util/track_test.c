@@ -0,0 +1,410 @@
+/*
+ * track_test.c	Tests for the RADIUS tracking tables
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/track.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include <string.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define MAX_ENTRIES	(700)		//!< fits in the initial hash table
+#define MAX_GROW	(5000)		//!< makes the hash table grow several times
+#define MAX_ROUNDS	(100)
+
+static int		debug_lvl = 0;
+
+#define MPRINT1 if (debug_lvl) printf
+
+#define VERSION(_i) (((_i) & 1) == 0)
+
+/*
+ *	What a listener would use for src/dst information.
+ */
+typedef struct test_address_t {
+	uint32_t	ipaddr;
+	uint16_t	port;
+	uint16_t	pad;
+} test_address_t;
+
+static bool const allowed[FR_MAX_PACKET_CODE] = {
+	[FR_CODE_ACCESS_REQUEST] = true,
+	[FR_CODE_ACCOUNTING_REQUEST] = true,
+};
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: track_test [OPTS]\n");
+	fprintf(stderr, "  -g <num>               Number of entries to insert when growing the table.\n");
+	fprintf(stderr, "  -r <rounds>            Number of rounds of deletes and inserts.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Get a value from the output of fr_radius_tracking_debug()
+ *
+ */
+static double tracking_stat(fr_tracking_t *ft, char const *name)
+{
+	char	*buffer = NULL, *p;
+	size_t	size = 0;
+	size_t	len = strlen(name);
+	FILE	*fp;
+	double	value = -1;
+
+	fp = open_memstream(&buffer, &size);
+	rad_assert(fp != NULL);
+
+	fr_radius_tracking_debug(ft, fp);
+	fclose(fp);
+
+	for (p = buffer; p && *p; p = strchr(p, '\n')) {
+		while (*p == '\n') p++;
+		while (*p == '\t') p++;
+
+		if ((strncmp(p, name, len) == 0) && (strncmp(p + len, " = ", 3) == 0)) {
+			value = strtod(p + len + 3, NULL);
+			break;
+		}
+	}
+
+	if (debug_lvl > 1) printf("%s", buffer);
+	free(buffer);
+
+	rad_assert(value >= 0);
+	return value;
+}
+
+/*
+ *	Many IDs from each client, so that the entries share src/dst
+ *	information.
+ */
+static void test_packet(uint8_t packet[20], test_address_t *address, int i, int version)
+{
+	memset(packet, 0, 20);
+	packet[0] = FR_CODE_ACCESS_REQUEST;
+	packet[1] = i & 0xff;
+	memset(packet + 4, version, 16);
+
+	memset(address, 0, sizeof(*address));
+	address->ipaddr = 0x0a000000 | (i >> 8);
+	address->port = 1812;
+}
+
+static fr_tracking_status_t test_insert(fr_tracking_entry_t **p_entry, fr_tracking_t *ft,
+					int i, int version, fr_time_t timestamp)
+{
+	uint8_t		packet[20];
+	test_address_t	address;
+
+	test_packet(packet, &address, i, version);
+
+	return fr_radius_tracking_entry_insert(p_entry, ft, packet, timestamp, &address);
+}
+
+/*
+ *	Connected sockets use an array per packet code.
+ */
+static void test_connected(TALLOC_CTX *ctx)
+{
+	fr_tracking_t		*ft;
+	fr_tracking_entry_t	*entry, *same;
+	uint8_t			packet[20];
+
+	ft = fr_radius_tracking_create(ctx, 0, allowed);
+	rad_assert(ft != NULL);
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = FR_CODE_ACCESS_REQUEST;
+	packet[1] = 5;
+
+	rad_assert(fr_radius_tracking_entry_insert(&entry, ft, packet, 1, NULL) == FR_TRACKING_NEW);
+	rad_assert(fr_radius_tracking_entry_insert(&same, ft, packet, 2, NULL) == FR_TRACKING_SAME);
+	rad_assert(same == entry);
+
+	packet[4] = 1;
+	rad_assert(fr_radius_tracking_entry_insert(&same, ft, packet, 3, NULL) == FR_TRACKING_DIFFERENT);
+	rad_assert(same == entry);
+	rad_assert(entry->timestamp == 3);
+
+	/*
+	 *	Not a tracked code.
+	 */
+	packet[0] = FR_CODE_COA_REQUEST;
+	rad_assert(fr_radius_tracking_entry_insert(&same, ft, packet, 4, NULL) == FR_TRACKING_ERROR);
+
+	rad_assert(tracking_stat(ft, "num_entries") == 1);
+	rad_assert(fr_radius_tracking_entry_delete(ft, entry) == 0);
+	rad_assert(fr_radius_tracking_entry_delete(ft, entry) < 0);
+	rad_assert(tracking_stat(ft, "num_entries") == 0);
+
+	talloc_free(ft);
+}
+
+/*
+ *	Insert, find duplicates, and delete.  Deleted slots must be
+ *	re-used, so that repeated deletes and inserts neither grow
+ *	the table, nor lose entries which probed past the deleted
+ *	ones.
+ */
+static void test_delete(TALLOC_CTX *ctx, int rounds)
+{
+	int			i, round;
+	fr_tracking_t		*ft;
+	fr_tracking_entry_t	*entries[MAX_ENTRIES], *entry;
+	double			num_slots, num_allocated;
+
+	ft = fr_radius_tracking_create(ctx, sizeof(test_address_t), allowed);
+	rad_assert(ft != NULL);
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		rad_assert(test_insert(&entries[i], ft, i, 0, i + 1) == FR_TRACKING_NEW);
+	}
+
+	rad_assert(tracking_stat(ft, "num_entries") == MAX_ENTRIES);
+
+	/*
+	 *	Retransmissions find the original entry.
+	 */
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		rad_assert(test_insert(&entry, ft, i, 0, i + 1) == FR_TRACKING_SAME);
+		rad_assert(entry == entries[i]);
+	}
+
+	/*
+	 *	New packets with the same ID replace the old ones.
+	 *	From now on, the packets for even entries are version 1.
+	 */
+	for (i = 0; i < MAX_ENTRIES; i += 2) {
+		rad_assert(test_insert(&entry, ft, i, 1, MAX_ENTRIES + i) == FR_TRACKING_DIFFERENT);
+		rad_assert(entry == entries[i]);
+		rad_assert(entry->timestamp == (fr_time_t) (MAX_ENTRIES + i));
+	}
+
+	rad_assert(tracking_stat(ft, "num_entries") == MAX_ENTRIES);
+
+	num_slots = tracking_stat(ft, "num_slots");
+	num_allocated = tracking_stat(ft, "num_allocated");
+
+	MPRINT1("%d entries in %.0f slots, %.0f allocated\n", MAX_ENTRIES, num_slots, num_allocated);
+
+	for (round = 0; round < rounds; round++) {
+		int step = 2 + (round % 5);
+		int start = round % step;
+
+		for (i = start; i < MAX_ENTRIES; i += step) {
+			rad_assert(fr_radius_tracking_entry_delete(ft, entries[i]) == 0);
+		}
+
+		/*
+		 *	Everything else can still be found.
+		 */
+		for (i = 0; i < MAX_ENTRIES; i++) {
+			if ((i >= start) && (((i - start) % step) == 0)) continue;
+
+			rad_assert(test_insert(&entry, ft, i, VERSION(i), 1) == FR_TRACKING_SAME);
+			rad_assert(entry == entries[i]);
+		}
+
+		/*
+		 *	The deleted packets are new again.
+		 */
+		for (i = start; i < MAX_ENTRIES; i += step) {
+			rad_assert(test_insert(&entries[i], ft, i, !VERSION(i), round + 1) == FR_TRACKING_NEW);
+			rad_assert(test_insert(&entry, ft, i, VERSION(i), round + 2) == FR_TRACKING_DIFFERENT);
+			rad_assert(entry == entries[i]);
+		}
+
+		rad_assert(tracking_stat(ft, "num_entries") == MAX_ENTRIES);
+		rad_assert(tracking_stat(ft, "num_slots") == num_slots);
+		rad_assert(tracking_stat(ft, "num_allocated") == num_allocated);
+	}
+
+	/*
+	 *	A deleted entry is the next one to be used.
+	 */
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		rad_assert(fr_radius_tracking_entry_delete(ft, entries[i]) == 0);
+		rad_assert(test_insert(&entry, ft, i, VERSION(i), 1) == FR_TRACKING_NEW);
+		rad_assert(entry == entries[i]);
+		rad_assert(fr_radius_tracking_entry_delete(ft, entry) == 0);
+	}
+	rad_assert(tracking_stat(ft, "num_entries") == 0);
+
+	MPRINT1("%.3f probes per lookup\n", tracking_stat(ft, "probes_per_lookup"));
+
+	talloc_free(ft);
+}
+
+/*
+ *	The hash table doubles in size to keep the fill ratio down.
+ *	Entries don't move, and can all still be found.
+ */
+static void test_grow(TALLOC_CTX *ctx, int num)
+{
+	int			i;
+	fr_tracking_t		*ft;
+	fr_tracking_entry_t	**entries, *entry;
+	uint32_t		num_slots;
+
+	ft = fr_radius_tracking_create(ctx, sizeof(test_address_t), allowed);
+	rad_assert(ft != NULL);
+
+	entries = talloc_array(ctx, fr_tracking_entry_t *, num);
+	rad_assert(entries != NULL);
+
+	num_slots = tracking_stat(ft, "num_slots");
+
+	for (i = 0; i < num; i++) {
+		rad_assert(test_insert(&entries[i], ft, i, 0, i + 1) == FR_TRACKING_NEW);
+		rad_assert(tracking_stat(ft, "fill") <= 0.75);
+	}
+
+	MPRINT1("%d entries grew the table from %u to %.0f slots\n", num, num_slots, tracking_stat(ft, "num_slots"));
+
+	while (((uint64_t) num * 4) > ((uint64_t) num_slots * 3)) num_slots *= 2;
+	rad_assert(tracking_stat(ft, "num_slots") == num_slots);
+	rad_assert(tracking_stat(ft, "num_entries") == num);
+
+	for (i = 0; i < num; i++) {
+		rad_assert(test_insert(&entry, ft, i, 0, i + 1) == FR_TRACKING_SAME);
+		rad_assert(entry == entries[i]);
+		rad_assert(entry->timestamp == (fr_time_t) (i + 1));
+	}
+
+	for (i = 0; i < num; i++) {
+		rad_assert(fr_radius_tracking_entry_delete(ft, entries[i]) == 0);
+	}
+	rad_assert(tracking_stat(ft, "num_entries") == 0);
+
+	talloc_free(entries);
+	talloc_free(ft);
+}
+
+/*
+ *	Cached replies expire oldest first.  Duplicates extend the
+ *	life of a cached reply.
+ */
+static void test_reply(TALLOC_CTX *ctx)
+{
+	int			i;
+	fr_tracking_t		*ft;
+	fr_tracking_entry_t	*entries[10], *entry;
+	uint8_t			reply[20];
+
+	ft = fr_radius_tracking_create(ctx, sizeof(test_address_t), allowed);
+	rad_assert(ft != NULL);
+
+	memset(reply, 0, sizeof(reply));
+	reply[0] = FR_CODE_ACCESS_ACCEPT;
+
+	rad_assert(fr_radius_tracking_oldest_reply(ft) == 0);
+
+	for (i = 0; i < 10; i++) {
+		rad_assert(test_insert(&entries[i], ft, i, 0, i + 1) == FR_TRACKING_NEW);
+		rad_assert(fr_radius_tracking_entry_reply(ft, entries[i], 100 + i, reply, sizeof(reply)) == 0);
+	}
+
+	rad_assert(tracking_stat(ft, "reply_size") == 10 * sizeof(reply));
+	rad_assert(fr_radius_tracking_oldest_reply(ft) == 100);
+
+	/*
+	 *	A "do not respond" reply isn't cached, but it is
+	 *	tracked.
+	 */
+	rad_assert(fr_radius_tracking_entry_reply(ft, entries[9], 109, reply, 0) == 0);
+	rad_assert(entries[9]->reply == NULL);
+	rad_assert(tracking_stat(ft, "reply_size") == 9 * sizeof(reply));
+
+	/*
+	 *	A retransmission of the first request.
+	 */
+	rad_assert(test_insert(&entry, ft, 0, 0, 200) == FR_TRACKING_SAME);
+	rad_assert(entry == entries[0]);
+	rad_assert(entry->reply_time == 200);
+	rad_assert(fr_radius_tracking_oldest_reply(ft) == 101);
+
+	rad_assert(fr_radius_tracking_expire(ft, 104) == 4);
+	rad_assert(tracking_stat(ft, "num_entries") == 6);
+	rad_assert(tracking_stat(ft, "reply_size") == 5 * sizeof(reply));
+	rad_assert(fr_radius_tracking_oldest_reply(ft) == 105);
+
+	for (i = 1; i <= 4; i++) {
+		rad_assert(test_insert(&entry, ft, i, 0, 300) == FR_TRACKING_NEW);
+		rad_assert(entry->reply == NULL);
+	}
+	rad_assert(test_insert(&entry, ft, 0, 0, 300) == FR_TRACKING_SAME);
+	rad_assert(entry->reply != NULL);
+
+	rad_assert(fr_radius_tracking_expire(ft, 1000) == 6);
+	rad_assert(tracking_stat(ft, "num_entries") == 4);
+	rad_assert(tracking_stat(ft, "reply_size") == 0);
+	rad_assert(fr_radius_tracking_oldest_reply(ft) == 0);
+
+	talloc_free(ft);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	int num_grow = MAX_GROW;
+	int rounds = MAX_ROUNDS;
+	TALLOC_CTX *autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "g:hr:x")) != EOF) switch (c) {
+		case 'g':
+			num_grow = atoi(optarg);
+			if (num_grow <= 0) usage();
+			break;
+
+		case 'r':
+			rounds = atoi(optarg);
+			if (rounds < 0) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+#if 0
+	argc -= (optind - 1);
+	argv += (optind - 1);
+#endif
+
+	test_connected(autofree);
+	test_delete(autofree, rounds);
+	test_grow(autofree, num_grow);
+	test_reply(autofree);
+
+	talloc_free(autofree);
+
+	return 0;
+}
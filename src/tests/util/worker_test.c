@@ -40,6 +40,7 @@ RCSID("$Id$")
 #define MAX_CONTROL_PLANE	(1024)
 #define MAX_KEVENTS		(10)
 #define MAX_WORKERS		(1024)
+#define NAK_SIZE		(10)
 
 #define MPRINT1 if (debug_lvl) printf
 #define MPRINT2 if (debug_lvl > 1) printf
@@ -49,6 +50,7 @@ typedef struct fr_schedule_worker_t {
 	pthread_t	pthread_id;		//!< pthread ID of the worker
 	fr_worker_t	*worker;		//!< pointer to the worker
 	fr_channel_t	*ch;			//!< channel for communicating with the worker
+	bool		exited;			//!< we told the worker to exit
 } fr_schedule_worker_t;
 
 static int		debug_lvl = 0;
@@ -61,37 +63,31 @@ static int		max_outstanding = 1;
 static bool		touch_memory = false;
 static int		num_workers = 1;
 static bool		quiet = false;
+static int		max_backlog = 0;
+static bool		steal = false;
+static fr_worker_steal_t *steal_group = NULL;
+static atomic_bool	thief_yielded;
 static fr_schedule_worker_t workers[MAX_WORKERS];
 
-/**********************************************************************/
-typedef struct rad_request REQUEST;
-
-REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
-{
-	return NULL;
-}
-
-void verify_request(UNUSED char const *file, UNUSED int line, UNUSED REQUEST *request)
-{
-}
-
-void talloc_const_free(void const *ptr)
-{
-	void *tmp;
-	if (!ptr) return;
-
-	memcpy(&tmp, &ptr, sizeof(tmp));
-	talloc_free(tmp);
-}
-/**********************************************************************/
+static atomic_bool	gate_running;		//!< the worker is holding on to message 1
+static atomic_bool	burst_sent;		//!< the master has sent the first burst
+static int		num_burst;		//!< messages in the first burst
+static int		num_burst_queued;	//!< less important messages in the first burst which were run
+static int		num_burst_naks;
+static int		num_naks;
+static int		last_priority;		//!< of the last reply to the first burst
+static uint32_t		last_number;
 
 static void NEVER_RETURNS usage(void)
 {
 	fprintf(stderr, "usage: worker_test [OPTS]\n");
+	fprintf(stderr, "  -b <backlog>           Shed messages when the backlog is larger than this, and check\n");
+	fprintf(stderr, "                         that they're run in order of priority.\n");
 	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
 	fprintf(stderr, "  -m <messages>	  Send number of messages.\n");
 	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
 	fprintf(stderr, "  -q                     quiet - suppresses worker stats.\n");
+	fprintf(stderr, "  -s                     Send all messages to worker 0, and check that others steal them.\n");
 	fprintf(stderr, "  -t                     Touch memory for fake packets.\n");
 	fprintf(stderr, "  -w N                   Create N workers.  Default is 1.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
@@ -99,9 +95,46 @@ static void NEVER_RETURNS usage(void)
 	exit(1);
 }
 
+/*
+ *	Message 1 is the most important, so that it's run first.
+ */
+static inline uint8_t test_priority(uint32_t number)
+{
+	return (number - 1) % 3;
+}
+
 static fr_io_final_t test_process(REQUEST *request, fr_io_action_t action)
 {
 	MPRINT1("\t\tPROCESS --- request %"PRIu64" action %d\n", request->number, action);
+
+	/*
+	 *	Hold on to the first request until the master has
+	 *	sent the rest of the first burst.  The worker then
+	 *	reads the whole burst at once.
+	 */
+	if (max_backlog && (action == FR_IO_ACTION_RUN) && (request->number == 1)) {
+		atomic_store(&gate_running, true);
+		while (!atomic_load(&burst_sent)) usleep(10);
+	}
+
+	if (!steal) return FR_IO_REPLY;
+
+	/*
+	 *	Worker 1 holds on to the first request it steals.  The
+	 *	master then tells it to exit, and the request has to
+	 *	make it back to worker 0.
+	 */
+	if ((action == FR_IO_ACTION_RUN) && request->async->stolen_from && !atomic_load(&thief_yielded) &&
+	    (request->el == fr_worker_el(workers[1].worker))) {
+		MPRINT1("\t\tYIELD --- request %"PRIu64"\n", request->number);
+		atomic_store(&thief_yielded, true);
+		return FR_IO_YIELD;
+	}
+
+	/*
+	 *	Take long enough that worker 0 builds up a backlog.
+	 */
+	usleep(1000);
 	return FR_IO_REPLY;
 }
 
@@ -124,10 +157,17 @@ static int test_decode(UNUSED void const *instance, REQUEST *request, uint8_t *c
 
 static ssize_t test_encode(void const *instance, REQUEST *request, uint8_t *const data, size_t data_len)
 {
+	uint32_t number = request->number;
+
 	MPRINT1("\t\tENCODE >>> request %"PRIu64" - data %p %p size %zd\n", request->number,
 		instance, data, data_len);
 
-	return data_len;
+	/*
+	 *	The reply is the packet number.
+	 */
+	memcpy(data, &number, sizeof(number));
+
+	return sizeof(number);
 }
 
 static size_t test_nak(void const *packet_ctx, uint8_t *const packet, size_t packet_len, uint8_t *reply, UNUSED size_t reply_len)
@@ -142,9 +182,21 @@ static size_t test_nak(void const *packet_ctx, uint8_t *const packet, size_t pac
 
 	MPRINT1("\t\tNAK !!! request %"PRIu64" - data %p %p size %zd\n", (uint64_t) number, packet_ctx, packet, packet_len);
 
-	return 10;
+	return NAK_SIZE;
 }
 
+static void test_process_set(UNUSED void const *instance, UNUSED REQUEST *request)
+{
+	/*
+	 *	test_decode() has already set the process function.
+	 */
+}
+
+static fr_app_t app = {
+	.name = "worker-test",
+	.process_set = test_process_set
+};
+
 static fr_app_io_t app_io = {
 	.name = "worker-test",
 	.default_message_size = 4096,
@@ -173,37 +225,166 @@ static void *worker_thread(void *arg)
 		exit(1);
 	}
 
-	worker = sw->worker = fr_worker_create(ctx, el, &default_log, ~0);
+	worker = fr_worker_create(ctx, el, &default_log, ~0);
 	if (!worker) {
 		fprintf(stderr, "worker_test: Failed to create the worker\n");
 		exit(1);
 	}
 
+	if (steal_group && (fr_worker_steal_join(worker, steal_group, sw->id) < 0)) {
+		fprintf(stderr, "worker_test: Failed to join the steal group: %s\n", fr_strerror());
+		exit(1);
+	}
+
+	sw->worker = worker;
+
 	MPRINT1("\tWorker %d looping.\n", sw->id);
 	fr_worker(worker);
 
-	sw->worker = NULL;
 	MPRINT1("\tWorker %d exiting.\n", sw->id);
 
+	fr_worker_destroy(worker);
 	talloc_free(ctx);
+
+	sw->worker = NULL;
 	return NULL;
 }
 
+/** Get a counter from the output of fr_worker_debug()
+ *
+ */
+static int worker_stat(fr_worker_t *worker, char const *name)
+{
+	char	*buffer = NULL, *p;
+	size_t	size = 0;
+	size_t	len = strlen(name);
+	FILE	*fp;
+	int	value = -1;
+
+	fp = open_memstream(&buffer, &size);
+	rad_assert(fp != NULL);
+
+	fr_worker_debug(worker, fp);
+	fclose(fp);
+
+	for (p = buffer; p && *p; p = strchr(p, '\n')) {
+		while (*p == '\n') p++;
+		while (*p == '\t') p++;
+
+		if ((strncmp(p, name, len) == 0) && (strncmp(p + len, " = ", 3) == 0)) {
+			value = atoi(p + len + 3);
+			break;
+		}
+	}
+
+	free(buffer);
+
+	rad_assert(value >= 0);
+	return value;
+}
+
+/** Check that the other workers stole from worker 0, and that it got everything back
+ *
+ */
+static void check_steal_stats(void)
+{
+	int i, offered, reclaimed, returned;
+
+	offered = worker_stat(workers[0].worker, "num_offered");
+	reclaimed = worker_stat(workers[0].worker, "num_reclaimed");
+	returned = worker_stat(workers[0].worker, "num_returned");
+
+	MPRINT1("Worker 0 offered %d, reclaimed %d, got back %d\n", offered, reclaimed, returned);
+
+	rad_assert(returned > 0);
+	rad_assert(offered == (reclaimed + returned));
+
+	for (i = 1; i < num_workers; i++) {
+		if (workers[i].exited) continue;
+
+		rad_assert(worker_stat(workers[i].worker, "num_holding") == 0);
+	}
+}
+
+/** Check that the backlog limit was applied to the first burst
+ *
+ *  The worker reads the burst all at once, but it reads the
+ *  channel lanes in weighted order.  So we don't know which of
+ *  the less important messages it sees first.  But it queues no
+ *  more of them than the backlog allows, and sheds them only
+ *  when the backlog is full.
+ */
+static void check_burst(void)
+{
+	int i, num_low = 0, num_high = 0;
+
+	for (i = 2; i <= num_burst; i++) {
+		if (test_priority(i) > 0) {
+			num_low++;
+		} else {
+			num_high++;
+		}
+	}
+
+	MPRINT1("Master burst of %d ran %d, and shed %d\n", num_burst, num_burst_queued, num_burst_naks);
+
+	rad_assert((num_burst_queued + num_burst_naks) == num_low);
+	rad_assert(num_burst_queued <= max_backlog);
+	rad_assert(num_burst_naks >= (num_low - max_backlog));
+	if (num_burst_naks > 0) rad_assert((num_burst_queued + num_high) >= max_backlog);
+}
+
+/** Check that the first burst is run in order of priority, and that only less important messages are shed
+ *
+ */
+static void check_reply(fr_channel_data_t const *reply)
+{
+	uint32_t	number;
+	bool		nak;
+
+	if (!max_backlog || !reply->m.data_size) return;
+
+	memcpy(&number, reply->m.data, sizeof(number));
+	rad_assert((number > 0) && (number <= (uint32_t) max_messages));
+
+	nak = (reply->m.data_size == NAK_SIZE);
+	if (nak) {
+		rad_assert(test_priority(number) > 0);
+		num_naks++;
+	}
+
+	if ((number == 1) || (number > (uint32_t) num_burst)) return;
+
+	if (nak) {
+		num_burst_naks++;
+		return;
+	}
+
+	if (test_priority(number) > 0) num_burst_queued++;
+
+	rad_assert(test_priority(number) >= last_priority);
+	if (test_priority(number) == last_priority) rad_assert(number > last_number);
+
+	last_priority = test_priority(number);
+	last_number = number;
+}
 
 static void master_process(void)
 {
 	bool			running, signaled_close;
 	int			rcode, i, num_events, which_worker;
 	int			num_outstanding, num_messages;
-	int			num_replies;
+	int			num_replies, num_empty, num_closed;
 	fr_message_set_t	*ms;
 	TALLOC_CTX		*ctx;
 	fr_channel_t		*ch;
 	fr_channel_event_t	ce;
 	pthread_attr_t		attr;
 	fr_schedule_worker_t	*sw;
-	fr_listen_t		listen = { .app_io = &app_io };
+	fr_listen_t		listen = { .app = &app, .app_io = &app_io };
+	fr_listen_admit_t	admit;
 	struct kevent		events[MAX_KEVENTS];
+	struct timespec		poll_interval = { 0, NANOSEC / 100 };
 
 	ctx = talloc_init("master");
 	if (!ctx) _exit(1);
@@ -216,6 +397,26 @@ static void master_process(void)
 
 	MPRINT1("Master started.\n");
 
+	if (max_backlog) {
+		memset(&admit, 0, sizeof(admit));
+		admit.max_delay = (fr_time_t) NANOSEC * 60;	/* only shed messages for the backlog */
+		admit.max_backlog = max_backlog;
+		listen.admit = &admit;
+
+		atomic_init(&gate_running, false);
+		atomic_init(&burst_sent, false);
+		last_number = 1;
+	}
+
+	if (steal) {
+		steal_group = fr_worker_steal_create(ctx, num_workers);
+		if (!steal_group) {
+			fprintf(stderr, "Failed creating steal group: %s\n", fr_strerror());
+			exit(1);
+		}
+		atomic_init(&thief_yielded, false);
+	}
+
 	/*
 	 *	Create the worker threads.
 	 */
@@ -257,7 +458,7 @@ static void master_process(void)
 	/*
 	 *	Bootstrap the queue with messages.
 	 */
-	num_replies = num_outstanding = num_messages = 0;
+	num_replies = num_empty = num_closed = num_outstanding = num_messages = 0;
 	which_worker = 0;
 
 	running = true;
@@ -282,6 +483,8 @@ static void master_process(void)
 		}
 		MPRINT1("Master sending %d messages\n", num_to_send);
 
+		if (max_backlog && !num_burst) num_burst = num_to_send;
+
 		for (i = 0; i < num_to_send; i++) {
 			cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
 			rad_assert(cd != NULL);
@@ -291,7 +494,7 @@ static void master_process(void)
 
 			cd->m.when = fr_time();
 
-			cd->priority = 0;
+			cd->priority = listen.admit ? test_priority(num_messages) : 0;
 			cd->listen = &listen;
 
 			if (touch_memory) {
@@ -311,27 +514,73 @@ static void master_process(void)
 			if (rcode < 0) {
 				fprintf(stderr, "Failed sending request: %s\n", strerror(errno));
 			}
-			which_worker++;
+			if (!steal) which_worker++;
 			if (which_worker >= num_workers) which_worker = 0;
 
 			rad_assert(rcode == 0);
 			if (reply) {
+				if (!reply->m.data_size) num_empty++;
+				check_reply(reply);
 				num_replies++;
 				num_outstanding--;
 				MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
 					num_replies, num_outstanding, num_messages, max_messages);
 				fr_message_done(&reply->m);
 			}
+
+			/*
+			 *	Send the rest of the burst only once the
+			 *	worker is running message 1.
+			 */
+			if (max_backlog && (num_messages == 1)) {
+				while (!atomic_load(&gate_running)) usleep(10);
+			}
 		}
 
+		if (max_backlog) atomic_store(&burst_sent, true);
+
 		/*
 		 *	Signal close only when done.
 		 */
 check_close:
+		/*
+		 *	The thief is holding on to a request.  Tell it
+		 *	to exit, which should return the request to
+		 *	worker 0.  We can't wait for everything else to
+		 *	be done, as worker 0 may not signal us until
+		 *	its channel has nothing outstanding.
+		 */
+		if (steal && !workers[1].exited && (num_messages >= max_messages) &&
+		    atomic_load(&thief_yielded)) {
+			MPRINT1("Master asked exit for thief worker 1.\n");
+
+			(void) fr_worker_exit(workers[1].worker);
+			(void) pthread_kill(workers[1].pthread_id, SIGTERM);
+			workers[1].exited = true;
+			num_closed++;
+		}
+
 		if (!signaled_close && (num_messages >= max_messages) && (num_outstanding == 0)) {
 			MPRINT1("Master signaling workers to exit.\n");
 
+			if (listen.admit && !quiet) {
+				printf("Shed %" PRIu64 " messages, backlog %d\n",
+				       (uint64_t) atomic_load(&admit.num_shed_backlog), atomic_load(&admit.backlog));
+			}
+
+			if (steal) check_steal_stats();
+
+			/*
+			 *	Shed messages aren't timeouts.
+			 */
+			if (listen.admit) {
+				rad_assert(worker_stat(workers[0].worker, "num_shed") == num_naks);
+				rad_assert(worker_stat(workers[0].worker, "num_timeouts") == 0);
+			}
+
 			for (i = 0; i < num_workers; i++) {
+				if (workers[i].exited) continue;
+
 				if (!quiet) {
 					printf("Worker %d\n", i);
 					fr_worker_debug(workers[i].worker, stdout);
@@ -350,7 +599,11 @@ check_close:
 		MPRINT1("Master waiting on events.\n");
 		rad_assert(num_messages <= max_messages);
 
-		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, NULL);
+		/*
+		 *	The thief may yield after we've checked for it,
+		 *	and then nothing will wake us up.  So poll.
+		 */
+		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, steal ? &poll_interval : NULL);
 		MPRINT1("Master kevent returned %d\n", num_events);
 
 		if (num_events < 0) {
@@ -399,6 +652,8 @@ check_close:
 				}
 
 				do {
+					if (!reply->m.data_size) num_empty++;
+					check_reply(reply);
 					num_replies++;
 					num_outstanding--;
 					MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
@@ -412,8 +667,13 @@ check_close:
 				rad_assert(sw != NULL);
 
 				MPRINT1("Master received close signal for worker %d\n", sw->id);
-				rad_assert(signaled_close == true);
 
+				/*
+				 *	The thief closes its channel when it exits.
+				 */
+				if (sw->exited) break;
+
+				rad_assert(signaled_close == true);
 
 				/*
 				 *	Tell the event loop to exit, and signal the worker
@@ -421,7 +681,13 @@ check_close:
 				 */
 				(void) fr_worker_exit(sw->worker);
 				(void) pthread_kill(sw->pthread_id, SIGTERM);
-				running = false;
+				sw->exited = true;
+
+				/*
+				 *	Keep going until all of the workers have closed.
+				 */
+				num_closed++;
+				if (num_closed == num_workers) running = false;
 				break;
 
 			case FR_CHANNEL_NOOP:
@@ -441,6 +707,28 @@ check_close:
 
 	MPRINT1("Master exiting.\n");
 
+	rad_assert(num_replies == max_messages);
+
+	/*
+	 *	Only the request the thief held on to has no reply.
+	 */
+	if (steal) rad_assert(num_empty == 1);
+
+	/*
+	 *	Every message which was NAKed was shed because of the
+	 *	backlog, and nothing was left behind in the queues.
+	 */
+	if (listen.admit) {
+		MPRINT1("Master got %d NAKs\n", num_naks);
+
+		check_burst();
+
+		rad_assert(num_naks == (int) atomic_load(&admit.num_shed_backlog));
+		rad_assert(atomic_load(&admit.num_shed_delay) == 0);
+		rad_assert(atomic_load(&admit.num_timeouts) == 0);
+		rad_assert(atomic_load(&admit.backlog) == 0);
+	}
+
 	fr_time_t last_checked = fr_time();
 
 	/*
@@ -497,11 +785,15 @@ int main(int argc, char *argv[])
 
 	fr_log_init(&default_log, false);
 
-	while ((c = getopt(argc, argv, "c:hm:o:qtw:x")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "b:c:hm:o:qstw:x")) != EOF) switch (c) {
 		case 'x':
 			debug_lvl++;
 			break;
 
+		case 'b':
+			max_backlog = atoi(optarg);
+			break;
+
 		case 'c':
 			max_control_plane = atoi(optarg);
 			break;
@@ -518,6 +810,10 @@ int main(int argc, char *argv[])
 			quiet = true;
 			break;
 
+		case 's':
+			steal = true;
+			break;
+
 		case 't':
 			touch_memory = true;
 			break;
@@ -534,6 +830,16 @@ int main(int argc, char *argv[])
 
 	if (max_outstanding > max_messages) max_outstanding = max_messages;
 
+	if (max_backlog && (num_workers > 1)) {
+		fprintf(stderr, "worker_test: Checking the backlog needs one worker\n");
+		exit(1);
+	}
+
+	if (steal && (num_workers < 2)) {
+		fprintf(stderr, "worker_test: Stealing needs at least two workers\n");
+		exit(1);
+	}
+
 	if (!max_control_plane) {
 		max_control_plane = MAX_CONTROL_PLANE;
 		if (max_outstanding > max_control_plane) max_control_plane = max_outstanding;
@@ -1,6 +1,6 @@
 TARGET := worker_test
 
-SOURCES		:= worker_test.c
+SOURCES		:= worker_test.c stubs.c
 
 TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-radius.a libfreeradius-io.a
 TGT_LDLIBS	:= $(LIBS)